@@ -0,0 +1,363 @@
+#include "build.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "cache.h"
+#include "interface.h"
+#include "lexer.h"
+#include "remarks.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+
+using namespace mhc;
+using namespace mhc::lexer;
+
+using namespace std;
+
+namespace fs = boost::filesystem;
+
+
+namespace {
+
+	bool readFile(const string& filename, string& contents) {
+		ifstream in(filename.c_str());
+		if (!in) {
+			return false;
+		}
+
+		contents = static_cast<stringstream const&>(stringstream() << in.rdbuf()).str();
+		return true;
+	}
+
+	// Joins a dotted module name starting at tokens[i], advances 'i' past it
+	string readModuleId(const vector<token>& tokens, size_t& i) {
+		string moduleId;
+
+		while (i < tokens.size() && tokens[i].kind == token_kind::conid) {
+			moduleId += tokens[i++].text;
+
+			if (i + 1 < tokens.size() && tokens[i].text == "." && tokens[i + 1].kind == token_kind::conid) {
+				moduleId += ".";
+				++i;
+			} else {
+				break;
+			}
+		}
+
+		return moduleId;
+	}
+
+	string moduleHeaderId(const string& source) {
+		const auto tokens = tokenize(source);
+
+		size_t i = 1;
+		if (!tokens.empty() && tokens[0].text == "module") {
+			return readModuleId(tokens, i);
+		}
+
+		return "Main";
+	}
+
+	// Orders modules so each one follows its imports, reports cycles
+	bool visitModule(size_t index, const vector<vector<size_t>>& imports, vector<int>& state,
+	                 vector<size_t>& order, vector<size_t>& path) {
+		if (state[index] == 2) {
+			return true;
+		}
+		if (state[index] == 1) {
+			path.push_back(index);
+			return false;
+		}
+
+		state[index] = 1;
+		path.push_back(index);
+
+		for (const size_t dep : imports[index]) {
+			if (!visitModule(dep, imports, state, order, path)) {
+				return false;
+			}
+		}
+
+		path.pop_back();
+		state[index] = 2;
+		order.push_back(index);
+
+		return true;
+	}
+
+}
+
+namespace mhc {
+
+	namespace build {
+
+		vector<string> scanImports(const string& source) {
+			const auto tokens = tokenize(source);
+			vector<string> imports;
+
+			for (size_t i = 0; i < tokens.size(); ++i) {
+				if (tokens[i].kind != token_kind::varid || tokens[i].text != "import") {
+					continue;
+				}
+
+				// Only at the start of a declaration, a line starts a layout item
+				if (i > 0 && !tokens[i].lineStart && tokens[i - 1].text != ";" && tokens[i - 1].text != "where" && tokens[i - 1].text != "{") {
+					continue;
+				}
+
+				size_t next = i + 1;
+				if (next < tokens.size() && tokens[next].text == "qualified") {
+					++next;
+				}
+
+				const string moduleId = readModuleId(tokens, next);
+				if (!moduleId.empty()) {
+					imports.push_back(moduleId);
+				}
+			}
+
+			return imports;
+		}
+
+		string modulePath(const string& searchDir, const string& moduleId) {
+			string relative = moduleId;
+			replace(relative.begin(), relative.end(), '.', '/');
+
+			return (fs::path(searchDir) / (relative + ".hs")).string();
+		}
+
+		bool discoverModules(const vector<string>& rootFiles, vector<module_info>& modules) {
+			if (rootFiles.empty()) {
+				return false;
+			}
+
+			const string searchDir = fs::path(rootFiles[0]).parent_path().string();
+
+			vector<module_info> found;
+			vector<vector<size_t>> imports;
+			map<string, size_t> byPath;
+
+			auto addModule = [&](const string& moduleId, const string& sourcePath) {
+				boost::system::error_code ec;
+				fs::path canonicalPath = fs::canonical(sourcePath, ec);
+				if (ec) {
+					canonicalPath = fs::absolute(sourcePath);
+				}
+				const string key = canonicalPath.string();
+
+				const auto itr = byPath.find(key);
+				if (itr != byPath.end()) {
+					return itr->second;
+				}
+
+				module_info info;
+				info.moduleId = moduleId;
+				info.sourcePath = sourcePath;
+				info.objPath = fs::path(sourcePath).replace_extension(".o").string();
+				info.interfacePath = fs::path(sourcePath).replace_extension(".mhi").string();
+
+				byPath[key] = found.size();
+				found.push_back(info);
+				imports.push_back({});
+
+				return found.size() - 1;
+			};
+
+			for (const auto& itr : rootFiles) {
+				string source;
+				if (!readFile(itr, source)) {
+					cerr << "Could not read source file: " << itr << endl;
+					return false;
+				}
+
+				addModule(moduleHeaderId(source), itr);
+			}
+
+			// Breadth first over the imports, 'found' grows as we go
+			for (size_t i = 0; i < found.size(); ++i) {
+				string source;
+				if (!readFile(found[i].sourcePath, source)) {
+					cerr << "Could not read source file: " << found[i].sourcePath << endl;
+					return false;
+				}
+
+				for (const auto& moduleId : scanImports(source)) {
+					const string path = modulePath(searchDir, moduleId);
+					if (!fs::exists(path)) {
+						continue;
+					}
+
+					const size_t dep = addModule(moduleId, path);
+					imports[i].push_back(dep);
+				}
+			}
+
+			vector<int> state(found.size(), 0);
+			vector<size_t> order;
+
+			for (size_t i = 0; i < found.size(); ++i) {
+				vector<size_t> path;
+
+				if (!visitModule(i, imports, state, order, path)) {
+					cerr << "Module imports form a cycle:";
+
+					const auto start = find(path.begin(), path.end(), path.back());
+					for (auto itr = start; itr != path.end(); ++itr) {
+						cerr << (itr == start ? " " : " -> ") << found[*itr].moduleId;
+					}
+					cerr << endl;
+
+					return false;
+				}
+			}
+
+			// Renumber in dependency order
+			vector<size_t> position(found.size());
+			for (size_t i = 0; i < order.size(); ++i) {
+				position[order[i]] = i;
+			}
+
+			modules.clear();
+			for (const size_t itr : order) {
+				module_info info = found[itr];
+				for (const size_t dep : imports[itr]) {
+					info.imports.push_back(position[dep]);
+				}
+				modules.push_back(info);
+			}
+
+			return true;
+		}
+
+		bool make(const vector<string>& rootFiles, const string& exeName, unsigned jobs, const driver::options& opts) {
+			vector<module_info> modules;
+			if (!discoverModules(rootFiles, modules)) {
+				return false;
+			}
+
+			const size_t count = modules.size();
+			const string searchDir = fs::path(rootFiles[0]).parent_path().string();
+
+			driver::options moduleOpts = opts;
+			moduleOpts.importDir = searchDir;
+
+			const string configKey = driver::configurationKey(opts);
+
+			vector<string> sources(count);
+			vector<vector<size_t>> dependents(count);
+
+			for (size_t i = 0; i < count; ++i) {
+				if (!readFile(modules[i].sourcePath, sources[i])) {
+					cerr << "Could not read source file: " << modules[i].sourcePath << endl;
+					return false;
+				}
+
+				for (const size_t dep : modules[i].imports) {
+					dependents[dep].push_back(i);
+				}
+			}
+
+			thread_pool pool(jobs);
+			mutex stateMutex;
+			vector<size_t> remaining(count);
+			vector<bool> failed(count, false);
+			atomic<size_t> started(0);
+
+			function<void(size_t)> buildModule = [&](size_t i) {
+				bool importFailed = false;
+				{
+					lock_guard<mutex> lock(stateMutex);
+					for (const size_t dep : modules[i].imports) {
+						importFailed = importFailed || failed[dep];
+					}
+				}
+
+				// A module needs rebuilding when its source, the compiler configuration
+				// or the interface of anything it imports changed, which the stamp
+				// captures. The imports are built by now so their interfaces are final.
+				bool ok = !importFailed;
+				string stamp;
+
+				if (ok) {
+					vector<string> parts = { configKey, sources[i] };
+					for (const size_t dep : modules[i].imports) {
+						iface::interface_file depInterface;
+						ok = ok && depInterface.open(modules[dep].interfacePath);
+						parts.push_back(depInterface.contentHash());
+					}
+					stamp = cache::hashKey(parts);
+				}
+
+				// Remarks come from compiling, a module that isn't compiled would
+				// be missing from the report
+				string previous;
+				const bool upToDate = ok
+				                   && !remarks::enabled()
+				                   && fs::exists(modules[i].objPath)
+				                   && fs::exists(modules[i].interfacePath)
+				                   && readFile(modules[i].objPath + ".stamp", previous)
+				                   && previous == stamp;
+
+				if (ok && !upToDate) {
+					{
+						lock_guard<mutex> lock(stateMutex);
+						cout << "[" << ++started << " of " << count << "] Compiling " << modules[i].moduleId << endl;
+					}
+
+					driver::options fileOpts = moduleOpts;
+					fileOpts.sourceName = modules[i].sourcePath;
+
+					timing::scoped_phase phase("module", modules[i].moduleId);
+					ok = driver::compileObject(sources[i], modules[i].objPath, fileOpts, modules[i].interfacePath);
+					if (ok) {
+						ofstream stampOut((modules[i].objPath + ".stamp").c_str(), ios::trunc);
+						stampOut << stamp;
+					}
+				}
+
+				lock_guard<mutex> lock(stateMutex);
+				failed[i] = !ok;
+
+				for (const size_t dep : dependents[i]) {
+					if (--remaining[dep] == 0) {
+						pool.submit([&buildModule, dep] { buildModule(dep); });
+					}
+				}
+			};
+
+			for (size_t i = 0; i < count; ++i) {
+				remaining[i] = modules[i].imports.size();
+			}
+			for (size_t i = 0; i < count; ++i) {
+				if (remaining[i] == 0) {
+					pool.submit([&buildModule, i] { buildModule(i); });
+				}
+			}
+
+			pool.wait();
+
+			vector<string> objects;
+			for (size_t i = 0; i < count; ++i) {
+				if (failed[i]) {
+					cerr << "Failed to compile module: " << modules[i].moduleId << endl;
+					return false;
+				}
+				objects.push_back(modules[i].objPath);
+			}
+
+			return driver::linkObjects(objects, exeName);
+		}
+
+	}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "driver.h"
+
+
+namespace mhc {
+
+	namespace build {
+
+		struct module_info {
+			std::string moduleId;
+			std::string sourcePath;
+			std::string objPath;
+			std::string interfacePath;         // Written next to the object
+			std::vector<size_t> imports;       // Indices of the imported local modules
+		};
+
+		// Modules named by the import declarations of the source, found with a
+		// token scan rather than a full parse
+		std::vector<std::string> scanImports(const std::string& source);
+
+		// Source file of a module under the search directory: "Data.Map" -> "<dir>/Data/Map.hs"
+		std::string modulePath(const std::string& searchDir, const std::string& moduleId);
+
+		// Finds every module reachable through imports from the root files, in an
+		// order where each module comes after all of its imports. Imports without
+		// a source file are assumed to be external and are skipped. Returns false
+		// on an import cycle or an unreadable root file.
+		bool discoverModules(const std::vector<std::string>& rootFiles, std::vector<module_info>& modules);
+
+		// Compiles every module reachable from the root files, up to 'jobs' at a
+		// time, and links them into one executable. Modules whose source, imports
+		// and compiler configuration are unchanged since the last build are reused.
+		bool make(const std::vector<std::string>& rootFiles, const std::string& exeName, unsigned jobs, const driver::options& opts);
+
+	}
+
+}
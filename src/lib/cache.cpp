@@ -0,0 +1,245 @@
+#include "cache.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+
+#include <llvm/Config/llvm-config.h>
+#if LLVM_VERSION_MAJOR >= 4
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/SHA1.h>
+#else
+#include <boost/uuid/detail/sha1.hpp>
+#endif
+
+
+using namespace std;
+
+namespace fs = boost::filesystem;
+namespace ipc = boost::interprocess;
+
+
+namespace {
+
+	const string g_lockName = "lock";
+	const string g_statsName = "stats";
+
+	// Temporary files older than this are left over from a crashed compiler
+	const time_t g_staleTmpSeconds = 60 * 60;
+
+	// Unique suffix for temporary files within this process
+	atomic<unsigned> g_tmpCounter(0);
+
+	// Holds the directory-wide lock, serializing eviction and stats updates
+	// across every compiler process sharing the cache
+	class directory_lock {
+	public:
+		explicit directory_lock(const string& directory) {
+			const string lockPath = (fs::path(directory) / g_lockName).string();
+			ofstream touch(lockPath.c_str(), ios::app);
+			touch.close();
+
+			m_lock = ipc::file_lock(lockPath.c_str());
+			m_lock.lock();
+		}
+
+		~directory_lock() {
+			m_lock.unlock();
+		}
+
+	private:
+		ipc::file_lock m_lock;
+	};
+
+	pair<unsigned, unsigned> readStats(const string& statsPath) {
+		unsigned hits = 0;
+		unsigned misses = 0;
+
+		ifstream in(statsPath.c_str());
+		in >> hits >> misses;
+
+		return make_pair(hits, misses);
+	}
+
+}
+
+namespace mhc {
+
+	namespace cache {
+
+		string hashKey(const vector<string>& parts) {
+			// Separator, followed by the length to keep the encoding unambiguous
+			string encoded;
+			for (const auto& part : parts) {
+				encoded += part;
+				encoded += '\0';
+				for (size_t len = part.size(); len != 0; len >>= 8) {
+					encoded += static_cast<char>(len & 0xff);
+				}
+			}
+
+			ostringstream out;
+			out << hex << setfill('0');
+
+#if LLVM_VERSION_MAJOR >= 4
+			llvm::SHA1 sha1;
+			sha1.update(encoded);
+			for (const char byte : sha1.final()) {
+				out << setw(2) << static_cast<unsigned>(static_cast<unsigned char>(byte));
+			}
+#else
+			boost::uuids::detail::sha1 sha1;
+			sha1.process_bytes(encoded.data(), encoded.size());
+
+			unsigned int digest[5];
+			sha1.get_digest(digest);
+			for (const unsigned int word : digest) {
+				out << setw(8) << word;
+			}
+#endif
+
+			return out.str();
+		}
+
+		object_cache::object_cache(const string& directory, uintmax_t maxBytes, const string& extension)
+		: m_directory(directory), m_maxBytes(maxBytes), m_extension(extension) {
+			boost::system::error_code ec;
+			fs::create_directories(m_directory, ec);
+		}
+
+		bool object_cache::fetch(const string& key, const string& destFilename) {
+			const string entry = entryPath(key);
+			boost::system::error_code ec;
+
+			// The entry may be evicted by another process at any point, an
+			// unlinked file that we already opened stays readable so any failure
+			// here is simply treated as a miss
+			fs::copy_file(entry, destFilename, fs::copy_option::overwrite_if_exists, ec);
+			if (ec) {
+				++m_misses;
+				recordStats(0, 1);
+				return false;
+			}
+
+			// Refresh the modification time, this is what eviction orders by
+			fs::last_write_time(entry, time(nullptr), ec);
+
+			++m_hits;
+			recordStats(1, 0);
+			return true;
+		}
+
+		bool object_cache::store(const string& key, const string& srcFilename) {
+			ostringstream tmpName;
+			tmpName << key << ".tmp." << getpid() << "." << g_tmpCounter++;
+
+			const fs::path tmpPath = fs::path(m_directory) / tmpName.str();
+			boost::system::error_code ec;
+
+			fs::copy_file(srcFilename, tmpPath, fs::copy_option::overwrite_if_exists, ec);
+			if (ec) {
+				fs::remove(tmpPath, ec);
+				return false;
+			}
+
+			// Rename is atomic within a directory, readers either see the old
+			// entry or the complete new one
+			fs::rename(tmpPath, entryPath(key), ec);
+			if (ec) {
+				fs::remove(tmpPath, ec);
+				return false;
+			}
+
+			evict();
+			return true;
+		}
+
+		void object_cache::evict() {
+			directory_lock lock(m_directory);
+
+			vector<pair<time_t, fs::path>> entries;
+			uintmax_t totalBytes = 0;
+			const time_t now = time(nullptr);
+
+			boost::system::error_code ec;
+			for (fs::directory_iterator itr(m_directory, ec), end; !ec && itr != end; itr.increment(ec)) {
+				const fs::path& p = itr->path();
+				const time_t modified = fs::last_write_time(p, ec);
+				if (ec) {
+					// Removed underneath us by another process
+					ec.clear();
+					continue;
+				}
+
+				if (p.filename().string().find(".tmp.") != string::npos) {
+					if (now - modified > g_staleTmpSeconds) {
+						fs::remove(p, ec);
+						ec.clear();
+					}
+					continue;
+				}
+
+				if (p.extension() != m_extension) {
+					continue;
+				}
+
+				const uintmax_t size = fs::file_size(p, ec);
+				if (ec) {
+					ec.clear();
+					continue;
+				}
+
+				totalBytes += size;
+				entries.push_back(make_pair(modified, p));
+			}
+
+			// Oldest first
+			sort(entries.begin(), entries.end());
+
+			for (const auto& entry : entries) {
+				if (totalBytes <= m_maxBytes) {
+					break;
+				}
+
+				const uintmax_t size = fs::file_size(entry.second, ec);
+				if (!ec && fs::remove(entry.second, ec)) {
+					totalBytes -= size;
+				}
+				ec.clear();
+			}
+		}
+
+		void object_cache::printStats(ostream& out) const {
+			const auto totals = readStats((fs::path(m_directory) / g_statsName).string());
+
+			out << "Cache hits: " << m_hits << ", misses: " << m_misses
+			    << " (total hits: " << totals.first << ", misses: " << totals.second << ")" << endl;
+		}
+
+		string object_cache::entryPath(const string& key) const {
+			return (fs::path(m_directory) / (key + m_extension)).string();
+		}
+
+		void object_cache::recordStats(unsigned hits, unsigned misses) {
+			directory_lock lock(m_directory);
+
+			const string statsPath = (fs::path(m_directory) / g_statsName).string();
+			auto totals = readStats(statsPath);
+
+			ofstream out(statsPath.c_str(), ios::trunc);
+			out << (totals.first + hits) << " " << (totals.second + misses) << endl;
+		}
+
+	}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+namespace mhc {
+
+	namespace cache {
+
+		// SHA-1 digest of the given parts, returned as a hex string. Entries are
+		// found by this digest alone, so it has to be collision resistant.
+		// Parts are separated so that {"ab", "c"} and {"a", "bc"} hash differently.
+		std::string hashKey(const std::vector<std::string>& parts);
+
+		// On-disk cache of compiled artifacts keyed by content hash. Entries are
+		// written to a temporary file and renamed into place, so concurrent
+		// compilers sharing a directory never observe a partial entry. The total
+		// size is bounded and the least recently used entries are evicted first.
+		// Only files with the cache's extension count, subdirectories are left
+		// to caches of their own.
+		class object_cache {
+		public:
+			object_cache(const std::string& directory, std::uintmax_t maxBytes, const std::string& extension = ".o");
+
+			// Copies the entry for 'key' to 'destFilename', returns false on a miss
+			bool fetch(const std::string& key, const std::string& destFilename);
+
+			// Stores a copy of 'srcFilename' under 'key' and evicts old entries
+			bool store(const std::string& key, const std::string& srcFilename);
+
+			// Removes least recently used entries until the cache fits its bound
+			void evict();
+
+			unsigned hits() const { return m_hits; }
+			unsigned misses() const { return m_misses; }
+
+			// Prints the statistics of this run along with the cumulative totals
+			// recorded in the cache directory
+			void printStats(std::ostream& out) const;
+
+		private:
+			std::string entryPath(const std::string& key) const;
+			void recordStats(unsigned hits, unsigned misses);
+
+			std::string m_directory;
+			std::uintmax_t m_maxBytes;
+			std::string m_extension;
+
+			unsigned m_hits = 0;
+			unsigned m_misses = 0;
+		};
+
+	}
+
+}
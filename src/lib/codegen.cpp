@@ -1,13 +1,22 @@
 #include "codegen.h"
 
+#include "core_codegen.h"
+#include "lexer.h"
+#include "llvm_compat.h"
+
 #include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include <boost/variant/get.hpp>
+
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h>
 
 // Debugging
@@ -19,7 +28,6 @@ using namespace parser;
 
 using namespace llvm;
 using namespace std;
-using namespace std::placeholders;
 
 
 namespace {
@@ -27,32 +35,295 @@ namespace {
 		return !s.empty() && find_if(s.begin(),
 			s.end(), [](char c) { return !isdigit(c); }) == s.end();
 	}
+
+	// "foreign export ccall [\"entity\"] name :: Type" exports 'name' with the C ABI
+	bool foreignExportName(const string& decl, string& name) {
+		const auto tokens = lexer::tokenize(decl);
+		if (tokens.size() < 3 || tokens[0].text != "foreign" || tokens[1].text != "export") {
+			return false;
+		}
+
+		for (size_t i = 2; i < tokens.size(); ++i) {
+			if (tokens[i].kind == lexer::token_kind::varid && tokens[i].text != "ccall" && tokens[i].text != "capi") {
+				name = tokens[i].text;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	using lowering_t = Value* (*)(IRBuilder<>&, Value*, Value*);
+
+	// Int overflow is undefined by the Haskell Report, Word arithmetic is modular
+	Value* sadd(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateNSWAdd(l, r, "add"); }
+	Value* ssub(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateNSWSub(l, r, "sub"); }
+	Value* smul(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateNSWMul(l, r, "mult"); }
+	Value* add(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateAdd(l, r, "add"); }
+	Value* sub(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateSub(l, r, "sub"); }
+	Value* mul(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateMul(l, r, "mult"); }
+	Value* sdiv(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateSDiv(l, r, "div"); }
+	Value* udiv(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateUDiv(l, r, "div"); }
+	Value* srem(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateSRem(l, r, "rem"); }
+	Value* urem(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateURem(l, r, "rem"); }
+
+	// div and mod round toward negative infinity, they only differ from quot
+	// and rem when the division isn't exact and the signs of the remainder
+	// and the divisor differ
+	Value* floorAdjust(IRBuilder<>& b, Value* remainder, Value* r) {
+		Value* const zero = ConstantInt::get(r->getType(), 0);
+		Value* const inexact = b.CreateICmpNE(remainder, zero);
+		Value* const signs = b.CreateICmpSLT(b.CreateXor(remainder, r), zero);
+		return b.CreateAnd(inexact, signs, "adjust");
+	}
+	Value* sdivFloor(IRBuilder<>& b, Value* l, Value* r) {
+		Value* const quotient = b.CreateSDiv(l, r, "quot");
+		Value* const adjust = floorAdjust(b, b.CreateSRem(l, r, "rem"), r);
+		return b.CreateSub(quotient, b.CreateZExt(adjust, l->getType()), "div");
+	}
+	Value* smodFloor(IRBuilder<>& b, Value* l, Value* r) {
+		Value* const remainder = b.CreateSRem(l, r, "rem");
+		return b.CreateSelect(floorAdjust(b, remainder, r), b.CreateAdd(remainder, r), remainder, "mod");
+	}
+
+	Value* eq(IRBuilder<>& b, Value* l, Value* r)     { return b.CreateICmpEQ(l, r, "cmp"); }
+	Value* ne(IRBuilder<>& b, Value* l, Value* r)     { return b.CreateICmpNE(l, r, "cmp"); }
+	Value* slt(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpSLT(l, r, "cmp"); }
+	Value* sle(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpSLE(l, r, "cmp"); }
+	Value* sgt(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpSGT(l, r, "cmp"); }
+	Value* sge(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpSGE(l, r, "cmp"); }
+	Value* ult(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpULT(l, r, "cmp"); }
+	Value* ule(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpULE(l, r, "cmp"); }
+	Value* ugt(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpUGT(l, r, "cmp"); }
+	Value* uge(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateICmpUGE(l, r, "cmp"); }
+	Value* bitAnd(IRBuilder<>& b, Value* l, Value* r) { return b.CreateAnd(l, r, "and"); }
+	Value* bitOr(IRBuilder<>& b, Value* l, Value* r)  { return b.CreateOr(l, r, "or"); }
+	Value* shl(IRBuilder<>& b, Value* l, Value* r)    { return b.CreateShl(l, r, "shl"); }
+	Value* ashr(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateAShr(l, r, "shr"); }
+	Value* lshr(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateLShr(l, r, "shr"); }
+	Value* fadd(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFAdd(l, r, "add"); }
+	Value* fsub(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFSub(l, r, "sub"); }
+	Value* fmul(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFMul(l, r, "mult"); }
+	Value* fdiv(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFDiv(l, r, "div"); }
+	Value* foeq(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFCmpOEQ(l, r, "cmp"); }
+	Value* fune(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFCmpUNE(l, r, "cmp"); }
+	Value* folt(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFCmpOLT(l, r, "cmp"); }
+	Value* fole(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFCmpOLE(l, r, "cmp"); }
+	Value* fogt(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFCmpOGT(l, r, "cmp"); }
+	Value* foge(IRBuilder<>& b, Value* l, Value* r)   { return b.CreateFCmpOGE(l, r, "cmp"); }
+
+	// Indexed by [operand_type][opcode], in the order of the enums
+	const lowering_t g_lowering[ops::g_operandTypeCount][ops::g_opcodeCount] = {
+		// Int
+		{ sadd, ssub, smul, sdiv, srem, sdivFloor, smodFloor, nullptr,
+		  eq, ne, slt, sle, sgt, sge, bitAnd, bitOr, shl, ashr, nullptr, nullptr },
+		// Word, unsigned division already rounds down
+		{ add, sub, mul, udiv, urem, udiv, urem, nullptr,
+		  eq, ne, ult, ule, ugt, uge, bitAnd, bitOr, shl, lshr, nullptr, nullptr },
+		// Double
+		{ fadd, fsub, fmul, nullptr, nullptr, nullptr, nullptr, fdiv,
+		  foeq, fune, folt, fole, fogt, foge, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr },
+	};
+}
+
+Value* mhc::emitBinaryOp(IRBuilder<>& builder, ops::opcode code, ops::operand_type type, Value* lhs, Value* rhs) {
+	if (code >= ops::opcode::count || type >= ops::operand_type::count) {
+		return nullptr;
+	}
+
+	const lowering_t lower = g_lowering[static_cast<size_t>(type)][static_cast<size_t>(code)];
+	return lower ? lower(builder, lhs, rhs) : nullptr;
+}
+
+
+void ast_codegen::setModuleHeader(const parser::module_decl& decl) {
+	// A module without a header is "module Main (main) where"
+	m_exportAll = !decl.has_export_list && !decl.module_id.empty();
+	m_exports.clear();
+
+	for (const auto& itr : decl.exports) {
+		const auto tokens = lexer::tokenize(itr);
+		if (tokens.empty() || tokens[0].text == "module") {
+			continue;
+		}
+
+		// Operators are exported in parens: "(<+>)"
+		m_exports.insert((tokens[0].text == "(" && tokens.size() > 1) ? tokens[1].text : tokens[0].text);
+	}
+
+	for (const auto& itr : decl.body) {
+		string name;
+		if (const string* str = boost::get<string>(&itr)) {
+			if (foreignExportName(*str, name)) {
+				m_foreignExports.insert(name);
+			}
+		}
+	}
+}
+
+bool ast_codegen::isExported(const string& name) const {
+	return m_exportAll || name == "main" || m_exports.count(name) > 0 || m_foreignExports.count(name) > 0;
+}
+
+bool ast_codegen::exportsUnfolding(const string& name) const {
+	return isExported(name) && name != "main" && m_foreignExports.count(name) == 0;
+}
+
+GlobalValue::LinkageTypes ast_codegen::linkageOf(const string& name) const {
+	if (isExported(name)) {
+		return GlobalValue::ExternalLinkage;
+	}
+
+	// Every piece using a specialization defines it, the linker keeps one
+	if (m_splitModule && core::isSpecialization(name)) {
+		return GlobalValue::LinkOnceODRLinkage;
+	}
+
+	// Pieces of a split module still reference each other, they're linked
+	// with hidden visibility instead (set by finalizeLinkage)
+	return m_splitModule ? GlobalValue::ExternalLinkage : GlobalValue::InternalLinkage;
+}
+
+CallingConv::ID ast_codegen::callingConvOf(const string& name) const {
+	if (name == "main" || m_foreignExports.count(name) > 0) {
+		return CallingConv::C;
+	}
+
+	return CallingConv::Fast;
+}
+
+bool ast_codegen::lowerCore() {
+	if (m_desugarer.empty()) {
+		return true;
+	}
+
+	core::module program(m_module->getModuleIdentifier());
+	const bool desugared = m_desugarer.finish(program);
+
+	// Written in one piece, partitions dump from several threads
+	if (m_coreDump) {
+		ostringstream text;
+		core::print(text, program);
+		*m_coreDump << text.str() << flush;
+	}
+
+	if (!desugared || !core::verify(program, cerr)) {
+		return false;
+	}
+
+	core_codegen lowering(*this, m_module, m_builder);
+	return lowering.lower(program);
 }
 
+bool ast_codegen::finalizeLinkage() {
+	// A module that failed to lower may hold half-built functions
+	if (!lowerCore()) {
+		return false;
+	}
+
+	for (auto& function : *m_module) {
+		if (function.isDeclaration() || function.isIntrinsic()) {
+			continue;
+		}
+
+		const string name = function.getName().str();
+		function.setLinkage(linkageOf(name));
+		function.setCallingConv(callingConvOf(name));
+
+		if (m_splitModule && !isExported(name)) {
+			function.setVisibility(GlobalValue::HiddenVisibility);
+		}
+	}
+
+	// A call must use its callee's convention, or its behaviour is undefined
+	for (auto& function : *m_module) {
+		for (auto& bb : function) {
+			for (auto& inst : bb) {
+				CallInst* const call = dyn_cast<CallInst>(&inst);
+				Function* const callee = (call ? call->getCalledFunction() : nullptr);
+
+				if (callee && !callee->isIntrinsic()) {
+					call->setCallingConv(callee->getCallingConv());
+				}
+			}
+		}
+	}
+
+	markTailCalls();
+
+	return true;
+}
+
+void ast_codegen::markTailCalls() {
+	for (auto& function : *m_module) {
+		for (auto& bb : function) {
+			ReturnInst* const ret = dyn_cast_or_null<ReturnInst>(bb.getTerminator());
+			if (!ret || ret == &bb.front()) {
+				continue;
+			}
+
+			CallInst* const call = dyn_cast<CallInst>(ret->getPrevNode());
+			Function* const callee = (call ? call->getCalledFunction() : nullptr);
+			if (!callee || callee->isIntrinsic() || ret->getReturnValue() != call) {
+				continue;
+			}
+
+			// TailCallElim leaves musttail calls alone, keep self calls loopable
+			if (callee == &function) {
+				call->setTailCall();
+				continue;
+			}
+
+			// musttail needs identical prototypes and conventions, and callee
+			// arguments can't point into the caller's frame
+			bool guaranteed = (callee->getFunctionType() == function.getFunctionType()
+			                && callee->getCallingConv() == function.getCallingConv());
+			for (unsigned i = 0; i < compat::argCount(call); ++i) {
+				guaranteed = guaranteed && !call->getArgOperand(i)->getType()->isPointerTy();
+			}
+
+			call->setTailCallKind(guaranteed ? CallInst::TCK_MustTail : CallInst::TCK_Tail);
+		}
+	}
+}
 
 Value* ast_codegen::operator()(const string& val) {
 	//cerr << "Generating code for string \"" << val << "\"" << endl;
 
+	// Top-level declarations are visited without an insertion point, they're
+	// desugared together once the module is complete
 	BasicBlock *bb = m_builder.GetInsertBlock();
+	if (!bb) {
+		// Foreign exports can follow the definition, they're picked up here
+		// when the module header was never seen (streaming)
+		string name;
+		if (foreignExportName(val, name)) {
+			m_foreignExports.insert(name);
+		}
+
+		m_desugarer.addDecl(val);
+		return nullptr;
+	}
+
 	Function *TheFunction = bb->getParent();
 	const string varName = string(TheFunction->getName()) + "_" + val;
 
 	Value *retVal = nullptr;
 
-	map<string, Value*>::iterator itr = m_symbolTable.find(varName);
-	if (itr != m_symbolTable.end()) {
-		Value* const localVar = itr->second;
+	Value* const* symbol = m_symbolTable.find(varName);
+	if (symbol) {
+		Value* const localVar = *symbol;
 
 		// Only create a load if this is a pointer type, this avoids
 		// problems with function arguments that aren't created through Alloca
 		if (localVar->getType()->isPointerTy()) {
-			retVal = m_builder.CreateLoad(localVar);
+			retVal = compat::createLoad(m_builder, localVar);
 		} else {
 			retVal = localVar;
 		}
 	} else if (is_number(val)) {
 		APInt vInt(64, stol(val));
-		retVal = ConstantInt::get(getGlobalContext(), vInt);
+		retVal = ConstantInt::get(m_context, vInt);
 	} else {
 		cerr << "ERROR: Could not find symbol: \"" << val << "\"" << endl;
 		cerr << "  SymbolTable size: " << m_symbolTable.size() << endl;
@@ -82,14 +353,135 @@ Value* ast_codegen::operator()(const parser::base_expr& expr) {
 }
 
 Value* ast_codegen::operator()(const parser::algebraic_datatype_decl& decl) {
+	declareConstructors(decl);
+	m_desugarer.addDataType(decl);
 	return nullptr;
 }
 
+void ast_codegen::declareConstructors(const parser::algebraic_datatype_decl& decl) {
+	// Tags follow declaration order
+	m_constructorCounts[decl.type_ctor] = decl.constructors.size();
+	for (size_t i = 0; i < decl.constructors.size(); ++i) {
+		m_constructorTags[decl.constructors[i]] = make_pair(decl.type_ctor, i);
+	}
+}
+
+MDNode* ast_codegen::tbaaAccess(bool tag) {
+	if (!m_tbaaTag) {
+		MDBuilder md(m_context);
+		MDNode* const root = md.createTBAARoot("mhc heap");
+		MDNode* const tagType = md.createTBAAScalarTypeNode("constructor tag", root);
+		MDNode* const fieldType = md.createTBAAScalarTypeNode("constructor field", root);
+
+		m_tbaaTag = md.createTBAAStructTagNode(tagType, tagType, 0);
+		m_tbaaField = md.createTBAAStructTagNode(fieldType, fieldType, 0);
+	}
+
+	return tag ? m_tbaaTag : m_tbaaField;
+}
+
+Value* ast_codegen::emitAllocation(Value* bytes) {
+	Function* allocF = m_module->getFunction("malloc");
+	if (!allocF) {
+		Type* const i8Ptr = Type::getInt8PtrTy(m_context);
+		FunctionType* const allocType = FunctionType::get(i8Ptr, Type::getInt64Ty(m_context), false);
+		allocF = Function::Create(allocType, GlobalValue::ExternalLinkage, "malloc", m_module);
+		allocF->setDoesNotThrow();
+		compat::setReturnNoAlias(allocF);
+	}
+
+	CallInst* const call = m_builder.CreateCall(allocF, bytes, "alloc");
+	compat::setReturnNoAlias(call);
+
+	return m_builder.CreateBitCast(call, Type::getInt64PtrTy(m_context), "object");
+}
+
+Value* ast_codegen::emitConstructor(const string& name, const vector<Value*>& fields) {
+	const auto itr = m_constructorTags.find(name);
+	if (itr == m_constructorTags.end()) {
+		cerr << "Error: Unknown constructor \"" << name << "\"" << endl;
+		return nullptr;
+	}
+
+	// One word for the tag followed by one word per field
+	Value* const bytes = m_builder.getInt64((fields.size() + 1) * sizeof(uint64_t));
+	Value* const object = emitAllocation(bytes);
+
+	StoreInst* const tag = m_builder.CreateStore(m_builder.getInt64(itr->second.second), object);
+	tag->setMetadata(LLVMContext::MD_tbaa, tbaaAccess(true));
+
+	for (size_t i = 0; i < fields.size(); ++i) {
+		Value* field = fields[i];
+		if (field->getType()->isPointerTy()) {
+			field = m_builder.CreatePtrToInt(field, m_builder.getInt64Ty());
+		}
+
+		Value* const slot = compat::createConstInBoundsGEP1_64(m_builder, object, i + 1, "field");
+		m_builder.CreateStore(field, slot)->setMetadata(LLVMContext::MD_tbaa, tbaaAccess(false));
+	}
+
+	return object;
+}
+
+Value* ast_codegen::emitTagLoad(Value* object, const string& typeName) {
+	LoadInst* const tag = compat::createLoad(m_builder, object, "tag");
+	tag->setMetadata(LLVMContext::MD_tbaa, tbaaAccess(true));
+
+	// Lets case analysis drop impossible alternatives and build dense jump tables
+	const auto itr = m_constructorCounts.find(typeName);
+	if (itr != m_constructorCounts.end() && itr->second > 0) {
+		tag->setMetadata(LLVMContext::MD_range,
+			MDBuilder(m_context).createRange(APInt(64, 0), APInt(64, itr->second)));
+	}
+
+	return tag;
+}
+
+Value* ast_codegen::emitFieldLoad(Value* object, unsigned index) {
+	Value* const slot = compat::createConstInBoundsGEP1_64(m_builder, object, index + 1, "field");
+	LoadInst* const field = compat::createLoad(m_builder, slot, "field");
+	field->setMetadata(LLVMContext::MD_tbaa, tbaaAccess(false));
+
+	return field;
+}
+
+void ast_codegen::visitHeader(const parser::module_decl& decl) {
+	setModuleHeader(decl);
+	m_desugarer.addEnvironment(decl);
+
+	for (const auto& itr : decl.body) {
+		if (const import_decl* import = boost::get<import_decl>(&itr)) {
+			(*this)(*import);
+		} else if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&itr)) {
+			(*this)(*adt);
+		}
+	}
+}
+
 Value* ast_codegen::operator()(const parser::module_decl& decl) {
+	visitHeader(decl);
+
+	for (const auto& itr : decl.body) {
+		if (boost::get<string>(&itr) || boost::get<type_synonym_decl>(&itr)) {
+			boost::apply_visitor(*this, itr);
+		}
+	}
+
+	return nullptr;
+}
+
+Value* ast_codegen::operator()(const parser::import_decl& decl) {
+	// Only the interface is needed, it's opened on first use
+	if (m_imports) {
+		m_imports->addImport(decl.module_id);
+	}
+
 	return nullptr;
 }
 
 Value* ast_codegen::operator()(const parser::type_synonym_decl& decl) {
+	// Expanded away while inferring types, Core never sees a synonym
+	m_desugarer.addSynonym(decl);
 	return nullptr;
 }
 
@@ -100,34 +492,47 @@ Value* ast_codegen::operator()(const parser::func_expr& func) {
 	Function *F = nullptr;
 
 	// Determine if this function name has been defined yet
-	auto itr = m_symbolTable.find(func.functionName);
-	if (itr == m_symbolTable.end()) {
+	Value** symbol = m_symbolTable.find(func.functionName);
+	if (!symbol) {
 		// Could not find existing function with this name, build it
-		vector<Type*> args(func.args.size(), Type::getInt64Ty(getGlobalContext()));
-		FunctionType *FT = FunctionType::get(Type::getInt64Ty(getGlobalContext()), args, false);
-		F = Function::Create(FT, Function::ExternalLinkage, func.functionName, m_module);
+		vector<Type*> args(func.args.size(), Type::getInt64Ty(m_context));
+		FunctionType *FT = FunctionType::get(Type::getInt64Ty(m_context), args, false);
+		F = Function::Create(FT, linkageOf(func.functionName), func.functionName, m_module);
+		F->setCallingConv(callingConvOf(func.functionName));
 
 		// Add it to the symbol table so we can refer to it later
-		m_symbolTable[func.functionName] = F;
+		m_symbolTable.insert(func.functionName, F);
 	} else {
-		F = dynamic_cast<Function*>(itr->second);
+		F = dynamic_cast<Function*>(*symbol);
 	}
 
-	BasicBlock *BB = BasicBlock::Create(getGlobalContext(), func.functionName.c_str(), F);
+	BasicBlock *BB = BasicBlock::Create(m_context, func.functionName.c_str(), F);
 	m_builder.SetInsertPoint(BB);
 
+	// Function-level scoping so our symbols aren't re-used across other functions
+	symbolType_t::scope functionScope(m_symbolTable);
+
 	// Build a return value in place
 	IRBuilder<> TmpB(&F->getEntryBlock(), F->getEntryBlock().begin());
-	AllocaInst* const Alloca = TmpB.CreateAlloca(Type::getInt64Ty(getGlobalContext()), nullptr, "__retval__");
+	AllocaInst* const Alloca = TmpB.CreateAlloca(Type::getInt64Ty(m_context), nullptr, "__retval__");
 	assert(Alloca);
-	m_symbolTable["__retval__"] = Alloca;
+	m_symbolTable.insert("__retval__", Alloca);
 
 	APInt vInt(64, 0);
-	m_builder.CreateStore(ConstantInt::get(getGlobalContext(), vInt), Alloca);
+	m_builder.CreateStore(ConstantInt::get(m_context, vInt), Alloca);
+
+	BasicBlock *ReturnBB = BasicBlock::Create(m_context, "return");
+	m_symbolTable.insert("__retval__BB", ReturnBB);
 
-	BasicBlock *ReturnBB = BasicBlock::Create(getGlobalContext(), "return");
-	m_symbolTable["__retval__BB"] = ReturnBB;
 
+	// Arguments are read through phis in a loop header, saturated self tail
+	// calls jump back to it instead of growing the stack
+	BasicBlock* const TailBB = BasicBlock::Create(m_context, "tailrecurse", F);
+	m_builder.CreateBr(TailBB);
+	m_builder.SetInsertPoint(TailBB);
+
+	m_tailHeader = TailBB;
+	m_tailPhis.clear();
 
 	// Add function arguments
 	Function::arg_iterator argItr = F->arg_begin();
@@ -135,18 +540,17 @@ Value* ast_codegen::operator()(const parser::func_expr& func) {
 		const string argName = string(F->getName()) + "_" + argStr;
 
 		argItr->setName(argName);
-		m_symbolTable[argName] = argItr;
+		PHINode* const phi = m_builder.CreatePHI(argItr->getType(), 2, argName + ".tr");
+		phi->addIncoming(argItr, BB);
+		m_tailPhis.push_back(phi);
+		m_symbolTable.insert(argName, phi);
 
 		++argItr;
 	}
 
-	// Create a new visitor, this allows function-level scoping so our symbol table
-	// isn't re-used across other functions
-	ast_codegen symbolVisitor(*this);
-
 	// Visit declarations inside the function node
 	for (auto& itrDecl : func.declarations) {
-		boost::apply_visitor(symbolVisitor, itrDecl);
+		boost::apply_visitor(*this, itrDecl);
 	}
 
 	// Default this to something other than nullptr, in cases where we
@@ -155,7 +559,7 @@ Value* ast_codegen::operator()(const parser::func_expr& func) {
 
 	// Visit expressions inside the function node
 	for (auto& itrExpr : func.expressions) {
-		lastExpr = boost::apply_visitor(symbolVisitor, itrExpr);
+		lastExpr = boost::apply_visitor(*this, itrExpr);
 
 		// Indicates that all paths branched (in the current case, this means everything returned)
 		// and we didn't create an "if.end" merge block, therefore stop here
@@ -163,7 +567,7 @@ Value* ast_codegen::operator()(const parser::func_expr& func) {
 			break;
 		}
 
-		if ((lastExpr && isa<BranchInst>(lastExpr))) {
+		if ((lastExpr && isa<TerminatorInst>(lastExpr))) {
 			break;
 		}
 	}
@@ -172,11 +576,14 @@ Value* ast_codegen::operator()(const parser::func_expr& func) {
 	F->getBasicBlockList().push_back(ReturnBB);
 	m_builder.SetInsertPoint(ReturnBB);
 
-	Value* const loadRetVal = m_builder.CreateLoad(m_symbolTable["__retval__"]);
+	Value* const loadRetVal = m_builder.CreateLoad(*m_symbolTable.find("__retval__"));
 	assert(loadRetVal);
 	Value* const retVal = m_builder.CreateRet(loadRetVal);
 	assert(retVal);
 
+	m_tailHeader = nullptr;
+	m_tailPhis.clear();
+
 	// LLVM sanity check
 	verifyFunction(*F);
 
@@ -193,8 +600,8 @@ Value* ast_codegen::operator()(const parser::decl_expr& decl) {
 
 	const string declName = string(TheFunction->getName()) + "_" + decl.declName;
 
-	map<string, Value*>::const_iterator itr = m_symbolTable.find(declName);
-	if (itr == m_symbolTable.end()) {
+	Value** symbol = m_symbolTable.find(declName);
+	if (!symbol) {
 		//cerr << "  Variable referenced for first time: " << decl.declName << endl;
 
 		AllocaInst *Alloca = nullptr;
@@ -202,41 +609,41 @@ Value* ast_codegen::operator()(const parser::decl_expr& decl) {
 		// If there is no basic block it indicates it might be at the global-level
 		if (bb) {
 			IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
-			Alloca = TmpB.CreateAlloca(Type::getInt64Ty(getGlobalContext()), nullptr, declName.c_str());
+			Alloca = TmpB.CreateAlloca(Type::getInt64Ty(m_context), nullptr, declName.c_str());
 
-			m_symbolTable[declName] = Alloca;
+			m_symbolTable.insert(declName, Alloca);
 		} else {
 			// Check if the function was already declared, if not then build it
-			auto itr = m_symbolTable.find(declName);
-			if (itr == m_symbolTable.end()) {
+			if (!m_symbolTable.find(declName)) {
 				// Assume for now this has no arguments
-				vector<Type*> args(0, Type::getInt64Ty(getGlobalContext()));
+				vector<Type*> args(0, Type::getInt64Ty(m_context));
 
-				FunctionType *FT = FunctionType::get(Type::getInt64Ty(getGlobalContext()), args, false);
-				Function *F = Function::Create(FT, Function::ExternalLinkage, declName, m_module);
+				FunctionType *FT = FunctionType::get(Type::getInt64Ty(m_context), args, false);
+				Function *F = Function::Create(FT, linkageOf(declName), declName, m_module);
+				F->setCallingConv(callingConvOf(declName));
 
 				// Add this function to the symbol table
-				m_symbolTable[declName] = F;
+				m_symbolTable.insert(declName, F);
 			}
 		}
 
 		var = Alloca;
 	} else {
 		// Use the variable itself
-		var = itr->second;
+		var = *symbol;
 	}
 
 	Value* const exprRhs = boost::apply_visitor(*this, decl.val);
 	if (exprRhs) {
 		// Don't just obtain the variable from codegen, since that produces a load...
 		// instead just look it up directly
-		const auto itr = m_symbolTable.find(declName);
-		if (itr != m_symbolTable.end()) {
+		Value* const* target = m_symbolTable.find(declName);
+		if (target) {
 			if (exprRhs->getType()->isPointerTy()) {
 				Value *varLhs = m_builder.CreateLoad(exprRhs);
-				m_builder.CreateStore(varLhs, itr->second);
+				m_builder.CreateStore(varLhs, *target);
 			} else {
-				m_builder.CreateStore(exprRhs, itr->second);
+				m_builder.CreateStore(exprRhs, *target);
 			}
 		} else {
 			cerr << "ERROR: Could not find variable: " << declName << endl;
@@ -260,14 +667,21 @@ Value* ast_codegen::operator()(const parser::return_expr& exprRet) {
 	// within an if-else, LLVM doesn't allow terminators in the branches
 	// Therefore, just reference the return value on the stack we setup
 	// when the function was created - we should only be writing to this once
-	Value* const retVal = m_symbolTable["__retval__"];
+	Value* const retVal = *m_symbolTable.find("__retval__");
 	assert(retVal);
 
+	// Calls in return position return directly or loop, skipping the slot
+	if (const call_expr* const call = boost::get<call_expr>(&exprRet.ret)) {
+		if (Value* const t = tailCall(*call)) {
+			return t;
+		}
+	}
+
 #if 0	
 	if (m_returnGenerated) {
 		/*
 		APInt vInt(64, stoi(val));
-		defaultRet = ConstantInt::get(getGlobalContext(), vInt);
+		defaultRet = ConstantInt::get(m_context, vInt);
 
 		m_builder.CreateStore(defaultRet, retVal);
 		*/
@@ -281,7 +695,7 @@ Value* ast_codegen::operator()(const parser::return_expr& exprRet) {
 	Value* const n = m_builder.CreateStore(v, retVal);
 	assert(n);
 
-	Value* const ReturnBB = m_symbolTable["__retval__BB"];
+	Value* const ReturnBB = *m_symbolTable.find("__retval__BB");
 	Value* const r = m_builder.CreateBr(dynamic_cast<BasicBlock*>(ReturnBB));
 	assert(r);
 
@@ -318,11 +732,43 @@ Value* ast_codegen::operator()(const parser::call_expr& expr) {
 	}
 
 	CallInst *callInst = m_builder.CreateCall(calleeF, ArgsV, callFuncName);
+	callInst->setCallingConv(calleeF->getCallingConv());
 
 	// Pass the call up so the value can be stored
 	return callInst;
 }
 
+Value* ast_codegen::tailCall(const parser::call_expr& expr) {
+	Function* const callerF = m_builder.GetInsertBlock()->getParent();
+	Function* const calleeF = m_module->getFunction(expr.funcName);
+	if (!calleeF || calleeF->arg_size() != expr.values.size()) {
+		return nullptr;
+	}
+
+	std::vector<Value*> ArgsV;
+	for (auto& exprArg : expr.values) {
+		ArgsV.push_back(boost::apply_visitor(*this, exprArg));
+	}
+
+	// Saturated self call, feed the header phis and jump back
+	if (calleeF == callerF && m_tailHeader) {
+		BasicBlock* const from = m_builder.GetInsertBlock();
+		for (size_t i = 0; i < ArgsV.size(); ++i) {
+			m_tailPhis[i]->addIncoming(ArgsV[i], from);
+		}
+
+		return m_builder.CreateBr(m_tailHeader);
+	}
+
+	CallInst* const callInst = m_builder.CreateCall(calleeF, ArgsV, expr.funcName);
+	callInst->setCallingConv(calleeF->getCallingConv());
+
+	// markTailCalls upgrades this to musttail once conventions are final
+	callInst->setTailCall();
+
+	return m_builder.CreateRet(callInst);
+}
+
 Value* ast_codegen::operator()(const parser::if_expr& expr) {
 	//cerr << "Generating code for ifExpr:" << endl;
 
@@ -335,9 +781,9 @@ Value* ast_codegen::operator()(const parser::if_expr& expr) {
 
 	// Create blocks for the then and else cases, insert the 'then' block at the
 	// end of the function
-	BasicBlock *ThenBB = BasicBlock::Create(getGlobalContext(), "if.then", TheFunction);
-	BasicBlock *ElseBB = BasicBlock::Create(getGlobalContext(), "if.else");
-	BasicBlock *MergeBB = BasicBlock::Create(getGlobalContext(), "if.end");
+	BasicBlock *ThenBB = BasicBlock::Create(m_context, "if.then", TheFunction);
+	BasicBlock *ElseBB = BasicBlock::Create(m_context, "if.else");
+	BasicBlock *MergeBB = BasicBlock::Create(m_context, "if.end");
 
 	m_builder.CreateCondBr(CondV, ThenBB, ElseBB);
 
@@ -351,21 +797,20 @@ Value* ast_codegen::operator()(const parser::if_expr& expr) {
 	{
 		m_builder.SetInsertPoint(ThenBB);
 
-		// Created a new visitor, this allows scoping so our symbol table
-		// isn't re-used across other functions
-		ast_codegen symbolVisitor(*this);
+		// Symbols declared in the branch go out of scope with it
+		symbolType_t::scope branchScope(m_symbolTable);
 
 		for (const auto& itrThen : expr.thenBranch) {
-			ThenV = boost::apply_visitor(symbolVisitor, itrThen);
+			ThenV = boost::apply_visitor(*this, itrThen);
 			assert(ThenV);
 
-			if (isa<BranchInst>(ThenV)) {
+			if (isa<TerminatorInst>(ThenV)) {
 				break;
 			}
 		}
 
 		// Create a branch to the MergeBB if the last was a branch instruction
-		if (!isa<BranchInst>(ThenV)) {
+		if (!isa<TerminatorInst>(ThenV)) {
 			m_builder.CreateBr(MergeBB);
 		} else {
 			thenBranched = true;
@@ -379,21 +824,20 @@ Value* ast_codegen::operator()(const parser::if_expr& expr) {
 		TheFunction->getBasicBlockList().push_back(ElseBB);
 		m_builder.SetInsertPoint(ElseBB);
 
-		// Created a new visitor, this allows scoping so our symbol table
-		// isn't re-used across other functions
-		ast_codegen symbolVisitor(*this);
+		// Symbols declared in the branch go out of scope with it
+		symbolType_t::scope branchScope(m_symbolTable);
 
 		for (const auto& itrElse : expr.elseBranch) {
-			ElseV = boost::apply_visitor(symbolVisitor, itrElse);
+			ElseV = boost::apply_visitor(*this, itrElse);
 			assert(ElseV);
 
-			if (isa<BranchInst>(ElseV)) {
+			if (isa<TerminatorInst>(ElseV)) {
 				break;
 			}
 		}
 
 		// Create a branch to the MergeBB if the last was a branch instruction
-		if (!ElseV || (ElseV && !isa<BranchInst>(ElseV))) {
+		if (!ElseV || (ElseV && !isa<TerminatorInst>(ElseV))) {
 			m_builder.CreateBr(MergeBB);
 		} else {
 			elseBranched = true;
@@ -473,9 +917,9 @@ Value* ast_codegen::operator()(const parser::while_loop& loop) {
 
 	Function *TheFunction = m_builder.GetInsertBlock()->getParent();
 
-	BasicBlock *LoopBB = BasicBlock::Create(getGlobalContext(), "while.body");
-	BasicBlock *AfterBB = BasicBlock::Create(getGlobalContext(), "while.end");
-	BasicBlock *loopCond = BasicBlock::Create(getGlobalContext(), "while.cond", TheFunction);
+	BasicBlock *LoopBB = BasicBlock::Create(m_context, "while.body");
+	BasicBlock *AfterBB = BasicBlock::Create(m_context, "while.end");
+	BasicBlock *loopCond = BasicBlock::Create(m_context, "while.cond", TheFunction);
 
 	m_builder.CreateBr(loopCond);
 	m_builder.SetInsertPoint(loopCond);
@@ -487,16 +931,16 @@ Value* ast_codegen::operator()(const parser::while_loop& loop) {
 	TheFunction->getBasicBlockList().push_back(LoopBB);
 	m_builder.SetInsertPoint(LoopBB);
 
-	// Created a new visitor, this allows scoping so our symbol table isn't re-used across other functions
-	ast_codegen symbolVisitor(*this);
+	// Symbols declared in the loop body go out of scope with it
+	symbolType_t::scope bodyScope(m_symbolTable);
 
 	// Generate the loop body
 	bool branchGenerated = false;
 	for (const auto& itrBody : loop.loopBody) {
-		Value* const v = boost::apply_visitor(symbolVisitor, itrBody);
+		Value* const v = boost::apply_visitor(*this, itrBody);
 		assert(v);
 
-		if ((v && isa<BranchInst>(v))) {
+		if ((v && isa<TerminatorInst>(v))) {
 			branchGenerated = true;
 			break;
 		}
@@ -522,17 +966,17 @@ Value* ast_codegen::operator()(const parser::var_assign& assign) {
 
 	Value* const rhsVal = boost::apply_visitor(*this, assign.varRhs);
 
-	const auto& itr = m_symbolTable.find(varName);
-	if (itr == m_symbolTable.end()) {
+	Value* const* target = m_symbolTable.find(varName);
+	if (!target) {
 		cerr << "Unknown variable assignment: \"" << assign.varName << "\"" << endl;
 		return nullptr;
 	}
 
 	if (rhsVal->getType()->isPointerTy()) {
 		Value* const varLhs = m_builder.CreateLoad(rhsVal);
-		return m_builder.CreateStore(varLhs, itr->second);
+		return m_builder.CreateStore(varLhs, *target);
 	}
 	
-	return m_builder.CreateStore(rhsVal, itr->second);
+	return m_builder.CreateStore(rhsVal, *target);
 }
 #endif
@@ -1,32 +1,108 @@
 #pragma once
 
+#include <iosfwd>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
+#include <llvm/IR/CallingConv.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
 
+#include "desugar.h"
+#include "interface.h"
+#include "operators.h"
 #include "parser.h"
+#include "symbol_table.h"
 
 
 namespace mhc {
 
+	// Lowers one binary operation through the static dispatch table, returns
+	// nullptr for combinations without an instruction (e.g. shifting a Double)
+	llvm::Value* emitBinaryOp(llvm::IRBuilder<>& builder, ops::opcode code, ops::operand_type type,
+	                          llvm::Value* lhs, llvm::Value* rhs);
+
 	class ast_codegen : public boost::static_visitor<llvm::Value*> {
 	public:
-		using symbolType_t = std::map<std::string, llvm::Value*>;
+		using symbolType_t = scoped_table<llvm::Value*>;
 
+		// Code is generated in the module's context, which must only be used by
+		// one thread at a time
 		ast_codegen(llvm::Module* m, llvm::IRBuilder<>& b)
-		: m_module(m), m_builder(b) {}
+		: m_module(m), m_context(m->getContext()), m_builder(b) {
+			declareConstructors(core::orderingDecl());
+		}
+
+		// Nested bodies open a scope on the symbol table instead of copying the visitor
+		ast_codegen(const ast_codegen&) = delete;
+		ast_codegen& operator=(const ast_codegen&) = delete;
+
+		// Interfaces of imported modules, import declarations are added to it
+		void setImports(iface::import_env* imports) {
+			m_imports = imports;
+			m_desugarer.setImports(imports);
+		}
+
+		// Bindings are collected as they're visited and desugared into Core
+		// together, printing it here first when set
+		void setCoreDump(std::ostream* out) { m_coreDump = out; }
+		core::desugarer& desugarer() { return m_desugarer; }
+
+		// The module's header, imports and data types, and its whole body as
+		// the environment bindings are desugared in. Visiting the module also
+		// visits its body, partitions only visit their own declarations.
+		void visitHeader(const parser::module_decl& decl);
+
+		// Only 'main' and foreign exports keep the C calling convention, every
+		// other binding uses fastcc. Bindings the module doesn't export get
+		// internal linkage so LLVM's interprocedural passes can see all their
+		// callers, unless the module is generated in pieces that link against
+		// each other (partitions, batches, declarations), where they're hidden.
+		void setModuleHeader(const parser::module_decl& decl);
+		void setSplitModule(bool split) { m_splitModule = split; }
+
+		bool isExported(const std::string& name) const;
+
+		// Importers can only inline what they can call: exported bindings other
+		// than the entry points, 'main' and the foreign exports
+		bool exportsUnfolding(const std::string& name) const;
+		llvm::GlobalValue::LinkageTypes linkageOf(const std::string& name) const;
+		llvm::CallingConv::ID callingConvOf(const std::string& name) const;
 
-		ast_codegen(const ast_codegen& rhs)
-		: m_module(rhs.m_module), m_builder(rhs.m_builder), m_symbolTable(rhs.m_symbolTable) {}
+		// Desugars the bindings visited so far, verifies the Core and lowers it
+		// into the module. Errors go to cerr.
+		bool lowerCore();
 
+		// Lowers the pending bindings (lowerCore), then applies the policy to
+		// every function defined in the module and makes call sites agree with
+		// their callee's convention, then marks tail calls
+		bool finalizeLinkage();
+
+		// A call whose result is returned right away becomes 'musttail' when
+		// caller and callee share a prototype and convention, so mutual
+		// recursion runs in constant stack. Self calls are only marked 'tail',
+		// core_codegen already turned the ones in return position into loops.
+		void markTailCalls();
+
+		// Heap objects are a tag word followed by one word per field. The
+		// allocation is marked noalias, tags and fields get distinct TBAA types
+		// and tag loads carry the range of the type's constructors.
+		llvm::Value* emitAllocation(llvm::Value* bytes);
+		llvm::Value* emitConstructor(const std::string& name, const std::vector<llvm::Value*>& fields);
+		llvm::Value* emitTagLoad(llvm::Value* object, const std::string& typeName);
+		llvm::Value* emitFieldLoad(llvm::Value* object, unsigned index);
 
 		llvm::Value* operator()(const parser::base_expr& expr);
 		llvm::Value* operator()(const parser::algebraic_datatype_decl& decl);
 		llvm::Value* operator()(const parser::module_decl& decl);
+		llvm::Value* operator()(const parser::import_decl& decl);
 		llvm::Value* operator()(const parser::type_synonym_decl& decl);
 		llvm::Value* operator()(const std::string& expr);
 		/*
@@ -39,13 +115,41 @@ namespace mhc {
 		llvm::Value* operator()(const parser::binary_op& expr);
 		llvm::Value* operator()(const parser::while_loop& expr);
 		llvm::Value* operator()(const parser::var_assign& expr);
+
+		// Lowers a call in return position, returns nullptr when it isn't saturated
+		llvm::Value* tailCall(const parser::call_expr& expr);
 		*/
 
 	private:
 		llvm::Module* m_module;
+		llvm::LLVMContext& m_context;
 		llvm::IRBuilder<>& m_builder;
+		iface::import_env* m_imports = nullptr;
+
+		core::desugarer m_desugarer;
+		std::ostream* m_coreDump = nullptr;
+
+		// Everything counts as exported until a module header says otherwise
+		bool m_exportAll = true;
+		bool m_splitModule = false;
+		std::set<std::string> m_exports;
+		std::set<std::string> m_foreignExports;
+
+		// Constructor -> (type, tag) and type -> number of constructors
+		void declareConstructors(const parser::algebraic_datatype_decl& decl);
+		std::map<std::string, std::pair<std::string, size_t>> m_constructorTags;
+		std::map<std::string, size_t> m_constructorCounts;
+
+		llvm::MDNode* tbaaAccess(bool tag);
+		llvm::MDNode* m_tbaaTag = nullptr;
+		llvm::MDNode* m_tbaaField = nullptr;
 
 		symbolType_t m_symbolTable;
+
+		// Loop header of the function being lowered, with one phi per argument
+		// that saturated self tail calls feed before jumping back
+		llvm::BasicBlock* m_tailHeader = nullptr;
+		std::vector<llvm::PHINode*> m_tailPhis;
 	};
 
 }
@@ -0,0 +1,765 @@
+#include "core.h"
+
+#include <ostream>
+#include <set>
+#include <sstream>
+
+
+using namespace mhc::core;
+using namespace mhc;
+
+using namespace std;
+
+
+namespace {
+
+	string varName(const module& m, var_id v) {
+		if (v >= m.vars.size()) {
+			return "<bad var " + to_string(v) + ">";
+		}
+
+		const var& x = m.vars[v];
+		if (x.global) {
+			return x.name;
+		}
+
+		// Locals may shadow each other, the index keeps them apart
+		return (x.name.empty() ? "t" : x.name) + "." + to_string(v);
+	}
+
+	string atomString(const module& m, const atom& a) {
+		switch (a.kind) {
+			case atom_kind::variable:
+				return varName(m, a.variable);
+			case atom_kind::integer:
+				if (a.type == g_boolType) {
+					return a.integer ? "True" : "False";
+				}
+				return to_string(a.integer);
+			case atom_kind::floating: {
+				ostringstream out;
+				out << a.floating;
+				const string text = out.str();
+				return (text.find_first_of(".en") == string::npos) ? text + ".0" : text;
+			}
+		}
+
+		return "";
+	}
+
+	string atomList(const module& m, uint32_t first, uint32_t count) {
+		string result;
+		for (uint32_t i = first; i < first + count && i < m.atoms.size(); ++i) {
+			result += " " + atomString(m, m.atoms[i]);
+		}
+
+		return result;
+	}
+
+	string binderList(const module& m, uint32_t first, uint32_t count) {
+		string result;
+		for (uint32_t i = first; i < first + count && i < m.binders.size(); ++i) {
+			result += " " + varName(m, m.binders[i]);
+		}
+
+		return result;
+	}
+
+	class printer {
+	public:
+		printer(ostream& out, const module& m) : m_out(out), m_module(m) {}
+
+		void printExpr(expr_id e, unsigned indent) {
+			// Bounded so a malformed module can't recurse forever
+			for (size_t steps = 0; e < m_module.exprs.size() && steps < m_module.exprs.size(); ++steps) {
+				const expr& x = m_module.exprs[e];
+				const string pad(indent * 2, ' ');
+
+				switch (x.kind) {
+					case expr_kind::ret:
+						m_out << pad << "ret" << atomList(m_module, x.first, x.count) << "\n";
+						return;
+					case expr_kind::let_atom:
+						m_out << pad << "let " << varName(m_module, x.binder) << " =" << atomList(m_module, x.first, x.count) << "\n";
+						break;
+					case expr_kind::let_prim:
+						m_out << pad << "let " << varName(m_module, x.binder) << " = " << ops::opcodeName(x.op)
+						      << atomList(m_module, x.first, x.count) << "\n";
+						break;
+					case expr_kind::let_call:
+						m_out << pad << "let " << varName(m_module, x.binder) << " = call " << varName(m_module, x.ref)
+						      << atomList(m_module, x.first, x.count) << "\n";
+						break;
+					case expr_kind::let_con:
+						m_out << pad << "let " << varName(m_module, x.binder) << " = "
+						      << (x.ref < m_module.constructors.size() ? m_module.constructors[x.ref].name : "<bad constructor>")
+						      << atomList(m_module, x.first, x.count) << "\n";
+						break;
+					case expr_kind::let_tag:
+						m_out << pad << "let " << varName(m_module, x.binder) << " = tag" << atomList(m_module, x.first, x.count) << "\n";
+						break;
+					case expr_kind::match:
+						m_out << pad << "case" << atomList(m_module, x.first, 1) << " of\n";
+						for (uint32_t i = x.ref; i < x.ref + x.count && i < m_module.alts.size(); ++i) {
+							printAlt(m_module.alts[i], indent + 1);
+						}
+						return;
+					case expr_kind::join:
+						m_out << pad << "join " << varName(m_module, x.binder) << binderList(m_module, x.first, x.count) << " =\n";
+						printExpr(x.ref, indent + 2);
+						m_out << pad << "in\n";
+						break;
+					case expr_kind::jump:
+						m_out << pad << "jump " << varName(m_module, x.ref) << atomList(m_module, x.first, x.count) << "\n";
+						return;
+					case expr_kind::fail:
+						m_out << pad << "fail\n";
+						return;
+				}
+
+				e = x.body;
+			}
+		}
+
+	private:
+		void printAlt(const alt& a, unsigned indent) {
+			m_out << string(indent * 2, ' ');
+			switch (a.kind) {
+				case alt_kind::constructor:
+					m_out << (a.constructor < m_module.constructors.size() ? m_module.constructors[a.constructor].name : "<bad constructor>")
+					      << binderList(m_module, a.first, a.count);
+					break;
+				case alt_kind::literal:
+					m_out << a.literal;
+					break;
+				case alt_kind::otherwise:
+					m_out << "_";
+					break;
+			}
+			m_out << " ->\n";
+
+			printExpr(a.body, indent + 1);
+		}
+
+		ostream& m_out;
+		const module& m_module;
+	};
+
+	class verifier {
+	public:
+		verifier(const module& m, ostream& errors)
+		: m_module(m), m_errors(errors), m_bound(m.vars.size(), 0), m_everBound(m.vars.size(), 0),
+		  m_labels(m.vars.size(), 0), m_visited(m.exprs.size(), 0) {}
+
+		bool ok() const { return m_ok; }
+
+		void checkTypes() {
+			for (type_id t = 0; t < m_module.types.size(); ++t) {
+				const type& x = m_module.types[t];
+				if (x.kind != type_kind::function) {
+					continue;
+				}
+
+				for (const auto p : x.params) {
+					if (p >= m_module.types.size() || m_module.types[p].kind == type_kind::function) {
+						error("function type " + to_string(t) + " has an invalid parameter type");
+					}
+				}
+				if (x.result >= m_module.types.size() || m_module.types[x.result].kind == type_kind::function) {
+					error("function type " + to_string(t) + " has an invalid result type");
+				}
+			}
+
+			for (const auto& c : m_module.constructors) {
+				if (c.type >= m_module.types.size() || m_module.types[c.type].kind != type_kind::data) {
+					error("constructor " + c.name + " doesn't build a data type");
+				}
+				for (const auto f : c.fields) {
+					if (f >= m_module.types.size() || m_module.types[f].kind == type_kind::function) {
+						error("constructor " + c.name + " has an invalid field type");
+					}
+				}
+			}
+
+			for (const auto& v : m_module.vars) {
+				if (v.type >= m_module.types.size()) {
+					error("variable " + v.name + " has an invalid type");
+				}
+			}
+		}
+
+		void checkFunction(const function& f) {
+			if (f.name >= m_module.vars.size() || !m_module.vars[f.name].global) {
+				error("function with an invalid name");
+				return;
+			}
+
+			m_where = m_module.vars[f.name].name;
+			const type* t = typeOf(f.name);
+			if (!t || t->kind != type_kind::function || t->params.size() != f.count) {
+				error("the type doesn't match the parameters");
+				return;
+			}
+
+			vector<var_id> params;
+			for (uint32_t i = 0; i < f.count; ++i) {
+				const var_id p = binderAt(f.first + i);
+				if (p == g_none) {
+					return;
+				}
+				if (m_module.vars[p].type != t->params[i]) {
+					error("parameter " + varName(m_module, p) + " has the wrong type");
+				}
+				bind(p);
+				params.push_back(p);
+			}
+
+			checkExpr(f.body, t->result);
+
+			for (const auto p : params) {
+				m_bound[p] = 0;
+			}
+		}
+
+	private:
+		void error(const string& message) {
+			m_ok = false;
+			m_errors << "Core error" << (m_where.empty() ? "" : " in " + m_where) << ": " << message << endl;
+		}
+
+		const type* typeOf(var_id v) const {
+			const type_id t = m_module.vars[v].type;
+			return (t < m_module.types.size()) ? &m_module.types[t] : nullptr;
+		}
+
+		var_id binderAt(uint32_t index) {
+			if (index >= m_module.binders.size() || m_module.binders[index] >= m_module.vars.size()) {
+				error("binder out of range");
+				return g_none;
+			}
+
+			return m_module.binders[index];
+		}
+
+		void bind(var_id v) {
+			if (m_module.vars[v].global || m_everBound[v]) {
+				error(varName(m_module, v) + " is bound more than once");
+			}
+
+			m_bound[v] = 1;
+			m_everBound[v] = 1;
+		}
+
+		// 'expected' is g_none when any type will do, returns the atom's type
+		type_id checkAtom(uint32_t index, type_id expected) {
+			if (index >= m_module.atoms.size()) {
+				error("atom out of range");
+				return g_none;
+			}
+
+			const atom& a = m_module.atoms[index];
+			type_id t = a.type;
+
+			if (a.kind == atom_kind::variable) {
+				if (a.variable >= m_module.vars.size()) {
+					error("variable out of range");
+					return g_none;
+				}
+				const var& v = m_module.vars[a.variable];
+				if (v.global || m_labels[a.variable]) {
+					error(varName(m_module, a.variable) + " isn't a value");
+				} else if (!m_bound[a.variable]) {
+					error(varName(m_module, a.variable) + " is used out of scope");
+				}
+				if (v.type != a.type) {
+					error("the atom's type doesn't match " + varName(m_module, a.variable));
+				}
+			} else if (a.kind == atom_kind::floating && t != g_doubleType) {
+				error("floating literal that isn't a Double");
+			} else if (a.kind == atom_kind::integer && t != g_intType && t != g_wordType && t != g_boolType) {
+				error("integer literal that isn't an Int, Word or Bool");
+			}
+
+			if (expected != g_none && t != expected) {
+				error("expected " + typeName(m_module, expected) + " but found " + typeName(m_module, t)
+				      + " (" + atomString(m_module, a) + ")");
+			}
+
+			return t;
+		}
+
+		void checkBinder(var_id v, type_id t) {
+			if (v >= m_module.vars.size()) {
+				error("binder out of range");
+				return;
+			}
+			if (m_module.vars[v].type != t) {
+				error(varName(m_module, v) + " should have type " + typeName(m_module, t));
+			}
+
+			bind(v);
+		}
+
+		void checkPrim(const expr& x) {
+			if (x.count != 2) {
+				error("primitive with " + to_string(x.count) + " operands");
+				return;
+			}
+
+			const type_id t = checkAtom(x.first, g_none);
+			checkAtom(x.first + 1, t);
+
+			ops::operand_type operand;
+			if (t == g_boolType) {
+				if (x.op != ops::opcode::eq && x.op != ops::opcode::ne && x.op != ops::opcode::bit_and && x.op != ops::opcode::bit_or) {
+					error(string("'") + ops::opcodeName(x.op) + "' on Bool");
+				}
+			} else if (!operandType(m_module, t, operand) || !ops::isSupported(x.op, operand)) {
+				error(string("'") + ops::opcodeName(x.op) + "' isn't defined on " + typeName(m_module, t));
+			}
+
+			checkBinder(x.binder, ops::isComparison(x.op) ? g_boolType : t);
+		}
+
+		void checkCall(const expr& x) {
+			if (x.ref >= m_module.vars.size() || !m_module.vars[x.ref].global) {
+				error("call of something that isn't a function");
+				return;
+			}
+
+			const type* t = typeOf(x.ref);
+			if (!t || t->kind != type_kind::function || t->params.size() != x.count) {
+				error("call of " + varName(m_module, x.ref) + " with " + to_string(x.count) + " arguments");
+				return;
+			}
+
+			for (uint32_t i = 0; i < x.count; ++i) {
+				checkAtom(x.first + i, t->params[i]);
+			}
+			checkBinder(x.binder, t->result);
+		}
+
+		void checkConstructor(const expr& x) {
+			if (x.ref >= m_module.constructors.size()) {
+				error("constructor out of range");
+				return;
+			}
+
+			const constructor& c = m_module.constructors[x.ref];
+			if (c.fields.size() != x.count) {
+				error(c.name + " applied to " + to_string(x.count) + " fields");
+				return;
+			}
+
+			for (uint32_t i = 0; i < x.count; ++i) {
+				checkAtom(x.first + i, c.fields[i]);
+			}
+			checkBinder(x.binder, c.type);
+		}
+
+		void checkTag(const expr& x) {
+			const type_id t = (x.count == 1) ? checkAtom(x.first, g_none) : g_none;
+			if (t == g_none || m_module.types[t].kind != type_kind::data) {
+				error("tag of something that isn't a data value");
+				return;
+			}
+
+			checkBinder(x.binder, g_intType);
+		}
+
+		void checkMatch(const expr& x, type_id result) {
+			const type_id scrutinee = checkAtom(x.first, g_none);
+			if (scrutinee == g_none || x.ref == g_none || x.ref + x.count > m_module.alts.size() || x.count == 0) {
+				error("case with invalid alternatives");
+				return;
+			}
+
+			const type_kind kind = m_module.types[scrutinee].kind;
+			set<int64_t> seen;
+			bool otherwise = false;
+
+			for (uint32_t i = x.ref; i < x.ref + x.count; ++i) {
+				const alt& a = m_module.alts[i];
+				vector<var_id> fields;
+
+				switch (a.kind) {
+					case alt_kind::constructor: {
+						if (a.constructor >= m_module.constructors.size()) {
+							error("constructor out of range");
+							continue;
+						}
+						const constructor& c = m_module.constructors[a.constructor];
+						if (c.type != scrutinee) {
+							error(c.name + " doesn't belong to " + typeName(m_module, scrutinee));
+						}
+						if (c.fields.size() != a.count) {
+							error(c.name + " binds " + to_string(a.count) + " fields");
+							continue;
+						}
+						if (!seen.insert(c.tag).second) {
+							error("duplicate alternative " + c.name);
+						}
+						for (uint32_t f = 0; f < a.count; ++f) {
+							const var_id v = binderAt(a.first + f);
+							if (v != g_none) {
+								checkBinder(v, c.fields[f]);
+								fields.push_back(v);
+							}
+						}
+						break;
+					}
+					case alt_kind::literal:
+						if (kind != type_kind::integer && kind != type_kind::word && kind != type_kind::boolean) {
+							error("literal alternative on " + typeName(m_module, scrutinee));
+						}
+						if (!seen.insert(a.literal).second) {
+							error("duplicate alternative " + to_string(a.literal));
+						}
+						break;
+					case alt_kind::otherwise:
+						if (otherwise) {
+							error("more than one default alternative");
+						}
+						otherwise = true;
+						break;
+				}
+
+				checkExpr(a.body, result);
+
+				for (const auto v : fields) {
+					m_bound[v] = 0;
+				}
+			}
+		}
+
+		void checkJoin(const expr& x, type_id result) {
+			if (x.binder >= m_module.vars.size()) {
+				error("join point out of range");
+				return;
+			}
+
+			const type* label = typeOf(x.binder);
+			if (!label || label->kind != type_kind::function || label->params.size() != x.count || label->result != result) {
+				error("join point " + varName(m_module, x.binder) + " has the wrong type");
+				return;
+			}
+
+			vector<var_id> params;
+			for (uint32_t i = 0; i < x.count; ++i) {
+				const var_id v = binderAt(x.first + i);
+				if (v != g_none) {
+					checkBinder(v, label->params[i]);
+					params.push_back(v);
+				}
+			}
+
+			// The code doesn't see its own label, join points don't loop
+			checkExpr(x.ref, result);
+			for (const auto v : params) {
+				m_bound[v] = 0;
+			}
+
+			bind(x.binder);
+			m_labels[x.binder] = 1;
+			checkExpr(x.body, result);
+			m_bound[x.binder] = 0;
+		}
+
+		void checkJump(const expr& x) {
+			if (x.ref >= m_module.vars.size() || !m_labels[x.ref] || !m_bound[x.ref]) {
+				error("jump to something that isn't a join point in scope");
+				return;
+			}
+
+			const type* label = typeOf(x.ref);
+			if (label->params.size() != x.count) {
+				error("jump to " + varName(m_module, x.ref) + " with " + to_string(x.count) + " arguments");
+				return;
+			}
+
+			for (uint32_t i = 0; i < x.count; ++i) {
+				checkAtom(x.first + i, label->params[i]);
+			}
+		}
+
+		void checkExpr(expr_id e, type_id result) {
+			vector<var_id> scope;
+
+			for (;;) {
+				if (e >= m_module.exprs.size()) {
+					error("expression out of range");
+					break;
+				}
+				if (m_visited[e]) {
+					error("expression " + to_string(e) + " is shared or cyclic");
+					break;
+				}
+				m_visited[e] = 1;
+
+				const expr& x = m_module.exprs[e];
+				bool done = true;
+
+				switch (x.kind) {
+					case expr_kind::ret:
+						if (x.count != 1) {
+							error("ret needs one atom");
+						} else {
+							checkAtom(x.first, result);
+						}
+						break;
+					case expr_kind::let_atom:
+						if (x.count != 1) {
+							error("let needs one atom");
+						} else {
+							checkBinder(x.binder, checkAtom(x.first, g_none));
+						}
+						done = false;
+						break;
+					case expr_kind::let_prim:
+						checkPrim(x);
+						done = false;
+						break;
+					case expr_kind::let_call:
+						checkCall(x);
+						done = false;
+						break;
+					case expr_kind::let_con:
+						checkConstructor(x);
+						done = false;
+						break;
+					case expr_kind::let_tag:
+						checkTag(x);
+						done = false;
+						break;
+					case expr_kind::match:
+						checkMatch(x, result);
+						break;
+					case expr_kind::join:
+						checkJoin(x, result);
+						break;
+					case expr_kind::jump:
+						checkJump(x);
+						break;
+					case expr_kind::fail:
+						break;
+				}
+
+				if (done) {
+					break;
+				}
+
+				if (x.binder < m_module.vars.size()) {
+					scope.push_back(x.binder);
+				}
+				e = x.body;
+			}
+
+			for (const auto v : scope) {
+				m_bound[v] = 0;
+			}
+		}
+
+		const module& m_module;
+		ostream& m_errors;
+		bool m_ok = true;
+		string m_where;
+
+		vector<uint8_t> m_bound;
+		vector<uint8_t> m_everBound;
+		vector<uint8_t> m_labels;
+		vector<uint8_t> m_visited;
+	};
+
+}
+
+namespace mhc {
+
+	namespace core {
+
+		atom integerAtom(int64_t value, type_id type) {
+			atom a;
+			a.kind = atom_kind::integer;
+			a.type = type;
+			a.integer = value;
+			return a;
+		}
+
+		atom floatingAtom(double value) {
+			atom a;
+			a.kind = atom_kind::floating;
+			a.type = g_doubleType;
+			a.floating = value;
+			return a;
+		}
+
+		size_t type_list_hash::operator()(const vector<type_id>& list) const {
+			size_t h = list.size();
+			for (const auto t : list) {
+				h ^= t + 0x9e3779b9 + (h << 6) + (h >> 2);
+			}
+			return h;
+		}
+
+		module::module() {
+			const type_kind primitives[] = { type_kind::integer, type_kind::word, type_kind::floating, type_kind::boolean };
+			const char* const names[] = { "Int", "Word", "Double", "Bool" };
+
+			for (size_t i = 0; i < 4; ++i) {
+				type t;
+				t.kind = primitives[i];
+				t.name = names[i];
+				types.push_back(t);
+				m_namedTypes[t.name] = static_cast<type_id>(i);
+			}
+		}
+
+		module::module(const string& id) : module() {
+			name = id;
+		}
+
+		type_id module::dataType(const string& typeName) {
+			const auto found = m_namedTypes.find(typeName);
+			if (found != m_namedTypes.end()) {
+				return found->second;
+			}
+
+			type t;
+			t.kind = type_kind::data;
+			t.name = typeName;
+			types.push_back(t);
+			return m_namedTypes[typeName] = static_cast<type_id>(types.size() - 1);
+		}
+
+		type_id module::functionType(const vector<type_id>& params, type_id result) {
+			vector<type_id> key = params;
+			key.push_back(result);
+			const auto found = m_functionTypes.find(key);
+			if (found != m_functionTypes.end()) {
+				return found->second;
+			}
+
+			type t;
+			t.kind = type_kind::function;
+			t.params = params;
+			t.result = result;
+			types.push_back(t);
+			return m_functionTypes[std::move(key)] = static_cast<type_id>(types.size() - 1);
+		}
+
+		var_id module::addVar(const string& varName, type_id varType, bool global) {
+			var v;
+			v.name = varName;
+			v.type = varType;
+			v.global = global;
+			vars.push_back(v);
+			return static_cast<var_id>(vars.size() - 1);
+		}
+
+		expr_id module::addExpr(const expr& e) {
+			exprs.push_back(e);
+			return static_cast<expr_id>(exprs.size() - 1);
+		}
+
+		uint32_t module::addAtoms(const vector<atom>& list) {
+			const uint32_t first = static_cast<uint32_t>(atoms.size());
+			atoms.insert(atoms.end(), list.begin(), list.end());
+			return first;
+		}
+
+		uint32_t module::addBinders(const vector<var_id>& list) {
+			const uint32_t first = static_cast<uint32_t>(binders.size());
+			binders.insert(binders.end(), list.begin(), list.end());
+			return first;
+		}
+
+		var_id module::findGlobal(const string& globalName) const {
+			for (var_id v = 0; v < vars.size(); ++v) {
+				if (vars[v].global && vars[v].name == globalName) {
+					return v;
+				}
+			}
+
+			return g_none;
+		}
+
+		uint32_t module::findConstructor(const string& conName) const {
+			for (uint32_t c = 0; c < constructors.size(); ++c) {
+				if (constructors[c].name == conName) {
+					return c;
+				}
+			}
+
+			return g_none;
+		}
+
+		string typeName(const module& m, type_id t) {
+			if (t >= m.types.size()) {
+				return "<bad type>";
+			}
+
+			const type& x = m.types[t];
+			if (x.kind != type_kind::function) {
+				return x.name;
+			}
+
+			string result;
+			for (const auto p : x.params) {
+				result += typeName(m, p) + " -> ";
+			}
+
+			return result + typeName(m, x.result);
+		}
+
+		bool operandType(const module& m, type_id t, ops::operand_type& result) {
+			if (t >= m.types.size()) {
+				return false;
+			}
+
+			switch (m.types[t].kind) {
+				case type_kind::integer:  result = ops::operand_type::integer;  return true;
+				case type_kind::word:     result = ops::operand_type::word;     return true;
+				case type_kind::floating: result = ops::operand_type::floating; return true;
+				default:                  return false;
+			}
+		}
+
+		void print(ostream& out, const module& m) {
+			// Constructors of a type are added together, in tag order
+			for (size_t i = 0; i < m.constructors.size(); ++i) {
+				const constructor& c = m.constructors[i];
+				const bool first = (i == 0 || m.constructors[i - 1].type != c.type);
+
+				out << (first ? "data " + typeName(m, c.type) + " = " : " | ") << c.name;
+				for (const auto f : c.fields) {
+					out << " " << typeName(m, f);
+				}
+				if (i + 1 == m.constructors.size() || m.constructors[i + 1].type != c.type) {
+					out << "\n";
+				}
+			}
+
+			printer p(out, m);
+			for (const auto& f : m.functions) {
+				out << "\n" << varName(m, f.name) << " :: " << (f.name < m.vars.size() ? typeName(m, m.vars[f.name].type) : "") << "\n";
+				out << varName(m, f.name) << binderList(m, f.first, f.count) << " =\n";
+				p.printExpr(f.body, 1);
+			}
+		}
+
+		bool verify(const module& m, ostream& errors) {
+			verifier v(m, errors);
+			v.checkTypes();
+			if (!v.ok()) {
+				return false;
+			}
+
+			for (const auto& f : m.functions) {
+				v.checkFunction(f);
+			}
+
+			return v.ok();
+		}
+
+	}
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "operators.h"
+
+
+namespace mhc {
+
+	// Typed A-normal form between the front end and LLVM. Every intermediate
+	// value is named by a let, so operands are atoms (a variable or a literal)
+	// and evaluation order is explicit. Nodes are stored in flat arrays owned
+	// by the module and refer to each other by 32-bit index, passes walk and
+	// rewrite them without chasing pointers.
+	namespace core {
+
+		using type_id = std::uint32_t;
+		using var_id = std::uint32_t;
+		using expr_id = std::uint32_t;
+
+		const std::uint32_t g_none = UINT32_MAX;
+
+		enum class type_kind : std::uint8_t {
+			integer,        // Int
+			word,           // Word
+			floating,       // Double
+			boolean,        // Bool, constructors True and False are the literals 1 and 0
+			data,           // An algebraic data type, a pointer to a heap object
+			function,
+		};
+
+		struct type {
+			type_kind kind = type_kind::integer;
+			std::string name;                   // Data types
+			std::vector<type_id> params;        // Functions
+			type_id result = g_none;
+		};
+
+		// The primitive types are always the first entries of the type table
+		const type_id g_intType = 0;
+		const type_id g_wordType = 1;
+		const type_id g_doubleType = 2;
+		const type_id g_boolType = 3;
+
+		struct var {
+			std::string name;
+			type_id type = g_none;
+			bool global = false;                // A top-level function, possibly in another module
+		};
+
+		enum class atom_kind : std::uint8_t {
+			variable,
+			integer,        // Int, Word and Bool literals
+			floating,
+		};
+
+		struct atom {
+			atom_kind kind = atom_kind::integer;
+			type_id type = g_intType;
+			union {
+				var_id variable;
+				std::int64_t integer;
+				double floating;
+			};
+
+			atom() : integer(0) {}
+		};
+
+		atom integerAtom(std::int64_t value, type_id type = g_intType);
+		atom floatingAtom(double value);
+
+		enum class expr_kind : std::uint8_t {
+			ret,            // Returns the atom
+			let_atom,       // binder = atom; body
+			let_prim,       // binder = op atom atom; body
+			let_call,       // binder = ref (atoms); body, 'ref' is a global variable
+			let_con,        // binder = constructor 'ref' (atoms); body
+			let_tag,        // binder = tag of the constructor the atom was built with, an Int; body
+			match,          // case atom of alternatives [ref, ref + count)
+			join,           // Join point 'binder' with parameters binders [first, first + count), code 'ref', scope 'body'
+			jump,           // Jumps to join point 'ref' with the atoms
+			fail,           // No alternative matched, traps
+		};
+
+		struct expr {
+			expr_kind kind = expr_kind::fail;
+			ops::opcode op = ops::opcode::add;
+			var_id binder = g_none;
+			std::uint32_t ref = g_none;
+			std::uint32_t first = 0;            // Operands in 'atoms', join parameters in 'binders'
+			std::uint32_t count = 0;            // Operands, parameters or, for a match, alternatives
+			expr_id body = g_none;
+		};
+
+		enum class alt_kind : std::uint8_t {
+			constructor,    // Binds the fields to binders [first, first + count)
+			literal,
+			otherwise,
+		};
+
+		struct alt {
+			alt_kind kind = alt_kind::otherwise;
+			std::uint32_t constructor = g_none;
+			std::int64_t literal = 0;
+			std::uint32_t first = 0;
+			std::uint32_t count = 0;
+			expr_id body = g_none;
+		};
+
+		struct constructor {
+			std::string name;
+			type_id type = g_none;
+			std::uint32_t tag = 0;              // Declaration order within the type
+			std::vector<type_id> fields;
+		};
+
+		struct function {
+			var_id name = g_none;
+			std::uint32_t first = 0;            // Parameters in 'binders'
+			std::uint32_t count = 0;
+			expr_id body = g_none;
+		};
+
+		// Hashes a function type's parameters followed by its result
+		struct type_list_hash {
+			std::size_t operator()(const std::vector<type_id>& list) const;
+		};
+
+		struct module {
+			module();
+			explicit module(const std::string& id);
+
+			std::string name;
+
+			std::vector<type> types;
+			std::vector<var> vars;
+			std::vector<atom> atoms;
+			std::vector<expr> exprs;
+			std::vector<alt> alts;
+			std::vector<var_id> binders;
+			std::vector<constructor> constructors;
+			std::vector<function> functions;
+
+			// Each type is in the table once, so types are equal when their ids
+			// are. Both look the type up in an index and add it when it's new.
+			type_id dataType(const std::string& typeName);
+			type_id functionType(const std::vector<type_id>& params, type_id result);
+
+			var_id addVar(const std::string& varName, type_id varType, bool global = false);
+			expr_id addExpr(const expr& e);
+
+			// Appends to 'atoms' or 'binders', returns the index of the first
+			std::uint32_t addAtoms(const std::vector<atom>& list);
+			std::uint32_t addBinders(const std::vector<var_id>& list);
+
+			// Global variable of a function, g_none when there's none by that name
+			var_id findGlobal(const std::string& globalName) const;
+			std::uint32_t findConstructor(const std::string& conName) const;
+
+		private:
+			std::unordered_map<std::string, type_id> m_namedTypes;
+			std::unordered_map<std::vector<type_id>, type_id, type_list_hash> m_functionTypes;
+		};
+
+		std::string typeName(const module& m, type_id t);
+
+		// Maps a primitive type to the operand representation of mhc::ops
+		bool operandType(const module& m, type_id t, ops::operand_type& result);
+
+		void print(std::ostream& out, const module& m);
+
+		// Checks indices, scoping and types. Every expression must be reachable
+		// from exactly one place, so the functions form trees the back end can
+		// lower in one pass. Problems are written to 'errors'.
+		bool verify(const module& m, std::ostream& errors);
+
+	}
+
+}
@@ -0,0 +1,395 @@
+#include "core_codegen.h"
+
+#include <iostream>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Intrinsics.h>
+
+
+using namespace mhc;
+using namespace mhc::core;
+
+using namespace llvm;
+using namespace std;
+
+
+bool core_codegen::lower(const core::module& program) {
+	m_program = &program;
+	m_failed = false;
+	m_values.assign(program.vars.size(), nullptr);
+	m_functions.assign(program.vars.size(), nullptr);
+	m_joins.clear();
+
+	// Declared up front so calls can go either way
+	for (const auto& f : program.functions) {
+		declare(f.name);
+	}
+
+	for (const auto& f : program.functions) {
+		Function* const function = m_functions[f.name];
+		if (!function->empty()) {
+			cerr << "Error: \"" << program.vars[f.name].name << "\" is defined more than once" << endl;
+			m_failed = true;
+			continue;
+		}
+
+		BasicBlock* const entry = BasicBlock::Create(m_context, "entry", function);
+		m_builder.SetInsertPoint(entry);
+
+		Function::arg_iterator arg = function->arg_begin();
+		for (uint32_t i = 0; i < f.count; ++i, ++arg) {
+			const var_id param = program.binders[f.first + i];
+			arg->setName(program.vars[param].name);
+			m_values[param] = arg;
+		}
+
+		m_self = f.name;
+		m_loop = join_point();
+		if (f.count > 0 && hasSelfTailCall(f.body)) {
+			m_loop.block = BasicBlock::Create(m_context, "tailrecurse", function);
+			m_builder.CreateBr(m_loop.block);
+			m_builder.SetInsertPoint(m_loop.block);
+
+			for (uint32_t i = 0; i < f.count; ++i) {
+				const var_id param = program.binders[f.first + i];
+				PHINode* const phi = m_builder.CreatePHI(lowerType(program.vars[param].type), 2, program.vars[param].name);
+				phi->addIncoming(m_values[param], entry);
+				m_loop.params.push_back(phi);
+				m_values[param] = phi;
+			}
+		}
+
+		lowerExpr(f.body);
+	}
+
+	// Top-level declarations are visited without an insertion point
+	m_builder.ClearInsertionPoint();
+	m_program = nullptr;
+
+	return !m_failed;
+}
+
+Type* core_codegen::lowerType(type_id t) {
+	switch (m_program->types[t].kind) {
+		case type_kind::integer:
+		case type_kind::word:
+			return Type::getInt64Ty(m_context);
+		case type_kind::floating:
+			return Type::getDoubleTy(m_context);
+		case type_kind::boolean:
+			return Type::getInt1Ty(m_context);
+		case type_kind::data:
+			return Type::getInt64PtrTy(m_context);
+		case type_kind::function:
+			break;
+	}
+
+	return nullptr;
+}
+
+Function* core_codegen::declare(var_id f) {
+	if (m_functions[f]) {
+		return m_functions[f];
+	}
+
+	const string& name = m_program->vars[f].name;
+	Function* function = m_module->getFunction(name);
+
+	if (!function) {
+		const core::type& t = m_program->types[m_program->vars[f].type];
+
+		vector<Type*> params;
+		for (const auto p : t.params) {
+			params.push_back(lowerType(p));
+		}
+
+		// Linkage of definitions is settled by finalizeLinkage, a declaration
+		// is always external
+		FunctionType* const type = FunctionType::get(lowerType(t.result), params, false);
+		function = Function::Create(type, GlobalValue::ExternalLinkage, name, m_module);
+		function->setCallingConv(m_objects.callingConvOf(name));
+	}
+
+	m_functions[f] = function;
+	return function;
+}
+
+Value* core_codegen::value(const atom& a) {
+	switch (a.kind) {
+		case atom_kind::variable:
+			return m_values[a.variable];
+		case atom_kind::integer:
+			if (a.type == g_boolType) {
+				return m_builder.getInt1(a.integer != 0);
+			}
+			return m_builder.getInt64(static_cast<uint64_t>(a.integer));
+		case atom_kind::floating:
+			return ConstantFP::get(Type::getDoubleTy(m_context), a.floating);
+	}
+
+	return nullptr;
+}
+
+Value* core_codegen::toWord(Value* v) {
+	Type* const type = v->getType();
+	if (type->isDoubleTy()) {
+		return m_builder.CreateBitCast(v, m_builder.getInt64Ty());
+	}
+	if (type->isIntegerTy(1)) {
+		return m_builder.CreateZExt(v, m_builder.getInt64Ty());
+	}
+
+	// Pointers are converted by emitConstructor
+	return v;
+}
+
+Value* core_codegen::fromWord(Value* word, type_id t) {
+	switch (m_program->types[t].kind) {
+		case type_kind::floating:
+			return m_builder.CreateBitCast(word, m_builder.getDoubleTy());
+		case type_kind::boolean:
+			return m_builder.CreateTrunc(word, m_builder.getInt1Ty());
+		case type_kind::data:
+			return m_builder.CreateIntToPtr(word, Type::getInt64PtrTy(m_context));
+		default:
+			return word;
+	}
+}
+
+void core_codegen::lowerExpr(expr_id e) {
+	const core::module& program = *m_program;
+
+	for (;;) {
+		const expr& x = program.exprs[e];
+
+		switch (x.kind) {
+			case expr_kind::ret:
+				m_builder.CreateRet(value(program.atoms[x.first]));
+				return;
+
+			case expr_kind::let_atom:
+				m_values[x.binder] = value(program.atoms[x.first]);
+				break;
+
+			case expr_kind::let_prim: {
+				const atom& lhs = program.atoms[x.first];
+
+				// Bool only has the bitwise operators and equality, which are
+				// the integer instructions on i1
+				ops::operand_type representation = ops::operand_type::integer;
+				operandType(program, lhs.type, representation);
+
+				Value* const result = emitBinaryOp(m_builder, x.op, representation, value(lhs), value(program.atoms[x.first + 1]));
+				if (!result) {
+					cerr << "Unsupported operator: \"" << ops::opcodeName(x.op) << "\"" << endl;
+					m_failed = true;
+					m_builder.CreateUnreachable();
+					return;
+				}
+				m_values[x.binder] = result;
+				break;
+			}
+
+			case expr_kind::let_call: {
+				if (m_loop.block && isSelfTailCall(x)) {
+					jump(m_loop, x.first, x.count);
+					return;
+				}
+
+				Function* const callee = declare(x.ref);
+
+				vector<Value*> args;
+				for (uint32_t i = 0; i < x.count; ++i) {
+					args.push_back(value(program.atoms[x.first + i]));
+				}
+
+				CallInst* const call = m_builder.CreateCall(callee, args, program.vars[x.ref].name);
+				call->setCallingConv(callee->getCallingConv());
+				m_values[x.binder] = call;
+				break;
+			}
+
+			case expr_kind::let_con: {
+				vector<Value*> fields;
+				for (uint32_t i = 0; i < x.count; ++i) {
+					fields.push_back(toWord(value(program.atoms[x.first + i])));
+				}
+
+				Value* const object = m_objects.emitConstructor(program.constructors[x.ref].name, fields);
+				if (!object) {
+					m_failed = true;
+					m_builder.CreateUnreachable();
+					return;
+				}
+				m_values[x.binder] = object;
+				break;
+			}
+
+			case expr_kind::let_tag: {
+				const atom& object = program.atoms[x.first];
+				m_values[x.binder] = m_objects.emitTagLoad(value(object), program.types[object.type].name);
+				break;
+			}
+
+			case expr_kind::match:
+				lowerMatch(x);
+				return;
+
+			case expr_kind::join:
+				lowerJoin(x);
+				return;
+
+			case expr_kind::jump:
+				jump(m_joins[x.ref], x.first, x.count);
+				return;
+
+			case expr_kind::fail:
+				m_builder.CreateCall(Intrinsic::getDeclaration(m_module, Intrinsic::trap));
+				m_builder.CreateUnreachable();
+				return;
+		}
+
+		e = x.body;
+	}
+}
+
+void core_codegen::lowerMatch(const expr& x) {
+	const core::module& program = *m_program;
+	const atom& scrutinee = program.atoms[x.first];
+	Value* const object = value(scrutinee);
+	const bool isData = (program.types[scrutinee.type].kind == type_kind::data);
+
+	Function* const function = m_builder.GetInsertBlock()->getParent();
+	BasicBlock* const otherwiseBB = BasicBlock::Create(m_context, "case.default", function);
+
+	vector<BasicBlock*> blocks;
+	bool hasOtherwise = false;
+	for (uint32_t i = x.ref; i < x.ref + x.count; ++i) {
+		const bool otherwise = (program.alts[i].kind == alt_kind::otherwise);
+		hasOtherwise = hasOtherwise || otherwise;
+		blocks.push_back(otherwise ? otherwiseBB : BasicBlock::Create(m_context, "case.alt", function));
+	}
+
+	// Guards and ifs are conditional branches, which profiles count and weight
+	if (scrutinee.type == g_boolType) {
+		BasicBlock* targets[2] = { otherwiseBB, otherwiseBB };
+		for (uint32_t i = 0; i < x.count; ++i) {
+			const alt& a = program.alts[x.ref + i];
+			if (a.kind == alt_kind::literal) {
+				targets[a.literal != 0 ? 1 : 0] = blocks[i];
+			}
+		}
+		m_builder.CreateCondBr(object, targets[1], targets[0]);
+	} else {
+		Value* const selector = isData ? m_objects.emitTagLoad(object, program.types[scrutinee.type].name) : object;
+		SwitchInst* const dispatch = m_builder.CreateSwitch(selector, otherwiseBB, x.count);
+
+		for (uint32_t i = 0; i < x.count; ++i) {
+			const alt& a = program.alts[x.ref + i];
+			if (a.kind == alt_kind::constructor) {
+				dispatch->addCase(m_builder.getInt64(program.constructors[a.constructor].tag), blocks[i]);
+			} else if (a.kind == alt_kind::literal) {
+				dispatch->addCase(m_builder.getInt64(static_cast<uint64_t>(a.literal)), blocks[i]);
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < x.count; ++i) {
+		const alt& a = program.alts[x.ref + i];
+
+		m_builder.SetInsertPoint(blocks[i]);
+		for (uint32_t f = 0; f < a.count; ++f) {
+			const var_id field = program.binders[a.first + f];
+			m_values[field] = fromWord(m_objects.emitFieldLoad(object, f), program.vars[field].type);
+		}
+
+		lowerExpr(a.body);
+	}
+
+	// The alternatives are exhaustive, the tag load's range tells LLVM as much
+	if (!hasOtherwise) {
+		m_builder.SetInsertPoint(otherwiseBB);
+		m_builder.CreateUnreachable();
+	}
+}
+
+void core_codegen::lowerJoin(const expr& x) {
+	const core::module& program = *m_program;
+
+	BasicBlock* const current = m_builder.GetInsertBlock();
+	BasicBlock* const block = BasicBlock::Create(m_context, program.vars[x.binder].name, current->getParent());
+
+	join_point target;
+	target.block = block;
+
+	m_builder.SetInsertPoint(block);
+	for (uint32_t i = 0; i < x.count; ++i) {
+		const var_id param = program.binders[x.first + i];
+		PHINode* const phi = m_builder.CreatePHI(lowerType(program.vars[param].type), 2, program.vars[param].name);
+		target.params.push_back(phi);
+		m_values[param] = phi;
+	}
+	m_joins[x.binder] = target;
+
+	// The scope jumps to the join point, which continues with its code
+	m_builder.SetInsertPoint(current);
+	lowerExpr(x.body);
+
+	m_builder.SetInsertPoint(block);
+	lowerExpr(x.ref);
+}
+
+void core_codegen::jump(const join_point& target, uint32_t first, uint32_t count) {
+	BasicBlock* const from = m_builder.GetInsertBlock();
+	for (uint32_t i = 0; i < count; ++i) {
+		target.params[i]->addIncoming(value(m_program->atoms[first + i]), from);
+	}
+
+	m_builder.CreateBr(target.block);
+}
+
+bool core_codegen::isSelfTailCall(const expr& x) const {
+	if (x.kind != expr_kind::let_call || x.ref != m_self) {
+		return false;
+	}
+
+	// Core calls are saturated, only the use of the result matters
+	const expr& next = m_program->exprs[x.body];
+	if (next.kind != expr_kind::ret) {
+		return false;
+	}
+
+	const atom& result = m_program->atoms[next.first];
+	return result.kind == atom_kind::variable && result.variable == x.binder;
+}
+
+bool core_codegen::hasSelfTailCall(expr_id e) const {
+	const core::module& program = *m_program;
+	const expr& x = program.exprs[e];
+
+	switch (x.kind) {
+		case expr_kind::let_atom:
+		case expr_kind::let_prim:
+		case expr_kind::let_con:
+		case expr_kind::let_tag:
+			return hasSelfTailCall(x.body);
+		case expr_kind::let_call:
+			return isSelfTailCall(x) || hasSelfTailCall(x.body);
+		case expr_kind::match:
+			for (uint32_t i = x.ref; i < x.ref + x.count; ++i) {
+				if (hasSelfTailCall(program.alts[i].body)) {
+					return true;
+				}
+			}
+			return false;
+		case expr_kind::join:
+			return hasSelfTailCall(x.body) || hasSelfTailCall(x.ref);
+		case expr_kind::ret:
+		case expr_kind::jump:
+		case expr_kind::fail:
+			return false;
+	}
+
+	return false;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Value.h>
+
+#include "codegen.h"
+#include "core.h"
+
+
+namespace mhc {
+
+	// Lowers verified Core into LLVM IR. Int and Word are i64, Double is double,
+	// Bool is i1 and a data value points to a heap object built and read through
+	// the ast_codegen's helpers, so fields are stored as words. A case on a Bool
+	// becomes a conditional branch, any other a switch, and a join point a
+	// block with one phi per parameter. A function calling itself in return
+	// position loops back to a header with one phi per parameter instead,
+	// which runs in constant stack even at -O0.
+	class core_codegen {
+	public:
+		core_codegen(ast_codegen& objects, llvm::Module* m, llvm::IRBuilder<>& b)
+		: m_objects(objects), m_module(m), m_context(m->getContext()), m_builder(b) {}
+
+		core_codegen(const core_codegen&) = delete;
+		core_codegen& operator=(const core_codegen&) = delete;
+
+		// Defines the module's functions and declares the ones they call from
+		// elsewhere, errors go to cerr
+		bool lower(const core::module& program);
+
+	private:
+		struct join_point {
+			llvm::BasicBlock* block = nullptr;
+			std::vector<llvm::PHINode*> params;
+		};
+
+		llvm::Type* lowerType(core::type_id t);
+		llvm::Function* declare(core::var_id f);
+		llvm::Value* value(const core::atom& a);
+
+		// Heap object fields are words
+		llvm::Value* toWord(llvm::Value* v);
+		llvm::Value* fromWord(llvm::Value* word, core::type_id t);
+
+		void lowerExpr(core::expr_id e);
+		void lowerMatch(const core::expr& x);
+		void lowerJoin(const core::expr& x);
+		void jump(const join_point& target, std::uint32_t first, std::uint32_t count);
+
+		// A call of the function being lowered whose result it returns
+		bool isSelfTailCall(const core::expr& x) const;
+		bool hasSelfTailCall(core::expr_id e) const;
+
+		ast_codegen& m_objects;
+		llvm::Module* m_module;
+		llvm::LLVMContext& m_context;
+		llvm::IRBuilder<>& m_builder;
+
+		const core::module* m_program = nullptr;
+		bool m_failed = false;
+
+		// Indexed by variable
+		std::vector<llvm::Value*> m_values;
+		std::vector<llvm::Function*> m_functions;
+		std::map<core::var_id, join_point> m_joins;
+
+		// The function being lowered, self tail calls jump to its loop header
+		core::var_id m_self = core::g_none;
+		join_point m_loop;
+	};
+
+}
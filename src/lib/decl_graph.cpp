@@ -0,0 +1,635 @@
+#include "decl_graph.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/variant/get.hpp>
+
+#include "cache.h"
+#include "lexer.h"
+
+
+using namespace mhc;
+using namespace mhc::lexer;
+using namespace parser;
+
+using namespace std;
+
+
+namespace {
+
+	bool isFixity(const string& s) {
+		return s == "infixl" || s == "infixr" || s == "infix";
+	}
+
+	// Text that fully describes a declaration, used for fingerprinting
+	string declSource(const base_expr_node& decl) {
+		if (const string* str = boost::get<string>(&decl)) {
+			return "decl:" + *str;
+		}
+		if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&decl)) {
+			string src = "data:" + adt->type_ctor;
+			for (const auto& itr : adt->components) {
+				src += " " + itr;
+			}
+			src += " deriving";
+			for (const auto& itr : adt->deriving_typeclasses) {
+				src += " " + itr;
+			}
+			return src;
+		}
+		if (const type_synonym_decl* syn = boost::get<type_synonym_decl>(&decl)) {
+			return "type:" + syn->type_new + "=" + syn->type_old;
+		}
+		if (const import_decl* import = boost::get<import_decl>(&decl)) {
+			return "import:" + import->module_id;
+		}
+
+		return "";
+	}
+
+	vector<string> stringDeclNames(const string& decl) {
+		const vector<token> tokens = tokenize(decl);
+		vector<string> names;
+
+		if (tokens.empty()) {
+			return names;
+		}
+
+		// Fixity declarations bind the operators they list
+		if (isFixity(tokens[0].text)) {
+			for (size_t i = 1; i < tokens.size(); ++i) {
+				if (tokens[i].kind == token_kind::varsym || tokens[i].kind == token_kind::varid) {
+					names.push_back(tokens[i].text);
+				}
+			}
+			return names;
+		}
+
+		const auto sig = find_if(tokens.begin(), tokens.end(), [](const token& t) {
+			return t.kind == token_kind::varsym && (t.text == "::" || t.text == "=" || t.text == "|");
+		});
+
+		// Foreign imports bind the name right before "::", foreign exports only
+		// reference theirs
+		if (tokens[0].text == "foreign") {
+			if (tokens.size() > 1 && tokens[1].text == "import" && sig != tokens.end() && sig->text == "::" && sig != tokens.begin()) {
+				names.push_back((sig - 1)->text);
+			}
+			return names;
+		}
+
+		// Type signature, every variable before the "::"
+		if (sig != tokens.end() && sig->text == "::") {
+			for (auto itr = tokens.begin(); itr != sig; ++itr) {
+				if (itr->kind == token_kind::varid || itr->kind == token_kind::varsym) {
+					names.push_back(itr->text);
+				}
+			}
+			return names;
+		}
+
+		// Operator defined in prefix form: (<+>) a b = ...
+		if (tokens.size() > 1 && tokens[0].text == "(" && tokens[1].kind == token_kind::varsym) {
+			names.push_back(tokens[1].text);
+			return names;
+		}
+
+		// Infix definition: a <+> b = ..., or a `op` b = ...
+		if (tokens.size() > 2 && tokens[1].text == "`") {
+			names.push_back(tokens[2].text);
+			return names;
+		}
+		if (tokens.size() > 1 && tokens[1].kind == token_kind::varsym
+		 && tokens[1].text != "=" && tokens[1].text != "|" && tokens[1].text != "@") {
+			names.push_back(tokens[1].text);
+			return names;
+		}
+
+		if (tokens[0].kind == token_kind::varid) {
+			names.push_back(tokens[0].text);
+			return names;
+		}
+
+		// Pattern binding, every variable on the left hand side
+		for (auto itr = tokens.begin(); itr != sig; ++itr) {
+			if (itr->kind == token_kind::varid) {
+				names.push_back(itr->text);
+			}
+		}
+
+		return names;
+	}
+
+	// Declarations whose effect isn't reached through a name they bind
+	bool isRootDecl(const base_expr_node& decl, const vector<string>& names) {
+		if (names.empty()) {
+			return true;
+		}
+
+		const string* str = boost::get<string>(&decl);
+		if (!str) {
+			return false;
+		}
+
+		const vector<token> tokens = tokenize(*str);
+		return !tokens.empty() && (tokens[0].text == "instance" || tokens[0].text == "class" || tokens[0].text == "default");
+	}
+
+	// The first "::", "=" or "|" of a declaration, what separates its left
+	// hand side from its type or body
+	vector<token>::const_iterator separator(const vector<token>& tokens) {
+		return find_if(tokens.begin(), tokens.end(), [](const token& t) {
+			return t.kind == token_kind::varsym && (t.text == "::" || t.text == "=" || t.text == "|");
+		});
+	}
+
+	// Tokens of a string declaration, empty for fixities and foreign declarations
+	vector<token> plainDeclTokens(const base_expr_node& decl) {
+		const string* str = boost::get<string>(&decl);
+		vector<token> tokens = str ? tokenize(*str) : vector<token>();
+		if (!tokens.empty() && (isFixity(tokens[0].text) || tokens[0].text == "foreign")) {
+			tokens.clear();
+		}
+
+		return tokens;
+	}
+
+	bool isSignature(const base_expr_node& decl) {
+		const vector<token> tokens = plainDeclTokens(decl);
+		const auto sig = separator(tokens);
+		return sig != tokens.end() && sig->text == "::";
+	}
+
+	// Left hand side of an equation, empty for any other declaration
+	vector<token> bindingLhs(const base_expr_node& decl) {
+		const vector<token> tokens = plainDeclTokens(decl);
+		const auto sig = separator(tokens);
+		if (sig == tokens.end() || sig->text == "::") {
+			return {};
+		}
+
+		return vector<token>(tokens.begin(), sig);
+	}
+
+	// A binding without parameters, "k = 3", "(<+>) = f" or a pattern binding.
+	// Without a signature it's kept monomorphic and its users decide its type.
+	bool isValueBinding(const base_expr_node& decl) {
+		const vector<token> lhs = bindingLhs(decl);
+		if (lhs.empty()) {
+			return false;
+		}
+
+		if (lhs[0].kind == token_kind::varid) {
+			return lhs.size() == 1;
+		}
+		if (lhs[0].text == "(" && lhs.size() > 1 && lhs[1].kind == token_kind::varsym) {
+			return lhs.size() == 3;
+		}
+
+		return true;
+	}
+
+	vector<string> identifiers(const string& text) {
+		vector<string> result;
+		for (const auto& t : tokenize(text)) {
+			if (t.kind == token_kind::varid || t.kind == token_kind::conid || t.kind == token_kind::varsym) {
+				result.push_back(t.text);
+			}
+		}
+
+		return result;
+	}
+
+}
+
+namespace mhc {
+
+	vector<string> declNames(const base_expr_node& decl) {
+		if (const string* str = boost::get<string>(&decl)) {
+			return stringDeclNames(*str);
+		}
+
+		if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&decl)) {
+			// The components mix constructors with field types, treat every
+			// constructor-like name as bound here
+			vector<string> names = { adt->type_ctor };
+			for (const auto& itr : adt->components) {
+				const auto tokens = tokenize(itr);
+				if (tokens.size() == 1 && tokens[0].kind == token_kind::conid) {
+					names.push_back(tokens[0].text);
+				}
+			}
+			return names;
+		}
+
+		if (const type_synonym_decl* syn = boost::get<type_synonym_decl>(&decl)) {
+			const auto tokens = tokenize(syn->type_new);
+			if (!tokens.empty()) {
+				return { tokens[0].text };
+			}
+		}
+
+		return {};
+	}
+
+	vector<string> declIdentifiers(const base_expr_node& decl) {
+		if (const string* str = boost::get<string>(&decl)) {
+			return identifiers(*str);
+		}
+
+		vector<string> result;
+		if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&decl)) {
+			for (const auto& itr : adt->components) {
+				const auto ids = identifiers(itr);
+				result.insert(result.end(), ids.begin(), ids.end());
+			}
+			result.insert(result.end(), adt->deriving_typeclasses.begin(), adt->deriving_typeclasses.end());
+		} else if (const type_synonym_decl* syn = boost::get<type_synonym_decl>(&decl)) {
+			result = identifiers(syn->type_old);
+		}
+
+		return result;
+	}
+
+	decl_graph buildDeclGraph(const module_decl& module) {
+		decl_graph graph;
+		unordered_map<string, vector<size_t>> binders;
+
+		for (const auto& itr : module.body) {
+			decl_graph::node n;
+			n.decl = &itr;
+			n.names = declNames(itr);
+
+			for (const auto& name : n.names) {
+				binders[name].push_back(graph.nodes.size());
+			}
+
+			graph.nodes.push_back(n);
+		}
+
+		for (size_t i = 0; i < graph.nodes.size(); ++i) {
+			auto& refs = graph.nodes[i].refs;
+
+			for (const auto& id : declIdentifiers(*graph.nodes[i].decl)) {
+				const auto itr = binders.find(id);
+				if (itr != binders.end()) {
+					refs.insert(refs.end(), itr->second.begin(), itr->second.end());
+				}
+			}
+
+			// Every declaration mentions its own name, recursion doesn't need an edge
+			refs.erase(remove(refs.begin(), refs.end(), i), refs.end());
+
+			sort(refs.begin(), refs.end());
+			refs.erase(unique(refs.begin(), refs.end()), refs.end());
+		}
+
+		return graph;
+	}
+
+	vector<vector<size_t>> stronglyConnectedComponents(const decl_graph& graph) {
+		// Iterative Tarjan, generated modules can be far deeper than the stack
+		const size_t unvisited = static_cast<size_t>(-1);
+		const size_t count = graph.nodes.size();
+
+		vector<size_t> index(count, unvisited);
+		vector<size_t> lowLink(count, 0);
+		vector<bool> onStack(count, false);
+		vector<size_t> stack;
+		vector<vector<size_t>> components;
+		size_t nextIndex = 0;
+
+		// Work list of (node, next edge to visit)
+		vector<pair<size_t, size_t>> work;
+
+		for (size_t root = 0; root < count; ++root) {
+			if (index[root] != unvisited) {
+				continue;
+			}
+
+			work.push_back(make_pair(root, 0));
+
+			while (!work.empty()) {
+				const size_t v = work.back().first;
+				size_t& edge = work.back().second;
+
+				if (edge == 0) {
+					index[v] = lowLink[v] = nextIndex++;
+					stack.push_back(v);
+					onStack[v] = true;
+				}
+
+				const auto& refs = graph.nodes[v].refs;
+				bool descended = false;
+
+				while (edge < refs.size()) {
+					const size_t w = refs[edge++];
+
+					if (index[w] == unvisited) {
+						work.push_back(make_pair(w, 0));
+						descended = true;
+						break;
+					} else if (onStack[w]) {
+						lowLink[v] = min(lowLink[v], index[w]);
+					}
+				}
+
+				if (descended) {
+					continue;
+				}
+
+				if (lowLink[v] == index[v]) {
+					vector<size_t> component;
+					size_t w = unvisited;
+					do {
+						w = stack.back();
+						stack.pop_back();
+						onStack[w] = false;
+						component.push_back(w);
+					} while (w != v);
+
+					sort(component.begin(), component.end());
+					components.push_back(component);
+				}
+
+				work.pop_back();
+				if (!work.empty()) {
+					const size_t parent = work.back().first;
+					lowLink[parent] = min(lowLink[parent], lowLink[v]);
+				}
+			}
+		}
+
+		return components;
+	}
+
+	vector<vector<size_t>> partitionComponents(const decl_graph& graph, size_t count) {
+		auto components = stronglyConnectedComponents(graph);
+		vector<size_t> weights(components.size(), 0);
+
+		for (size_t c = 0; c < components.size(); ++c) {
+			for (const size_t n : components[c]) {
+				weights[c] += declSource(*graph.nodes[n].decl).size();
+			}
+		}
+
+		// Largest component first into the lightest group
+		vector<size_t> order(components.size());
+		for (size_t c = 0; c < order.size(); ++c) {
+			order[c] = c;
+		}
+		stable_sort(order.begin(), order.end(), [&weights](size_t a, size_t b) { return weights[a] > weights[b]; });
+
+		using load_t = pair<size_t, size_t>;    // Weight, group
+		priority_queue<load_t, vector<load_t>, greater<load_t>> loads;
+		for (size_t g = 0; g < max<size_t>(count, 1); ++g) {
+			loads.push(make_pair(0, g));
+		}
+
+		vector<vector<size_t>> groups(max<size_t>(count, 1));
+		for (const size_t c : order) {
+			load_t lightest = loads.top();
+			loads.pop();
+
+			groups[lightest.second].insert(groups[lightest.second].end(), components[c].begin(), components[c].end());
+
+			lightest.first += weights[c];
+			loads.push(lightest);
+		}
+
+		vector<vector<size_t>> result;
+		for (auto& itr : groups) {
+			if (!itr.empty()) {
+				sort(itr.begin(), itr.end());
+				result.push_back(move(itr));
+			}
+		}
+
+		return result;
+	}
+
+	vector<bool> reachableDecls(const module_decl& module, const decl_graph& graph) {
+		const size_t count = graph.nodes.size();
+
+		// A module without a header is "module Main (main) where"
+		if (!module.has_export_list && !module.module_id.empty()) {
+			return vector<bool>(count, true);
+		}
+
+		set<string> roots = { "main" };
+		for (const auto& itr : module.exports) {
+			const auto tokens = tokenize(itr);
+			if (tokens.empty()) {
+				continue;
+			}
+
+			// Re-exporting the module itself exports everything
+			if (tokens[0].text == "module") {
+				if (tokens.size() > 1 && tokens[1].text == module.module_id) {
+					return vector<bool>(count, true);
+				}
+				continue;
+			}
+
+			// Operators are exported in parens: "(<+>)"
+			roots.insert((tokens[0].text == "(" && tokens.size() > 1) ? tokens[1].text : tokens[0].text);
+		}
+
+		vector<bool> reachable(count, false);
+		vector<size_t> work;
+
+		for (size_t i = 0; i < count; ++i) {
+			const auto& names = graph.nodes[i].names;
+			const bool root = isRootDecl(*graph.nodes[i].decl, names)
+			               || any_of(names.begin(), names.end(), [&roots](const string& name) { return roots.count(name) > 0; });
+
+			if (root) {
+				reachable[i] = true;
+				work.push_back(i);
+			}
+		}
+
+		while (!work.empty()) {
+			const size_t n = work.back();
+			work.pop_back();
+
+			for (const size_t r : graph.nodes[n].refs) {
+				if (!reachable[r]) {
+					reachable[r] = true;
+					work.push_back(r);
+				}
+			}
+		}
+
+		return reachable;
+	}
+
+	vector<string> eliminateDeadDecls(module_decl& module) {
+		const decl_graph graph = buildDeclGraph(module);
+		const vector<bool> reachable = reachableDecls(module, graph);
+
+		vector<string> eliminated;
+		set<string> reported;
+		vector<base_expr_node> body;
+		body.reserve(module.body.size());
+
+		for (size_t i = 0; i < graph.nodes.size(); ++i) {
+			if (reachable[i]) {
+				body.push_back(std::move(module.body[i]));
+			} else if (reported.insert(graph.nodes[i].names[0]).second) {
+				eliminated.push_back(graph.nodes[i].names[0]);
+			}
+		}
+
+		module.body = std::move(body);
+		return eliminated;
+	}
+
+	vector<string> declFingerprints(const decl_graph& graph) {
+		const size_t count = graph.nodes.size();
+
+		vector<string> ownHash(count);
+		for (size_t i = 0; i < count; ++i) {
+			ownHash[i] = cache::hashKey({ declSource(*graph.nodes[i].decl) });
+		}
+
+		const auto components = stronglyConnectedComponents(graph);
+
+		// Components come dependencies first, so every referenced component
+		// already has its fingerprint when we reach a node
+		vector<size_t> componentOf(count, 0);
+		vector<string> componentHash(components.size());
+		vector<vector<size_t>> componentDeps(components.size());
+		vector<string> fingerprints(count);
+
+		for (size_t c = 0; c < components.size(); ++c) {
+			for (const size_t n : components[c]) {
+				componentOf[n] = c;
+			}
+		}
+
+		for (size_t c = 0; c < components.size(); ++c) {
+			vector<string> parts;
+			vector<size_t> deps;
+
+			for (const size_t n : components[c]) {
+				parts.push_back(ownHash[n]);
+
+				for (const size_t r : graph.nodes[n].refs) {
+					if (componentOf[r] != c) {
+						deps.push_back(componentOf[r]);
+					}
+				}
+			}
+
+			sort(deps.begin(), deps.end());
+			deps.erase(unique(deps.begin(), deps.end()), deps.end());
+			componentDeps[c] = deps;
+
+			// Order by hash rather than position, moving a declaration around
+			// in the file shouldn't invalidate anything
+			sort(parts.begin(), parts.end());
+			vector<string> depHashes;
+			for (const size_t d : deps) {
+				depHashes.push_back(componentHash[d]);
+			}
+			sort(depHashes.begin(), depHashes.end());
+			parts.insert(parts.end(), depHashes.begin(), depHashes.end());
+
+			componentHash[c] = cache::hashKey(parts);
+
+			for (const size_t n : components[c]) {
+				fingerprints[n] = cache::hashKey({ ownHash[n], componentHash[c] });
+			}
+		}
+
+		// A value binding without a signature gets its type from its users, so
+		// their fingerprints are part of its own and of everything referencing
+		// it. A user without a signature passes the choice on to its users.
+		set<string> signedNames;
+		for (const auto& n : graph.nodes) {
+			if (isSignature(*n.decl)) {
+				signedNames.insert(n.names.begin(), n.names.end());
+			}
+		}
+
+		vector<bool> unsignedBinding(count, false);
+		vector<vector<size_t>> users(count);
+		for (size_t n = 0; n < count; ++n) {
+			const auto& names = graph.nodes[n].names;
+			unsignedBinding[n] = !bindingLhs(*graph.nodes[n].decl).empty()
+			                  && none_of(names.begin(), names.end(), [&signedNames](const string& name) { return signedNames.count(name) > 0; });
+
+			for (const size_t r : graph.nodes[n].refs) {
+				users[r].push_back(n);
+			}
+		}
+
+		vector<string> usersHash(count);
+		for (size_t k = 0; k < count; ++k) {
+			if (!unsignedBinding[k] || !isValueBinding(*graph.nodes[k].decl)) {
+				continue;
+			}
+
+			vector<string> parts;
+			vector<bool> seen(count, false);
+			vector<size_t> work = { k };
+			seen[k] = true;
+
+			while (!work.empty()) {
+				const size_t n = work.back();
+				work.pop_back();
+
+				for (const size_t u : users[n]) {
+					if (!seen[u]) {
+						seen[u] = true;
+						parts.push_back(fingerprints[u]);
+						if (unsignedBinding[u]) {
+							work.push_back(u);
+						}
+					}
+				}
+			}
+
+			if (!parts.empty()) {
+				sort(parts.begin(), parts.end());
+				usersHash[k] = cache::hashKey(parts);
+			}
+		}
+
+		// Dependencies first again, each component collects the users' hashes
+		// of every monomorphic binding it reaches
+		vector<string> reachedUsers(components.size());
+		for (size_t c = 0; c < components.size(); ++c) {
+			vector<string> parts;
+			for (const size_t n : components[c]) {
+				if (!usersHash[n].empty()) {
+					parts.push_back(usersHash[n]);
+				}
+			}
+			for (const size_t d : componentDeps[c]) {
+				if (!reachedUsers[d].empty()) {
+					parts.push_back(reachedUsers[d]);
+				}
+			}
+
+			if (parts.empty()) {
+				continue;
+			}
+
+			sort(parts.begin(), parts.end());
+			reachedUsers[c] = cache::hashKey(parts);
+			for (const size_t n : components[c]) {
+				fingerprints[n] = cache::hashKey({ fingerprints[n], reachedUsers[c] });
+			}
+		}
+
+		return fingerprints;
+	}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+
+namespace mhc {
+
+	// Dependency graph over the top-level declarations of a module, edges point
+	// from a declaration to every other declaration it references
+	struct decl_graph {
+		struct node {
+			const parser::base_expr_node* decl;    // Points into the module body
+			std::vector<std::string> names;        // Names bound by the declaration
+			std::vector<size_t> refs;              // Indices of referenced nodes
+		};
+
+		std::vector<node> nodes;
+	};
+
+	// Names bound by a top-level declaration, a type signature binds the names
+	// it annotates so it is grouped with the matching equations
+	std::vector<std::string> declNames(const parser::base_expr_node& decl);
+
+	// Identifiers and operators appearing in a declaration
+	std::vector<std::string> declIdentifiers(const parser::base_expr_node& decl);
+
+	// References are found textually, so a shadowed local that happens to share
+	// a top-level name adds a spurious edge. That only ever over-approximates.
+	decl_graph buildDeclGraph(const parser::module_decl& module);
+
+	// Strongly connected components of the graph, each listed after every
+	// component it depends on
+	std::vector<std::vector<size_t>> stronglyConnectedComponents(const decl_graph& graph);
+
+	// Splits the nodes into at most 'count' groups of roughly equal source
+	// size, never separating a strongly connected component. Groups list node
+	// indices in source order, empty groups are dropped.
+	std::vector<std::vector<size_t>> partitionComponents(const decl_graph& graph, size_t count);
+
+	// Marks the nodes reachable from the module's roots: 'main', the exports
+	// and declarations that can't be judged by the names they bind (imports,
+	// instances, foreign exports). A module with a header but no export list
+	// exports everything, so every node is reachable.
+	std::vector<bool> reachableDecls(const parser::module_decl& module, const decl_graph& graph);
+
+	// Drops the unreachable declarations from the module's body and returns
+	// the names they bound in source order, once per binding even when a
+	// signature and several equations declare it
+	std::vector<std::string> eliminateDeadDecls(parser::module_decl& module);
+
+	// Fingerprint of each node covering its own source and, through its
+	// dependencies' fingerprints, everything it transitively references. A
+	// value binding without a signature takes its type from its users, so
+	// their sources are covered too wherever it's reached.
+	std::vector<std::string> declFingerprints(const decl_graph& graph);
+
+}
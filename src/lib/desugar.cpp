@@ -0,0 +1,1569 @@
+#include "desugar.h"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include <boost/variant/get.hpp>
+
+#include "decl_graph.h"
+#include "lexer.h"
+#include "thread_pool.h"
+
+
+using namespace mhc::core;
+using namespace mhc;
+using namespace parser;
+
+using namespace std;
+
+
+namespace {
+
+	// Guards that always hold
+	bool isTrue(const syntax::expr& e) {
+		return (e.kind == syntax::expr_kind::variable && e.name == "otherwise")
+		    || (e.kind == syntax::expr_kind::constructor && e.name == "True");
+	}
+
+	bool isBoolConstructor(const string& name) {
+		return name == "True" || name == "False";
+	}
+
+	atom varAtom(const module& m, var_id v) {
+		atom a;
+		a.kind = atom_kind::variable;
+		a.type = m.vars[v].type;
+		a.variable = v;
+		return a;
+	}
+
+	// True or False as an expression, the branch of a && or || that doesn't
+	// evaluate the right operand
+	const syntax::expr& boolExpr(bool value) {
+		static const syntax::expr values[2] = {
+			[] { syntax::expr e; e.kind = syntax::expr_kind::constructor; e.name = "False"; return e; }(),
+			[] { syntax::expr e; e.kind = syntax::expr_kind::constructor; e.name = "True"; return e; }(),
+		};
+		return values[value ? 1 : 0];
+	}
+
+	alt literalAlt(int64_t value) {
+		alt a;
+		a.kind = alt_kind::literal;
+		a.literal = value;
+		return a;
+	}
+
+	// The start of a declaration, for error messages
+	string snippet(const string& decl) {
+		string result = decl.substr(0, 40);
+		for (auto& c : result) {
+			c = (c == '\n' || c == '\t') ? ' ' : c;
+		}
+
+		return (decl.size() > result.size()) ? result + "..." : result;
+	}
+
+	// Names an expression refers to, locals included
+	void collectNames(const syntax::expr& e, vector<string>& names) {
+		if (e.kind == syntax::expr_kind::variable || e.kind == syntax::expr_kind::binary) {
+			names.push_back(e.name);
+		}
+
+		for (const auto& itr : e.children) {
+			collectNames(itr, names);
+		}
+	}
+
+}
+
+namespace mhc {
+
+	namespace core {
+
+		void desugarer::addEnvironment(const module_decl& module) {
+			for (const auto& itr : module.body) {
+				if (const string* str = boost::get<string>(&itr)) {
+					m_environment.push_back(*str);
+				} else if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&itr)) {
+					addDataType(*adt);
+				} else if (const type_synonym_decl* syn = boost::get<type_synonym_decl>(&itr)) {
+					addSynonym(*syn);
+				}
+			}
+		}
+
+		const algebraic_datatype_decl& orderingDecl() {
+			static const algebraic_datatype_decl decl = [] {
+				algebraic_datatype_decl d;
+				d.type_ctor = "Ordering";
+				d.components = { "LT", "EQ", "GT" };
+				d.constructors = d.components;
+				d.deriving_typeclasses = { "Eq", "Ord", "Enum", "Bounded" };
+				return d;
+			}();
+			return decl;
+		}
+
+		void desugarer::addDataType(const algebraic_datatype_decl& decl) {
+			for (const auto& itr : m_dataTypes) {
+				if (itr.type_ctor == decl.type_ctor) {
+					return;
+				}
+			}
+
+			m_dataTypes.push_back(decl);
+		}
+
+		void desugarer::addSynonym(const type_synonym_decl& decl) {
+			const auto tokens = lexer::tokenize(decl.type_new);
+			if (!tokens.empty()) {
+				m_synonyms[tokens[0].text] = decl;
+			}
+		}
+
+		void desugarer::addDecl(const string& decl) {
+			m_decls.push_back(decl);
+		}
+
+		bool desugarer::finish(module& result) {
+			m_module = &result;
+			m_ok = true;
+			m_signatures.clear();
+			m_equations.clear();
+			m_defined.clear();
+			m_instances.clear();
+			m_pending.clear();
+			m_derived.clear();
+
+			m_checkers.clear();
+			m_checkerOf.clear();
+			m_typeErrors.clear();
+
+			// Data types go into the checker every binding group's is copied from
+			m_base = infer::checker();
+			m_base.setImports(m_imports);
+			m_base.setOpenWorld(m_openWorld);
+			m_checker = &m_base;
+
+			// Each synonym without parameters is expanded once for the whole
+			// module, one with parameters at each use. A cycle or a wrong
+			// number of arguments is reported by the signatures that use it.
+			m_synonymTable.clear();
+			for (const auto& itr : m_synonyms) {
+				const auto tokens = lexer::tokenize(itr.second.type_new);
+				vector<string> params;
+				for (size_t i = 1; i < tokens.size(); ++i) {
+					if (tokens[i].kind != lexer::token_kind::varid ||
+					    find(params.begin(), params.end(), tokens[i].text) != params.end()) {
+						cerr << "Error: \"" << tokens[i].text << "\" isn't a type variable of its own in \"type " << itr.second.type_new << "\"" << endl;
+						m_ok = false;
+						break;
+					}
+					params.push_back(tokens[i].text);
+				}
+
+				syntax::type_expr type;
+				string why;
+				if (params.size() + 1 != tokens.size() || !syntax::parseType(itr.second.type_old, type)) {
+					continue;
+				}
+
+				// Bodies the table can't hold as one type, such as those that
+				// apply another synonym, are substituted like parameterized ones
+				const types::type t = params.empty() ? types::fromSyntax(type, why) : nullptr;
+				if (t) {
+					m_synonymTable.add(itr.first, t);
+				} else {
+					m_synonymTable.add(itr.first, params, type);
+				}
+			}
+			m_base.setSynonyms(&m_synonymTable);
+
+			m_fixities = syntax::defaultFixities();
+			for (const auto& itr : m_environment) {
+				syntax::addFixities(itr, m_fixities);
+			}
+			for (const auto& itr : m_decls) {
+				syntax::addFixities(itr, m_fixities);
+			}
+
+			declareDataTypes();
+			parseDecls();
+			inferTypes();
+
+			for (const auto& name : m_defined) {
+				if (m_typeErrors.count(name) > 0) {
+					continue;
+				}
+
+				// A function only data types fit is defined at the types it's used at
+				m_checker = m_checkerOf[name];
+				bool defaulted = true;
+				for (const auto v : m_checker->generics(m_checker->scheme(name))) {
+					defaulted = defaulted && (m_checker->at(v).allowed & (infer::g_numSet | infer::g_boolSet)) != 0;
+				}
+
+				substitution types;
+				const var_id self = defaulted ? declareInstance(name, m_equations[name][0].params.size(), types) : g_none;
+				desugarFunction(name, self, {});
+			}
+
+			// Specializations and derived instances can ask for more of them
+			for (size_t i = 0, j = 0; i < m_pending.size() || j < m_derived.size(); ) {
+				if (i < m_pending.size()) {
+					const specialization pending = m_pending[i++];
+					if (m_typeErrors.count(pending.name) == 0) {
+						desugarFunction(pending.name, pending.symbol, pending.types);
+					}
+				} else {
+					deriveInstance(m_derived[j++]);
+				}
+			}
+
+			// The declarations are lowered, a later call only defines new ones
+			m_decls.clear();
+			m_module = nullptr;
+			return m_ok;
+		}
+
+		void desugarer::declareDataTypes() {
+			// Every module has Ordering unless it declares its own
+			addDataType(orderingDecl());
+
+			m_deriving.clear();
+			for (const auto& adt : m_dataTypes) {
+				m_module->dataType(adt.type_ctor);
+				m_checker->addDataType(adt.type_ctor);
+			}
+
+			for (const auto& adt : m_dataTypes) {
+				const type_id t = m_module->dataType(adt.type_ctor);
+				if (m_module->types[t].kind != type_kind::data) {
+					continue;
+				}
+
+				// Components list each constructor followed by its field types
+				vector<constructor> constructors;
+				vector<vector<infer::node_id>> fields;
+				bool supported = true;
+				for (const auto& component : adt.components) {
+					if (constructors.size() < adt.constructors.size() && component == adt.constructors[constructors.size()]) {
+						constructor c;
+						c.name = component;
+						c.type = t;
+						c.tag = static_cast<uint32_t>(constructors.size());
+						constructors.push_back(c);
+						fields.push_back({});
+						continue;
+					}
+
+					// A type variable means a parameterized data type
+					syntax::type_expr field;
+					string why;
+					const infer::node_id fieldNode = syntax::parseType(component, field) ? m_checker->fromSyntax(field, why) : infer::g_none;
+					const type_id fieldType = (fieldNode == infer::g_none) ? g_none : coreType(fieldNode, substitution());
+					if (constructors.empty() || fieldType == g_none || !m_checker->generics(fieldNode).empty()) {
+						supported = false;
+						break;
+					}
+					constructors.back().fields.push_back(fieldType);
+					fields.back().push_back(fieldNode);
+				}
+
+				if (!supported || constructors.size() != adt.constructors.size()) {
+					for (const auto& itr : adt.constructors) {
+						m_checker->addUnsupported(itr, adt.type_ctor);
+					}
+					continue;
+				}
+
+				for (size_t i = 0; i < constructors.size(); ++i) {
+					m_checker->addConstructor(constructors[i].name, fields[i], m_checker->constant(adt.type_ctor));
+				}
+				m_module->constructors.insert(m_module->constructors.end(), constructors.begin(), constructors.end());
+
+				// Enum and Bounded only make sense for enumerations, using
+				// them on another type is a type error. A type without
+				// constructors has no values to compare.
+				bool enumeration = true;
+				for (const auto& itr : constructors) {
+					enumeration = enumeration && itr.fields.empty();
+				}
+				vector<string>& derived = m_deriving[t];
+				for (const auto& itr : adt.deriving_typeclasses) {
+					// There are no Char and String types for show to produce or
+					// read to take, so those classes can't be derived
+					if (itr == "Show" || itr == "Read") {
+						cerr << "Error: deriving " << itr << " needs a String type, which mhc doesn't have, in \"data " << adt.type_ctor << "\"" << endl;
+						m_ok = false;
+						continue;
+					}
+					if (itr != "Eq" && itr != "Ord" && itr != "Enum" && itr != "Bounded") {
+						cerr << "Error: deriving " << itr << " isn't supported in \"data " << adt.type_ctor << "\"" << endl;
+						m_ok = false;
+						continue;
+					}
+
+					if (!constructors.empty() && (enumeration || (itr != "Enum" && itr != "Bounded"))) {
+						derived.push_back(itr);
+					}
+				}
+				m_checker->addDerived(adt.type_ctor, derived);
+			}
+		}
+
+		void desugarer::parseDecls() {
+			for (const auto& text : m_environment) {
+				syntax::decl d;
+				string why;
+				if (!syntax::parseDecl(text, m_fixities, d, why)) {
+					continue;
+				}
+
+				if (d.kind == syntax::decl_kind::signature) {
+					for (const auto& name : d.names) {
+						m_signatures[name] = d.type;
+					}
+				} else if (d.kind == syntax::decl_kind::clause) {
+					m_equations[d.equation.name].push_back(std::move(d.equation));
+				}
+			}
+
+			set<string> own;
+			for (const auto& text : m_decls) {
+				syntax::decl d;
+				string why;
+				if (!syntax::parseDecl(text, m_fixities, d, why)) {
+					cerr << "Error: " << why << " in \"" << snippet(text) << "\"" << endl;
+					m_ok = false;
+					continue;
+				}
+
+				if (d.kind == syntax::decl_kind::signature) {
+					for (const auto& name : d.names) {
+						m_signatures[name] = d.type;
+					}
+				} else if (d.kind == syntax::decl_kind::clause) {
+					const string name = d.equation.name;
+					if (own.insert(name).second) {
+						m_equations[name].clear();
+						m_defined.push_back(name);
+					}
+					m_equations[name].push_back(std::move(d.equation));
+				}
+			}
+		}
+
+		void desugarer::inferTypes() {
+			// Signatures of names the module doesn't bind are seen by every group
+			for (const auto& itr : m_signatures) {
+				if (m_equations.count(itr.first) == 0) {
+					m_base.addSignature(itr.first, itr.second);
+				}
+			}
+
+			// Bindings are inferred a strongly connected component at a time,
+			// after the components they use
+			decl_graph graph;
+			map<string, size_t> nodes;
+			for (const auto& itr : m_equations) {
+				decl_graph::node n;
+				n.decl = nullptr;
+				n.names = { itr.first };
+				nodes[itr.first] = graph.nodes.size();
+				graph.nodes.push_back(n);
+			}
+
+			vector<char> untyped(graph.nodes.size(), 0);
+			for (const auto& itr : m_equations) {
+				vector<string> names;
+				for (const auto& c : itr.second) {
+					for (const auto& rhs : c.rhs) {
+						collectNames(rhs.guard, names);
+						collectNames(rhs.body, names);
+					}
+				}
+				sort(names.begin(), names.end());
+				names.erase(unique(names.begin(), names.end()), names.end());
+
+				const size_t self = nodes[itr.first];
+				auto& refs = graph.nodes[self].refs;
+				for (const auto& name : names) {
+					const auto found = nodes.find(name);
+					boost::string_ref payload;
+					if (found != nodes.end()) {
+						refs.push_back(found->second);
+					} else if (m_imports && m_imports->lookup(name, iface::entry_kind::value, payload) && payload.empty()) {
+						untyped[self] = 1;
+					}
+				}
+				sort(refs.begin(), refs.end());
+			}
+
+			const vector<vector<size_t>> components = stronglyConnectedComponents(graph);
+			const size_t count = components.size();
+			vector<size_t> componentOf(graph.nodes.size());
+			for (size_t c = 0; c < count; ++c) {
+				for (const size_t n : components[c]) {
+					componentOf[n] = c;
+				}
+			}
+
+			// A group is open when it has a value without a signature, whose
+			// constrained variables are left for its uses to decide, when it
+			// uses something of unknown type, or when it uses an open group.
+			// Open groups share a checker and take turns. Every other group
+			// has a checker of its own that only needs the generalized types of
+			// the groups it uses, so independent groups run in parallel.
+			vector<char> open(count, 0);
+			vector<vector<size_t>> dependents(count);
+			vector<size_t> waiting(count, 0);
+			size_t lastOpen = count;
+			for (size_t c = 0; c < count; ++c) {
+				vector<size_t> uses;
+				for (const size_t n : components[c]) {
+					const string& name = graph.nodes[n].names[0];
+					open[c] = open[c] || untyped[n] || (m_signatures.count(name) == 0 && m_equations[name][0].params.empty());
+					for (const size_t r : graph.nodes[n].refs) {
+						if (componentOf[r] != c) {
+							uses.push_back(componentOf[r]);
+							open[c] = open[c] || open[componentOf[r]];
+						}
+					}
+				}
+
+				if (open[c] && lastOpen != count) {
+					uses.push_back(lastOpen);
+				}
+				lastOpen = open[c] ? c : lastOpen;
+
+				sort(uses.begin(), uses.end());
+				uses.erase(unique(uses.begin(), uses.end()), uses.end());
+				for (const size_t u : uses) {
+					dependents[u].push_back(c);
+				}
+				waiting[c] = uses.size();
+			}
+
+			// The last checker is the open groups'
+			m_checkers.clear();
+			m_checkers.resize(count + 1);
+			m_checkers[count].reset(new infer::checker(m_base));
+			vector<types::type> exported(graph.nodes.size(), nullptr);
+
+			const auto inferComponent = [&](size_t c) {
+				unique_ptr<infer::checker>& checker = m_checkers[open[c] ? count : c];
+				if (!checker) {
+					checker.reset(new infer::checker(m_base));
+				}
+
+				vector<string> names;
+				for (const size_t n : components[c]) {
+					const string& name = graph.nodes[n].names[0];
+					names.push_back(name);
+
+					const auto signature = m_signatures.find(name);
+					if (signature != m_signatures.end()) {
+						checker->addSignature(name, signature->second);
+					}
+					for (const size_t r : graph.nodes[n].refs) {
+						if (componentOf[r] != c && !open[componentOf[r]]) {
+							checker->addScheme(graph.nodes[r].names[0], exported[r]);
+						}
+					}
+				}
+
+				checker->inferGroup(m_equations, names);
+
+				if (!open[c]) {
+					for (const size_t n : components[c]) {
+						const infer::node_id scheme = checker->scheme(graph.nodes[n].names[0]);
+						exported[n] = (scheme != infer::g_none) ? checker->toType(scheme) : nullptr;
+					}
+				}
+			};
+
+			// A group is inferred once the groups it uses are, whichever
+			// thread gets to it
+			if (m_threads <= 1 || count < 2) {
+				for (size_t c = 0; c < count; ++c) {
+					inferComponent(c);
+				}
+			} else {
+				thread_pool pool(static_cast<unsigned>(min<size_t>(m_threads, count)));
+				mutex waitingMutex;
+
+				std::function<void(size_t)> run = [&](size_t c) {
+					inferComponent(c);
+
+					vector<size_t> ready;
+					{
+						lock_guard<mutex> lock(waitingMutex);
+						for (const size_t d : dependents[c]) {
+							if (--waiting[d] == 0) {
+								ready.push_back(d);
+							}
+						}
+					}
+					for (const size_t d : ready) {
+						pool.submit([&run, d] { run(d); });
+					}
+				};
+
+				// Found before any runs, the counts change as groups finish
+				vector<size_t> ready;
+				for (size_t c = 0; c < count; ++c) {
+					if (waiting[c] == 0) {
+						ready.push_back(c);
+					}
+				}
+				for (const size_t c : ready) {
+					pool.submit([&run, c] { run(c); });
+				}
+				pool.wait();
+			}
+
+			for (size_t c = 0; c < count; ++c) {
+				for (const size_t n : components[c]) {
+					m_checkerOf[graph.nodes[n].names[0]] = m_checkers[open[c] ? count : c].get();
+				}
+			}
+
+			m_typeErrors = m_base.errors();
+			for (const auto& checker : m_checkers) {
+				if (checker) {
+					m_typeErrors.insert(checker->errors().begin(), checker->errors().end());
+				}
+			}
+
+			// Errors elsewhere are reported by whoever defines those bindings
+			for (const auto& name : m_defined) {
+				const auto found = m_typeErrors.find(name);
+				if (found != m_typeErrors.end()) {
+					cerr << "Error: " << found->second << " in \"" << name << "\"" << endl;
+					m_ok = false;
+				}
+			}
+		}
+
+		type_id desugarer::coreType(infer::node_id t, const substitution& types) {
+			t = m_checker->find(t);
+			const infer::node n = m_checker->at(t);
+
+			switch (n.kind) {
+				case infer::node_kind::variable: {
+					if (n.level != infer::g_genericLevel) {
+						// Nothing decided it
+						m_checker->setDefault(t);
+						return coreType(t, types);
+					}
+
+					const auto found = types.find(t);
+					return (found != types.end()) ? found->second : coreType(m_checker->defaultType(n.allowed), types);
+				}
+				case infer::node_kind::constant:
+					return m_module->dataType(m_checker->constantName(t));
+				case infer::node_kind::function:
+					break;
+			}
+
+			return g_none;
+		}
+
+		type_id desugarer::typeOf(const syntax::expr& e) {
+			const type_id t = coreType(e.type, m_types);
+			if (t == g_none) {
+				error("values of type " + m_checker->show(e.type) + " aren't supported yet");
+			}
+
+			return t;
+		}
+
+		bool desugarer::bindGenerics(infer::node_id t, type_id concrete, substitution& types) {
+			t = m_checker->find(t);
+			const infer::node n = m_checker->at(t);
+
+			if (n.kind == infer::node_kind::variable && n.level == infer::g_genericLevel) {
+				return types.insert(make_pair(t, concrete)).first->second == concrete;
+			}
+
+			// Monomorphic variables are settled when the type is lowered
+			return n.kind == infer::node_kind::variable || coreType(t, types) == concrete;
+		}
+
+		var_id desugarer::declareInstance(const string& name, size_t arity, substitution& types) {
+			const infer::node_id scheme = m_checker->scheme(name);
+
+			// Variables the uses didn't decide take their defaults
+			string suffix;
+			bool special = false;
+			vector<type_id> generics;
+			for (const auto v : m_checker->generics(scheme)) {
+				const type_id fallback = coreType(m_checker->defaultType(m_checker->at(v).allowed), types);
+				const type_id t = types.insert(make_pair(v, fallback)).first->second;
+				special = special || (t != fallback);
+				suffix += (suffix.empty() ? "" : ",") + typeName(*m_module, t);
+				generics.push_back(t);
+			}
+
+			const string symbol = special ? name + "{" + suffix + "}" : name;
+			const auto found = m_instances.find(symbol);
+			if (found != m_instances.end()) {
+				return found->second;
+			}
+
+			vector<type_id> params;
+			infer::node_id t = scheme;
+			for (size_t i = 0; i < arity && t != infer::g_none; ++i) {
+				const infer::node f = m_checker->at(m_checker->find(t));
+				params.push_back(f.kind == infer::node_kind::function ? coreType(f.param, types) : g_none);
+				t = (f.kind == infer::node_kind::function) ? f.result : infer::g_none;
+			}
+
+			const type_id result = (t == infer::g_none) ? g_none : coreType(t, types);
+			if (result == g_none || find(params.begin(), params.end(), g_none) != params.end()) {
+				error("the type " + m_checker->show(scheme) + " of " + name + " isn't supported yet");
+				return g_none;
+			}
+
+			const var_id v = m_module->addVar(symbol, m_module->functionType(params, result), true);
+			m_instances[symbol] = v;
+
+			if (special) {
+				if (m_equations.count(name) == 0) {
+					error(name + " is polymorphic and defined in another module or batch, it can't be specialized");
+					return g_none;
+				}
+				m_pending.push_back(specialization { name, v, generics });
+			}
+
+			return v;
+		}
+
+		var_id desugarer::instance(const string& name, const vector<type_id>& params, type_id result) {
+			const auto equations = m_equations.find(name);
+			const size_t arity = (equations != m_equations.end()) ? equations->second[0].params.size() : params.size();
+			if (arity != params.size()) {
+				error(name + " takes " + to_string(arity) + " arguments but is given " + to_string(params.size()));
+				return g_none;
+			}
+
+			// The generic variables are whatever the use's types make them
+			substitution types;
+			infer::node_id t = m_checker->scheme(name);
+			bool matched = (t != infer::g_none);
+			for (size_t i = 0; i < arity && matched; ++i) {
+				const infer::node f = m_checker->at(m_checker->find(t));
+				matched = (f.kind == infer::node_kind::function) && bindGenerics(f.param, params[i], types);
+				t = f.result;
+			}
+
+			if (!matched || !bindGenerics(t, result, types)) {
+				error("no instance of " + name + " for these types");
+				return g_none;
+			}
+
+			return declareInstance(name, arity, types);
+		}
+
+		void desugarer::error(const string& message) {
+			m_ok = false;
+
+			// Later errors in the same function usually follow from the first
+			if (m_failed) {
+				return;
+			}
+
+			m_failed = true;
+			cerr << "Error: " << message << (m_where.empty() ? "" : " in \"" + m_where + "\"") << endl;
+		}
+
+		void desugarer::fill(expr_id e) {
+			switch (m_hole.where) {
+				case hole::slot::function: m_function.body = e;                      break;
+				case hole::slot::body:     m_module->exprs[m_hole.index].body = e;   break;
+				case hole::slot::code:     m_module->exprs[m_hole.index].ref = e;    break;
+				case hole::slot::alt:      m_module->alts[m_hole.index].body = e;    break;
+				case hole::slot::none:                                               break;
+			}
+		}
+
+		void desugarer::emit(const expr& x) {
+			const expr_id e = m_module->addExpr(x);
+			fill(e);
+
+			if (x.kind == expr_kind::let_atom || x.kind == expr_kind::let_prim
+			 || x.kind == expr_kind::let_call || x.kind == expr_kind::let_con || x.kind == expr_kind::let_tag) {
+				m_hole.where = hole::slot::body;
+				m_hole.index = e;
+			} else {
+				m_hole.where = hole::slot::none;
+			}
+		}
+
+		var_id desugarer::emitLet(expr x, type_id type, const string& name) {
+			x.binder = m_module->addVar(name, type);
+			emit(x);
+			return x.binder;
+		}
+
+		void desugarer::emitFail(var_id label) {
+			expr x;
+			x.kind = (label == g_none) ? expr_kind::fail : expr_kind::jump;
+			x.ref = label;
+			emit(x);
+		}
+
+		uint32_t desugarer::emitMatch(const atom& scrutinee, const vector<alt>& alts) {
+			expr x;
+			x.kind = expr_kind::match;
+			x.first = m_module->addAtoms({ scrutinee });
+			x.ref = static_cast<uint32_t>(m_module->alts.size());
+			x.count = static_cast<uint32_t>(alts.size());
+
+			m_module->alts.insert(m_module->alts.end(), alts.begin(), alts.end());
+			emit(x);
+			return x.ref;
+		}
+
+		atom desugarer::emitPrim(ops::opcode code, const atom& lhs, const atom& rhs) {
+			expr x;
+			x.kind = expr_kind::let_prim;
+			x.op = code;
+			x.first = m_module->addAtoms({ lhs, rhs });
+			x.count = 2;
+			return varAtom(*m_module, emitLet(x, ops::isComparison(code) ? g_boolType : lhs.type));
+		}
+
+		atom desugarer::emitConstructor(uint32_t index, const vector<atom>& fields) {
+			expr x;
+			x.kind = expr_kind::let_con;
+			x.ref = index;
+			x.first = m_module->addAtoms(fields);
+			x.count = static_cast<uint32_t>(fields.size());
+			return varAtom(*m_module, emitLet(x, m_module->constructors[index].type));
+		}
+
+		atom desugarer::emitTag(const atom& value) {
+			expr x;
+			x.kind = expr_kind::let_tag;
+			x.first = m_module->addAtoms({ value });
+			x.count = 1;
+			return varAtom(*m_module, emitLet(x, g_intType));
+		}
+
+		void desugarer::emitReturn(const atom& value) {
+			expr x;
+			x.kind = expr_kind::ret;
+			x.first = m_module->addAtoms({ value });
+			x.count = 1;
+			emit(x);
+		}
+
+		void desugarer::desugarFunction(const string& name, var_id self, const vector<type_id>& generics) {
+			const vector<syntax::clause>& clauses = m_equations[name];
+
+			m_where = name;
+			m_failed = false;
+			m_scope = scope_t();
+
+			// The expressions carry types of the checker that inferred them
+			m_checker = m_checkerOf[name];
+			m_types.clear();
+			const vector<infer::node_id> variables = m_checker->generics(m_checker->scheme(name));
+			for (size_t i = 0; i < generics.size() && i < variables.size(); ++i) {
+				m_types[variables[i]] = generics[i];
+			}
+
+			if (self == g_none) {
+				return;
+			}
+
+			// Copied, the type table grows while desugaring
+			const type t = m_module->types[m_module->vars[self].type];
+
+			vector<var_id> params;
+			for (size_t i = 0; i < t.params.size(); ++i) {
+				const syntax::pattern& p = clauses[0].params[i];
+				params.push_back(m_module->addVar(p.kind == syntax::pattern_kind::variable ? p.name : "arg", t.params[i]));
+			}
+
+			m_result = t.result;
+			m_function = function();
+			m_function.name = self;
+			m_function.first = m_module->addBinders(params);
+			m_function.count = static_cast<uint32_t>(params.size());
+			m_hole.where = hole::slot::function;
+
+			desugarClauses(clauses, 0, params);
+
+			if (!m_failed) {
+				m_module->functions.push_back(m_function);
+			}
+		}
+
+		void desugarer::desugarClauses(const vector<syntax::clause>& clauses, size_t index, const vector<var_id>& params) {
+			if (index == clauses.size()) {
+				emitFail(g_none);
+				return;
+			}
+
+			// The remaining equations become a join point the patterns and
+			// guards of this one fall through to
+			var_id failLabel = g_none;
+			if (index + 1 < clauses.size()) {
+				expr x;
+				x.kind = expr_kind::join;
+				x.binder = m_module->addVar("next", m_module->functionType({}, m_result));
+				x.first = static_cast<uint32_t>(m_module->binders.size());
+
+				const expr_id j = m_module->addExpr(x);
+				fill(j);
+
+				m_hole.where = hole::slot::code;
+				m_hole.index = j;
+				desugarClauses(clauses, index + 1, params);
+
+				m_hole.where = hole::slot::body;
+				m_hole.index = j;
+				failLabel = x.binder;
+			}
+
+			scope_t::scope patterns(m_scope);
+			const syntax::clause& c = clauses[index];
+			for (size_t i = 0; i < c.params.size() && !m_failed; ++i) {
+				matchPattern(c.params[i], params[i], failLabel);
+			}
+
+			desugarRhs(c.rhs, failLabel);
+		}
+
+		void desugarer::matchPattern(const syntax::pattern& p, var_id value, var_id failLabel) {
+			if (m_failed) {
+				return;
+			}
+
+			const type_id t = m_module->vars[value].type;
+
+			switch (p.kind) {
+				case syntax::pattern_kind::variable:
+					m_scope.insert(p.name, varAtom(*m_module, value));
+					return;
+				case syntax::pattern_kind::wildcard:
+					return;
+				case syntax::pattern_kind::integer:
+				case syntax::pattern_kind::constructor:
+					break;
+			}
+
+			int64_t literal = p.integer;
+			if (p.kind == syntax::pattern_kind::constructor && isBoolConstructor(p.name) && t == g_boolType) {
+				literal = (p.name == "True") ? 1 : 0;
+			} else if (p.kind == syntax::pattern_kind::constructor) {
+				// Checked by inference
+				const uint32_t index = m_module->findConstructor(p.name);
+				const constructor c = m_module->constructors[index];
+
+				vector<var_id> fields;
+				for (size_t i = 0; i < c.fields.size(); ++i) {
+					const bool named = (p.args[i].kind == syntax::pattern_kind::variable);
+					fields.push_back(m_module->addVar(named ? p.args[i].name : "", c.fields[i]));
+				}
+
+				alt matched;
+				matched.kind = alt_kind::constructor;
+				matched.constructor = index;
+				matched.first = m_module->addBinders(fields);
+				matched.count = static_cast<uint32_t>(fields.size());
+
+				vector<alt> alts = { matched };
+				size_t siblings = 0;
+				for (const auto& itr : m_module->constructors) {
+					siblings += (itr.type == t) ? 1 : 0;
+				}
+				if (siblings > 1) {
+					alts.push_back(alt());
+				}
+
+				const uint32_t first = emitMatch(varAtom(*m_module, value), alts);
+				if (siblings > 1) {
+					m_hole.where = hole::slot::alt;
+					m_hole.index = first + 1;
+					emitFail(failLabel);
+				}
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+				for (size_t i = 0; i < fields.size(); ++i) {
+					matchPattern(p.args[i], fields[i], failLabel);
+				}
+				return;
+			}
+
+			const uint32_t first = emitMatch(varAtom(*m_module, value), { literalAlt(literal), alt() });
+			m_hole.where = hole::slot::alt;
+			m_hole.index = first + 1;
+			emitFail(failLabel);
+
+			m_hole.where = hole::slot::alt;
+			m_hole.index = first;
+		}
+
+		void desugarer::desugarRhs(const vector<syntax::guarded_rhs>& rhs, var_id failLabel) {
+			for (const auto& r : rhs) {
+				if (m_failed) {
+					return;
+				}
+
+				if (!r.guarded || isTrue(r.guard)) {
+					desugarTail(r.body);
+					return;
+				}
+
+				const atom condition = desugarAtom(r.guard);
+				if (!coerce(condition, g_boolType)) {
+					return;
+				}
+
+				const uint32_t first = emitMatch(condition, { literalAlt(1), alt() });
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+				desugarTail(r.body);
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+			}
+
+			emitFail(failLabel);
+		}
+
+		void desugarer::desugarTail(const syntax::expr& e) {
+			if (m_failed) {
+				return;
+			}
+
+			const syntax::expr* branches[2] = { nullptr, nullptr };
+			if (e.kind == syntax::expr_kind::if_then_else) {
+				branches[0] = &e.children[1];
+				branches[1] = &e.children[2];
+			}
+
+			if (branches[0] || shortCircuit(e, branches)) {
+				const atom condition = desugarAtom(e.children[0]);
+				if (!coerce(condition, g_boolType)) {
+					return;
+				}
+
+				const uint32_t first = emitMatch(condition, { literalAlt(1), alt() });
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+				desugarTail(*branches[0]);
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+				desugarTail(*branches[1]);
+				return;
+			}
+
+			if (e.kind == syntax::expr_kind::let_in) {
+				const atom value = desugarAtom(e.children[0]);
+				scope_t::scope body(m_scope);
+				m_scope.insert(e.name, value);
+				desugarTail(e.children[1]);
+				return;
+			}
+
+			const atom result = desugarAtom(e);
+			if (coerce(result, m_result)) {
+				emitReturn(result);
+			}
+		}
+
+		atom desugarer::desugarAtom(const syntax::expr& e) {
+			if (m_failed) {
+				return atom();
+			}
+
+			switch (e.kind) {
+				case syntax::expr_kind::integer: {
+					const type_id t = typeOf(e);
+					return (t == g_doubleType) ? floatingAtom(static_cast<double>(e.integer)) : integerAtom(e.integer, t);
+				}
+
+				case syntax::expr_kind::floating:
+					return floatingAtom(e.floating);
+
+				case syntax::expr_kind::variable:
+					if (const atom* local = m_scope.find(e.name)) {
+						return *local;
+					}
+					return desugarCall(e.name, false, {}, typeOf(e));
+
+				case syntax::expr_kind::constructor:
+					if (isBoolConstructor(e.name)) {
+						return integerAtom(e.name == "True" ? 1 : 0, g_boolType);
+					}
+					return desugarCall(e.name, true, {}, typeOf(e));
+
+				case syntax::expr_kind::apply: {
+					const syntax::expr& callee = e.children[0];
+					if (callee.kind != syntax::expr_kind::variable && callee.kind != syntax::expr_kind::constructor) {
+						error("only named functions can be applied");
+						return atom();
+					}
+
+					if (m_scope.find(callee.name)) {
+						error("local functions aren't supported yet (" + callee.name + ")");
+						return atom();
+					}
+
+					vector<const syntax::expr*> args;
+					for (size_t i = 1; i < e.children.size(); ++i) {
+						args.push_back(&e.children[i]);
+					}
+					return desugarCall(callee.name, callee.kind == syntax::expr_kind::constructor, args, typeOf(e));
+				}
+
+				case syntax::expr_kind::binary:
+					return desugarBinary(e);
+
+				case syntax::expr_kind::negate: {
+					atom operand = desugarAtom(e.children[0]);
+					if (operand.kind == atom_kind::integer) {
+						operand.integer = -operand.integer;
+						return operand;
+					}
+					if (operand.kind == atom_kind::floating) {
+						operand.floating = -operand.floating;
+						return operand;
+					}
+
+					// -0.0 - x keeps the sign of a zero operand, 0.0 - 0.0 would be +0.0
+					expr x;
+					x.kind = expr_kind::let_prim;
+					x.op = ops::opcode::sub;
+					x.first = m_module->addAtoms({ operand.type == g_doubleType ? floatingAtom(-0.0) : integerAtom(0, operand.type), operand });
+					x.count = 2;
+					return varAtom(*m_module, emitLet(x, operand.type));
+				}
+
+				case syntax::expr_kind::if_then_else:
+					return desugarIf(e.children[0], e.children[1], e.children[2], typeOf(e));
+
+				case syntax::expr_kind::let_in: {
+					const atom value = desugarAtom(e.children[0]);
+					scope_t::scope body(m_scope);
+					m_scope.insert(e.name, value);
+					return desugarAtom(e.children[1]);
+				}
+			}
+
+			return atom();
+		}
+
+		atom desugarer::desugarCall(const string& callee, bool isConstructor, const vector<const syntax::expr*>& args, type_id result) {
+			vector<atom> values;
+			vector<type_id> types;
+			for (const auto itr : args) {
+				values.push_back(desugarAtom(*itr));
+				types.push_back(values.back().type);
+			}
+			if (m_failed || result == g_none) {
+				return atom();
+			}
+
+			// Inference saw a constructor applied to all of its fields
+			if (isConstructor) {
+				return emitConstructor(m_module->findConstructor(callee), values);
+			}
+
+			if (m_checker->isMethod(callee)) {
+				return desugarMethod(callee, values, result);
+			}
+
+			const var_id f = instance(callee, types, result);
+			if (f == g_none) {
+				return atom();
+			}
+
+			expr x;
+			x.kind = expr_kind::let_call;
+			x.ref = f;
+			x.first = m_module->addAtoms(values);
+			x.count = static_cast<uint32_t>(values.size());
+			return varAtom(*m_module, emitLet(x, result));
+		}
+
+		atom desugarer::desugarBinary(const syntax::expr& e) {
+			const syntax::expr* branches[2];
+			if (shortCircuit(e, branches)) {
+				return desugarIf(e.children[0], *branches[0], *branches[1], g_boolType);
+			}
+
+			// Operators the program defines are called like functions
+			if (!m_checker->isPrimitive(e)) {
+				return desugarCall(e.name, false, { &e.children[0], &e.children[1] }, typeOf(e));
+			}
+
+			const atom lhs = desugarAtom(e.children[0]);
+			const atom rhs = desugarAtom(e.children[1]);
+			if (!coerce(rhs, lhs.type)) {
+				return atom();
+			}
+
+			return ops::isComparison(e.op) ? desugarComparison(e.op, lhs, rhs) : emitPrim(e.op, lhs, rhs);
+		}
+
+		// "a && b" is "if a then b else False" and "a || b" is "if a then True
+		// else b", like a case on the Bool
+		bool desugarer::shortCircuit(const syntax::expr& e, const syntax::expr* branches[2]) const {
+			if (e.kind != syntax::expr_kind::binary || (e.op != ops::opcode::logical_and && e.op != ops::opcode::logical_or)
+			 || !m_checker->isPrimitive(e)) {
+				return false;
+			}
+
+			const bool conjunction = (e.op == ops::opcode::logical_and);
+			branches[0] = conjunction ? &e.children[1] : &boolExpr(true);
+			branches[1] = conjunction ? &boolExpr(false) : &e.children[1];
+			return true;
+		}
+
+		atom desugarer::desugarIf(const syntax::expr& test, const syntax::expr& then, const syntax::expr& otherwise, type_id t) {
+			const atom condition = desugarAtom(test);
+			if (!coerce(condition, g_boolType) || t == g_none) {
+				return atom();
+			}
+
+			// What follows the if becomes a join point both branches jump to
+			const var_id label = m_module->addVar("join", m_module->functionType({ t }, m_result));
+			const var_id result = m_module->addVar("", t);
+
+			expr x;
+			x.kind = expr_kind::join;
+			x.binder = label;
+			x.first = m_module->addBinders({ result });
+			x.count = 1;
+			const expr_id j = m_module->addExpr(x);
+			fill(j);
+
+			m_hole.where = hole::slot::body;
+			m_hole.index = j;
+			const uint32_t first = emitMatch(condition, { literalAlt(1), alt() });
+
+			hole holes[2];
+			atom args[2];
+			for (uint32_t i = 0; i < 2; ++i) {
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + i;
+				args[i] = desugarAtom(i == 0 ? then : otherwise);
+				holes[i] = m_hole;
+
+				if (!coerce(args[i], t)) {
+					return atom();
+				}
+			}
+
+			for (size_t i = 0; i < 2; ++i) {
+				expr jump;
+				jump.kind = expr_kind::jump;
+				jump.ref = label;
+				jump.first = m_module->addAtoms({ args[i] });
+				jump.count = 1;
+
+				m_hole = holes[i];
+				emit(jump);
+			}
+
+			m_hole.where = hole::slot::code;
+			m_hole.index = j;
+			return varAtom(*m_module, result);
+		}
+
+		// Inference already matched the types, this only guards the lowering
+		bool desugarer::coerce(const atom& a, type_id type) {
+			if (m_failed) {
+				return false;
+			}
+			if (a.type == type) {
+				return true;
+			}
+
+			error("expected " + typeName(*m_module, type) + " but found " + typeName(*m_module, a.type));
+			return false;
+		}
+
+		bool desugarer::derives(type_id t, const string& typeClass) const {
+			const auto found = m_deriving.find(t);
+			return found != m_deriving.end() && std::find(found->second.begin(), found->second.end(), typeClass) != found->second.end();
+		}
+
+		vector<uint32_t> desugarer::constructorsOf(type_id t) const {
+			vector<uint32_t> result;
+			for (uint32_t i = 0; i < m_module->constructors.size(); ++i) {
+				if (m_module->constructors[i].type == t) {
+					result.push_back(i);
+				}
+			}
+			return result;
+		}
+
+		// Data values compare through the instances their types derive, an
+		// order compares the tag of the Ordering "compare" returns with EQ's
+		atom desugarer::desugarComparison(ops::opcode code, const atom& lhs, const atom& rhs) {
+			const type_kind kind = m_module->types[lhs.type].kind;
+			if (kind != type_kind::data && kind != type_kind::function) {
+				return emitPrim(code, lhs, rhs);
+			}
+
+			const bool equality = (code == ops::opcode::eq || code == ops::opcode::ne);
+			const string typeClass = equality ? "Eq" : "Ord";
+			if (!derives(lhs.type, typeClass)) {
+				error("no instance of " + typeClass + " for " + typeName(*m_module, lhs.type));
+				return atom();
+			}
+
+			expr x;
+			x.kind = expr_kind::let_call;
+			x.ref = derivedInstance(equality ? "==" : "compare", lhs.type);
+			x.first = m_module->addAtoms({ lhs, rhs });
+			x.count = 2;
+			const atom result = varAtom(*m_module, emitLet(x, equality ? g_boolType : orderingType()));
+
+			if (code == ops::opcode::eq) {
+				return result;
+			}
+			return (code == ops::opcode::ne) ? emitPrim(ops::opcode::eq, result, integerAtom(0, g_boolType))
+			                                 : emitPrim(code, emitTag(result), integerAtom(1));
+		}
+
+		type_id desugarer::orderingType() {
+			return m_module->dataType("Ordering");
+		}
+
+		// LT, EQ or GT as 'order' is negative, zero or positive
+		void desugarer::returnOrder(int order) {
+			emitReturn(emitConstructor(constructorsOf(orderingType())[order + 1], {}));
+		}
+
+		// Methods of the derivable classes at the type they're used at
+		atom desugarer::desugarMethod(const string& name, const vector<atom>& values, type_id result) {
+			const bool bounded = (name == "minBound" || name == "maxBound");
+			const bool ordered = (name == "compare");
+			if (!bounded && values.size() != (ordered ? 2u : 1u)) {
+				error(name + (ordered ? " can only be applied to two arguments" : " can only be applied to one argument"));
+				return atom();
+			}
+
+			const type_id t = (name == "fromEnum" || name == "succ" || name == "pred" || ordered) ? values[0].type : result;
+			const string typeClass = bounded ? "Bounded" : ordered ? "Ord" : "Enum";
+
+			// The primitive types are ordered, compare{Int} compares them like < does
+			const bool primitive = ordered && m_module->types[t].kind != type_kind::data && m_module->types[t].kind != type_kind::function;
+			if (!primitive && !derives(t, typeClass)) {
+				error("no instance of " + typeClass + " for " + typeName(*m_module, t));
+				return atom();
+			}
+
+			// Enumerations are their tags, these need no function
+			if (name == "fromEnum") {
+				return emitTag(values[0]);
+			}
+			if (bounded) {
+				const vector<uint32_t> constructors = constructorsOf(t);
+				return emitConstructor(name == "minBound" ? constructors.front() : constructors.back(), {});
+			}
+
+			expr x;
+			x.kind = expr_kind::let_call;
+			x.ref = derivedInstance(name, t);
+			x.first = m_module->addAtoms(values);
+			x.count = static_cast<uint32_t>(values.size());
+			return varAtom(*m_module, emitLet(x, result));
+		}
+
+		var_id desugarer::derivedInstance(const string& method, type_id t) {
+			const string symbol = method + "{" + typeName(*m_module, t) + "}";
+			const auto found = m_instances.find(symbol);
+			if (found != m_instances.end()) {
+				return found->second;
+			}
+
+			const type_id f = (method == "==")      ? m_module->functionType({ t, t }, g_boolType)
+			                : (method == "compare") ? m_module->functionType({ t, t }, orderingType())
+			                : (method == "toEnum")  ? m_module->functionType({ g_intType }, t)
+			                                        : m_module->functionType({ t }, t);
+			const var_id v = m_module->addVar(symbol, f, true);
+			m_instances[symbol] = v;
+			m_derived.push_back(specialization { method, v, { t } });
+			return v;
+		}
+
+		void desugarer::deriveInstance(const specialization& derived) {
+			m_where = m_module->vars[derived.symbol].name;
+			m_failed = false;
+			m_scope = scope_t();
+			m_types.clear();
+
+			// Copied, the type table grows while generating
+			const type t = m_module->types[m_module->vars[derived.symbol].type];
+
+			vector<var_id> params;
+			for (size_t i = 0; i < t.params.size(); ++i) {
+				params.push_back(m_module->addVar(i == 0 ? "x" : "y", t.params[i]));
+			}
+
+			m_result = t.result;
+			m_function = function();
+			m_function.name = derived.symbol;
+			m_function.first = m_module->addBinders(params);
+			m_function.count = static_cast<uint32_t>(params.size());
+			m_hole.where = hole::slot::function;
+
+			if (derived.name == "==") {
+				deriveEq(params[0], params[1]);
+			} else if (derived.name == "compare") {
+				deriveCompare(params[0], params[1]);
+			} else {
+				deriveEnum(derived.name, params[0]);
+			}
+
+			if (!m_failed) {
+				m_module->functions.push_back(m_function);
+			}
+		}
+
+		void desugarer::deriveEq(var_id x, var_id y) {
+			const vector<uint32_t> constructors = constructorsOf(m_module->vars[x].type);
+			bool enumeration = true;
+			for (const auto itr : constructors) {
+				enumeration = enumeration && m_module->constructors[itr].fields.empty();
+			}
+
+			// Values built with different constructors differ, an enumeration
+			// is equal when the tags are
+			if (constructors.size() > 1) {
+				const atom tag = emitTag(varAtom(*m_module, x));
+				const atom same = emitPrim(ops::opcode::eq, tag, emitTag(varAtom(*m_module, y)));
+				if (enumeration) {
+					emitReturn(same);
+					return;
+				}
+
+				const uint32_t first = emitMatch(same, { literalAlt(1), alt() });
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+				emitReturn(integerAtom(0, g_boolType));
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+			}
+
+			vector<vector<var_id>> fields;
+			const uint32_t first = matchConstructors(x, fields);
+			for (size_t i = 0; i < constructors.size() && !m_failed; ++i) {
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + static_cast<uint32_t>(i);
+
+				const vector<var_id> others = matchConstructor(y, constructors[i]);
+				atom result = integerAtom(1, g_boolType);
+				for (size_t j = 0; j < others.size() && !m_failed; ++j) {
+					const atom same = desugarComparison(ops::opcode::eq, varAtom(*m_module, fields[i][j]), varAtom(*m_module, others[j]));
+					result = (j == 0) ? same : emitPrim(ops::opcode::bit_and, result, same);
+				}
+				if (!m_failed) {
+					emitReturn(result);
+				}
+			}
+		}
+
+		// LT, EQ or GT as x is less than, equal to or greater than y
+		void desugarer::deriveCompare(var_id x, var_id y) {
+			const type_id t = m_module->vars[x].type;
+			if (m_module->types[t].kind != type_kind::data) {
+				compareFields(varAtom(*m_module, x), varAtom(*m_module, y));
+				if (!m_failed) {
+					returnOrder(0);
+				}
+				return;
+			}
+
+			const vector<uint32_t> constructors = constructorsOf(t);
+			bool enumeration = true;
+			for (const auto itr : constructors) {
+				enumeration = enumeration && m_module->constructors[itr].fields.empty();
+			}
+
+			// Constructors order by their tags, fields only break ties
+			if (constructors.size() > 1) {
+				compareFields(emitTag(varAtom(*m_module, x)), emitTag(varAtom(*m_module, y)));
+			}
+			if (enumeration) {
+				returnOrder(0);
+				return;
+			}
+
+			vector<vector<var_id>> fields;
+			const uint32_t first = matchConstructors(x, fields);
+			for (size_t i = 0; i < constructors.size() && !m_failed; ++i) {
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + static_cast<uint32_t>(i);
+
+				const vector<var_id> others = matchConstructor(y, constructors[i]);
+				for (size_t j = 0; j < others.size() && !m_failed; ++j) {
+					compareFields(varAtom(*m_module, fields[i][j]), varAtom(*m_module, others[j]));
+				}
+				if (!m_failed) {
+					returnOrder(0);
+				}
+			}
+		}
+
+		// Returns the order of two fields unless they're equal, what follows
+		// goes in the hole left
+		void desugarer::compareFields(const atom& lhs, const atom& rhs) {
+			const type_kind kind = m_module->types[lhs.type].kind;
+			if (kind == type_kind::data && derives(lhs.type, "Ord")) {
+				expr x;
+				x.kind = expr_kind::let_call;
+				x.ref = derivedInstance("compare", lhs.type);
+				x.first = m_module->addAtoms({ lhs, rhs });
+				x.count = 2;
+				const atom order = varAtom(*m_module, emitLet(x, orderingType()));
+
+				const uint32_t first = emitMatch(emitPrim(ops::opcode::ne, emitTag(order), integerAtom(1)), { literalAlt(1), alt() });
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+				emitReturn(order);
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+				return;
+			}
+
+			// False is less than True, there's no order on Bool to use
+			if (kind == type_kind::boolean) {
+				const uint32_t first = emitMatch(emitPrim(ops::opcode::ne, lhs, rhs), { literalAlt(1), alt() });
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+				const uint32_t which = emitMatch(lhs, { literalAlt(1), alt() });
+				for (uint32_t i = 0; i < 2; ++i) {
+					m_hole.where = hole::slot::alt;
+					m_hole.index = which + i;
+					returnOrder(i == 0 ? 1 : -1);
+				}
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+				return;
+			}
+
+			const ops::opcode tests[] = { ops::opcode::lt, ops::opcode::gt };
+			for (uint32_t i = 0; i < 2 && !m_failed; ++i) {
+				const atom holds = desugarComparison(tests[i], lhs, rhs);
+				if (m_failed) {
+					return;
+				}
+
+				const uint32_t first = emitMatch(holds, { literalAlt(1), alt() });
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first;
+				returnOrder(i == 0 ? -1 : 1);
+
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+			}
+		}
+
+		// toEnum is the constructor with a tag, succ and pred the next and
+		// previous ones, out of range fails like a missing pattern
+		void desugarer::deriveEnum(const string& method, var_id x) {
+			const type_id t = (method == "toEnum") ? m_result : m_module->vars[x].type;
+			const vector<uint32_t> constructors = constructorsOf(t);
+
+			vector<alt> alts;
+			for (size_t i = 0; i < constructors.size(); ++i) {
+				alt a = literalAlt(static_cast<int64_t>(i));
+				if (method != "toEnum") {
+					a.kind = alt_kind::constructor;
+					a.constructor = constructors[i];
+					a.first = m_module->addBinders({});
+				}
+				alts.push_back(a);
+			}
+			if (method == "toEnum") {
+				alts.push_back(alt());
+			}
+
+			const uint32_t first = emitMatch(varAtom(*m_module, x), alts);
+			for (size_t i = 0; i < alts.size(); ++i) {
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + static_cast<uint32_t>(i);
+
+				const size_t target = (method == "succ") ? i + 1 : (method == "pred") ? i - 1 : i;
+				if (target < constructors.size()) {
+					emitReturn(emitConstructor(constructors[target], {}));
+				} else {
+					emitFail(g_none);
+				}
+			}
+		}
+
+		// A match on every constructor of the value's type, 'fields' gets the
+		// binders of each
+		uint32_t desugarer::matchConstructors(var_id value, vector<vector<var_id>>& fields) {
+			vector<alt> alts;
+			for (const auto index : constructorsOf(m_module->vars[value].type)) {
+				fields.push_back({});
+				for (const auto itr : m_module->constructors[index].fields) {
+					fields.back().push_back(m_module->addVar("", itr));
+				}
+
+				alt a;
+				a.kind = alt_kind::constructor;
+				a.constructor = index;
+				a.first = m_module->addBinders(fields.back());
+				a.count = static_cast<uint32_t>(fields.back().size());
+				alts.push_back(a);
+			}
+
+			return emitMatch(varAtom(*m_module, value), alts);
+		}
+
+		// The fields of a value built with one constructor, any other fails.
+		// What follows goes in the hole left.
+		vector<var_id> desugarer::matchConstructor(var_id value, uint32_t index) {
+			vector<var_id> fields;
+			for (const auto itr : m_module->constructors[index].fields) {
+				fields.push_back(m_module->addVar("", itr));
+			}
+
+			alt matched;
+			matched.kind = alt_kind::constructor;
+			matched.constructor = index;
+			matched.first = m_module->addBinders(fields);
+			matched.count = static_cast<uint32_t>(fields.size());
+
+			const bool siblings = constructorsOf(m_module->constructors[index].type).size() > 1;
+			const uint32_t first = emitMatch(varAtom(*m_module, value), siblings ? vector<alt> { matched, alt() } : vector<alt> { matched });
+			if (siblings) {
+				m_hole.where = hole::slot::alt;
+				m_hole.index = first + 1;
+				emitFail(g_none);
+			}
+
+			m_hole.where = hole::slot::alt;
+			m_hole.index = first;
+			return fields;
+		}
+
+		bool isSpecialization(const string& name) {
+			return !name.empty() && name.back() == '}';
+		}
+
+	}
+
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core.h"
+#include "infer.h"
+#include "interface.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include "syntax.h"
+#include "types.h"
+
+
+namespace mhc {
+
+	namespace core {
+
+		// What compare returns, "data Ordering = LT | EQ | GT" as the Prelude
+		// declares it. Every module has it unless it declares its own.
+		const parser::algebraic_datatype_decl& orderingDecl();
+
+		// Turns the bindings of a module into Core. Equations are matched top to
+		// bottom, a failed pattern or guard jumps to a join point holding the
+		// next equation, and an if in the middle of an expression joins its
+		// branches the same way. && and || branch like an if, their right
+		// operand is only evaluated when it decides the result. Declarations lowered elsewhere (another
+		// partition, batch or module) are only declared, their types come from
+		// the environment.
+		//
+		// Types are inferred first. A polymorphic function is defined at the
+		// types its variables default to under its own name, and every other
+		// type it's used at gets a specialization, "f{Double}".
+		//
+		// There are no dictionaries. A derived class method used at a data
+		// type is a direct function generated for that type, "=={Color}" or
+		// "compare{Color}", and a comparison of data values calls it.
+		// compare returns Ordering, which every module declares implicitly.
+		class desugarer {
+		public:
+			// Signatures, fixities, synonyms and data types of the whole module,
+			// and the equations of every binding so types can be worked out for
+			// those without a signature
+			void addEnvironment(const parser::module_decl& module);
+			void addDataType(const parser::algebraic_datatype_decl& decl);
+			void addSynonym(const parser::type_synonym_decl& decl);
+
+			// A top-level declaration to define
+			void addDecl(const std::string& decl);
+
+			bool empty() const { return m_decls.empty(); }
+
+			// Values exported by the imported modules
+			void setImports(iface::import_env* imports) { m_imports = imports; }
+
+			// Names nothing declares may be defined by another batch, typed by
+			// 'signatures', the module's top-level signatures
+			void setOpenWorld(const std::map<std::string, syntax::type_expr>* signatures) { m_openWorld = signatures; }
+
+			// Binding groups that don't depend on each other are inferred on
+			// up to this many threads, the result is the same for any number
+			void setThreads(unsigned threads) { m_threads = threads; }
+
+			// Desugars the declarations added since the last call, errors are
+			// written to cerr
+			bool finish(module& result);
+
+		private:
+			// Where the next expression goes
+			struct hole {
+				enum class slot : std::uint8_t { none, function, body, code, alt } where = slot::none;
+				std::uint32_t index = 0;
+			};
+
+			// Core types of the generic variables of a function's type
+			using substitution = std::map<infer::node_id, type_id>;
+
+			// What the parameters and let bindings in scope are bound to
+			using scope_t = scoped_table<atom>;
+
+			// Checkers number their variables differently, a specialization
+			// lists the types of the generic variables in order of appearance
+			struct specialization {
+				std::string name;
+				var_id symbol;
+				std::vector<type_id> types;
+			};
+
+			void declareDataTypes();
+			void parseDecls();
+			void inferTypes();
+			void desugarFunction(const std::string& name, var_id self, const std::vector<type_id>& generics);
+
+			type_id coreType(infer::node_id t, const substitution& types);
+			type_id typeOf(const syntax::expr& e);
+			bool bindGenerics(infer::node_id t, type_id concrete, substitution& types);
+			var_id declareInstance(const std::string& name, size_t arity, substitution& types);
+			var_id instance(const std::string& name, const std::vector<type_id>& params, type_id result);
+
+			void error(const std::string& message);
+
+			void fill(expr_id e);
+			void emit(const expr& x);
+			var_id emitLet(expr x, type_id type, const std::string& name = "");
+			void emitFail(var_id label);
+			std::uint32_t emitMatch(const atom& scrutinee, const std::vector<alt>& alts);
+
+			void desugarClauses(const std::vector<syntax::clause>& clauses, size_t index, const std::vector<var_id>& params);
+			void matchPattern(const syntax::pattern& p, var_id value, var_id failLabel);
+			void desugarRhs(const std::vector<syntax::guarded_rhs>& rhs, var_id failLabel);
+			void desugarTail(const syntax::expr& e);
+			atom desugarAtom(const syntax::expr& e);
+			atom desugarCall(const std::string& callee, bool isConstructor, const std::vector<const syntax::expr*>& args, type_id result);
+			atom desugarBinary(const syntax::expr& e);
+			atom desugarIf(const syntax::expr& test, const syntax::expr& then, const syntax::expr& otherwise, type_id t);
+			bool shortCircuit(const syntax::expr& e, const syntax::expr* branches[2]) const;
+			bool coerce(const atom& a, type_id type);
+
+			bool derives(type_id t, const std::string& typeClass) const;
+			std::vector<std::uint32_t> constructorsOf(type_id t) const;
+			atom desugarComparison(ops::opcode code, const atom& lhs, const atom& rhs);
+			type_id orderingType();
+			void returnOrder(int order);
+			atom desugarMethod(const std::string& name, const std::vector<atom>& values, type_id result);
+			var_id derivedInstance(const std::string& method, type_id t);
+			void deriveInstance(const specialization& derived);
+			void deriveEq(var_id x, var_id y);
+			void deriveCompare(var_id x, var_id y);
+			void deriveEnum(const std::string& method, var_id x);
+			void compareFields(const atom& lhs, const atom& rhs);
+			std::uint32_t matchConstructors(var_id value, std::vector<std::vector<var_id>>& fields);
+			std::vector<var_id> matchConstructor(var_id value, std::uint32_t index);
+
+			atom emitPrim(ops::opcode code, const atom& lhs, const atom& rhs);
+			atom emitConstructor(std::uint32_t index, const std::vector<atom>& fields);
+			atom emitTag(const atom& value);
+			void emitReturn(const atom& value);
+
+			std::vector<std::string> m_decls;
+			std::vector<std::string> m_environment;
+			std::vector<parser::algebraic_datatype_decl> m_dataTypes;
+			std::map<std::string, parser::type_synonym_decl> m_synonyms;
+			types::synonym_table m_synonymTable;
+			iface::import_env* m_imports = nullptr;
+			const std::map<std::string, syntax::type_expr>* m_openWorld = nullptr;
+
+			module* m_module = nullptr;
+			bool m_ok = true;
+			syntax::fixity_table m_fixities;
+			std::map<std::string, syntax::type_expr> m_signatures;
+			std::map<std::string, std::vector<syntax::clause>> m_equations;
+			std::vector<std::string> m_defined;
+			infer::checker m_base;
+			std::vector<std::unique_ptr<infer::checker>> m_checkers;
+			std::map<std::string, infer::checker*> m_checkerOf;
+			infer::checker* m_checker = nullptr;          // Of the function being desugared
+			std::map<std::string, std::string> m_typeErrors;
+			unsigned m_threads = 1;
+			std::map<std::string, var_id> m_instances;    // By symbol
+			std::vector<specialization> m_pending;        // Left to desugar
+			std::map<type_id, std::vector<std::string>> m_deriving;
+			std::vector<specialization> m_derived;        // Left to generate, 'name' is the method
+
+			// State of the function being desugared
+			std::string m_where;
+			bool m_failed = false;
+			type_id m_result = g_none;
+			substitution m_types;
+			hole m_hole;
+			function m_function;
+			scope_t m_scope;
+		};
+
+		// Whether a function is a specialization, which every module using it
+		// defines for itself
+		bool isSpecialization(const std::string& name);
+
+	}
+
+}
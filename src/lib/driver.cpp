@@ -1,16 +1,42 @@
 #include "driver.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
 #include <boost/variant/get.hpp>
 
-#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
 #include <llvm/IR/IRBuilder.h>
 #include "llvm/IR/LLVMContext.h"
 #include <llvm/IR/Module.h>
-#include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
 
-#include "parser.h"
+#include "cache.h"
 #include "codegen.h"
+#include "decl_graph.h"
+#include "interface.h"
+#include "llvm_compat.h"
+#include "mem_report.h"
+#include "parser.h"
+#include "profile.h"
+#include "remarks.h"
+#include "syntax.h"
+#include "thread_pool.h"
+#include "timing.h"
 
 
 using namespace mhc;
@@ -19,98 +45,1117 @@ using namespace parser;
 using namespace llvm;
 using namespace std;
 
+// 'opt' and 'llc' of the LLVM release mhc is built against
+#ifndef MHC_LLVM_TOOL_SUFFIX
+#define MHC_LLVM_TOOL_SUFFIX "-3.5"
+#endif
+
+namespace {
+
+	const string g_compilerVersion = "mhc-0.2";
+
+	// Flags passed to 'opt' and 'llc' per optimization level, these are part of
+	// the cache key. -O0 doesn't run 'opt' and uses the fast instruction selector.
+	const unsigned g_maxOptLevel = 3;
+	const char* const g_optFlags[g_maxOptLevel + 1] = {
+		"",
+		"-O1",
+		"-O2 -loop-vectorize -slp-vectorizer",
+		"-O3 -loop-unroll -loop-vectorize -slp-vectorizer",
+	};
+	const char* const g_llcFlags[g_maxOptLevel + 1] = {
+		"-O0 -fast-isel -relocation-model=pic",
+		"-O1 -relocation-model=pic",
+		"-O2 -relocation-model=pic",
+		"-O3 -relocation-model=pic",
+	};
+
+	// Inlining thresholds of the in-process pipelines at -O2 and -O3
+	const int g_inlineThreshold[g_maxOptLevel + 1] = { 0, 0, 225, 275 };
+
+	unsigned optLevel(const driver::options& opts) {
+		return min(opts.optLevel, g_maxOptLevel);
+	}
+
+	// Rough heap use of a module's IR: instructions with their operands, blocks,
+	// functions and globals
+	uint64_t moduleBytes(const Module& module) {
+		uint64_t bytes = sizeof(Module);
+		for (auto itr = module.global_begin(); itr != module.global_end(); ++itr) {
+			bytes += sizeof(GlobalVariable);
+		}
+
+		for (const auto& function : module) {
+			bytes += sizeof(Function) + function.arg_size() * sizeof(Argument);
+			for (const auto& bb : function) {
+				bytes += sizeof(BasicBlock);
+				for (const auto& inst : bb) {
+					bytes += sizeof(Instruction) + inst.getNumOperands() * sizeof(Use);
+				}
+			}
+		}
+
+		return bytes;
+	}
+
+	// LLVM prints a per-pass report when each pass manager is destroyed
+	void enablePassTiming() {
+		static std::once_flag once;
+		std::call_once(once, [] { TimePassesIsEnabled = true; });
+	}
+
+	// Turns LLVM's optimization remarks into mhc remarks located at their
+	// declaration through the source_map passed as 'context'. Everything
+	// else is handled like LLVM's default handler would: printed, and an
+	// error ends the process.
+	void diagnosticHandler(const DiagnosticInfo& info, void* context) {
+		const int kind = info.getKind();
+		if (kind != DK_OptimizationRemark && kind != DK_OptimizationRemarkMissed && kind != DK_OptimizationRemarkAnalysis) {
+			switch (info.getSeverity()) {
+				case DS_Error:   errs() << "error: ";   break;
+				case DS_Warning: errs() << "warning: "; break;
+				case DS_Remark:  errs() << "remark: ";  break;
+				case DS_Note:    errs() << "note: ";    break;
+			}
+
+			DiagnosticPrinterRawOStream printer(errs());
+			info.print(printer);
+			errs() << "\n";
+
+			if (info.getSeverity() == DS_Error) {
+				exit(1);
+			}
+			return;
+		}
+
+		const auto& optRemark = static_cast<const compat::optimization_remark&>(info);
+
+		mhc::remarks::remark r;
+		r.kind = (kind == DK_OptimizationRemark ? mhc::remarks::remark_kind::passed
+		        : kind == DK_OptimizationRemarkMissed ? mhc::remarks::remark_kind::missed : mhc::remarks::remark_kind::analysis);
+		r.pass = StringRef(optRemark.getPassName()).str();
+		r.function = optRemark.getFunction().getName().str();
+		r.message = Twine(optRemark.getMsg()).str();
+
+		// Size remarks hang off whichever function the pass manager had at
+		// hand. The module-wide count belongs to no function, a function's
+		// own count names it in an argument.
+		if (r.pass == "size-info") {
+			r.function = (compat::remarkName(optRemark) == "FunctionIRSizeChange" ? compat::remarkArgument(optRemark, "Function") : "");
+		}
+
+		if (context) {
+			static_cast<const mhc::remarks::source_map*>(context)->locate(r);
+		}
+		mhc::remarks::emit(r);
+	}
+
+	// Passes report remarks to the context they run in, 'sources' may be null
+	// when nothing is known about the source
+	void collectRemarks(LLVMContext& context, mhc::remarks::source_map* sources) {
+		if (mhc::remarks::enabled()) {
+			compat::setDiagnosticHandler(context, diagnosticHandler, sources);
+		}
+	}
+
+	// Records one of mhc's own decisions about 'function'
+	void emitRemark(mhc::remarks::remark_kind kind, const char* pass, const Function& function, const string& message) {
+		if (!mhc::remarks::wanted(kind, pass)) {
+			return;
+		}
+
+		mhc::remarks::remark r;
+		r.kind = kind;
+		r.pass = pass;
+		r.function = function.getName().str();
+		r.message = message;
+
+		const LLVMContext& context = function.getContext();
+		if (compat::diagnosticHandler(context) == diagnosticHandler && compat::diagnosticContext(context)) {
+			static_cast<const mhc::remarks::source_map*>(compat::diagnosticContext(context))->locate(r);
+		}
+		mhc::remarks::emit(r);
+	}
+
+	// Drops the declarations nothing reachable from 'main' or the exports
+	// uses, before they cost code generation and optimization time
+	void dropDeadDecls(module_decl& module, const driver::options& opts, const mhc::remarks::source_map& sources) {
+		const size_t count = module.body.size();
+
+		vector<string> eliminated;
+		{
+			timing::scoped_phase phase("dead decls", module.module_id);
+			eliminated = eliminateDeadDecls(module);
+		}
+
+		if (mhc::remarks::wanted(mhc::remarks::remark_kind::passed, "mhc-dce")) {
+			for (const auto& name : eliminated) {
+				mhc::remarks::remark r;
+				r.kind = mhc::remarks::remark_kind::passed;
+				r.pass = "mhc-dce";
+				r.function = name;
+				r.message = "declaration eliminated, nothing reachable from main or the exports uses it";
+
+				sources.locate(r);
+				mhc::remarks::emit(r);
+			}
+		}
+
+		if (opts.deadDeclStats) {
+			cout << "Declarations eliminated: " << eliminated.size() << " of " << count << endl;
+		}
+	}
+
+	// Hash of every profile in the directory, a new profile invalidates cached objects
+	string profileDigest(const string& directory) {
+		vector<string> parts;
+		boost::system::error_code ec;
+		for (boost::filesystem::directory_iterator itr(directory, ec), end; !ec && itr != end; ++itr) {
+			if (itr->path().extension() == ".mhprof") {
+				ifstream in(itr->path().string().c_str(), ios::binary);
+				parts.push_back(itr->path().filename().string() + "\n" + string(istreambuf_iterator<char>(in), istreambuf_iterator<char>()));
+			}
+		}
+		std::sort(parts.begin(), parts.end());
+
+		return cache::hashKey(parts);
+	}
+
+	// Declarations lowered into one module before a streaming compile flushes it
+	const size_t g_streamBatchSize = 256;
+
+	// Functions up to this many instructions ship an unfolding in the interface
+	// even without an INLINE pragma
+	const size_t g_unfoldingThreshold = 24;
+
+	// Intermediate files are named after the file they lead to: "Foo.o" ->
+	// "Foo.bc", "Foo_opt.bc", and the executable "Foo" -> "Foo.o", so compiles
+	// to different outputs in one directory don't overwrite each other's
+	string intermediateName(const string& filename, const string& suffix) {
+		const boost::filesystem::path path(filename);
+		return (path.parent_path() / (path.stem().string() + suffix)).string();
+	}
+
+	// "-mcpu"/"-mattr" for 'opt' and 'llc', nothing selects generic x86-64
+	string targetFlags(const driver::options& opts) {
+		string flags;
+		if (!opts.cpu.empty()) {
+			flags += " -mcpu=" + opts.cpu;
+		}
+		if (!opts.features.empty()) {
+			flags += " -mattr=" + opts.features;
+		}
+
+		return flags;
+	}
+
+	// Optimize the generated bitcode with LLVM 'opt', produces an optimized bitcode file.
+	// The target flags let the vectorizers use the selected CPU's vector width.
+	bool optimize(const string& bitCodeFilename, const string& optBitCodeFilename, const driver::options& opts) {
+		timing::scoped_phase phase("optimize", bitCodeFilename);
+
+		const string optCmd = "opt" MHC_LLVM_TOOL_SUFFIX " -filetype=obj -o " + optBitCodeFilename + " " + g_optFlags[optLevel(opts)] + targetFlags(opts)
+		                    + (opts.timePasses ? " -time-passes " : " ") + bitCodeFilename;
+
+		const int retval = system(optCmd.c_str());
+		if (retval != 0) {
+			cerr << "Error running 'opt': \"" << optCmd << "\"" << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Transform the bitcode into an object file with LLVM 'llc'
+	bool emitObject(const string& optBitCodeFilename, const string& objFilename, const driver::options& opts) {
+		timing::scoped_phase phase("emit object", objFilename);
+
+		const string llcCmd = "llc" MHC_LLVM_TOOL_SUFFIX " -filetype=obj " + string(g_llcFlags[optLevel(opts)]) + targetFlags(opts)
+		                    + (opts.timePasses ? " -time-passes" : "") + " -o " + objFilename + " " + optBitCodeFilename;
+
+		const int retval = system(llcCmd.c_str());
+		if (retval != 0) {
+			cerr << "Error running 'llc': \"" << llcCmd << "\"" << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Leverage gcc here to link the object files into the final executable
+	// this is mainly to bypass the more complicated options that the system 'ld' needs
+	bool linkExecutable(const vector<string>& objFilenames, const string& exeName) {
+		timing::scoped_phase phase("link", exeName);
+
+		const string outputExeName = (exeName.empty() ? "a.out" : exeName);
+		string gccCmd = "gcc -o " + outputExeName;
+		for (const auto& itr : objFilenames) {
+			gccCmd += " " + itr;
+		}
+
+		const int retval = system(gccCmd.c_str());
+		if (retval != 0) {
+			cerr << "Error running 'gcc': \"" << gccCmd << "\"" << " -- returned: " << retval << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// The in-process counterpart of 'opt' for modules that skip it (partitions,
+	// batches, cached declarations). -O1 only inlines INLINE pragmas.
+	void optimizeModule(Module& module, unsigned level) {
+		if (level == 0) {
+			return;
+		}
+
+		timing::scoped_phase phase("optimize", module.getModuleIdentifier());
+
+		PassManagerBuilder passBuilder;
+		passBuilder.OptLevel = level;
+		passBuilder.Inliner = (level > 1 ? createFunctionInliningPass(g_inlineThreshold[level]) : compat::createAlwaysInlinerPass());
+		passBuilder.LoopVectorize = (level > 1);
+		passBuilder.SLPVectorize = (level > 1);
+
+		compat::module_pass_manager passes;
+		passBuilder.populateModulePassManager(passes);
+		passes.run(module);
+	}
+
+	size_t instructionCount(const Function& function) {
+		size_t count = 0;
+		for (const auto& bb : function) {
+			count += bb.size();
+		}
+
+		return count;
+	}
+
+	// A global can also be an operand of a constant, such as a GEP into a
+	// private string or a bitcast of an internal function
+	bool referencesLocalSymbol(const Value* value, const Function& function, set<const Constant*>& seen) {
+		if (const GlobalValue* const global = dyn_cast<GlobalValue>(value)) {
+			return global != &function && global->hasLocalLinkage();
+		}
+
+		const Constant* const constant = dyn_cast<Constant>(value);
+		if (!constant || !seen.insert(constant).second) {
+			return false;
+		}
+
+		for (const auto& op : constant->operands()) {
+			if (referencesLocalSymbol(op.get(), function, seen)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// An unfolding can only refer to symbols the importer can link against
+	bool referencesLocalSymbols(const Function& function) {
+		set<const Constant*> seen;
+		for (const auto& bb : function) {
+			for (const auto& inst : bb) {
+				for (const auto& op : inst.operands()) {
+					if (referencesLocalSymbol(op.get(), function, seen)) {
+						return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+
+	// Optimized bitcode of small or INLINE marked functions importers can call,
+	// each in a module of its own where everything else is only declared
+	iface::unfolding_map extractUnfoldings(const Module& module, const vector<string>& marked, const ast_codegen& codeGenerator) {
+		timing::scoped_phase phase("unfoldings", module.getModuleIdentifier());
+		iface::unfolding_map unfoldings;
+
+		for (const auto& function : module) {
+			const string name = function.getName().str();
+			const bool isMarked = find(marked.begin(), marked.end(), name) != marked.end();
+
+			// Split modules hide what they don't export instead of making it local
+			if (function.isDeclaration() || function.hasLocalLinkage() || !codeGenerator.exportsUnfolding(name)) {
+				continue;
+			}
+			if (referencesLocalSymbols(function)) {
+				emitRemark(mhc::remarks::remark_kind::missed, "mhc-unfolding", function,
+				           "no unfolding exported, the body references symbols local to the module");
+				continue;
+			}
+
+			const size_t size = instructionCount(function);
+			if (!isMarked && size > g_unfoldingThreshold) {
+				emitRemark(mhc::remarks::remark_kind::missed, "mhc-unfolding", function,
+				           "no unfolding exported, " + to_string(size) + " instructions exceed the threshold of "
+				           + to_string(g_unfoldingThreshold) + " without an INLINE pragma");
+				continue;
+			}
+
+			emitRemark(mhc::remarks::remark_kind::passed, "mhc-unfolding", function,
+			           isMarked ? "unfolding exported for the INLINE pragma"
+			                    : "unfolding exported, " + to_string(size) + " instructions");
+
+			unique_ptr<Module> unfolding = compat::cloneModule(module);
+
+			for (auto& itr : *unfolding) {
+				if (itr.getName() != name && !itr.isDeclaration()) {
+					itr.deleteBody();
+				}
+			}
+			for (auto itr = unfolding->global_begin(); itr != unfolding->global_end(); ++itr) {
+				if (!itr->isDeclaration()) {
+					itr->setInitializer(nullptr);
+					itr->setLinkage(GlobalValue::ExternalLinkage);
+				}
+			}
+
+			Function* target = unfolding->getFunction(name);
+			target->addFnAttr(isMarked ? Attribute::AlwaysInline : Attribute::InlineHint);
+
+			PassManagerBuilder passBuilder;
+			passBuilder.OptLevel = 2;
+
+			compat::module_pass_manager passes;
+			passBuilder.populateModulePassManager(passes);
+			passes.run(*unfolding);
+
+			string bitCode;
+			{
+				raw_string_ostream outStream(bitCode);
+				compat::writeBitcode(*unfolding, outStream);
+			}
+
+			unfoldings[name] = bitCode;
+		}
+
+		return unfoldings;
+	}
+
+	// Links the unfoldings of called imported functions into the module as
+	// available_externally definitions, which the inliner can use but which
+	// are never emitted, the call still resolves against the defining module
+	bool importUnfoldings(Module& module, iface::import_env& imports) {
+		timing::scoped_phase phase("import unfoldings", module.getModuleIdentifier());
+		vector<string> declared;
+		for (const auto& function : module) {
+			if (function.isDeclaration() && !function.use_empty()) {
+				declared.push_back(function.getName().str());
+			}
+		}
+
+		for (const auto& name : declared) {
+			boost::string_ref payload;
+			if (!imports.lookup(name, iface::entry_kind::unfolding, payload)) {
+				continue;
+			}
+
+			unique_ptr<Module> unfolding = compat::parseBitcode(StringRef(payload.data(), payload.size()), name, module.getContext());
+			if (!unfolding) {
+				cerr << "Warning: Ignoring unreadable unfolding: " << name << endl;
+				continue;
+			}
+
+			unfolding->getFunction(name)->setLinkage(GlobalValue::AvailableExternallyLinkage);
+
+			string errorInfo;
+			if (!compat::linkModules(module, std::move(unfolding), errorInfo)) {
+				cerr << "Failed to link unfolding: " << errorInfo << endl;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	bool verifyGenerated(Module& module) {
+		timing::scoped_phase phase("verify", module.getModuleIdentifier());
+		string errorInfo;
+		raw_string_ostream errorOut(errorInfo);
+
+		if (verifyModule(module, &errorOut)) {
+			cerr << "Failed to generate LLVM IR: " << errorOut.str() << endl;
+
+			module.print(errorOut, nullptr);
+			cerr << "Module:" << endl << errorOut.str() << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Merges objects into a single relocatable object with the system 'ld'
+	bool combineObjects(const vector<string>& objFilenames, const string& objFilename) {
+		timing::scoped_phase phase("link", objFilename);
+		string ldCmd = "ld -r -o " + objFilename;
+		for (const auto& itr : objFilenames) {
+			ldCmd += " " + itr;
+		}
+
+		const int retval = system(ldCmd.c_str());
+		if (retval != 0) {
+			cerr << "Error running 'ld': \"" << ldCmd << "\"" << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Verifies, optimizes and writes out a module generated on its own: collects
+	// its unfoldings when 'inlined' is set, then links in imported ones. Both
+	// are skipped at -O0.
+	bool finishModule(Module& module, const ast_codegen& codeGenerator, const string& bitCodeName, iface::import_env& imports,
+	                  const vector<string>* inlined, iface::unfolding_map& unfoldings, unsigned level) {
+		if (!verifyGenerated(module)) {
+			return false;
+		}
+
+		// Nothing inlines at -O0, unfoldings would only cost time
+		if (inlined && level > 0) {
+			const auto found = extractUnfoldings(module, *inlined, codeGenerator);
+			unfoldings.insert(found.begin(), found.end());
+		}
+
+		if (level > 0 && !importUnfoldings(module, imports)) {
+			return false;
+		}
+
+		optimizeModule(module, level);
+
+		if (mem_report::enabled()) {
+			mem_report::sample("optimize " + module.getModuleIdentifier(), { { "LLVM module", moduleBytes(module) } });
+		}
+
+		string errorInfo;
+		if (!compat::writeBitcodeFile(module, bitCodeName, errorInfo)) {
+			cerr << "Failed to write bitcode: " << errorInfo << endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Lowers and optimizes one group of declarations in a context of its own,
+	// references to declarations in other groups are left as external symbols
+	bool generatePartition(const module_decl& decl, const decl_graph& graph, const vector<size_t>& group,
+	                       const string& bitCodeName, const driver::options& opts, mhc::remarks::source_map* sources,
+	                       const vector<string>* inlined, iface::unfolding_map& unfoldings) {
+		LLVMContext context;
+		collectRemarks(context, sources);
+		unique_ptr<Module> module(new Module(decl.module_id, context));
+		IRBuilder<> builder(context);
+
+		iface::import_env imports(opts.importDir);
+		ast_codegen codeGenerator(module.get(), builder);
+		codeGenerator.setImports(&imports);
+		codeGenerator.setCoreDump(opts.dumpCore ? &cerr : nullptr);
+		codeGenerator.desugarer().setThreads(opts.typeCheckThreads);
+
+		bool lowered = false;
+		{
+			timing::scoped_phase phase("codegen", bitCodeName);
+
+			// Every group sees all of the module's imports and declarations
+			codeGenerator.visitHeader(decl);
+
+			codeGenerator.setSplitModule(true);
+
+			for (const size_t n : group) {
+				boost::apply_visitor(codeGenerator, *graph.nodes[n].decl);
+			}
+
+			lowered = codeGenerator.finalizeLinkage();
+		}
+
+		return lowered && finishModule(*module, codeGenerator, bitCodeName, imports, inlined, unfoldings, optLevel(opts));
+	}
+
+	// Partitions the module by call graph components and generates, optimizes
+	// and emits every partition on its own thread
+	bool compilePartitioned(const string& fileContents, const string& objName, const driver::options& opts,
+	                        const string& interfaceName) {
+		base_expr_node rootAst;
+		{
+			timing::scoped_phase phase("parse");
+			if (!parse(fileContents, rootAst)) {
+				cerr << "Failed to parse source file!" << endl;
+				return false;
+			}
+		}
+
+		// Without a module header the root declarations form the module
+		base_expr* expr = boost::get<base_expr>(&rootAst);
+		module_decl headerless;
+		module_decl* moduleDecl = &headerless;
+
+		for (auto& itr : expr->children) {
+			if (module_decl* found = boost::get<module_decl>(&itr)) {
+				moduleDecl = found;
+			} else {
+				headerless.body.push_back(itr);
+			}
+		}
+
+		// Only read by the partitions' threads
+		mhc::remarks::source_map sources(moduleDecl->module_id, fileContents, opts.sourceName);
+		if (mhc::remarks::enabled()) {
+			sources.addModule(*moduleDecl);
+		}
+
+		dropDeadDecls(*moduleDecl, opts, sources);
+
+		decl_graph graph;
+		vector<vector<size_t>> groups;
+		{
+			timing::scoped_phase phase("decl graph");
+			graph = buildDeclGraph(*moduleDecl);
+			groups = partitionComponents(graph, opts.codegenPartitions);
+		}
+		if (groups.empty()) {
+			groups.push_back({});
+		}
+
+		const vector<string> inlined = iface::inlinePragmas(fileContents);
+		const size_t count = groups.size();
+
+		vector<string> objNames(count);
+		vector<iface::unfolding_map> unfoldings(count);
+		vector<char> succeeded(count, 0);
+
+		{
+			thread_pool pool(static_cast<unsigned>(count));
+
+			for (size_t k = 0; k < count; ++k) {
+				objNames[k] = intermediateName(objName, ".part" + to_string(k) + ".o");
+
+				pool.submit([&, k] {
+					const string bitCodeName = intermediateName(objName, ".part" + to_string(k) + ".bc");
+
+					succeeded[k] = generatePartition(*moduleDecl, graph, groups[k], bitCodeName, opts, &sources,
+					                                 interfaceName.empty() ? nullptr : &inlined, unfoldings[k])
+					            && emitObject(bitCodeName, objNames[k], opts);
+
+					boost::filesystem::remove(bitCodeName);
+				});
+			}
+
+			pool.wait();
+		}
+
+		// The partitions' objects are removed whether or not they're combined
+		bool ok = (find(succeeded.begin(), succeeded.end(), 0) == succeeded.end());
+
+		if (ok && !interfaceName.empty()) {
+			iface::unfolding_map merged;
+			for (const auto& itr : unfoldings) {
+				merged.insert(itr.begin(), itr.end());
+			}
+
+			ok = iface::writeInterface(*moduleDecl, interfaceName, merged);
+			if (!ok) {
+				cerr << "Failed to write interface file: " << interfaceName << endl;
+			}
+		}
+
+		ok = ok && combineObjects(objNames, objName);
+		for (const auto& itr : objNames) {
+			boost::filesystem::remove(itr);
+		}
+
+		return ok;
+	}
+
+	// Parses, lowers and releases one top-level declaration at a time. Every
+	// g_streamBatchSize declarations the batch's module is optimized, emitted
+	// to an object and freed along with its context, so neither the whole AST
+	// nor the whole IR is ever held. Only the interface summary is kept.
+	// Whether a declaration is dead isn't known before the end of the module,
+	// so nothing is eliminated.
+	bool compileStreaming(const string& fileContents, const string& objName, const driver::options& opts,
+	                      const string& interfaceName) {
+		const vector<string> inlined = iface::inlinePragmas(fileContents);
+
+		// Every batch needs the types of the names the others define
+		const map<string, syntax::type_expr> signatures = syntax::topLevelSignatures(fileContents);
+		const vector<string>* collectInlined = (interfaceName.empty() ? nullptr : &inlined);
+
+		iface::import_env imports(opts.importDir);
+		iface::unfolding_map unfoldings;
+		module_decl summary;
+		vector<string> objNames;
+
+		unique_ptr<mhc::remarks::source_map> sources;
+		unique_ptr<LLVMContext> context;
+		unique_ptr<Module> module;
+		unique_ptr<IRBuilder<>> builder;
+		unique_ptr<ast_codegen> codeGenerator;
+		vector<base_expr_node> typeDecls;
+		size_t batchDecls = 0;
+		bool flushFailed = false;
+
+		auto startBatch = [&] {
+			context.reset(new LLVMContext);
+			collectRemarks(*context, sources.get());
+			module.reset(new Module(summary.module_id, *context));
+			builder.reset(new IRBuilder<>(*context));
+			codeGenerator.reset(new ast_codegen(module.get(), *builder));
+			codeGenerator->setImports(&imports);
+			codeGenerator->setModuleHeader(summary);
+			codeGenerator->setSplitModule(true);
+			codeGenerator->setCoreDump(opts.dumpCore ? &cerr : nullptr);
+			codeGenerator->desugarer().setThreads(opts.typeCheckThreads);
+
+			// Later declarations aren't known yet, earlier data types are
+			codeGenerator->desugarer().setOpenWorld(&signatures);
+			for (const auto& itr : typeDecls) {
+				boost::apply_visitor(*codeGenerator, itr);
+			}
+			batchDecls = 0;
+		};
+
+		auto flushBatch = [&] {
+			const string suffix = ".batch" + to_string(objNames.size());
+			const string bitCodeName = intermediateName(objName, suffix + ".bc");
+			objNames.push_back(intermediateName(objName, suffix + ".o"));
+
+			const bool ok = codeGenerator->finalizeLinkage()
+			             && finishModule(*module, *codeGenerator, bitCodeName, imports, collectInlined, unfoldings, optLevel(opts))
+			             && emitObject(bitCodeName, objNames.back(), opts);
+
+			// Release in dependency order, the context goes last
+			codeGenerator.reset();
+			builder.reset();
+			module.reset();
+			context.reset();
+
+			boost::filesystem::remove(bitCodeName);
+			return ok;
+		};
+
+		const bool parsed = parseStream(fileContents, summary, [&](const base_expr_node& decl) {
+			// The header has been parsed by the first declaration
+			if (mhc::remarks::enabled()) {
+				if (!sources) {
+					sources.reset(new mhc::remarks::source_map(summary.module_id, fileContents, opts.sourceName));
+				}
+				sources->add(decl);
+			}
+
+			if (!module) {
+				startBatch();
+			}
+
+			if (boost::get<algebraic_datatype_decl>(&decl) || boost::get<type_synonym_decl>(&decl)) {
+				typeDecls.push_back(decl);
+			}
+
+			{
+				const vector<string> names = declNames(decl);
+				timing::scoped_phase phase("codegen", names.empty() ? string() : names[0]);
+				boost::apply_visitor(*codeGenerator, decl);
+			}
+
+			if (!interfaceName.empty()) {
+				summary.body.push_back(iface::interfaceSummary(decl));
+			}
+
+			if (++batchDecls >= g_streamBatchSize && !flushBatch()) {
+				flushFailed = true;
+				return false;
+			}
+
+			return true;
+		});
+
+		if (!parsed) {
+			if (!flushFailed) {
+				cerr << "Failed to parse source file!" << endl;
+			}
+			return false;
+		}
+
+		// An empty module still gets an object
+		if (!module && objNames.empty()) {
+			startBatch();
+		}
+		if (module && !flushBatch()) {
+			return false;
+		}
+
+		if (!interfaceName.empty() && !iface::writeInterface(summary, interfaceName, unfoldings)) {
+			cerr << "Failed to write interface file: " << interfaceName << endl;
+			return false;
+		}
+
+		const bool combined = combineObjects(objNames, objName);
+		for (const auto& itr : objNames) {
+			boost::filesystem::remove(itr);
+		}
+
+		return combined;
+	}
+
+	// Lowers each top-level declaration of the module into its own LLVM module,
+	// optimizes it and caches the bitcode by the declaration's fingerprint. An
+	// unchanged declaration (including everything it references) is read back
+	// from the cache instead of going through ast_codegen again.
+	bool generateIncremental(const module_decl& decl, Module& module, const string& tmpDeclBCName, const driver::options& opts) {
+		cache::object_cache declCache((boost::filesystem::path(opts.cacheDir) / "decls").string(), opts.cacheMaxBytes, ".bc");
+
+		const decl_graph graph = buildDeclGraph(decl);
+		const vector<string> fingerprints = declFingerprints(graph);
+		LLVMContext& context = module.getContext();
+		iface::import_env imports(opts.importDir);
+
+		// Hashes the profile files too, once is enough. An import binds no
+		// names, so no fingerprint reaches the interfaces it brings in, but
+		// any declaration may be lowered against them.
+		vector<string> configParts = { driver::configurationKey(opts) };
+		for (const auto& itr : decl.body) {
+			if (const import_decl* import = boost::get<import_decl>(&itr)) {
+				iface::interface_file importInterface;
+				importInterface.open(iface::interfacePath(opts.importDir, import->module_id));
+				configParts.push_back(import->module_id);
+				configParts.push_back(importInterface.contentHash());
+			}
+		}
+		const string configKey = cache::hashKey(configParts);
+
+		size_t next = 0;
+		size_t groups = 0;
+		for (size_t i = 0; i < graph.nodes.size(); i = next, ++groups) {
+			const vector<string> names = declNames(*graph.nodes[i].decl);
+			timing::scoped_phase phase("codegen", names.empty() ? fingerprints[i] : names[0]);
+
+			// The equations and signature of a function are lowered together
+			vector<string> groupKey = { configKey, "decl", fingerprints[i] };
+			for (next = i + 1; next < graph.nodes.size() && !names.empty() && declNames(*graph.nodes[next].decl) == names; ++next) {
+				groupKey.push_back(fingerprints[next]);
+			}
+
+			const string key = cache::hashKey(groupKey);
+			unique_ptr<Module> declModule;
+
+			if (declCache.fetch(key, tmpDeclBCName)) {
+				auto buffer = MemoryBuffer::getFile(tmpDeclBCName);
+				if (buffer) {
+					declModule = compat::parseBitcode(buffer.get()->getBuffer(), tmpDeclBCName, context);
+				}
+			}
+
+			if (!declModule) {
+				declModule.reset(new Module(fingerprints[i], context));
+				IRBuilder<> builder(context);
+
+				// Declarations link against each other, nothing can be internal
+				ast_codegen codeGenerator(declModule.get(), builder);
+				codeGenerator.setImports(&imports);
+				codeGenerator.setCoreDump(opts.dumpCore ? &cerr : nullptr);
+				codeGenerator.desugarer().setThreads(opts.typeCheckThreads);
+				codeGenerator.visitHeader(decl);
+				codeGenerator.setSplitModule(true);
+				for (size_t n = i; n < next; ++n) {
+					boost::apply_visitor(codeGenerator, *graph.nodes[n].decl);
+				}
+				if (!codeGenerator.finalizeLinkage()) {
+					return false;
+				}
+
+				// Optimize in isolation so the cached copy can be linked as-is
+				optimizeModule(*declModule, optLevel(opts));
+
+				string errorInfo;
+				if (!compat::writeBitcodeFile(*declModule, tmpDeclBCName, errorInfo) || !declCache.store(key, tmpDeclBCName)) {
+					cerr << "Warning: Failed to cache declaration bitcode: " << errorInfo << endl;
+				}
+			}
+
+			string errorInfo;
+			if (!compat::linkModules(module, std::move(declModule), errorInfo)) {
+				cerr << "Failed to link declaration: " << errorInfo << endl;
+				return false;
+			}
+		}
+
+		boost::filesystem::remove(tmpDeclBCName);
+
+		if (opts.cacheStats) {
+			cout << "Declarations reused: " << declCache.hits() << " of " << groups << endl;
+		}
+
+		return true;
+	}
+
+}
+
 namespace mhc {
 
 	namespace driver {
 
-		bool generateOutput(const string& fileContents, const string& outputBitCodeName) {
+		bool generateOutput(const string& fileContents, const string& outputBitCodeName, const options& opts, const string& interfaceName) {
 			// Parse the source file
-			//cout << "Parsing..." << endl;
 			base_expr_node rootAst;
-			if (!parse(fileContents, rootAst)) {
-				cerr << "Failed to parse source file!" << endl;
-				return false;
+			{
+				timing::scoped_phase phase("parse");
+				if (!parse(fileContents, rootAst)) {
+					cerr << "Failed to parse source file!" << endl;
+					return false;
+				}
+			}
+
+			if (mem_report::enabled()) {
+				mem_report::holdings held = { { "source buffer", fileContents.capacity() } };
+				mem_report::addAst(held, mem_report::astUsage(rootAst));
+				mem_report::sample("parse", held);
 			}
 
 			// Generate the code
-			//cout << "Generating code..." << endl;
-			LLVMContext &context = getGlobalContext();
+			// Each compilation owns its context so modules can be generated on
+			// several threads at once, it's declared first so it outlives the module
+			LLVMContext context;
 			unique_ptr<Module> module(new Module("", context));
-			IRBuilder<> builder(getGlobalContext());
+			IRBuilder<> builder(context);
 
+			iface::import_env imports(opts.importDir);
 			ast_codegen codeGenerator(module.get(), builder);
+			codeGenerator.setImports(&imports);
+			codeGenerator.setCoreDump(opts.dumpCore ? &cerr : nullptr);
+			codeGenerator.desugarer().setThreads(opts.typeCheckThreads);
 
 			// Generate code for each expression at the root level
-			const base_expr* expr = boost::get<base_expr>(&rootAst);
+			base_expr* expr = boost::get<base_expr>(&rootAst);
+			module_decl* rootModule = nullptr;
+			for (auto& itr : expr->children) {
+				if (module_decl* found = boost::get<module_decl>(&itr)) {
+					rootModule = found;
+				}
+			}
+			const string moduleId = (rootModule ? rootModule->module_id : "");
+
+			// Without a module header the root declarations form the module
+			module_decl headerless;
+			module_decl& moduleDecl = (rootModule ? *rootModule : headerless);
+			if (!rootModule) {
+				headerless.body = std::move(expr->children);
+			}
+
+			// Installed before code generation, incremental compiles optimize
+			// each declaration as it's lowered
+			remarks::source_map sources(moduleId, fileContents, opts.sourceName);
+			if (remarks::enabled()) {
+				sources.addModule(moduleDecl);
+			}
+			collectRemarks(context, &sources);
+
+			dropDeadDecls(moduleDecl, opts, sources);
+			if (!rootModule) {
+				expr->children = std::move(headerless.body);
+			}
+
 			for (auto& itr : expr->children) {
-				boost::apply_visitor(codeGenerator, itr);
+				const module_decl* moduleDecl = boost::get<module_decl>(&itr);
+
+				if (moduleDecl && opts.incremental && !opts.cacheDir.empty()) {
+					if (!generateIncremental(*moduleDecl, *module, outputBitCodeName + ".decl", opts)) {
+						return false;
+					}
+				} else {
+					timing::scoped_phase phase("codegen", moduleDecl ? moduleDecl->module_id : string());
+					boost::apply_visitor(codeGenerator, itr);
+				}
+			}
+
+			if (!codeGenerator.finalizeLinkage()) {
+				return false;
+			}
+
+			if (mem_report::enabled()) {
+				mem_report::sample("codegen", { { "LLVM module", moduleBytes(*module) } });
 			}
 
 			// Perform an LLVM verify as a sanity check
-			string errorInfo;
-			raw_string_ostream errorOut(errorInfo);
+			if (!verifyGenerated(*module)) {
+				return false;
+			}
+
+			// Counters keep instrumented functions out of the unfoldings, weights
+			// from a profile travel with them
+			if (!opts.profileGenerate.empty()) {
+				timing::scoped_phase phase("profile", moduleId);
+				profile::instrumentModule(*module, profile::profilePath(opts.profileGenerate, moduleId));
+			}
+			if (!opts.profileUse.empty()) {
+				timing::scoped_phase phase("profile", moduleId);
+				profile::applyProfile(*module, profile::profilePath(opts.profileUse, moduleId));
+			}
+
+			// Unfoldings are taken before importing any, so they only carry this
+			// module's own code
+			if (rootModule && !interfaceName.empty()) {
+				timing::scoped_phase phase("interface", interfaceName);
+				const auto unfoldings = (optLevel(opts) > 0 ? extractUnfoldings(*module, iface::inlinePragmas(fileContents), codeGenerator)
+				                                            : iface::unfolding_map());
 
-			if (verifyModule(*module, &errorOut)) {
-				cerr << "Failed to generate LLVM IR: " << errorInfo << endl;
+				if (!iface::writeInterface(*rootModule, interfaceName, unfoldings)) {
+					cerr << "Failed to write interface file: " << interfaceName << endl;
+					return false;
+				}
+			}
 
-				module->print(errorOut, nullptr);
-				cerr << "Module:" << endl << errorInfo << endl;
+			// An incremental build isn't optimized as a whole module, nothing
+			// would inline the unfoldings
+			const bool incremental = opts.incremental && !opts.cacheDir.empty();
+			if (optLevel(opts) > 0 && !incremental && !importUnfoldings(*module, imports)) {
 				return false;
 			}
 
+			if (mem_report::enabled()) {
+				mem_report::sample("unfoldings", { { "LLVM module", moduleBytes(*module) } });
+			}
+
+			// Remarks only reach the handler from passes run in this process,
+			// so the module is optimized here instead of by 'opt'
+			if (remarks::enabled() && !incremental) {
+				optimizeModule(*module, optLevel(opts));
+			}
+
 			// Dump the LLVM IR to a file
-			llvm::raw_fd_ostream outStream(outputBitCodeName.c_str(), errorInfo, llvm::sys::fs::F_None);
-			llvm::WriteBitcodeToFile(module.get(), outStream);
+			string errorInfo;
+			if (!compat::writeBitcodeFile(*module, outputBitCodeName, errorInfo)) {
+				cerr << "Failed to write bitcode: " << errorInfo << endl;
+				return false;
+			}
 
 			return true;
 		}
 
 		bool optimizeAndLink(const string& bitCodeFilename, const string& exeName) {
-			const string tmpOptBCName = "output_opt.bc";
-			const string tmpObjName = "output.o";
+			const string optBitCodeName = intermediateName(bitCodeFilename, "_opt.bc");
+			const string objName = intermediateName(bitCodeFilename, ".o");
 
-			// Optimize the generated bitcode with LLVM 'opt', produces an optimized bitcode file
-			{
-				//cout << "Optimizing..." << endl;
+			return optimize(bitCodeFilename, optBitCodeName, options())
+			    && emitObject(optBitCodeName, objName, options())
+			    && linkExecutable({ objName }, exeName);
+		}
 
-				const string optCmd = "opt-3.5 -filetype=obj -o " + tmpOptBCName + " -O3 -loop-unroll -loop-vectorize -slp-vectorizer output.bc";
+		string configurationKey(const options& opts) {
+			return cache::hashKey({ g_compilerVersion, g_optFlags[optLevel(opts)], g_llcFlags[optLevel(opts)],
+			                        (opts.incremental ? "incremental" : ""),
+			                        (opts.codegenPartitions > 1 ? "partitions=" + to_string(opts.codegenPartitions) : ""),
+			                        (opts.streaming ? "streaming" : ""),
+			                        "cpu=" + opts.cpu, "mattr=" + opts.features,
+			                        (opts.profileGenerate.empty() ? "" : "profile-generate=" + opts.profileGenerate),
+			                        (opts.profileUse.empty() ? "" : "profile-use=" + profileDigest(opts.profileUse)),
+			                        (remarks::enabled() ? "remarks" : "") });
+		}
 
-				const int retval = system(optCmd.c_str());
-				if (retval != 0) {
-					cerr << "Error running 'opt': \"" << optCmd << "\"" << endl;
-					return false;
-				}
+		string hostCPU() {
+			return sys::getHostCPUName().str();
+		}
+
+		string hostFeatures() {
+			// Not every platform can report features, the CPU name implies them
+			StringMap<bool> available;
+			if (!sys::getHostCPUFeatures(available)) {
+				return "";
 			}
 
-			// Transform the bitcode into an object file with LLVM 'llc'
-			{
-				//cout << "Linking..." << endl;
+			// Sorted so the cache key doesn't depend on hash order
+			vector<string> features;
+			for (const auto& itr : available) {
+				features.push_back((itr.getValue() ? "+" : "-") + itr.getKey().str());
+			}
+			std::sort(features.begin(), features.end());
 
-				const string llcCmd = "llc-3.5 -filetype=obj -o " + tmpObjName + " " + tmpOptBCName;
+			string result;
+			for (const auto& itr : features) {
+				result += (result.empty() ? "" : ",") + itr;
+			}
 
-				const int retval = system(llcCmd.c_str());
-				if (retval != 0) {
-					cerr << "Error running 'llc': \"" << llcCmd << "\"" << endl;
-					return false;
-				}
+			return result;
+		}
+
+		bool compileObject(const string& input, const string& objName, const options& opts, const string& interfaceName) {
+			if (opts.timePasses) {
+				enablePassTiming();
 			}
 
-			// Leverage gcc here to link the object file into the final executable
-			// this is mainly to bypass the more complicated options that the system 'ld' needs
-			{
-				//cout << "Building executable..." << endl;
-
-				const string outputExeName = (exeName.empty() ? "a.out" : exeName);
-				const string gccCmd = "gcc -o " + outputExeName + " " + tmpObjName;
-				
-				const int retval = system(gccCmd.c_str());
-				if (retval != 0) {
-					cerr << "Error running 'gcc': \"" << gccCmd << "\"" << " -- returned: " << retval << endl;
-					return false;
+			const bool profiled = !opts.profileGenerate.empty() || !opts.profileUse.empty();
+			if (opts.streaming && !profiled) {
+				return compileStreaming(input, objName, opts, interfaceName);
+			}
+			if (opts.codegenPartitions > 1 && !profiled) {
+				return compilePartitioned(input, objName, opts, interfaceName);
+			}
+
+			const string bitCodeName = intermediateName(objName, ".bc");
+			const string optBitCodeName = intermediateName(objName, "_opt.bc");
+
+			if (!generateOutput(input, bitCodeName, opts, interfaceName)) {
+				return false;
+			}
+
+			// Incremental builds link declarations that were already optimized
+			// on their own, so the whole-module 'opt' run is skipped
+			if (opts.incremental && !opts.cacheDir.empty()) {
+				return emitObject(bitCodeName, objName, opts);
+			}
+
+			// Without optimizations or already optimized in-process for remarks
+			if (optLevel(opts) == 0 || remarks::enabled()) {
+				return emitObject(bitCodeName, objName, opts);
+			}
+
+			if (!optimize(bitCodeName, optBitCodeName, opts)) {
+				return false;
+			}
+			mem_report::sample("optimize");
+
+			const bool emitted = emitObject(optBitCodeName, objName, opts);
+			mem_report::sample("emit object");
+			return emitted;
+		}
+
+		bool linkObjects(const vector<string>& objNames, const string& exeName) {
+			const bool linked = linkExecutable(objNames, exeName);
+			mem_report::sample("link");
+			return linked;
+		}
+
+		bool compile(const string& input, const string& exeName, const options& opts) {
+			const string objName = intermediateName(exeName, ".o");
+
+			if (opts.cacheDir.empty()) {
+				return compileObject(input, objName, opts) && linkObjects({ objName }, exeName);
+			}
+
+			cache::object_cache objectCache(opts.cacheDir, opts.cacheMaxBytes);
+			const string key = cache::hashKey({ configurationKey(opts), input });
+
+			bool result = false;
+			// A hit would skip the passes that report remarks and the Core dump
+			if (!remarks::enabled() && !opts.dumpCore && objectCache.fetch(key, objName)) {
+				// Cache hit, only the final link is left
+				result = linkObjects({ objName }, exeName);
+			} else {
+				result = compileObject(input, objName, opts);
+
+				if (result && !objectCache.store(key, objName)) {
+					cerr << "Warning: Failed to store object in cache: " << opts.cacheDir << endl;
 				}
+
+				result = result && linkObjects({ objName }, exeName);
 			}
 
-			return true;
+			if (opts.cacheStats) {
+				objectCache.printStats(cout);
+			}
+
+			return result;
 		}
 
 	}
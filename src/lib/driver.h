@@ -1,17 +1,109 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 
 namespace mhc {
 
 	namespace driver {
 
-		bool generateOutput(const std::string& input, const std::string& outputBitCodeName);
+		struct options {
+			// Directory of the compilation cache, empty disables caching
+			std::string cacheDir;
+
+			// Bound of the cached objects. Incremental builds keep the bitcode of
+			// each declaration under "decls" in the cache directory, bounded
+			// separately by the same size, so the directory can hold twice this.
+			std::uintmax_t cacheMaxBytes = 256 * 1024 * 1024;
+
+			// Print cache hit/miss statistics after compiling
+			bool cacheStats = false;
+
+			// Print how many declarations nothing reachable from 'main' or the
+			// exports used, these are dropped before code generation
+			bool deadDeclStats = false;
+
+			// Reuse the optimized bitcode of unchanged top-level declarations,
+			// requires a cache directory. Each declaration is optimized on its
+			// own, so calls between declarations and into imported modules
+			// aren't inlined, and the imports' unfoldings go unused.
+			bool incremental = false;
+
+			// Directory searched for the interfaces (.mhi) of imported modules
+			std::string importDir;
+
+			// Split a module's declarations into this many groups, each lowered
+			// and optimized on its own thread, and combine the objects. Calls
+			// between groups can't be inlined, so this only pays off with a
+			// core per group.
+			unsigned codegenPartitions = 1;
+
+			// Parse, lower and emit one batch of declarations at a time so peak
+			// memory doesn't grow with the size of the module
+			bool streaming = false;
+
+			// Target CPU ("-mcpu") and features ("-mattr", e.g. "+avx2,-avx512f")
+			// for 'opt' and 'llc', empty selects generic x86-64. Both are part
+			// of the cache key so objects for different targets never mix.
+			std::string cpu;
+			std::string features;
+
+			// 0-3 like "-O". -O0 skips 'opt' and the in-process optimizations and
+			// uses llc's fast instruction selector, for the edit-compile-test loop.
+			unsigned optLevel = 3;
+
+			// Path of the source file, remarks are located in it. Empty when the
+			// source text didn't come from a file, remarks then name the module.
+			std::string sourceName;
+
+			// Directory the instrumented program writes its profiles to, one
+			// "<module>.mhprof" per module, and the directory they're read from.
+			// Profiles describe a whole module, so these disable partitions and
+			// streaming.
+			std::string profileGenerate;
+			std::string profileUse;
+
+			// Print LLVM's per-pass timings, for the in-process pipelines and
+			// 'opt'/'llc'. Compiler phases are timed through mhc::timing.
+			bool timePasses = false;
+
+			// Print the Core of the module's bindings to stderr before it's
+			// lowered, a cache hit would skip it
+			bool dumpCore = false;
+
+			// Infer the types of independent binding groups on this many
+			// threads, per partition. The result doesn't depend on it.
+			unsigned typeCheckThreads = 1;
+		};
+
+		// The host's CPU name and its features in "-mattr" form, for -march=native
+		std::string hostCPU();
+		std::string hostFeatures();
+
+		// Generates bitcode for the source text, the module's interface is written
+		// to 'interfaceName' when it's set
+		bool generateOutput(const std::string& input, const std::string& outputBitCodeName, const options& opts = options(),
+		                    const std::string& interfaceName = "");
 
 		bool optimizeAndLink(const std::string& bitCodeFilename, const std::string& exeName = "");
 
+		// Hash of everything besides the source that affects the generated code
+		std::string configurationKey(const options& opts);
+
+		// Compiles source text into an optimized object file, intermediate files
+		// are placed next to it. Safe to call from several threads at once.
+		bool compileObject(const std::string& input, const std::string& objName, const options& opts = options(),
+		                   const std::string& interfaceName = "");
+
+		bool linkObjects(const std::vector<std::string>& objNames, const std::string& exeName);
+
+		// Compiles source text into an executable. When a cache directory is set the
+		// optimized object is looked up by a hash of the source, compiler version and
+		// optimization flags, a hit skips parsing, code generation, 'opt' and 'llc'
+		bool compile(const std::string& input, const std::string& exeName, const options& opts = options());
+
 	}
 
 }
-
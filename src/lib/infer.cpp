@@ -0,0 +1,837 @@
+#include "infer.h"
+
+#include <algorithm>
+#include <cctype>
+
+
+using namespace mhc::infer;
+using namespace mhc;
+
+using namespace std;
+
+
+namespace {
+
+	bool isBoolConstructor(const string& name) {
+		return name == "True" || name == "False";
+	}
+
+	// A type of kind and classes 'set' is allowed if its kind is, and every
+	// class it lacks may be missing
+	bool fits(mhc::infer::type_set set, mhc::infer::type_set allowed) {
+		return (set & allowed & mhc::infer::g_kindSet) != 0 && (set & mhc::infer::g_classSet & ~allowed) == 0;
+	}
+
+	// Whether 'e' refers to the variable 'name', a let binding it again hides
+	// it from that let's body
+	bool mentions(const mhc::syntax::expr& e, const string& name) {
+		if (e.kind == mhc::syntax::expr_kind::variable) {
+			return e.name == name;
+		}
+		if (e.kind == mhc::syntax::expr_kind::let_in && e.name == name) {
+			return mentions(e.children[0], name);
+		}
+
+		for (const auto& itr : e.children) {
+			if (mentions(itr, name)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+}
+
+namespace mhc {
+
+	namespace infer {
+
+		type_set operandSet(ops::opcode code) {
+			type_set result = 0;
+			result |= ops::isSupported(code, ops::operand_type::integer) ? g_intSet : 0;
+			result |= ops::isSupported(code, ops::operand_type::word) ? g_wordSet : 0;
+			result |= ops::isSupported(code, ops::operand_type::floating) ? g_doubleSet : 0;
+
+			// Bool is i1, equality and the bitwise operators work on it too.
+			// && and || are only defined on Bool.
+			const bool equality = (code == ops::opcode::eq || code == ops::opcode::ne);
+			const bool logical = (code == ops::opcode::logical_and || code == ops::opcode::logical_or);
+			if (equality || logical || code == ops::opcode::bit_and || code == ops::opcode::bit_or) {
+				result |= g_boolSet;
+			}
+
+			// Comparisons also take the data types deriving Eq or Ord
+			if (ops::isComparison(code)) {
+				result |= g_otherSet | (g_classSet & ~(equality ? g_noEqSet : g_noOrdSet));
+			}
+
+			return result;
+		}
+
+		checker::checker() {
+			m_int = constant("Int");
+			m_word = constant("Word");
+			m_double = constant("Double");
+			m_bool = constant("Bool");
+
+			m_schemes["otherwise"] = m_bool;
+
+			const node_id enumType = fresh(g_otherSet | (g_classSet & ~g_noEnumSet), g_genericLevel);
+			m_methods["fromEnum"] = function(enumType, m_int);
+			m_methods["toEnum"] = function(m_int, enumType);
+			m_methods["succ"] = function(enumType, enumType);
+			m_methods["pred"] = function(enumType, enumType);
+
+			// Ord takes the primitive types too, Ordering is declared with the data types
+			const node_id ordType = fresh(g_kindSet | (g_classSet & ~g_noOrdSet), g_genericLevel);
+			m_methods["compare"] = function(ordType, function(ordType, constant("Ordering")));
+
+			const node_id boundedType = fresh(g_otherSet | (g_classSet & ~g_noBoundedSet), g_genericLevel);
+			m_methods["minBound"] = boundedType;
+			m_methods["maxBound"] = boundedType;
+		}
+
+		node_id checker::constant(const string& name) {
+			const auto found = m_constants.find(name);
+			if (found != m_constants.end()) {
+				return found->second;
+			}
+
+			node n;
+			n.kind = node_kind::constant;
+			n.constant = static_cast<uint32_t>(m_constantNames.size());
+			m_constantNames.push_back(name);
+			m_nodes.push_back(n);
+
+			const node_id t = static_cast<node_id>(m_nodes.size() - 1);
+			m_constants[name] = t;
+			return t;
+		}
+
+		node_id checker::fresh(type_set allowed) {
+			return fresh(allowed, m_level);
+		}
+
+		node_id checker::fresh(type_set allowed, uint32_t level) {
+			node n;
+			n.allowed = allowed;
+			n.level = level;
+			m_nodes.push_back(n);
+			return static_cast<node_id>(m_nodes.size() - 1);
+		}
+
+		node_id checker::function(node_id param, node_id result) {
+			node n;
+			n.kind = node_kind::function;
+			n.param = param;
+			n.result = result;
+			m_nodes.push_back(n);
+			return static_cast<node_id>(m_nodes.size() - 1);
+		}
+
+		node_id checker::find(node_id t) {
+			node_id root = t;
+			while (m_nodes[root].kind == node_kind::variable && m_nodes[root].link != g_none) {
+				root = m_nodes[root].link;
+			}
+
+			while (t != root) {
+				const node_id next = m_nodes[t].link;
+				m_nodes[t].link = root;
+				t = next;
+			}
+
+			return root;
+		}
+
+		type_set checker::setOf(node_id t) const {
+			if (t == m_int)    return g_intSet;
+			if (t == m_word)   return g_wordSet;
+			if (t == m_double) return g_doubleSet;
+			if (t == m_bool)   return g_boolSet;
+
+			const auto found = m_lacking.find(t);
+			return g_otherSet | (found != m_lacking.end() ? found->second : g_classSet);
+		}
+
+		bool checker::occurs(node_id variable, node_id t, uint32_t level) {
+			t = find(t);
+			if (t == variable) {
+				return true;
+			}
+
+			node& n = m_nodes[t];
+			if (n.kind == node_kind::variable) {
+				// What the variable is bound to is visible wherever it is
+				if (n.level != g_genericLevel) {
+					n.level = min(n.level, level);
+				}
+				return false;
+			}
+
+			return n.kind == node_kind::function && (occurs(variable, n.param, level) || occurs(variable, n.result, level));
+		}
+
+		bool checker::bind(node_id variable, node_id t) {
+			node& v = m_nodes[variable];
+
+			if (m_nodes[t].kind == node_kind::variable) {
+				const type_set allowed = v.allowed & m_nodes[t].allowed;
+				if (!(allowed & g_kindSet)) {
+					return false;
+				}
+
+				m_nodes[t].allowed = allowed;
+				m_nodes[t].level = min(m_nodes[t].level, v.level);
+				v.link = t;
+				return true;
+			}
+
+			if (!fits(setOf(t), v.allowed)) {
+				m_lacks = t;
+				m_lacked = setOf(t) & g_classSet & ~v.allowed;
+				return false;
+			}
+			if (occurs(variable, t, v.level)) {
+				m_infinite = true;
+				return false;
+			}
+
+			m_nodes[variable].link = t;
+			return true;
+		}
+
+		bool checker::unifyTypes(node_id a, node_id b) {
+			a = find(a);
+			b = find(b);
+			if (a == b) {
+				return true;
+			}
+
+			if (m_nodes[a].kind == node_kind::variable) {
+				return bind(a, b);
+			}
+			if (m_nodes[b].kind == node_kind::variable) {
+				return bind(b, a);
+			}
+
+			// Constants are unique per name, two different ones never match
+			if (m_nodes[a].kind == node_kind::function && m_nodes[b].kind == node_kind::function) {
+				return unifyTypes(m_nodes[a].param, m_nodes[b].param) && unifyTypes(m_nodes[a].result, m_nodes[b].result);
+			}
+
+			return false;
+		}
+
+		bool checker::unify(node_id expected, node_id found) {
+			m_infinite = false;
+			m_lacked = 0;
+			if (unifyTypes(expected, found)) {
+				return true;
+			}
+
+			if (m_lacked & g_noEqSet)           error("no instance of Eq for " + show(m_lacks));
+			else if (m_lacked & g_noOrdSet)     error("no instance of Ord for " + show(m_lacks));
+			else if (m_lacked & g_noEnumSet)    error("no instance of Enum for " + show(m_lacks));
+			else if (m_lacked & g_noBoundedSet) error("no instance of Bounded for " + show(m_lacks));
+			if (m_lacked) {
+				return false;
+			}
+
+			// Both sides name their variables alike
+			map<node_id, char> names;
+			string message = "expected ";
+			show(expected, names, message);
+			message += " but found ";
+			show(found, names, message);
+			error(m_infinite ? message + ", an infinite type" : message);
+			return false;
+		}
+
+		bool checker::restrict(node_id t, type_set allowed) {
+			t = find(t);
+			if (m_nodes[t].kind != node_kind::variable) {
+				return fits(setOf(t), allowed);
+			}
+
+			const type_set narrowed = m_nodes[t].allowed & allowed;
+			if (!(narrowed & g_kindSet)) {
+				return false;
+			}
+
+			m_nodes[t].allowed = narrowed;
+			return true;
+		}
+
+		void checker::generalize(node_id t, bool restricted) {
+			t = find(t);
+			node& n = m_nodes[t];
+
+			if (n.kind == node_kind::function) {
+				const node_id param = n.param;
+				const node_id result = n.result;
+				generalize(param, restricted);
+				generalize(result, restricted);
+			} else if (n.kind == node_kind::variable && n.level != g_genericLevel && n.level > m_level) {
+				// A variable kept monomorphic now belongs to the enclosing level
+				n.level = (!restricted || n.allowed == g_anySet) ? g_genericLevel : m_level;
+			}
+		}
+
+		node_id checker::instantiate(node_id t) {
+			map<node_id, node_id> copies;
+			return instantiate(t, copies);
+		}
+
+		node_id checker::instantiate(node_id t, map<node_id, node_id>& copies) {
+			t = find(t);
+			const node n = m_nodes[t];
+
+			switch (n.kind) {
+				case node_kind::variable: {
+					if (n.level != g_genericLevel) {
+						return t;
+					}
+
+					const auto copy = copies.find(t);
+					if (copy != copies.end()) {
+						return copy->second;
+					}
+					return copies[t] = fresh(n.allowed);
+				}
+				case node_kind::constant:
+					return t;
+				case node_kind::function: {
+					const node_id param = instantiate(n.param, copies);
+					const node_id result = instantiate(n.result, copies);
+					return (param == n.param && result == n.result) ? t : function(param, result);
+				}
+			}
+
+			return t;
+		}
+
+		vector<node_id> checker::generics(node_id t) {
+			vector<node_id> result;
+			vector<node_id> work = { t };
+
+			while (!work.empty()) {
+				const node_id next = find(work.back());
+				work.pop_back();
+
+				const node& n = m_nodes[next];
+				if (n.kind == node_kind::function) {
+					work.push_back(n.result);
+					work.push_back(n.param);
+				} else if (n.kind == node_kind::variable && n.level == g_genericLevel
+				        && find_if(result.begin(), result.end(), [&](node_id v) { return v == next; }) == result.end()) {
+					result.push_back(next);
+				}
+			}
+
+			return result;
+		}
+
+		node_id checker::defaultType(type_set allowed) const {
+			// Haskell's default (Integer, Double), then what's left
+			if (allowed & g_intSet)    return m_int;
+			if (allowed & g_doubleSet) return m_double;
+			if (allowed & g_wordSet)   return m_word;
+			if (allowed & g_boolSet)   return m_bool;
+
+			return m_int;
+		}
+
+		void checker::setDefault(node_id variable) {
+			variable = find(variable);
+			if (m_nodes[variable].kind == node_kind::variable) {
+				m_nodes[variable].link = defaultType(m_nodes[variable].allowed);
+			}
+		}
+
+		string checker::show(node_id t) {
+			map<node_id, char> names;
+			string result;
+			show(t, names, result);
+			return result;
+		}
+
+		void checker::show(node_id t, map<node_id, char>& names, string& result) {
+			t = find(t);
+			const node n = m_nodes[t];
+
+			switch (n.kind) {
+				case node_kind::variable: {
+					const auto found = names.find(t);
+					if (found == names.end()) {
+						const char name = static_cast<char>('a' + names.size() % 26);
+						names[t] = name;
+					}
+					result += names[t];
+					break;
+				}
+				case node_kind::constant:
+					result += m_constantNames[n.constant];
+					break;
+				case node_kind::function: {
+					const bool nested = (m_nodes[find(n.param)].kind == node_kind::function);
+					result += nested ? "(" : "";
+					show(n.param, names, result);
+					result += nested ? ") -> " : " -> ";
+					show(n.result, names, result);
+					break;
+				}
+			}
+		}
+
+		node_id checker::fromSyntax(const syntax::type_expr& type, string& error) {
+			const types::type t = m_synonyms ? m_synonyms->fromSyntax(type, error) : types::fromSyntax(type, error);
+			return t ? fromType(t, error) : g_none;
+		}
+
+		node_id checker::fromType(types::type t, string& error) {
+			// A closed type is the same nodes every time, variables are fresh
+			// for each signature
+			if (t->closed) {
+				const auto found = m_closed.find(t);
+				if (found != m_closed.end()) {
+					return found->second;
+				}
+			}
+
+			map<string, node_id> vars;
+			const node_id result = fromType(t, vars, error);
+			if (t->closed && result != g_none) {
+				m_closed[t] = result;
+			}
+			return result;
+		}
+
+		node_id checker::fromType(types::type t, map<string, node_id>& vars, string& error) {
+			switch (t->kind) {
+				case types::type_kind::function: {
+					const node_id param = fromType(t->param, vars, error);
+					const node_id result = fromType(t->result, vars, error);
+					return (param == g_none || result == g_none) ? g_none : function(param, result);
+				}
+				case types::type_kind::variable: {
+					const auto found = vars.find(t->name);
+					return (found != vars.end()) ? found->second : (vars[t->name] = fresh(t->allowed & g_anySet, g_genericLevel));
+				}
+				case types::type_kind::constant:
+					break;
+			}
+
+			const auto found = m_constants.find(t->name);
+			if (found == m_constants.end()) {
+				error = "unknown type " + t->name;
+				return g_none;
+			}
+
+			return found->second;
+		}
+
+		types::type checker::toType(node_id t) {
+			map<node_id, types::type> vars;
+			return toType(t, vars);
+		}
+
+		types::type checker::toType(node_id t, map<node_id, types::type>& vars) {
+			t = find(t);
+			const node& n = m_nodes[t];
+
+			switch (n.kind) {
+				case node_kind::constant:
+					return types::constant(m_constantNames[n.constant]);
+				case node_kind::function: {
+					const types::type param = toType(n.param, vars);
+					return types::function(param, toType(n.result, vars));
+				}
+				case node_kind::variable:
+					break;
+			}
+
+			const auto found = vars.find(t);
+			if (found != vars.end()) {
+				return found->second;
+			}
+
+			const types::type v = types::variable("t" + to_string(vars.size()), n.allowed);
+			vars[t] = v;
+			return v;
+		}
+
+		void checker::addScheme(const string& name, types::type t) {
+			string why;
+			const node_id scheme = (m_schemes.count(name) == 0) ? fromType(t, why) : g_none;
+			if (scheme != g_none) {
+				m_schemes[name] = scheme;
+			}
+		}
+
+		void checker::addDataType(const string& name) {
+			constant(name);
+		}
+
+		void checker::addConstructor(const string& name, const vector<node_id>& fields, node_id result) {
+			node_id t = result;
+			for (auto itr = fields.rbegin(); itr != fields.rend(); ++itr) {
+				t = function(*itr, t);
+			}
+
+			m_constructors[name] = t;
+		}
+
+		void checker::addUnsupported(const string& constructor, const string& dataType) {
+			m_unsupported[constructor] = dataType;
+		}
+
+		void checker::addDerived(const string& dataType, const vector<string>& classes) {
+			type_set lacking = g_classSet;
+			for (const auto& itr : classes) {
+				lacking &= (itr == "Eq")      ? ~g_noEqSet
+				         : (itr == "Ord")     ? ~g_noOrdSet
+				         : (itr == "Enum")    ? ~g_noEnumSet
+				         : (itr == "Bounded") ? ~g_noBoundedSet
+				         : g_anySet;
+			}
+
+			m_lacking[constant(dataType)] = lacking;
+		}
+
+		bool checker::addSignature(const string& name, const syntax::type_expr& type) {
+			string why;
+			const node_id t = fromSyntax(type, why);
+			if (t == g_none) {
+				m_current = name;
+				error(why + " in the signature");
+				return false;
+			}
+
+			m_schemes[name] = t;
+			m_signatures[name] = t;
+			return true;
+		}
+
+		node_id checker::scheme(const string& name) const {
+			const auto found = m_schemes.find(name);
+			return (found != m_schemes.end()) ? found->second : g_none;
+		}
+
+		bool checker::isPrimitive(const syntax::expr& e) const {
+			return e.op != ops::opcode::count && m_schemes.count(e.name) == 0 && m_group.count(e.name) == 0;
+		}
+
+		bool checker::isMethod(const string& name) const {
+			return m_schemes.count(name) == 0 && m_group.count(name) == 0 && m_methods.count(name) > 0;
+		}
+
+		void checker::error(const string& message) {
+			if (m_errors.count(m_current) == 0) {
+				m_errors[m_current] = message;
+			}
+		}
+
+		node_id checker::lookup(const string& name, const locals_t& locals) {
+			const node_id* local = locals.find(name);
+			if (local) {
+				return *local;
+			}
+
+			const auto member = m_group.find(name);
+			if (member != m_group.end()) {
+				return member->second;
+			}
+
+			const auto found = m_schemes.find(name);
+			if (found != m_schemes.end()) {
+				return instantiate(found->second);
+			}
+
+			if (m_openWorld) {
+				const auto signature = m_openWorld->find(name);
+				if (signature != m_openWorld->end()) {
+					string why;
+					const node_id t = fromSyntax(signature->second, why);
+					if (t == g_none) {
+						error(why + " in the signature of " + name);
+						return fresh();
+					}
+
+					m_schemes[name] = t;
+					return instantiate(t);
+				}
+			}
+
+			boost::string_ref payload;
+			const bool imported = m_imports && m_imports->lookup(name, iface::entry_kind::value, payload);
+			if (imported && !payload.empty()) {
+				syntax::type_expr declared;
+				string why;
+				const node_id t = syntax::parseType(payload.to_string(), declared) ? fromSyntax(declared, why) : g_none;
+				if (t != g_none) {
+					m_schemes[name] = t;
+					return instantiate(t);
+				}
+			}
+
+			const auto method = m_methods.find(name);
+			if (method != m_methods.end()) {
+				return instantiate(method->second);
+			}
+
+			// Untyped, every use shares one type outside of any binding
+			if (imported) {
+				return m_schemes[name] = fresh(g_anySet, 0);
+			}
+
+			error(m_openWorld ? "variable not in scope, or defined elsewhere in the module without a type signature: " + name
+			                  : "variable not in scope: " + name);
+			return fresh();
+		}
+
+		node_id checker::constructorType(const string& name) {
+			if (isBoolConstructor(name)) {
+				return m_bool;
+			}
+
+			const auto found = m_constructors.find(name);
+			if (found != m_constructors.end()) {
+				return found->second;
+			}
+
+			const auto unsupported = m_unsupported.find(name);
+			error(unsupported != m_unsupported.end() ? "the data type " + unsupported->second + " isn't supported yet"
+			                                         : "unknown constructor " + name);
+			return fresh();
+		}
+
+		void checker::inferGroup(map<string, vector<syntax::clause>>& equations, const vector<string>& names) {
+			++m_level;
+
+			// A signature is instantiated so the definition can be checked
+			// against it, uses elsewhere in the group see the signature itself
+			vector<node_id> types;
+			vector<map<node_id, node_id>> rigid(names.size());
+			for (size_t i = 0; i < names.size(); ++i) {
+				const auto signature = m_signatures.find(names[i]);
+				if (signature != m_signatures.end()) {
+					types.push_back(instantiate(signature->second, rigid[i]));
+				} else {
+					types.push_back(fresh());
+					m_group[names[i]] = types.back();
+				}
+			}
+
+			for (size_t i = 0; i < names.size(); ++i) {
+				m_current = names[i];
+				inferBinding(equations.at(names[i]), types[i]);
+			}
+
+			--m_level;
+			m_group.clear();
+
+			for (size_t i = 0; i < names.size(); ++i) {
+				m_current = names[i];
+
+				if (m_signatures.count(names[i]) == 0) {
+					generalize(types[i], equations.at(names[i])[0].params.empty());
+					m_schemes[names[i]] = types[i];
+					continue;
+				}
+
+				// The variables of the signature must still be distinct and
+				// unconstrained, or the definition is less general
+				vector<node_id> seen;
+				for (const auto& itr : rigid[i]) {
+					const node_id t = find(itr.second);
+					if (m_nodes[t].kind != node_kind::variable || m_nodes[t].allowed != m_nodes[itr.first].allowed
+					 || std::find(seen.begin(), seen.end(), t) != seen.end()) {
+						error("the signature is more general than the definition");
+						break;
+					}
+					seen.push_back(t);
+				}
+			}
+		}
+
+		void checker::inferBinding(vector<syntax::clause>& clauses, node_id type) {
+			const size_t arity = clauses[0].params.size();
+
+			vector<node_id> params;
+			for (size_t i = 0; i < arity; ++i) {
+				params.push_back(fresh());
+			}
+
+			const node_id result = fresh();
+			node_id t = result;
+			for (auto itr = params.rbegin(); itr != params.rend(); ++itr) {
+				t = function(*itr, t);
+			}
+
+			if (!unify(type, t)) {
+				return;
+			}
+
+			for (auto& c : clauses) {
+				if (c.params.size() != arity) {
+					error("equations with " + to_string(arity) + " and " + to_string(c.params.size()) + " parameters");
+					return;
+				}
+
+				locals_t locals;
+				for (size_t i = 0; i < arity; ++i) {
+					inferPattern(c.params[i], params[i], locals);
+				}
+
+				for (auto& rhs : c.rhs) {
+					if (rhs.guarded) {
+						unify(m_bool, inferExpr(rhs.guard, locals));
+					}
+					unify(result, inferExpr(rhs.body, locals));
+				}
+			}
+		}
+
+		void checker::inferPattern(const syntax::pattern& p, node_id type, locals_t& locals) {
+			switch (p.kind) {
+				case syntax::pattern_kind::variable:
+					locals.insert(p.name, type);
+					return;
+
+				case syntax::pattern_kind::wildcard:
+					return;
+
+				case syntax::pattern_kind::integer:
+					if (!restrict(type, g_intSet | g_wordSet)) {
+						error("integer pattern for a value of type " + show(type));
+					}
+					return;
+
+				case syntax::pattern_kind::constructor: {
+					node_id t = constructorType(p.name);
+					for (const auto& arg : p.args) {
+						const node_id field = find(t);
+						if (m_nodes[field].kind != node_kind::function) {
+							error("constructor " + p.name + " has fewer fields than its pattern");
+							return;
+						}
+
+						inferPattern(arg, m_nodes[field].param, locals);
+						t = m_nodes[field].result;
+					}
+
+					if (m_nodes[find(t)].kind == node_kind::function) {
+						error("constructor " + p.name + " has more fields than its pattern");
+						return;
+					}
+					unify(type, t);
+					return;
+				}
+			}
+		}
+
+		node_id checker::inferApply(node_id callee, const string& name, const vector<node_id>& args) {
+			for (const auto arg : args) {
+				const node_id t = find(callee);
+				if (m_nodes[t].kind == node_kind::constant) {
+					error(name + " is applied to too many arguments");
+					return fresh();
+				}
+
+				const node_id result = fresh();
+				if (!unify(function(arg, result), t)) {
+					return result;
+				}
+				callee = result;
+			}
+
+			return callee;
+		}
+
+		node_id checker::inferExpr(syntax::expr& e, locals_t& locals) {
+			node_id t = g_none;
+
+			switch (e.kind) {
+				case syntax::expr_kind::integer:
+					t = fresh(g_numSet);
+					break;
+
+				case syntax::expr_kind::floating:
+					t = m_double;
+					break;
+
+				case syntax::expr_kind::variable:
+					t = lookup(e.name, locals);
+					break;
+
+				case syntax::expr_kind::constructor:
+					t = constructorType(e.name);
+					break;
+
+				case syntax::expr_kind::apply: {
+					const node_id callee = inferExpr(e.children[0], locals);
+
+					vector<node_id> args;
+					for (size_t i = 1; i < e.children.size(); ++i) {
+						args.push_back(inferExpr(e.children[i], locals));
+					}
+					t = inferApply(callee, e.children[0].name, args);
+					break;
+				}
+
+				case syntax::expr_kind::binary: {
+					const node_id lhs = inferExpr(e.children[0], locals);
+					const node_id rhs = inferExpr(e.children[1], locals);
+
+					if (!isPrimitive(e)) {
+						t = inferApply(lookup(e.name, locals), e.name, { lhs, rhs });
+						break;
+					}
+
+					if (unify(lhs, rhs) && !restrict(lhs, operandSet(e.op))) {
+						error("operator " + e.name + " isn't defined on " + show(lhs));
+					}
+					t = ops::isComparison(e.op) ? m_bool : lhs;
+					break;
+				}
+
+				case syntax::expr_kind::negate:
+					t = inferExpr(e.children[0], locals);
+					if (!restrict(t, g_numSet)) {
+						error("negation of a value of type " + show(t));
+					}
+					break;
+
+				case syntax::expr_kind::if_then_else:
+					unify(m_bool, inferExpr(e.children[0], locals));
+					t = inferExpr(e.children[1], locals);
+					unify(t, inferExpr(e.children[2], locals));
+					break;
+
+				case syntax::expr_kind::let_in: {
+					// Local bindings are values, which the monomorphism
+					// restriction keeps monomorphic, so there's nothing to
+					// generalize. They aren't recursive either, in Haskell the
+					// name would refer to the binding itself rather than an
+					// outer one.
+					if (mentions(e.children[0], e.name)) {
+						error("recursive let bindings aren't supported yet (" + e.name + ")");
+					}
+
+					const node_id value = inferExpr(e.children[0], locals);
+					locals_t::scope body(locals);
+					locals.insert(e.name, value);
+					t = inferExpr(e.children[1], locals);
+					break;
+				}
+			}
+
+			e.type = t;
+			return t;
+		}
+
+	}
+
+}
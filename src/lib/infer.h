@@ -0,0 +1,208 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "interface.h"
+#include "operators.h"
+#include "symbol_table.h"
+#include "syntax.h"
+#include "types.h"
+
+
+namespace mhc {
+
+	// Hindley-Milner type inference for the bindings of a module. Type
+	// variables are union-find nodes with path compression, and each records
+	// the binding depth ('level') it was created at. Binding a variable lowers
+	// the levels of everything it's unified with, so generalizing a binding
+	// only has to look at its own type: the variables deeper than the binding
+	// are exactly the ones the environment can't see.
+	namespace infer {
+
+		using node_id = std::uint32_t;
+
+		const node_id g_none = UINT32_MAX;
+
+		// Level of the variables of a generalized type, instantiating copies them
+		const std::uint32_t g_genericLevel = UINT32_MAX;
+
+		// Types a variable may still become. Literals and primitive operators
+		// restrict their operands this way, the only type classes are the
+		// ones data types derive. A type is in a set when its kind is, and
+		// when the set admits types without each class the type lacks.
+		using type_set = std::uint16_t;
+
+		const type_set g_intSet = 1;
+		const type_set g_wordSet = 2;
+		const type_set g_doubleSet = 4;
+		const type_set g_boolSet = 8;
+		const type_set g_otherSet = 16;        // Data types and functions
+		const type_set g_numSet = g_intSet | g_wordSet | g_doubleSet;
+		const type_set g_kindSet = g_numSet | g_boolSet | g_otherSet;
+
+		// Types without a derivable class, the primitive types have them all
+		const type_set g_noEqSet = 32;
+		const type_set g_noOrdSet = 64;
+		const type_set g_noEnumSet = 128;
+		const type_set g_noBoundedSet = 256;
+		const type_set g_classSet = g_noEqSet | g_noOrdSet | g_noEnumSet | g_noBoundedSet;
+
+		const type_set g_anySet = g_kindSet | g_classSet;
+
+		// The types a primitive operator is defined on
+		type_set operandSet(ops::opcode code);
+
+		enum class node_kind : std::uint8_t {
+			variable,
+			constant,       // Int, Word, Double, Bool or a data type, one node per name
+			function,       // Curried, param -> result
+		};
+
+		struct node {
+			node_kind kind = node_kind::variable;
+			type_set allowed = g_anySet;        // Variables
+			std::uint32_t level = 0;            // Variables
+			node_id link = g_none;              // Variables: what it was unified with
+			std::uint32_t constant = 0;         // Constants: index of the name
+			node_id param = g_none;             // Functions
+			node_id result = g_none;
+		};
+
+		class checker {
+		public:
+			checker();
+
+			node_id constant(const std::string& name);
+			node_id fresh(type_set allowed = g_anySet);
+			node_id function(node_id param, node_id result);
+
+			// Representative of a type, compresses the path to it
+			node_id find(node_id t);
+			const node& at(node_id t) const { return m_nodes[t]; }
+			const std::string& constantName(node_id t) const { return m_constantNames[m_nodes[t].constant]; }
+
+			bool unify(node_id expected, node_id found);
+
+			// Generalizes the variables deeper than the current level. A
+			// restricted binding (a value rather than a function) keeps the
+			// variables its operators constrain monomorphic, so they're settled
+			// by its uses like Haskell's monomorphism restriction.
+			void generalize(node_id t, bool restricted);
+			node_id instantiate(node_id t);
+			node_id instantiate(node_id t, std::map<node_id, node_id>& copies);
+
+			// Generic variables of a type in order of appearance
+			std::vector<node_id> generics(node_id t);
+
+			// What a variable nothing decided becomes, Int if it can
+			node_id defaultType(type_set allowed) const;
+			void setDefault(node_id variable);
+
+			std::string show(node_id t);
+
+			// A type written in the source, its variables are generic. Synonyms
+			// are expanded through the table set with setSynonyms.
+			node_id fromSyntax(const syntax::type_expr& type, std::string& error);
+			node_id fromType(types::type t, std::string& error);
+
+			// A type in the process-wide table, for another checker. Variables
+			// are named in order of appearance and keep what they're restricted
+			// to, the type is meant to be generalized.
+			types::type toType(node_id t);
+
+			void addDataType(const std::string& name);
+			void setSynonyms(types::synonym_table* synonyms) { m_synonyms = synonyms; }
+			void addConstructor(const std::string& name, const std::vector<node_id>& fields, node_id result);
+			void addUnsupported(const std::string& constructor, const std::string& dataType);
+
+			// The classes of a data type's deriving clause, others are ignored
+			void addDerived(const std::string& dataType, const std::vector<std::string>& classes);
+			bool addSignature(const std::string& name, const syntax::type_expr& type);
+
+			// A binding another checker inferred, kept if the name has a type already
+			void addScheme(const std::string& name, types::type t);
+
+			// Names the module doesn't bind are looked up in the imports. In an
+			// open world they may be defined elsewhere in the module too, with
+			// their types in 'signatures'. One without a signature is an error,
+			// a type guessed from its uses could disagree with its definition.
+			void setImports(iface::import_env* imports) { m_imports = imports; }
+			void setOpenWorld(const std::map<std::string, syntax::type_expr>* signatures) { m_openWorld = signatures; }
+
+			// Infers the types of a group of mutually recursive bindings after
+			// the groups they depend on, annotating their expressions
+			void inferGroup(std::map<std::string, std::vector<syntax::clause>>& equations, const std::vector<std::string>& names);
+
+			// Type of a top-level name, generic where it was generalized
+			node_id scheme(const std::string& name) const;
+
+			// Whether a binary expression's operator is the primitive the parser
+			// found for it, not a binding's
+			bool isPrimitive(const syntax::expr& e) const;
+
+			// Whether a name is a method of a derivable class, fromEnum, toEnum,
+			// succ, pred, minBound or maxBound, not a binding's
+			bool isMethod(const std::string& name) const;
+
+			// The first error in each binding
+			const std::map<std::string, std::string>& errors() const { return m_errors; }
+
+		private:
+			// Parameters and let bindings in scope, one hash probe however deep
+			using locals_t = scoped_table<node_id>;
+
+			node_id fresh(type_set allowed, std::uint32_t level);
+			node_id fromType(types::type t, std::map<std::string, node_id>& vars, std::string& error);
+			types::type toType(node_id t, std::map<node_id, types::type>& vars);
+
+			bool unifyTypes(node_id a, node_id b);
+			bool bind(node_id variable, node_id t);
+			bool occurs(node_id variable, node_id t, std::uint32_t level);
+			bool restrict(node_id t, type_set allowed);
+			type_set setOf(node_id t) const;
+			void show(node_id t, std::map<node_id, char>& names, std::string& result);
+
+			void error(const std::string& message);
+
+			node_id lookup(const std::string& name, const locals_t& locals);
+			node_id constructorType(const std::string& name);
+			void inferBinding(std::vector<syntax::clause>& clauses, node_id type);
+			void inferPattern(const syntax::pattern& p, node_id type, locals_t& locals);
+			node_id inferApply(node_id callee, const std::string& name, const std::vector<node_id>& args);
+			node_id inferExpr(syntax::expr& e, locals_t& locals);
+
+			std::vector<node> m_nodes;
+			std::vector<std::string> m_constantNames;
+			std::map<std::string, node_id> m_constants;
+			node_id m_int;
+			node_id m_word;
+			node_id m_double;
+			node_id m_bool;
+			std::uint32_t m_level = 0;
+			bool m_infinite = false;              // Why the last unification failed
+			node_id m_lacks = g_none;             // A type without a class that was asked for
+			type_set m_lacked = 0;
+
+			types::synonym_table* m_synonyms = nullptr;
+			std::map<types::type, node_id> m_closed;     // Types without variables, converted once
+			std::map<std::string, node_id> m_constructors;
+			std::map<std::string, std::string> m_unsupported;     // Constructor -> its data type
+			std::map<node_id, type_set> m_lacking;                // Data type -> the classes it doesn't derive
+			std::map<std::string, node_id> m_methods;
+			std::map<std::string, node_id> m_schemes;
+			std::map<std::string, node_id> m_signatures;
+			iface::import_env* m_imports = nullptr;
+			const std::map<std::string, syntax::type_expr>* m_openWorld = nullptr;
+
+			// The group being inferred, its bindings are monomorphic within it
+			std::map<std::string, node_id> m_group;
+			std::string m_current;
+			std::map<std::string, std::string> m_errors;
+		};
+
+	}
+
+}
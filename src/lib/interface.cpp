@@ -0,0 +1,460 @@
+#include "interface.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <utility>
+
+#include <boost/variant/get.hpp>
+
+#include "cache.h"
+#include "decl_graph.h"
+#include "lexer.h"
+
+
+using namespace mhc;
+using namespace mhc::iface;
+using namespace mhc::lexer;
+using namespace parser;
+
+using namespace std;
+
+
+namespace {
+
+	const char g_magic[4] = { 'M', 'H', 'I', '\0' };
+
+	using entry_map = map<pair<string, entry_kind>, string>;
+
+	string trim(const string& s) {
+		const size_t first = s.find_first_not_of(" \t\r\n");
+		if (first == string::npos) {
+			return "";
+		}
+
+		const size_t last = s.find_last_not_of(" \t\r\n");
+		return s.substr(first, last - first + 1);
+	}
+
+	string join(const vector<string>& parts, const string& separator) {
+		string result;
+		for (size_t i = 0; i < parts.size(); ++i) {
+			result += (i == 0 ? "" : separator) + parts[i];
+		}
+
+		return result;
+	}
+
+	void addDecl(const string& decl, entry_map& entries) {
+		const auto tokens = tokenize(decl);
+		if (tokens.empty()) {
+			return;
+		}
+
+		const vector<string> names = declNames(decl);
+
+		if (tokens[0].text == "infixl" || tokens[0].text == "infixr" || tokens[0].text == "infix") {
+			string fixity = tokens[0].text;
+			if (tokens.size() > 1 && tokens[1].kind == token_kind::integer) {
+				fixity += " " + tokens[1].text;
+			}
+
+			for (const auto& name : names) {
+				entries[make_pair(name, entry_kind::fixity)] = fixity;
+			}
+			return;
+		}
+
+		// A signature if "::" comes before any "=" or guard
+		const size_t sig = decl.find("::");
+		const size_t eq = decl.find_first_of("=|");
+		if (sig != string::npos && (eq == string::npos || sig < eq)) {
+			const string type = trim(decl.substr(sig + 2));
+			for (const auto& name : names) {
+				entries[make_pair(name, entry_kind::value)] = type;
+			}
+			return;
+		}
+
+		// Binding without a signature, the type stays unknown
+		for (const auto& name : names) {
+			entries.insert(make_pair(make_pair(name, entry_kind::value), string()));
+		}
+	}
+
+	void addData(const algebraic_datatype_decl& adt, entry_map& entries) {
+		const string payload = join(adt.deriving_typeclasses, ",") + "\n" + join(adt.components, "\n");
+		entries[make_pair(adt.type_ctor, entry_kind::data)] = payload;
+
+		for (const auto& itr : adt.constructors) {
+			entries[make_pair(itr, entry_kind::constructor)] = adt.type_ctor;
+		}
+	}
+
+	void addSynonym(const type_synonym_decl& syn, entry_map& entries) {
+		const auto tokens = tokenize(syn.type_new);
+		if (!tokens.empty()) {
+			entries[make_pair(tokens[0].text, entry_kind::synonym)] = syn.type_new + " = " + syn.type_old;
+		}
+	}
+
+	// Drops everything the export list doesn't mention
+	void filterExports(const module_decl& module, entry_map& entries) {
+		if (!module.has_export_list) {
+			return;
+		}
+
+		set<string> exported;
+		set<string> withConstructors;
+
+		for (const auto& itr : module.exports) {
+			const auto tokens = tokenize(itr);
+			if (tokens.empty() || tokens[0].text == "module") {
+				continue;
+			}
+
+			// Operators are exported in parens: "(<+>)"
+			if (tokens[0].text == "(" && tokens.size() > 1) {
+				exported.insert(tokens[1].text);
+				continue;
+			}
+
+			exported.insert(tokens[0].text);
+
+			for (size_t i = 1; i < tokens.size(); ++i) {
+				if (tokens[i].text == "..") {
+					withConstructors.insert(tokens[0].text);
+				} else if (tokens[i].kind == token_kind::conid || tokens[i].kind == token_kind::varid) {
+					exported.insert(tokens[i].text);
+				}
+			}
+		}
+
+		for (auto itr = entries.begin(); itr != entries.end();) {
+			const bool keep = exported.count(itr->first.first) > 0
+			               || (itr->first.second == entry_kind::constructor && withConstructors.count(itr->second) > 0);
+
+			itr = keep ? next(itr) : entries.erase(itr);
+		}
+	}
+
+}
+
+namespace mhc {
+
+	namespace iface {
+
+		string buildInterface(const module_decl& module, const unfolding_map& unfoldings) {
+			entry_map entries;
+
+			for (const auto& itr : module.body) {
+				if (const string* decl = boost::get<string>(&itr)) {
+					addDecl(*decl, entries);
+				} else if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&itr)) {
+					addData(*adt, entries);
+				} else if (const type_synonym_decl* syn = boost::get<type_synonym_decl>(&itr)) {
+					addSynonym(*syn, entries);
+				}
+			}
+
+			for (const auto& itr : unfoldings) {
+				entries[make_pair(itr.first, entry_kind::unfolding)] = itr.second;
+			}
+
+			filterExports(module, entries);
+
+			// Map order is already name then kind, which is what lookups expect
+			vector<file_entry> table;
+			string strings;
+
+			for (const auto& itr : entries) {
+				file_entry e;
+				e.nameOffset = static_cast<uint32_t>(strings.size());
+				e.nameLength = static_cast<uint32_t>(itr.first.first.size());
+				strings += itr.first.first;
+
+				e.kind = static_cast<uint32_t>(itr.first.second);
+
+				e.payloadOffset = static_cast<uint32_t>(strings.size());
+				e.payloadLength = static_cast<uint32_t>(itr.second.size());
+				strings += itr.second;
+
+				table.push_back(e);
+			}
+
+			file_header header;
+			memcpy(header.magic, g_magic, sizeof(header.magic));
+			header.version = g_version;
+			header.entryCount = static_cast<uint32_t>(table.size());
+			header.stringsOffset = static_cast<uint32_t>(sizeof(file_header) + table.size() * sizeof(file_entry));
+
+			const string body(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(file_entry));
+			const string hash = cache::hashKey({ body, strings });
+			for (size_t i = 0; i < sizeof(header.contentHash); ++i) {
+				header.contentHash[i] = static_cast<unsigned char>(stoul(hash.substr(i * 2, 2), nullptr, 16));
+			}
+
+			// Offsets in the table are relative to the string data
+			string image(reinterpret_cast<const char*>(&header), sizeof(header));
+			image += body;
+			image += strings;
+
+			return image;
+		}
+
+		bool writeInterface(const module_decl& module, const string& path, const unfolding_map& unfoldings) {
+			const string image = buildInterface(module, unfoldings);
+
+			// Write and rename so a parallel importer never maps a partial file
+			const string tmpPath = path + ".tmp";
+			{
+				ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+				out.write(image.data(), image.size());
+				if (!out) {
+					return false;
+				}
+			}
+
+			return rename(tmpPath.c_str(), path.c_str()) == 0;
+		}
+
+		base_expr_node interfaceSummary(const base_expr_node& decl) {
+			const string* str = boost::get<string>(&decl);
+			if (!str) {
+				return decl;
+			}
+
+			// Signatures and fixities are kept whole, they're what the interface records
+			const size_t sig = str->find("::");
+			const size_t eq = str->find_first_of("=|");
+			if (eq == string::npos || (sig != string::npos && sig < eq)) {
+				return decl;
+			}
+
+			return str->substr(0, eq);
+		}
+
+		vector<string> inlinePragmas(const string& source) {
+			vector<string> names;
+
+			for (size_t start = source.find("{-#"); start != string::npos; start = source.find("{-#", start)) {
+				const size_t end = source.find("#-}", start);
+				if (end == string::npos) {
+					break;
+				}
+
+				const auto tokens = tokenize(source.substr(start + 3, end - start - 3));
+				if (!tokens.empty() && tokens[0].text == "INLINE") {
+					for (size_t i = 1; i < tokens.size(); ++i) {
+						if (tokens[i].kind == token_kind::varid || tokens[i].kind == token_kind::varsym) {
+							names.push_back(tokens[i].text);
+						}
+					}
+				}
+
+				start = end + 3;
+			}
+
+			return names;
+		}
+
+		string interfacePath(const string& searchDir, const string& moduleId) {
+			string relative = moduleId;
+			replace(relative.begin(), relative.end(), '.', '/');
+
+			return (searchDir.empty() ? relative : searchDir + "/" + relative) + ".mhi";
+		}
+
+		interface_file::~interface_file() {
+			close();
+		}
+
+		bool interface_file::open(const string& path) {
+			close();
+
+			const int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(file_header))) {
+				::close(fd);
+				return false;
+			}
+
+			void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+
+			if (data == MAP_FAILED) {
+				return false;
+			}
+
+			m_data = static_cast<const char*>(data);
+			m_size = st.st_size;
+			m_mapped = true;
+
+			if (!validate()) {
+				close();
+				return false;
+			}
+
+			return true;
+		}
+
+		bool interface_file::openBuffer(const char* data, size_t size) {
+			close();
+
+			m_data = data;
+			m_size = size;
+
+			if (!validate()) {
+				close();
+				return false;
+			}
+
+			return true;
+		}
+
+		bool interface_file::validate() {
+			if (m_size < sizeof(file_header)) {
+				return false;
+			}
+
+			m_header = reinterpret_cast<const file_header*>(m_data);
+			if (memcmp(m_header->magic, g_magic, sizeof(g_magic)) != 0 || m_header->version != g_version) {
+				return false;
+			}
+
+			// Only the table bounds are checked up front, entries are checked as
+			// they're read so opening stays independent of the interface size
+			const size_t tableEnd = sizeof(file_header) + static_cast<size_t>(m_header->entryCount) * sizeof(file_entry);
+			if (tableEnd > m_size || m_header->stringsOffset != tableEnd) {
+				return false;
+			}
+
+			m_entries = reinterpret_cast<const file_entry*>(m_data + sizeof(file_header));
+			return true;
+		}
+
+		void interface_file::close() {
+			if (m_mapped) {
+				munmap(const_cast<char*>(m_data), m_size);
+			}
+
+			m_data = nullptr;
+			m_size = 0;
+			m_mapped = false;
+			m_header = nullptr;
+			m_entries = nullptr;
+		}
+
+		size_t interface_file::size() const {
+			return m_header ? m_header->entryCount : 0;
+		}
+
+		boost::string_ref interface_file::name(size_t index) const {
+			const file_entry& e = m_entries[index];
+			const size_t offset = m_header->stringsOffset + static_cast<size_t>(e.nameOffset);
+
+			if (offset + e.nameLength > m_size) {
+				return boost::string_ref();
+			}
+
+			return boost::string_ref(m_data + offset, e.nameLength);
+		}
+
+		entry_kind interface_file::kind(size_t index) const {
+			return static_cast<entry_kind>(m_entries[index].kind);
+		}
+
+		boost::string_ref interface_file::payload(size_t index) const {
+			const file_entry& e = m_entries[index];
+			const size_t offset = m_header->stringsOffset + static_cast<size_t>(e.payloadOffset);
+
+			if (offset + e.payloadLength > m_size) {
+				return boost::string_ref();
+			}
+
+			return boost::string_ref(m_data + offset, e.payloadLength);
+		}
+
+		bool interface_file::lookup(boost::string_ref key, entry_kind kind, boost::string_ref& result) const {
+			size_t low = 0;
+			size_t high = size();
+
+			// Lower bound on (name, kind)
+			while (low < high) {
+				const size_t mid = low + (high - low) / 2;
+				const int cmp = name(mid).compare(key);
+
+				if (cmp < 0 || (cmp == 0 && m_entries[mid].kind < static_cast<uint32_t>(kind))) {
+					low = mid + 1;
+				} else {
+					high = mid;
+				}
+			}
+
+			if (low < size() && name(low) == key && this->kind(low) == kind) {
+				result = payload(low);
+				return true;
+			}
+
+			return false;
+		}
+
+		string interface_file::contentHash() const {
+			if (!m_header) {
+				return string();
+			}
+
+			static const char digits[] = "0123456789abcdef";
+			string hex;
+			for (const unsigned char byte : m_header->contentHash) {
+				hex += digits[byte >> 4];
+				hex += digits[byte & 0xf];
+			}
+			return hex;
+		}
+
+		void import_env::addImport(const string& moduleId) {
+			lock_guard<mutex> lock(m_mutex);
+			if (find(m_moduleIds.begin(), m_moduleIds.end(), moduleId) != m_moduleIds.end()) {
+				return;
+			}
+
+			m_moduleIds.push_back(moduleId);
+			m_files.emplace_back(new interface_file);
+			m_opened.push_back(false);
+		}
+
+		bool import_env::lookup(const string& name, entry_kind kind, boost::string_ref& payload, string* moduleId) {
+			lock_guard<mutex> lock(m_mutex);
+			for (size_t i = 0; i < m_moduleIds.size(); ++i) {
+				if (!m_opened[i]) {
+					// A missing interface (e.g. an external module) simply never matches
+					m_opened[i] = true;
+					m_files[i]->open(interfacePath(m_searchDir, m_moduleIds[i]));
+				}
+
+				if (m_files[i]->lookup(name, kind, payload)) {
+					if (moduleId) {
+						*moduleId = m_moduleIds[i];
+					}
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+	}
+
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "parser.h"
+
+
+namespace mhc {
+
+	namespace iface {
+
+		// Binary module interface (.mhi), laid out so it can be used straight
+		// from a read-only mapping:
+		//
+		//   header                  magic, version, counts and a content hash
+		//   entry[entryCount]       sorted by name, then kind
+		//   string data             names and payloads referenced by offset
+		//
+		// All integers are native endian, the interface is only read back by
+		// the compiler that wrote it.
+		const std::uint32_t g_version = 2;
+
+		enum class entry_kind : std::uint32_t {
+			value       = 1,    // Payload is the declared type, empty when unknown
+			data        = 2,    // Payload is "deriving classes" then one component per line
+			constructor = 3,    // Payload is the name of the data type
+			synonym     = 4,    // Payload is the synonym's right hand side type
+			fixity      = 5,    // Payload is the fixity declaration, e.g. "infixl 6"
+			unfolding   = 6,    // Payload is LLVM bitcode defining the function, for inlining
+		};
+
+		struct file_header {
+			char magic[4];
+			std::uint32_t version;
+			std::uint32_t entryCount;
+			std::uint32_t stringsOffset;
+			unsigned char contentHash[20];    // SHA-1 digest of the entries and strings
+		};
+
+		struct file_entry {
+			std::uint32_t nameOffset;
+			std::uint32_t nameLength;
+			std::uint32_t kind;
+			std::uint32_t payloadOffset;
+			std::uint32_t payloadLength;
+		};
+
+		// Function name -> optimized bitcode of its definition
+		using unfolding_map = std::map<std::string, std::string>;
+
+		// Serializes the exported declarations of the module along with the
+		// unfoldings of exported functions
+		std::string buildInterface(const parser::module_decl& module, const unfolding_map& unfoldings = unfolding_map());
+
+		bool writeInterface(const parser::module_decl& module, const std::string& path,
+		                    const unfolding_map& unfoldings = unfolding_map());
+
+		// The part of a declaration buildInterface reads, bindings are cut down to
+		// their left hand side. Lets a streaming compile build the interface
+		// without holding on to whole declarations.
+		parser::base_expr_node interfaceSummary(const parser::base_expr_node& decl);
+
+		// Names listed in "{-# INLINE f #-}" pragmas, the parser drops these as comments
+		std::vector<std::string> inlinePragmas(const std::string& source);
+
+		// Path of a module's interface under the search directory: "Data.Map" -> "<dir>/Data/Map.mhi"
+		std::string interfacePath(const std::string& searchDir, const std::string& moduleId);
+
+		// A memory mapped interface, lookups binary search the entry table and
+		// return views into the mapping without copying
+		class interface_file {
+		public:
+			interface_file() {}
+			~interface_file();
+
+			interface_file(const interface_file&) = delete;
+			interface_file& operator=(const interface_file&) = delete;
+
+			// Maps the file and validates the header and table bounds
+			bool open(const std::string& path);
+
+			// Maps an in-memory image, used for testing, the buffer must outlive this
+			bool openBuffer(const char* data, std::size_t size);
+
+			bool lookup(boost::string_ref name, entry_kind kind, boost::string_ref& payload) const;
+
+			std::size_t size() const;
+			boost::string_ref name(std::size_t index) const;
+			entry_kind kind(std::size_t index) const;
+			boost::string_ref payload(std::size_t index) const;
+
+			// Changes whenever anything in the interface changes, the SHA-1
+			// digest as 40 hex digits
+			std::string contentHash() const;
+
+		private:
+			bool validate();
+			void close();
+
+			const char* m_data = nullptr;
+			std::size_t m_size = 0;
+			bool m_mapped = false;
+
+			const file_header* m_header = nullptr;
+			const file_entry* m_entries = nullptr;
+		};
+
+		// The interfaces of a module's imports. Interfaces are opened the first
+		// time a lookup reaches them, so unused imports are never touched.
+		// Lookups are safe from several threads at once.
+		class import_env {
+		public:
+			explicit import_env(const std::string& searchDir) : m_searchDir(searchDir) {}
+
+			void addImport(const std::string& moduleId);
+
+			// Searches the imports in order, 'moduleId' is set to the providing module
+			bool lookup(const std::string& name, entry_kind kind, boost::string_ref& payload, std::string* moduleId = nullptr);
+
+		private:
+			std::string m_searchDir;
+			std::vector<std::string> m_moduleIds;
+			std::vector<std::unique_ptr<interface_file>> m_files;
+			std::vector<bool> m_opened;
+			std::mutex m_mutex;
+		};
+
+	}
+
+}
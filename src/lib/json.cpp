@@ -0,0 +1,37 @@
+#include "json.h"
+
+#include <cstdio>
+
+
+using namespace std;
+
+
+namespace mhc {
+
+	namespace json {
+
+		string quoted(const string& str) {
+			string result = "\"";
+			for (const char c : str) {
+				switch (c) {
+					case '"':  result += "\\\""; break;
+					case '\\': result += "\\\\"; break;
+					case '\n': result += "\\n";  break;
+					case '\t': result += "\\t";  break;
+					default:
+						if (static_cast<unsigned char>(c) < 0x20) {
+							char buffer[8];
+							snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+							result += buffer;
+						} else {
+							result += c;
+						}
+				}
+			}
+
+			return result + "\"";
+		}
+
+	}
+
+}
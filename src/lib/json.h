@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+
+namespace mhc {
+
+	namespace json {
+
+		// 'str' as a JSON string literal, quotes included
+		std::string quoted(const std::string& str);
+
+	}
+
+}
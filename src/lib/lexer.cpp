@@ -0,0 +1,139 @@
+#include "lexer.h"
+
+#include <cctype>
+#include <cstring>
+
+
+using namespace std;
+
+
+namespace {
+
+	bool isSymbol(char c) {
+		return c != '\0' && strchr("!#$%&*+./<=>?@\\^|-~:", c) != nullptr;
+	}
+
+	bool isSpecial(char c) {
+		return c != '\0' && strchr("(),;[]`{}", c) != nullptr;
+	}
+
+	bool isIdentChar(char c) {
+		return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '\'';
+	}
+
+	// Skips a quoted literal starting at 'i', handling escapes
+	size_t skipQuoted(const string& text, size_t i, char quote) {
+		++i;
+		while (i < text.size() && text[i] != quote) {
+			i += (text[i] == '\\') ? 2 : 1;
+		}
+
+		return (i < text.size()) ? i + 1 : text.size();
+	}
+
+}
+
+namespace mhc {
+
+	namespace lexer {
+
+		vector<token> tokenize(const string& text) {
+			vector<token> tokens;
+			bool lineStart = true;
+
+			size_t i = 0;
+			while (i < text.size()) {
+				const char c = text[i];
+				const size_t start = i;
+
+				if (isspace(static_cast<unsigned char>(c))) {
+					lineStart = lineStart || (c == '\n');
+					++i;
+					continue;
+				}
+
+				// Line comment, only when "--" isn't part of a longer operator
+				if (text.compare(i, 2, "--") == 0) {
+					size_t end = i;
+					while (end < text.size() && text[end] == '-') {
+						++end;
+					}
+					if (end >= text.size() || !isSymbol(text[end])) {
+						const size_t eol = text.find('\n', i);
+						i = (eol == string::npos) ? text.size() : eol + 1;
+						lineStart = true;
+						continue;
+					}
+				}
+
+				// Nested block comment
+				if (text.compare(i, 2, "{-") == 0) {
+					int depth = 0;
+					while (i < text.size()) {
+						if (text.compare(i, 2, "{-") == 0) {
+							++depth;
+							i += 2;
+						} else if (text.compare(i, 2, "-}") == 0) {
+							i += 2;
+							if (--depth == 0) {
+								break;
+							}
+						} else {
+							++i;
+						}
+					}
+					lineStart = lineStart || text.find('\n', start) < i;
+					continue;
+				}
+
+				token t;
+
+				if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+					while (i < text.size() && isIdentChar(text[i])) {
+						++i;
+					}
+					t.kind = (isupper(static_cast<unsigned char>(c)) ? token_kind::conid : token_kind::varid);
+				} else if (isdigit(static_cast<unsigned char>(c))) {
+					t.kind = token_kind::integer;
+					while (i < text.size() && isalnum(static_cast<unsigned char>(text[i]))) {
+						++i;
+					}
+					if (i + 1 < text.size() && text[i] == '.' && isdigit(static_cast<unsigned char>(text[i + 1]))) {
+						t.kind = token_kind::floating;
+						++i;
+						while (i < text.size() && isalnum(static_cast<unsigned char>(text[i]))) {
+							++i;
+						}
+					}
+				} else if (c == '"') {
+					t.kind = token_kind::string;
+					i = skipQuoted(text, i, '"');
+				} else if (c == '\'') {
+					t.kind = token_kind::character;
+					i = skipQuoted(text, i, '\'');
+				} else if (isSpecial(c)) {
+					t.kind = token_kind::special;
+					++i;
+				} else if (isSymbol(c)) {
+					t.kind = token_kind::varsym;
+					while (i < text.size() && isSymbol(text[i])) {
+						++i;
+					}
+				} else {
+					// Unknown character, skip it
+					++i;
+					continue;
+				}
+
+				t.text = text.substr(start, i - start);
+				t.lineStart = lineStart;
+				lineStart = false;
+				tokens.push_back(t);
+			}
+
+			return tokens;
+		}
+
+	}
+
+}
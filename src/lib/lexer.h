@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+namespace mhc {
+
+	namespace lexer {
+
+		enum class token_kind {
+			varid,      // Variable identifiers and reserved words
+			conid,      // Constructor, type and module identifiers
+			varsym,     // Operator symbols, including reserved operators
+			integer,
+			floating,
+			character,
+			string,
+			special     // One of "(),;[]`{}"
+		};
+
+		struct token {
+			token_kind kind;
+			std::string text;
+			bool lineStart = false;       // The first token on its line
+		};
+
+		// Splits source text into Haskell lexemes, comments and whitespace are dropped
+		std::vector<token> tokenize(const std::string& text);
+
+	}
+
+}
@@ -0,0 +1,282 @@
+#include "llvm_compat.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#if LLVM_VERSION_MAJOR >= 4
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#else
+#include <llvm/Bitcode/ReaderWriter.h>
+#endif
+
+
+using namespace llvm;
+using namespace std;
+
+
+namespace {
+
+#if LLVM_VERSION_MAJOR >= 4
+	// Since LLVM 5 passes only build remarks the context's handler asks for,
+	// the callback alone would never see one
+	struct remark_handler : public DiagnosticHandler {
+		remark_handler(mhc::compat::diagnostic_handler handler, void* handlerContext)
+		: DiagnosticHandler(handlerContext) {
+			DiagHandlerCallback = handler;
+		}
+
+		bool isAnalysisRemarkEnabled(StringRef) const override { return true; }
+		bool isMissedOptRemarkEnabled(StringRef) const override { return true; }
+		bool isPassedOptRemarkEnabled(StringRef) const override { return true; }
+		bool isAnyRemarkEnabled() const override { return true; }
+	};
+#endif
+
+}
+
+namespace mhc {
+
+	namespace compat {
+
+#if LLVM_VERSION_MAJOR >= 4
+
+		void setDiagnosticHandler(LLVMContext& context, diagnostic_handler handler, void* handlerContext) {
+			context.setDiagnosticHandler(unique_ptr<DiagnosticHandler>(new remark_handler(handler, handlerContext)));
+		}
+
+		diagnostic_handler diagnosticHandler(const LLVMContext& context) {
+			return context.getDiagnosticHandlerCallBack();
+		}
+
+		void* diagnosticContext(const LLVMContext& context) {
+			return context.getDiagnosticContext();
+		}
+
+		string remarkName(const optimization_remark& remark) {
+			return remark.getRemarkName().str();
+		}
+
+		string remarkArgument(const optimization_remark& remark, StringRef key) {
+			for (const auto& arg : remark.getArgs()) {
+				if (arg.Key == key) {
+					return arg.Val;
+				}
+			}
+			return "";
+		}
+
+		LoadInst* createLoad(IRBuilder<>& builder, Value* ptr, const Twine& name) {
+			return builder.CreateLoad(ptr->getType()->getPointerElementType(), ptr, name);
+		}
+
+		Value* createConstInBoundsGEP1_64(IRBuilder<>& builder, Value* ptr, uint64_t index, const Twine& name) {
+			return builder.CreateConstInBoundsGEP1_64(ptr->getType()->getPointerElementType(), ptr, index, name);
+		}
+
+		Value* createConstInBoundsGEP2_64(IRBuilder<>& builder, Value* ptr, uint64_t index0, uint64_t index1, const Twine& name) {
+			return builder.CreateConstInBoundsGEP2_64(ptr->getType()->getPointerElementType(), ptr, index0, index1, name);
+		}
+
+		Value* createInBoundsGEP(IRBuilder<>& builder, Value* ptr, Value* index, const Twine& name) {
+			return builder.CreateInBoundsGEP(ptr->getType()->getPointerElementType(), ptr, index, name);
+		}
+
+		Function* getOrInsertFunction(Module& module, StringRef name, FunctionType* type) {
+			return cast<Function>(module.getOrInsertFunction(name, type).getCallee());
+		}
+
+		unsigned argCount(const CallInst* call) {
+			return call->arg_size();
+		}
+
+		void setReturnNoAlias(Function* function) {
+			function->setReturnDoesNotAlias();
+		}
+
+		void setReturnNoAlias(CallInst* call) {
+			call->addRetAttr(Attribute::NoAlias);
+		}
+
+		bool returnsNoAlias(const Function* function) {
+			return function->returnDoesNotAlias();
+		}
+
+		ConstantInt* caseValue(SwitchInst* dispatch, unsigned index) {
+			return (dispatch->case_begin() + index)->getCaseValue();
+		}
+
+		const ConstantInt* caseValue(const SwitchInst* dispatch, unsigned index) {
+			return (dispatch->case_begin() + index)->getCaseValue();
+		}
+
+		AtomicRMWInst* createAtomicAdd(IRBuilder<>& builder, Value* ptr, Value* amount) {
+			return builder.CreateAtomicRMW(AtomicRMWInst::Add, ptr, amount, MaybeAlign(), AtomicOrdering::Monotonic);
+		}
+
+		ConstantInt* constantOperand(const MDNode* node, unsigned index) {
+			return mdconst::extract<ConstantInt>(node->getOperand(index));
+		}
+
+		Pass* createAlwaysInlinerPass() {
+			return createAlwaysInlinerLegacyPass();
+		}
+
+		unique_ptr<Module> cloneModule(const Module& module) {
+			return CloneModule(module);
+		}
+
+		unique_ptr<Module> parseBitcode(StringRef bitCode, StringRef name, LLVMContext& context) {
+			auto parsed = parseBitcodeFile(MemoryBufferRef(bitCode, name), context);
+			if (!parsed) {
+				consumeError(parsed.takeError());
+				return nullptr;
+			}
+
+			return std::move(parsed.get());
+		}
+
+		void writeBitcode(const Module& module, raw_ostream& out) {
+			WriteBitcodeToFile(module, out);
+		}
+
+		bool writeBitcodeFile(const Module& module, const string& path, string& errorInfo) {
+			error_code ec;
+			raw_fd_ostream out(path, ec, sys::fs::OF_None);
+			if (ec) {
+				errorInfo = ec.message();
+				return false;
+			}
+
+			WriteBitcodeToFile(module, out);
+			return true;
+		}
+
+		bool linkModules(Module& dest, unique_ptr<Module> source, string& errorInfo) {
+			// The reason went to the context's diagnostic handler
+			if (Linker::linkModules(dest, std::move(source))) {
+				errorInfo = "see the diagnostics above";
+				return false;
+			}
+
+			return true;
+		}
+
+#else
+
+		void setDiagnosticHandler(LLVMContext& context, diagnostic_handler handler, void* handlerContext) {
+			context.setDiagnosticHandler(handler, handlerContext);
+		}
+
+		diagnostic_handler diagnosticHandler(const LLVMContext& context) {
+			return context.getDiagnosticHandler();
+		}
+
+		void* diagnosticContext(const LLVMContext& context) {
+			return context.getDiagnosticContext();
+		}
+
+		string remarkName(const optimization_remark&) {
+			return "";
+		}
+
+		string remarkArgument(const optimization_remark&, StringRef) {
+			return "";
+		}
+
+		LoadInst* createLoad(IRBuilder<>& builder, Value* ptr, const Twine& name) {
+			return builder.CreateLoad(ptr, name);
+		}
+
+		Value* createConstInBoundsGEP1_64(IRBuilder<>& builder, Value* ptr, uint64_t index, const Twine& name) {
+			return builder.CreateConstInBoundsGEP1_64(ptr, index, name);
+		}
+
+		Value* createConstInBoundsGEP2_64(IRBuilder<>& builder, Value* ptr, uint64_t index0, uint64_t index1, const Twine& name) {
+			return builder.CreateConstInBoundsGEP2_64(ptr, index0, index1, name);
+		}
+
+		Value* createInBoundsGEP(IRBuilder<>& builder, Value* ptr, Value* index, const Twine& name) {
+			return builder.CreateInBoundsGEP(ptr, index, name);
+		}
+
+		Function* getOrInsertFunction(Module& module, StringRef name, FunctionType* type) {
+			return cast<Function>(module.getOrInsertFunction(name, type));
+		}
+
+		unsigned argCount(const CallInst* call) {
+			return call->getNumArgOperands();
+		}
+
+		void setReturnNoAlias(Function* function) {
+			function->setDoesNotAlias(0);
+		}
+
+		void setReturnNoAlias(CallInst* call) {
+			call->addAttribute(AttributeSet::ReturnIndex, Attribute::NoAlias);
+		}
+
+		bool returnsNoAlias(const Function* function) {
+			return function->doesNotAlias(0);
+		}
+
+		ConstantInt* caseValue(SwitchInst* dispatch, unsigned index) {
+			return SwitchInst::CaseIt(dispatch, index).getCaseValue();
+		}
+
+		const ConstantInt* caseValue(const SwitchInst* dispatch, unsigned index) {
+			return SwitchInst::ConstCaseIt(dispatch, index).getCaseValue();
+		}
+
+		AtomicRMWInst* createAtomicAdd(IRBuilder<>& builder, Value* ptr, Value* amount) {
+			return builder.CreateAtomicRMW(AtomicRMWInst::Add, ptr, amount, Monotonic);
+		}
+
+		ConstantInt* constantOperand(const MDNode* node, unsigned index) {
+			return cast<ConstantInt>(node->getOperand(index));
+		}
+
+		Pass* createAlwaysInlinerPass() {
+			return llvm::createAlwaysInlinerPass();
+		}
+
+		unique_ptr<Module> cloneModule(const Module& module) {
+			return unique_ptr<Module>(CloneModule(&module));
+		}
+
+		unique_ptr<Module> parseBitcode(StringRef bitCode, StringRef name, LLVMContext& context) {
+			unique_ptr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(bitCode, name, false));
+			auto parsed = parseBitcodeFile(buffer.get(), context);
+			return unique_ptr<Module>(parsed ? parsed.get() : nullptr);
+		}
+
+		void writeBitcode(const Module& module, raw_ostream& out) {
+			WriteBitcodeToFile(&module, out);
+		}
+
+		bool writeBitcodeFile(const Module& module, const string& path, string& errorInfo) {
+			raw_fd_ostream out(path.c_str(), errorInfo, sys::fs::F_None);
+			if (!errorInfo.empty()) {
+				return false;
+			}
+
+			WriteBitcodeToFile(&module, out);
+			return true;
+		}
+
+		bool linkModules(Module& dest, unique_ptr<Module> source, string& errorInfo) {
+			return !Linker::LinkModules(&dest, source.get(), Linker::DestroySource, &errorInfo);
+		}
+
+#endif
+
+	}
+
+}
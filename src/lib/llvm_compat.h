@@ -0,0 +1,96 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if LLVM_VERSION_MAJOR >= 4
+#include <llvm/IR/LegacyPassManager.h>
+#else
+#include <llvm/PassManager.h>
+#endif
+
+
+namespace mhc {
+
+	// The Makefile builds against LLVM 3.5 unless LLVM_VERSION says otherwise.
+	// Calls whose signatures changed since go through here, everything else
+	// uses LLVM directly.
+	namespace compat {
+
+#if LLVM_VERSION_MAJOR >= 4
+		using terminator_inst = llvm::Instruction;
+		using module_pass_manager = llvm::legacy::PassManager;
+		using optimization_remark = llvm::DiagnosticInfoIROptimization;
+#else
+		using terminator_inst = llvm::TerminatorInst;
+		using module_pass_manager = llvm::PassManager;
+		using optimization_remark = llvm::DiagnosticInfoOptimizationRemarkBase;
+#endif
+
+		using diagnostic_handler = void (*)(const llvm::DiagnosticInfo&, void*);
+
+		// Every remark is delivered to 'handler', mhc filters them itself
+		void setDiagnosticHandler(llvm::LLVMContext& context, diagnostic_handler handler, void* handlerContext);
+		diagnostic_handler diagnosticHandler(const llvm::LLVMContext& context);
+		void* diagnosticContext(const llvm::LLVMContext& context);
+
+		// The remark's name within its pass ("IRSizeChange") and the value of
+		// one of its arguments, empty where LLVM doesn't keep them
+		std::string remarkName(const optimization_remark& remark);
+		std::string remarkArgument(const optimization_remark& remark, llvm::StringRef key);
+
+		// Loads and address arithmetic on the pointee type of 'ptr'
+		llvm::LoadInst* createLoad(llvm::IRBuilder<>& builder, llvm::Value* ptr, const llvm::Twine& name = "");
+		llvm::Value* createConstInBoundsGEP1_64(llvm::IRBuilder<>& builder, llvm::Value* ptr, std::uint64_t index,
+		                                        const llvm::Twine& name = "");
+		llvm::Value* createConstInBoundsGEP2_64(llvm::IRBuilder<>& builder, llvm::Value* ptr, std::uint64_t index0,
+		                                        std::uint64_t index1, const llvm::Twine& name = "");
+		llvm::Value* createInBoundsGEP(llvm::IRBuilder<>& builder, llvm::Value* ptr, llvm::Value* index,
+		                               const llvm::Twine& name = "");
+
+		// Declares 'name' with 'type' unless the module already has it
+		llvm::Function* getOrInsertFunction(llvm::Module& module, llvm::StringRef name, llvm::FunctionType* type);
+
+		unsigned argCount(const llvm::CallInst* call);
+
+		void setReturnNoAlias(llvm::Function* function);
+		void setReturnNoAlias(llvm::CallInst* call);
+		bool returnsNoAlias(const llvm::Function* function);
+
+		llvm::ConstantInt* caseValue(llvm::SwitchInst* dispatch, unsigned index);
+		const llvm::ConstantInt* caseValue(const llvm::SwitchInst* dispatch, unsigned index);
+
+		// Adds 'amount' to the integer at 'ptr' as one monotonic atomicrmw, so
+		// threads updating it at the same time lose no increment
+		llvm::AtomicRMWInst* createAtomicAdd(llvm::IRBuilder<>& builder, llvm::Value* ptr, llvm::Value* amount);
+
+		// Integer operand of metadata such as !range or !prof
+		llvm::ConstantInt* constantOperand(const llvm::MDNode* node, unsigned index);
+
+		llvm::Pass* createAlwaysInlinerPass();
+
+		std::unique_ptr<llvm::Module> cloneModule(const llvm::Module& module);
+
+		// Returns nullptr when 'bitCode' can't be read
+		std::unique_ptr<llvm::Module> parseBitcode(llvm::StringRef bitCode, llvm::StringRef name, llvm::LLVMContext& context);
+		void writeBitcode(const llvm::Module& module, llvm::raw_ostream& out);
+		bool writeBitcodeFile(const llvm::Module& module, const std::string& path, std::string& errorInfo);
+
+		// Links 'source' into 'dest', which takes over its definitions
+		bool linkModules(llvm::Module& dest, std::unique_ptr<llvm::Module> source, std::string& errorInfo);
+
+	}
+
+}
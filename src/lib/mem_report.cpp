@@ -0,0 +1,171 @@
+#include "mem_report.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+#include <boost/variant/apply_visitor.hpp>
+#include <boost/variant/static_visitor.hpp>
+
+
+using namespace mhc::mem_report;
+using namespace parser;
+
+using namespace std;
+
+
+namespace {
+
+	struct sample_t {
+		string phase;
+		uint64_t peak;
+		uint64_t childPeak;
+		holdings held;
+	};
+
+	atomic<bool> g_enabled(false);
+
+	mutex g_mutex;
+	vector<sample_t> g_samples;
+
+	uint64_t maxRSS(int who) {
+		rusage usage;
+		if (getrusage(who, &usage) != 0) {
+			return 0;
+		}
+
+		// Reported in kilobytes on Linux
+		return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+	}
+
+	uint64_t stringBytes(const string& str) {
+		return str.capacity() + 1;
+	}
+
+	uint64_t stringsBytes(const vector<string>& strs) {
+		uint64_t bytes = strs.capacity() * sizeof(string);
+		for (const auto& itr : strs) {
+			bytes += stringBytes(itr);
+		}
+
+		return bytes;
+	}
+
+	class ast_counter : public boost::static_visitor<void> {
+	public:
+		explicit ast_counter(ast_usage& usage) : m_usage(usage) {}
+
+		void operator()(const base_expr& expr) {
+			add("base_expr", sizeof(expr) + expr.children.capacity() * sizeof(base_expr_node));
+			visitAll(expr.children);
+		}
+		void operator()(const module_decl& decl) {
+			add("module_decl", sizeof(decl) + stringBytes(decl.module_id) + stringsBytes(decl.exports)
+			                   + decl.body.capacity() * sizeof(base_expr_node));
+			visitAll(decl.body);
+		}
+		void operator()(const import_decl& decl) {
+			add("import_decl", sizeof(decl) + stringBytes(decl.module_id));
+		}
+		void operator()(const algebraic_datatype_decl& decl) {
+			add("algebraic_datatype_decl", sizeof(decl) + stringBytes(decl.type_ctor) + stringBytes(decl.value_ctor)
+			                               + stringsBytes(decl.components) + stringsBytes(decl.deriving_typeclasses)
+			                               + stringsBytes(decl.constructors));
+		}
+		void operator()(const type_synonym_decl& decl) {
+			add("type_synonym_decl", sizeof(decl) + stringBytes(decl.type_new) + stringBytes(decl.type_old));
+		}
+		void operator()(const string& str) {
+			add("declaration", stringBytes(str));
+		}
+
+	private:
+		void add(const char* kind, uint64_t bytes) {
+			auto& entry = m_usage.kinds[kind];
+			entry.first += 1;
+			entry.second += bytes;
+			m_usage.bytes += bytes;
+		}
+
+		void visitAll(const vector<base_expr_node>& nodes) {
+			for (const auto& itr : nodes) {
+				boost::apply_visitor(*this, itr);
+			}
+		}
+
+		ast_usage& m_usage;
+	};
+
+	string megabytes(uint64_t bytes) {
+		ostringstream out;
+		out << fixed << setprecision(1) << bytes / (1024.0 * 1024.0) << " MB";
+		return out.str();
+	}
+
+}
+
+namespace mhc {
+
+	namespace mem_report {
+
+		void enable() {
+			g_enabled = true;
+		}
+
+		bool enabled() {
+			return g_enabled.load(memory_order_relaxed);
+		}
+
+		uint64_t peakRSS() {
+			return maxRSS(RUSAGE_SELF);
+		}
+
+		uint64_t childPeakRSS() {
+			return maxRSS(RUSAGE_CHILDREN);
+		}
+
+		ast_usage astUsage(const base_expr_node& root) {
+			ast_usage usage;
+			ast_counter counter(usage);
+			boost::apply_visitor(counter, root);
+
+			return usage;
+		}
+
+		void sample(const string& phase, const holdings& held) {
+			if (!enabled()) {
+				return;
+			}
+
+			sample_t s = { phase, peakRSS(), childPeakRSS(), held };
+
+			lock_guard<mutex> lock(g_mutex);
+			g_samples.push_back(move(s));
+		}
+
+		void addAst(holdings& held, const ast_usage& usage) {
+			held.push_back(make_pair("AST", usage.bytes));
+			for (const auto& itr : usage.kinds) {
+				held.push_back(make_pair("  " + itr.first + " x" + to_string(itr.second.first), itr.second.second));
+			}
+		}
+
+		void print(ostream& out) {
+			lock_guard<mutex> lock(g_mutex);
+
+			out << "===-- Memory report --===" << endl;
+			for (const auto& s : g_samples) {
+				out << s.phase << ": peak RSS " << megabytes(s.peak) << ", child peak RSS " << megabytes(s.childPeak) << endl;
+
+				for (const auto& itr : s.held) {
+					out << "    " << left << setw(40) << itr.first << right << setw(14) << itr.second << " bytes" << endl;
+				}
+			}
+		}
+
+	}
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parser.h"
+
+
+namespace mhc {
+
+	namespace mem_report {
+
+		// Samples are only recorded once enabled, callers check enabled() before
+		// measuring anything expensive
+		void enable();
+		bool enabled();
+
+		// Peak resident set of this process and of the largest child waited for
+		// ('opt', 'llc', the linker), in bytes
+		std::uint64_t peakRSS();
+		std::uint64_t childPeakRSS();
+
+		// Nodes of the AST by kind, along with the bytes they and their strings hold
+		struct ast_usage {
+			std::map<std::string, std::pair<std::size_t, std::uint64_t>> kinds;    // Kind -> (count, bytes)
+			std::uint64_t bytes = 0;
+		};
+
+		ast_usage astUsage(const parser::base_expr_node& root);
+
+		// What a data structure holds at a phase boundary, e.g. { "LLVM module", 1234 }
+		using holdings = std::vector<std::pair<std::string, std::uint64_t>>;
+
+		// Records the holdings along with the process' peak RSS at the end of 'phase'
+		void sample(const std::string& phase, const holdings& held = holdings());
+
+		// Adds the AST's total and per-kind usage to 'held'
+		void addAst(holdings& held, const ast_usage& usage);
+
+		void print(std::ostream& out);
+
+	}
+
+}
@@ -0,0 +1,84 @@
+#include "operators.h"
+
+
+using namespace mhc::ops;
+
+using namespace std;
+
+
+namespace {
+
+	struct operator_symbol {
+		const char* symbol;
+		opcode code;
+	};
+
+	const operator_symbol g_symbols[] = {
+		{ "+",      opcode::add         },
+		{ "-",      opcode::sub         },
+		{ "*",      opcode::mul         },
+		{ "quot",   opcode::quot        },
+		{ "rem",    opcode::rem         },
+		{ "div",    opcode::div         },
+		{ "mod",    opcode::mod         },
+		{ "/",      opcode::fdiv        },
+		{ "==",     opcode::eq          },
+		{ "/=",     opcode::ne          },
+		{ "<",      opcode::lt          },
+		{ "<=",     opcode::le          },
+		{ ">",      opcode::gt          },
+		{ ">=",     opcode::ge          },
+		{ ".&.",    opcode::bit_and     },
+		{ ".|.",    opcode::bit_or      },
+		{ "shiftL", opcode::shl         },
+		{ "shiftR", opcode::shr         },
+		{ "&&",     opcode::logical_and },
+		{ "||",     opcode::logical_or  },
+	};
+
+	const char* const g_names[g_opcodeCount] = {
+		"add", "sub", "mul", "quot", "rem", "div", "mod", "fdiv",
+		"eq", "ne", "lt", "le", "gt", "ge",
+		"and", "or", "shl", "shr", "andalso", "orelse",
+	};
+
+}
+
+namespace mhc {
+
+	namespace ops {
+
+		bool resolveOperator(const string& symbol, opcode& code) {
+			for (const auto& itr : g_symbols) {
+				if (symbol == itr.symbol) {
+					code = itr.code;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		const char* opcodeName(opcode code) {
+			return (code < opcode::count) ? g_names[static_cast<size_t>(code)] : "unknown";
+		}
+
+		bool isComparison(opcode code) {
+			return code >= opcode::eq && code <= opcode::ge;
+		}
+
+		bool isSupported(opcode code, operand_type type) {
+			if (code == opcode::logical_and || code == opcode::logical_or) {
+				return false;
+			}
+			if (type != operand_type::floating) {
+				return code != opcode::fdiv && code < opcode::count;
+			}
+
+			return code == opcode::add || code == opcode::sub || code == opcode::mul
+			    || code == opcode::fdiv || isComparison(code);
+		}
+
+	}
+
+}
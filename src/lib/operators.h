@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace mhc {
+
+	namespace ops {
+
+		// Binary operators, resolved from their symbol once when the AST is
+		// built so lowering indexes a constant table instead of comparing strings
+		enum class opcode : std::uint8_t {
+			add,
+			sub,
+			mul,
+			quot,           // Rounds toward zero, unsigned for Word
+			rem,
+			div,            // Rounds toward negative infinity
+			mod,            // Takes the sign of the divisor
+			fdiv,           // "/", only Double is Fractional
+			eq,
+			ne,
+			lt,
+			le,
+			gt,
+			ge,
+			bit_and,
+			bit_or,
+			shl,
+			shr,            // Arithmetic for Int, logical for Word
+			logical_and,    // && and || of Bool, desugared into branches so the
+			logical_or,     // right operand is only evaluated when it's needed
+			count
+		};
+
+		// Operand representation, selects signed/unsigned/floating instructions
+		enum class operand_type : std::uint8_t {
+			integer,        // Int, 64-bit signed
+			word,           // Word, 64-bit unsigned
+			floating,       // Double
+			count
+		};
+
+		const std::size_t g_opcodeCount = static_cast<std::size_t>(opcode::count);
+		const std::size_t g_operandTypeCount = static_cast<std::size_t>(operand_type::count);
+
+		// Maps an operator symbol (or backquoted name such as "quot") to its
+		// opcode. The parser stores it in each binary expression, inference and
+		// desugaring use it when no binding has the operator's name.
+		bool resolveOperator(const std::string& symbol, opcode& code);
+
+		const char* opcodeName(opcode code);
+
+		bool isComparison(opcode code);
+
+		// Double only has arithmetic, "/" and the comparisons, the Integral
+		// and bitwise operators are for Int and Word. The logical ones are
+		// never a primitive.
+		bool isSupported(opcode code, operand_type type);
+
+	}
+
+}
@@ -5,6 +5,7 @@
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/qi_hold.hpp>
 #include <boost/spirit/include/qi_lexeme.hpp>
+#include <boost/spirit/include/phoenix_bind.hpp>
 #include <boost/spirit/include/phoenix_core.hpp>
 #include <boost/spirit/include/phoenix_operator.hpp>
 #include <boost/spirit/include/phoenix_fusion.hpp>
@@ -38,6 +39,13 @@ BOOST_FUSION_ADAPT_STRUCT(
 	parser::module_decl,
 	(std::string, module_id)
 	(std::vector<parser::base_expr_node>, body)
+	(std::vector<std::string>, exports)
+	(bool, has_export_list)
+)
+
+BOOST_FUSION_ADAPT_STRUCT(
+	parser::import_decl,
+	(std::string, module_id)
 )
 
 BOOST_FUSION_ADAPT_STRUCT(
@@ -145,6 +153,26 @@ namespace parser {
 			("_",        1)
 			("case",     2)
 			("deriving", 3)
+			("class",    4)
+			("data",     5)
+			("default",  6)
+			("do",       7)
+			("else",     8)
+			("foreign",  9)
+			("if",      10)
+			("import",  11)
+			("in",      12)
+			("infix",   13)
+			("infixl",  14)
+			("infixr",  15)
+			("instance",16)
+			("let",     17)
+			("module",  18)
+			("newtype", 19)
+			("of",      20)
+			("then",    21)
+			("type",    22)
+			("where",   23)
 			;
 		}
 	} reservedid_symbols;
@@ -238,16 +266,18 @@ namespace parser {
 				| literal
 				;
 
+			// "2.5" would otherwise stop after the "2"
 			literal %=
-				  integer
-				| float_ 
+				  float_
+				| integer
 				| char__
 				| string__
 				;
 
 			special %= qi::char_("(),;[]`{}");
 
-			ascSymbol %= qi::char_("!#$%&*+./<=>?@\\^|-~:");
+			// '-' goes last, anywhere else it forms a range
+			ascSymbol %= qi::char_("!#$%&*+./<=>?@\\^|~:-");
 
 			symbol %=
 				   (!special)
@@ -273,13 +303,17 @@ namespace parser {
 				   (!reservedid)
 				>> qi::lexeme[(qi::char_("A-Z") >> *qi::char_("a-zA-Z0-9'"))];
 
+			// A lexeme, the skipper would let "where y" look like one identifier
 			reservedid %=
-				   reservedid_symbols
-				>> !(char_("a-zA-Z0-9'_"));
+				qi::lexeme[
+				     reservedid_symbols
+				  >> !(char_("a-zA-Z0-9'_"))
+				];
 
-			// Operators
+			// Operators, a reserved operator only excludes a symbol it spells out
+			// entirely: "=" is reserved but "==" is not
 			varsym %=
-				   (!reservedop)
+				   (!(reservedop >> !symbol))
 				>> (
 				       (!qi::char_(":"))
 				    >> (symbol >> *symbol)
@@ -287,6 +321,14 @@ namespace parser {
 
 			reservedop %= reservedop_symbols;
 
+			consym %=
+				   (!(reservedop >> !symbol))
+				>> qi::char_(':') >> *symbol;
+
+			gconsym %=
+				  (qi::char_(':') >> !symbol)
+				| qconsym;
+
 			// Type variable
 			tyvar %= varid;
 
@@ -306,7 +348,7 @@ namespace parser {
 				//	  (qi::lexeme[*(conid_noskip >> '.')])
 				//   >> conid_noskip
 				//	  (qi::lexeme[*(conid_noskip >> '.') >> conid_noskip])
-					  (qi::lexeme[(conid_noskip % '.')])
+					  qi::raw[qi::lexeme[(conid_noskip % '.')]]
 				  )
 				;
 
@@ -395,14 +437,17 @@ namespace parser {
 				  lpat >> qconop >> pat
 				| lpat;
 
+			// A constructor with arguments comes first, apat alone would stop
+			// after the constructor
 			lpat %=
-				  apat
+				  (qcon >> +apat)
+				| apat
 				| (qi::char_('-') >>
 				   (
-				      integer
-				    | float_
+				      float_
+				    | integer
 				   ))
-				| (qcon >> *apat);
+				;
 
 			apat %=
 				  var >> -(qi::lit('@') >> apat)
@@ -451,13 +496,28 @@ namespace parser {
 				  (
 				       "module"
 				    >> modid      [at_c<0>(_val) = _1]
-					>> /* TODO: -(exports) >> */
-					   "where"
+					>> -(exports  [at_c<2>(_val) = _1, at_c<3>(_val) = true])
+					>> "where"
 					>> body       [at_c<1>(_val) = _1]
 				  )
 				| body            [at_c<1>(_val) = _1]
 				;
 
+			// Export entries keep their text: "f", "T", "T(..)", "T(A, B)", "module M"
+			exports %=
+				   '('
+				>> -(export_ % ',')
+				>> -(qi::lit(','))
+				>> ')'
+				;
+
+			export_ %=
+				qi::raw[
+				    ("module" >> modid)
+				  | (qtycon >> -('(' >> *(char_ - ')') >> ')'))
+				  | qvar
+				];
+
 			body %=
 				  /* TODO: '{' >> impdecls >> ';' >> topdecls >> '}' >>*/  // ch5: Modules
 				  /*'{' >> topdecls >> '}';*/
@@ -467,21 +527,45 @@ namespace parser {
 				  topdecl % ';';
 
 			topdecl %=
-				  topdecl_typesynonym
+				  impdecl
+				| topdecl_typesynonym
 				| topdecl_data
 			//	| ("class" >> /* TODO: -(scontext >> "=>") >>*/ tycls >> tyvar >> -("where" >> cdecls))
-				| decl
+				| topdecl_foreign
+				| topdecl_decl
+				;
+
+			// Ch8: Foreign function interface, kept as source text like other declarations
+			topdecl_foreign %=
+				qi::raw[
+				     qi::lexeme["foreign" >> !char_("a-zA-Z0-9_'")]
+				  >> (qi::lit("import") | qi::lit("export"))
+				  >> *(char_ - ';')
+				];
+
+			// Top-level declarations keep their source text, the token rules
+			// below concatenate without separators which loses identifier boundaries
+			topdecl_decl %= qi::raw[decl];
+
+			// Ch5: Modules, imports are accepted among the top-level declarations
+			impdecl =
+				   "import"
+				>> -(qi::lit("qualified"))
+				>> modid      [at_c<0>(_val) = _1]
+				>> -("as" >> modid)
+				>> -(qi::lit("hiding"))
+				>> -("(" >> -(qi::omit[(var | con | qvar) % ',']) >> ")")
 				;
 
 			// Algebraic Datatype Decls
 			topdecl_typesynonym %=
-				("type" >> simpletype >> "=" >> type);
+				("type" >> qi::raw[simpletype] >> "=" >> qi::raw[type]);
 
 			topdecl_data %=
 				(
 				     "data"
 				  >> /* TODO: -(context >> "=>") >>*/ simpletype
-				  >> -('=' >> constrs)
+				  >> -('=' >> constrs(phoenix::bind(&algebraic_datatype_decl::constructors, _val)))
 				  >> -(deriving)
 				);
 				//("data" >> simpletype);
@@ -531,14 +615,14 @@ namespace parser {
 				| "let" >> decls
 				| infixexp;
 
+			// Factored so the common prefix is parsed once, trying each
+			// alternative from the start again made nested lets exponential
 			exp_ %=
-				  infixexp >> "::" >> /*TODO: -(context >> "=>")*/ type
-				| infixexp;
+				  infixexp >> -("::" >> /*TODO: -(context >> "=>")*/ type);
 
 			infixexp %=
-				  lexp >> qop >> infixexp
-				| qi::lit('-') >> infixexp
-				| lexp;
+				  lexp >> -(qop >> infixexp)
+				| qi::lit('-') >> infixexp;
 
 			lexp %=
 				  (qi::lit('\\') >> +apat >> "->" >> exp_)
@@ -549,9 +633,9 @@ namespace parser {
 				| fexp
 				;
 
+			// Application, the left recursive fexp aexp as a repetition
 			fexp %=
-				  /* TODO: -(fexp) >>*/
-				  aexp;
+				  aexp >> *aexp;
 
 			aexp %=
 				  qvar
@@ -565,9 +649,13 @@ namespace parser {
 				| (qi::lit('(') >> infixexp >> qop >> ')')
 				| (qi::lit('(') >> (qop - '-') >> infixexp >> ')')
 				| (qcon >> '{' >> *fbind >> '}')
-				| ((aexp - qcon) >> '{' >> +fbind >> '}')
+				/* TODO: Record update, left recursive: aexp<qcon> '{' fbind+ '}' */
 				;
 
+			qvarop %=
+				  qvarsym
+				| (qi::char_('`') >> qvarid >> qi::char_('`'));
+
 			varop %=
 				  varsym
 				| ("`" >> varid  >> "`");
@@ -615,10 +703,11 @@ namespace parser {
 				| ("(," >> (*qi::char_(',')) >> ")");	// tupling constructor
 
 			// TODO
-			constrs %= (constr % '|');
+			// Constructor names are also collected on their own, in declaration order
+			constrs %= (constr(_r1) % '|');
 			constr %=
 				  //con >> -(qi::lit('!')) >> *atype >> -(qi::lit('!')) >> -(atype)
-				  con >> *(-(qi::lit('!')) >> atype);
+				  con [push_back(_r1, _1)] >> *(-(qi::lit('!')) >> atype);
 				;
 				//| (btype | (qi::lit('!') >> atype)) >> conop >> (btype | (qi::lit('!') >> atype))
 				//| con >> *(fielddecl);
@@ -738,10 +827,15 @@ namespace parser {
 
 		qi::rule<Iterator, module_decl(),				skipper<Iterator>> module;
 		qi::rule<Iterator, vector<base_expr_node>(),	skipper<Iterator>> body;
+		qi::rule<Iterator, vector<string>(),			skipper<Iterator>> exports;
+		qi::rule<Iterator, string(),					skipper<Iterator>> export_;
 		qi::rule<Iterator, vector<base_expr_node>(),	skipper<Iterator>> topdecls;
 		qi::rule<Iterator, base_expr_node(),			skipper<Iterator>> topdecl;
+		qi::rule<Iterator, import_decl(),				skipper<Iterator>> impdecl;
 		qi::rule<Iterator, type_synonym_decl(),			skipper<Iterator>> topdecl_typesynonym;
 		qi::rule<Iterator, algebraic_datatype_decl(),	skipper<Iterator>> topdecl_data;
+		qi::rule<Iterator, string(),					skipper<Iterator>> topdecl_foreign;
+		qi::rule<Iterator, string(),					skipper<Iterator>> topdecl_decl;
 		qi::rule<Iterator, string(),					skipper<Iterator>> decls;
 		qi::rule<Iterator, string(),					skipper<Iterator>> decl;
 		qi::rule<Iterator, string(),					skipper<Iterator>> cdecls;
@@ -795,8 +889,8 @@ namespace parser {
 		qi::rule<Iterator, string(),			skipper<Iterator>> atype;
 		qi::rule<Iterator, string(),			skipper<Iterator>> gtycon;
 
-		qi::rule<Iterator, vector<string>(),	skipper<Iterator>> constrs;
-		qi::rule<Iterator, vector<string>(),	skipper<Iterator>> constr;
+		qi::rule<Iterator, vector<string>(vector<string>&),	skipper<Iterator>> constrs;
+		qi::rule<Iterator, vector<string>(vector<string>&),	skipper<Iterator>> constr;
 		qi::rule<Iterator, string(),			skipper<Iterator>> fielddecl;
 		qi::rule<Iterator, vector<string>(),	skipper<Iterator>> deriving;
 		qi::rule<Iterator, string(),			skipper<Iterator>> dclass;
@@ -823,5 +917,53 @@ namespace mhc {
 		return parse(str, root);
 	}
 
+	bool parseStream(const std::string& str, parser::module_decl& header,
+	                 const std::function<bool(const parser::base_expr_node&)>& callback) {
+		using iterator_t = std::string::const_iterator;
+
+		parser::mhc_grammar<iterator_t> p;
+		parser::skipper<iterator_t> s;
+
+		iterator_t itr = str.begin();
+		const iterator_t end = str.end();
+
+		// Mirrors the 'module' rule, a failed header means the body starts right away
+		header = parser::module_decl();
+		const iterator_t start = itr;
+
+		if (qi::phrase_parse(itr, end, qi::lit("module"), s)
+		 && qi::phrase_parse(itr, end, p.modid, s, header.module_id)) {
+			header.has_export_list = qi::phrase_parse(itr, end, p.exports, s, header.exports);
+
+			if (!qi::phrase_parse(itr, end, qi::lit("where"), s)) {
+				header = parser::module_decl();
+				itr = start;
+			}
+		} else {
+			header = parser::module_decl();
+			itr = start;
+		}
+
+		// The 'body' rule one declaration at a time, ';' separators are optional
+		// between groups just as in '*topdecls'
+		for (;;) {
+			qi::phrase_parse(itr, end, qi::eps, s);
+			if (itr == end) {
+				return true;
+			}
+
+			parser::base_expr_node decl;
+			if (!qi::phrase_parse(itr, end, p.topdecl, s, decl)) {
+				return false;
+			}
+
+			if (!callback(decl)) {
+				return false;
+			}
+
+			qi::phrase_parse(itr, end, qi::lit(';'), s);
+		}
+	}
+
 }
 
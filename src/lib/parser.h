@@ -2,6 +2,7 @@
 
 #include <boost/variant/recursive_variant.hpp>
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -9,12 +10,14 @@ namespace parser {
 
 	struct base_expr;
 	struct module_decl;
+	struct import_decl;
 	struct algebraic_datatype_decl;
 	struct type_synonym_decl;
 
 	using base_expr_node = boost::variant<
 		boost::recursive_wrapper<base_expr>,
 		boost::recursive_wrapper<module_decl>,
+		boost::recursive_wrapper<import_decl>,
 		boost::recursive_wrapper<algebraic_datatype_decl>,
 		boost::recursive_wrapper<type_synonym_decl>,
 		std::string
@@ -27,6 +30,12 @@ namespace parser {
 	struct module_decl {
 		std::string module_id;
 		std::vector<base_expr_node> body;
+		std::vector<std::string> exports;              // Export list entries
+		bool has_export_list = false;                  // Without an export list everything is exported
+	};
+
+	struct import_decl {
+		std::string module_id;
 	};
 
 	struct algebraic_datatype_decl {
@@ -34,6 +43,7 @@ namespace parser {
 		std::string value_ctor;                        // Value constructor
 		std::vector<std::string> components;           // Value/Data constructors
 		std::vector<std::string> deriving_typeclasses;
+		std::vector<std::string> constructors;         // Value constructors only, their index is the tag
 	};
 
 	struct type_synonym_decl {
@@ -136,5 +146,12 @@ namespace mhc {
 
 	bool parse(const std::string& str, parser::base_expr_node& root);
 
+	// Parses the module header into 'header' (the body is left empty), then
+	// hands every top-level declaration to 'callback' as soon as it's parsed
+	// and releases it, so only one declaration is held at a time. Stops with
+	// false on a syntax error or when the callback returns false.
+	bool parseStream(const std::string& str, parser::module_decl& header,
+	                 const std::function<bool(const parser::base_expr_node&)>& callback);
+
 }
 
@@ -0,0 +1,365 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include "llvm_compat.h"
+
+
+using namespace mhc;
+using namespace mhc::profile;
+
+using namespace llvm;
+using namespace std;
+
+
+namespace {
+
+	const string g_countersName = "__mhc_prof_counters";
+	const string g_dumpName = "__mhc_prof_dump";
+	const string g_initName = "__mhc_prof_init";
+
+	// Functions reached this often relative to the hottest one are inlining candidates
+	const uint64_t g_hotDivisor = 100;
+
+	const uint64_t g_fnvOffset = 14695981039346656037ULL;
+	const uint64_t g_fnvPrime = 1099511628211ULL;
+
+	uint64_t fnv(uint64_t hash, const string& data) {
+		for (const char c : data) {
+			hash = (hash ^ static_cast<unsigned char>(c)) * g_fnvPrime;
+		}
+
+		return hash;
+	}
+
+	// Code the profile describes, the runtime support added by instrumentModule
+	// and bodies imported from other modules are left out
+	bool isProfiled(const Function& function) {
+		return !function.isDeclaration() && !function.hasAvailableExternallyLinkage()
+		    && function.getName() != g_dumpName && function.getName() != g_initName;
+	}
+
+	// Conditional branches and switches, a case of the Core becomes either
+	vector<compat::terminator_inst*> profiledBranches(Function& function) {
+		vector<compat::terminator_inst*> branches;
+		for (auto& bb : function) {
+			compat::terminator_inst* const terminator = bb.getTerminator();
+			const BranchInst* const branch = dyn_cast<BranchInst>(terminator);
+			if ((branch && branch->isConditional()) || isa<SwitchInst>(terminator)) {
+				branches.push_back(terminator);
+			}
+		}
+
+		return branches;
+	}
+
+	// Taken and total of a conditional branch, every case and the total of a switch
+	size_t counterCount(const compat::terminator_inst* branch) {
+		const SwitchInst* const dispatch = dyn_cast<SwitchInst>(branch);
+		return dispatch ? dispatch->getNumCases() + 1 : 2;
+	}
+
+	size_t branchCounterCount(const Function& function) {
+		size_t count = 0;
+		for (const auto& bb : function) {
+			const compat::terminator_inst* const terminator = bb.getTerminator();
+			const BranchInst* const branch = dyn_cast<BranchInst>(terminator);
+			count += ((branch && branch->isConditional()) || isa<SwitchInst>(terminator)) ? counterCount(terminator) : 0;
+		}
+
+		return count;
+	}
+
+	// Atomic, a load and a store would drop the counts of threads running
+	// the same code at once
+	void increment(IRBuilder<>& builder, GlobalVariable* counters, size_t index, Value* amount) {
+		compat::createAtomicAdd(builder, compat::createConstInBoundsGEP2_64(builder, counters, 0, index), amount);
+	}
+
+	// Each profiled branch by block index with the blocks it goes to, and the
+	// values of a switch's cases. Counters are only meaningful for branches
+	// that still go where they went when they were recorded.
+	string branchShape(const Function& function) {
+		map<const BasicBlock*, size_t> blocks;
+		for (const auto& bb : function) {
+			blocks.insert(make_pair(&bb, blocks.size()));
+		}
+
+		string shape;
+		for (const auto& bb : function) {
+			const compat::terminator_inst* const terminator = bb.getTerminator();
+			const BranchInst* const branch = dyn_cast_or_null<BranchInst>(terminator);
+			const SwitchInst* const dispatch = dyn_cast_or_null<SwitchInst>(terminator);
+			if (!(branch && branch->isConditional()) && !dispatch) {
+				continue;
+			}
+
+			shape += to_string(blocks[&bb]) + (dispatch ? ":switch" : ":br");
+			for (unsigned i = 0; i < terminator->getNumSuccessors(); ++i) {
+				shape += " " + to_string(blocks[terminator->getSuccessor(i)]);
+			}
+			for (unsigned i = 0; dispatch && i < dispatch->getNumCases(); ++i) {
+				shape += " =" + to_string(compat::caseValue(dispatch, i)->getSExtValue());
+			}
+			shape += ",";
+		}
+
+		return shape;
+	}
+
+	// void __mhc_prof_dump(): appends { checksum, count, counters... } to the profile
+	Function* buildDump(Module& module, GlobalVariable* counters, const module_layout& layout, const string& path) {
+		LLVMContext& context = module.getContext();
+		Type* const i8Ptr = Type::getInt8PtrTy(context);
+		Type* const i64 = Type::getInt64Ty(context);
+
+		Function* const fopenF = compat::getOrInsertFunction(module, "fopen", FunctionType::get(i8Ptr, { i8Ptr, i8Ptr }, false));
+		Function* const fwriteF = compat::getOrInsertFunction(module, "fwrite", FunctionType::get(i64, { i8Ptr, i64, i64, i8Ptr }, false));
+		Function* const fcloseF = compat::getOrInsertFunction(module, "fclose", FunctionType::get(Type::getInt32Ty(context), i8Ptr, false));
+
+		const uint64_t header[] = { layout.checksum, layout.counterCount };
+		GlobalVariable* const headerG = new GlobalVariable(module, ArrayType::get(i64, 2), true, GlobalValue::PrivateLinkage,
+			ConstantDataArray::get(context, header), "__mhc_prof_header");
+
+		Function* const dump = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+			GlobalValue::InternalLinkage, g_dumpName, &module);
+
+		BasicBlock* const entryBB = BasicBlock::Create(context, "entry", dump);
+		BasicBlock* const writeBB = BasicBlock::Create(context, "write", dump);
+		BasicBlock* const doneBB = BasicBlock::Create(context, "done", dump);
+
+		IRBuilder<> builder(entryBB);
+		Value* const file = builder.CreateCall(fopenF, { builder.CreateGlobalStringPtr(path), builder.CreateGlobalStringPtr("ab") });
+		builder.CreateCondBr(builder.CreateIsNull(file), doneBB, writeBB);
+
+		builder.SetInsertPoint(writeBB);
+		builder.CreateCall(fwriteF, { builder.CreateBitCast(headerG, i8Ptr), builder.getInt64(sizeof(uint64_t)), builder.getInt64(2), file });
+		builder.CreateCall(fwriteF, { builder.CreateBitCast(counters, i8Ptr), builder.getInt64(sizeof(uint64_t)),
+			builder.getInt64(layout.counterCount), file });
+		builder.CreateCall(fcloseF, file);
+		builder.CreateBr(doneBB);
+
+		builder.SetInsertPoint(doneBB);
+		builder.CreateRetVoid();
+
+		return dump;
+	}
+
+	// Counts of every matching record in the file, summed. Lengths come from
+	// the file, a record longer than what is left ends the read.
+	bool readCounts(const string& path, const module_layout& layout, vector<uint64_t>& counts) {
+		ifstream in(path.c_str(), ios::binary | ios::ate);
+		if (!in) {
+			return false;
+		}
+
+		const uint64_t size = static_cast<uint64_t>(in.tellg());
+		in.seekg(0);
+
+		counts.assign(layout.counterCount, 0);
+		vector<uint64_t> record(layout.counterCount);
+		bool found = false;
+
+		uint64_t header[2];
+		while (in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+			const uint64_t left = size - static_cast<uint64_t>(in.tellg());
+			if (header[1] > left / sizeof(uint64_t)) {
+				break;
+			}
+
+			if (header[0] != layout.checksum || header[1] != layout.counterCount) {
+				in.seekg(header[1] * sizeof(uint64_t), ios::cur);
+				continue;
+			}
+
+			if (!in.read(reinterpret_cast<char*>(record.data()), record.size() * sizeof(uint64_t))) {
+				break;
+			}
+
+			for (size_t i = 0; i < record.size(); ++i) {
+				counts[i] += record[i];
+			}
+			found = true;
+		}
+
+		return found;
+	}
+
+	// Branch weights are 32-bit, scale them down together. Never seen
+	// successors end up even instead of zero.
+	MDNode* branchWeights(LLVMContext& context, vector<uint64_t> counts) {
+		while (*max_element(counts.begin(), counts.end()) >= numeric_limits<uint32_t>::max()) {
+			for (auto& itr : counts) {
+				itr >>= 1;
+			}
+		}
+
+		vector<uint32_t> weights;
+		for (const auto itr : counts) {
+			weights.push_back(static_cast<uint32_t>(itr) + 1);
+		}
+		return MDBuilder(context).createBranchWeights(weights);
+	}
+
+}
+
+namespace mhc {
+
+	namespace profile {
+
+		module_layout layoutOf(const Module& module) {
+			module_layout layout;
+			layout.checksum = g_fnvOffset;
+
+			for (const auto& function : module) {
+				if (!isProfiled(function)) {
+					continue;
+				}
+
+				const size_t branches = branchCounterCount(function);
+				layout.checksum = fnv(layout.checksum, function.getName().str() + "/" + to_string(branches) + "/" + branchShape(function) + ";");
+				layout.counterCount += 1 + branches;
+			}
+
+			return layout;
+		}
+
+		string profilePath(const string& directory, const string& moduleId) {
+			// Absolute, the instrumented program may run from anywhere
+			const auto dir = boost::filesystem::absolute(directory);
+			return (dir / ((moduleId.empty() ? "Main" : moduleId) + ".mhprof")).string();
+		}
+
+		bool instrumentModule(Module& module, const string& path) {
+			const module_layout layout = layoutOf(module);
+			if (layout.counterCount == 0) {
+				return true;
+			}
+
+			LLVMContext& context = module.getContext();
+			ArrayType* const countersType = ArrayType::get(Type::getInt64Ty(context), layout.counterCount);
+			GlobalVariable* const counters = new GlobalVariable(module, countersType, false, GlobalValue::InternalLinkage,
+				ConstantAggregateZero::get(countersType), g_countersName);
+
+			// Collected first, the runtime support added below isn't instrumented
+			vector<Function*> functions;
+			for (auto& function : module) {
+				if (isProfiled(function)) {
+					functions.push_back(&function);
+				}
+			}
+
+			size_t next = 0;
+			for (Function* function : functions) {
+				const auto branches = profiledBranches(*function);
+
+				BasicBlock& entry = function->getEntryBlock();
+				IRBuilder<> builder(&entry, entry.getFirstInsertionPt());
+				increment(builder, counters, next++, builder.getInt64(1));
+
+				// Taken and total instead of one counter per edge, so no edge is
+				// split. The default of a switch is what its cases don't take.
+				for (compat::terminator_inst* branch : branches) {
+					builder.SetInsertPoint(branch);
+					if (BranchInst* const conditional = dyn_cast<BranchInst>(branch)) {
+						increment(builder, counters, next++, builder.CreateZExt(conditional->getCondition(), builder.getInt64Ty()));
+					} else {
+						SwitchInst* const dispatch = cast<SwitchInst>(branch);
+						for (unsigned i = 0; i < dispatch->getNumCases(); ++i) {
+							Value* const taken = builder.CreateICmpEQ(dispatch->getCondition(), compat::caseValue(dispatch, i));
+							increment(builder, counters, next++, builder.CreateZExt(taken, builder.getInt64Ty()));
+						}
+					}
+					increment(builder, counters, next++, builder.getInt64(1));
+				}
+			}
+
+			Function* const dump = buildDump(module, counters, layout, path);
+
+			// void __mhc_prof_init() { atexit(__mhc_prof_dump); }, run as a global constructor
+			Function* const atexitF = compat::getOrInsertFunction(module, "atexit",
+				FunctionType::get(Type::getInt32Ty(context), dump->getType(), false));
+			Function* const init = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+				GlobalValue::InternalLinkage, g_initName, &module);
+
+			IRBuilder<> builder(BasicBlock::Create(context, "entry", init));
+			builder.CreateCall(atexitF, dump);
+			builder.CreateRetVoid();
+
+			appendToGlobalCtors(module, init, 65535);
+			return true;
+		}
+
+		bool applyProfile(Module& module, const string& path) {
+			const module_layout layout = layoutOf(module);
+
+			vector<uint64_t> counts;
+			if (!readCounts(path, layout, counts)) {
+				cerr << "Warning: No profile matching this module in " << path << endl;
+				return false;
+			}
+
+			uint64_t hottest = 0;
+			size_t next = 0;
+			for (auto& function : module) {
+				if (isProfiled(function)) {
+					hottest = max(hottest, counts[next]);
+					next += 1 + branchCounterCount(function);
+				}
+			}
+
+			// LLVM 3.5 has no function entry counts, the closest it understands
+			// are the cold and inline hint attributes
+			next = 0;
+			for (auto& function : module) {
+				if (!isProfiled(function)) {
+					continue;
+				}
+
+				const uint64_t entry = counts[next++];
+				if (entry == 0) {
+					function.addFnAttr(Attribute::Cold);
+				} else if (entry * g_hotDivisor >= hottest) {
+					function.addFnAttr(Attribute::InlineHint);
+				}
+
+				// Weights list the successors in order, a switch's default first
+				for (compat::terminator_inst* branch : profiledBranches(function)) {
+					vector<uint64_t> taken(counts.begin() + next, counts.begin() + next + counterCount(branch) - 1);
+					next += taken.size();
+					const uint64_t total = counts[next++];
+
+					uint64_t sum = 0;
+					for (const auto itr : taken) {
+						sum += itr;
+					}
+					const uint64_t rest = (total > sum) ? total - sum : 0;
+					taken.insert(isa<SwitchInst>(branch) ? taken.begin() : taken.end(), rest);
+
+					branch->setMetadata(LLVMContext::MD_prof, branchWeights(module.getContext(), taken));
+				}
+			}
+
+			return true;
+		}
+
+	}
+
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace llvm {
+	class Module;
+}
+
+
+namespace mhc {
+
+	namespace profile {
+
+		// Each defined function owns a run of counters: its entry count, then
+		// for every conditional branch in block order its taken and total
+		// counts, and for every switch the count of each case and the total.
+		// The checksum covers function names, counter counts and where every
+		// branch goes, block by block, so a profile is only applied to the
+		// code it was recorded from. Counters are updated atomically.
+		struct module_layout {
+			std::uint64_t checksum = 0;
+			std::size_t counterCount = 0;
+		};
+
+		module_layout layoutOf(const llvm::Module& module);
+
+		// "<dir>/<module id>.mhprof", a module without a header is "Main"
+		std::string profilePath(const std::string& directory, const std::string& moduleId);
+
+		// Inserts the counters and registers an atexit handler that appends
+		// them to 'path', so several runs accumulate in one file
+		bool instrumentModule(llvm::Module& module, const std::string& path);
+
+		// Sums the records in 'path' that match the module's layout, attaches
+		// branch weights and marks never-run functions cold and hot ones as
+		// inline candidates. Returns false when no record matches.
+		bool applyProfile(llvm::Module& module, const std::string& path);
+
+	}
+
+}
@@ -0,0 +1,239 @@
+#include "remarks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <regex>
+#include <tuple>
+
+#include <boost/variant/get.hpp>
+
+#include "decl_graph.h"
+#include "json.h"
+
+
+using namespace mhc;
+using namespace mhc::remarks;
+using namespace parser;
+
+using namespace std;
+
+
+namespace {
+
+	atomic<bool> g_enabled(false);
+
+	// Patterns are set once before compiling, remarks arrive from any thread
+	mutex g_mutex;
+	vector<remark> g_remarks;
+	regex g_patterns[3];
+	bool g_active[3] = { false, false, false };
+
+	size_t kindIndex(remark_kind kind) {
+		return static_cast<size_t>(kind);
+	}
+
+	const char* kindName(remark_kind kind) {
+		switch (kind) {
+			case remark_kind::passed:   return "Passed";
+			case remark_kind::missed:   return "Missed";
+			case remark_kind::analysis: return "Analysis";
+		}
+
+		return "";
+	}
+
+	// Text searched for in the source to find a declaration
+	string anchorText(const base_expr_node& decl) {
+		if (const string* str = boost::get<string>(&decl)) {
+			return *str;
+		}
+		if (const algebraic_datatype_decl* adt = boost::get<algebraic_datatype_decl>(&decl)) {
+			return adt->type_ctor;
+		}
+		if (const type_synonym_decl* syn = boost::get<type_synonym_decl>(&decl)) {
+			return syn->type_new;
+		}
+
+		return "";
+	}
+
+}
+
+namespace mhc {
+
+	namespace remarks {
+
+		bool configure(const string& passed, const string& missed, const string& analysis) {
+			const string* patterns[] = { &passed, &missed, &analysis };
+
+			lock_guard<mutex> lock(g_mutex);
+			for (size_t i = 0; i < 3; ++i) {
+				g_active[i] = !patterns[i]->empty();
+				if (!g_active[i]) {
+					continue;
+				}
+
+				try {
+					g_patterns[i] = regex(*patterns[i]);
+				} catch (const regex_error&) {
+					g_active[i] = false;
+					return false;
+				}
+			}
+
+			g_enabled = g_active[0] || g_active[1] || g_active[2];
+			return true;
+		}
+
+		bool enabled() {
+			return g_enabled.load(memory_order_relaxed);
+		}
+
+		bool wanted(remark_kind kind, const string& pass) {
+			if (!enabled()) {
+				return false;
+			}
+
+			lock_guard<mutex> lock(g_mutex);
+			return g_active[kindIndex(kind)] && regex_search(pass, g_patterns[kindIndex(kind)]);
+		}
+
+		void source_map::add(const base_expr_node& decl) {
+			const long index = m_nextIndex++;
+
+			const string anchor = anchorText(decl);
+			const size_t found = (anchor.empty() ? string::npos : m_source.find(anchor, m_searchFrom));
+			if (found == string::npos) {
+				return;
+			}
+			m_searchFrom = found + anchor.size();
+
+			const auto begin = m_source.begin();
+			m_line += static_cast<unsigned>(count(begin + m_counted, begin + found, '\n'));
+			m_counted = found;
+
+			const unsigned line = m_line;
+			const size_t lineStart = m_source.rfind('\n', found);
+			const unsigned column = 1 + static_cast<unsigned>(lineStart == string::npos ? found : found - lineStart - 1);
+
+			// A signature comes before its equations and keeps the name
+			for (const auto& name : declNames(decl)) {
+				m_positions.insert(make_pair(name, position{ index, line, column }));
+			}
+		}
+
+		void source_map::addModule(const module_decl& module) {
+			for (const auto& itr : module.body) {
+				add(itr);
+			}
+		}
+
+		bool source_map::locate(remark& r) const {
+			r.module = m_moduleId;
+			r.file = m_filename;
+
+			const auto itr = m_positions.find(r.function);
+			if (itr == m_positions.end()) {
+				return false;
+			}
+
+			r.declIndex = itr->second.index;
+			r.line = itr->second.line;
+			r.column = itr->second.column;
+			return true;
+		}
+
+		void emit(const remark& r) {
+			if (!wanted(r.kind, r.pass)) {
+				return;
+			}
+
+			lock_guard<mutex> lock(g_mutex);
+			g_remarks.push_back(r);
+		}
+
+		vector<remark> collected() {
+			vector<remark> result;
+			{
+				lock_guard<mutex> lock(g_mutex);
+				result = g_remarks;
+			}
+
+			// Threads finish in any order, the output shouldn't depend on it
+			stable_sort(result.begin(), result.end(), [](const remark& a, const remark& b) {
+				return tie(a.module, a.line, a.column, a.pass, a.function, a.message)
+				     < tie(b.module, b.line, b.column, b.pass, b.function, b.message);
+			});
+
+			return result;
+		}
+
+		void printText(ostream& out) {
+			for (const auto& r : collected()) {
+				out << (!r.file.empty() ? r.file : r.module.empty() ? "Main" : r.module);
+				if (r.line > 0) {
+					out << ":" << r.line << ":" << r.column;
+				}
+				out << ": remark: [" << r.pass << "] " << (r.function.empty() ? "" : r.function + ": ") << r.message << endl;
+			}
+		}
+
+		void writeYAML(ostream& out) {
+			for (const auto& r : collected()) {
+				out << "--- !" << kindName(r.kind) << endl;
+				out << "Pass:            " << json::quoted(r.pass) << endl;
+				out << "Function:        " << json::quoted(r.function) << endl;
+				out << "Module:          " << json::quoted(r.module) << endl;
+				if (!r.file.empty()) {
+					out << "File:            " << json::quoted(r.file) << endl;
+				}
+				if (r.line > 0) {
+					out << "Declaration:     { Index: " << r.declIndex << ", Line: " << r.line << ", Column: " << r.column << " }" << endl;
+				}
+				out << "Message:         " << json::quoted(r.message) << endl;
+				out << "..." << endl;
+			}
+		}
+
+		void writeJSON(ostream& out) {
+			const auto all = collected();
+
+			out << "[";
+			for (size_t i = 0; i < all.size(); ++i) {
+				const remark& r = all[i];
+				out << (i > 0 ? "," : "") << "\n{\"kind\":" << json::quoted(kindName(r.kind))
+				    << ",\"pass\":" << json::quoted(r.pass)
+				    << ",\"function\":" << json::quoted(r.function)
+				    << ",\"module\":" << json::quoted(r.module);
+				if (!r.file.empty()) {
+					out << ",\"file\":" << json::quoted(r.file);
+				}
+				if (r.line > 0) {
+					out << ",\"declaration\":{\"index\":" << r.declIndex << ",\"line\":" << r.line << ",\"column\":" << r.column << "}";
+				}
+				out << ",\"message\":" << json::quoted(r.message) << "}";
+			}
+			out << "\n]" << endl;
+		}
+
+		bool writeFile(const string& path) {
+			ofstream out(path.c_str());
+			if (!out) {
+				return false;
+			}
+
+			const bool json = (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0);
+			if (json) {
+				writeJSON(out);
+			} else {
+				writeYAML(out);
+			}
+
+			return static_cast<bool>(out);
+		}
+
+	}
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+
+namespace mhc {
+
+	namespace remarks {
+
+		enum class remark_kind {
+			passed,         // -Rpass, an optimization happened
+			missed,         // -Rpass-missed, an optimization was considered but didn't happen
+			analysis,       // -Rpass-analysis, why a decision went the way it did
+		};
+
+		struct remark {
+			remark_kind kind;
+			std::string pass;           // LLVM pass or mhc decision, e.g. "inline", "mhc-unfolding"
+			std::string function;
+			std::string message;
+
+			// Originating declaration in module_decl::body, unknown when 'line' is 0.
+			// 'file' is the module's source file, empty when it isn't known.
+			std::string module;
+			std::string file;
+			long declIndex = -1;
+			unsigned line = 0;
+			unsigned column = 0;
+		};
+
+		// Regular expressions on pass names like clang's -Rpass=, empty disables
+		// that kind. Returns false when a pattern doesn't compile.
+		bool configure(const std::string& passed, const std::string& missed, const std::string& analysis);
+		bool enabled();
+		bool wanted(remark_kind kind, const std::string& pass);
+
+		// Locates declarations in the module's source by the names they bind.
+		// Declarations are added in body order, so each is searched for after
+		// the previous one and a streaming compile can add them as they arrive.
+		class source_map {
+		public:
+			source_map(const std::string& moduleId, const std::string& source, const std::string& filename = "")
+			: m_moduleId(moduleId), m_filename(filename), m_source(source) {}
+
+			void add(const parser::base_expr_node& decl);
+			void addModule(const parser::module_decl& module);
+
+			// Fills in the declaration of 'r.function', false when it isn't known
+			bool locate(remark& r) const;
+
+			const std::string& moduleId() const { return m_moduleId; }
+
+		private:
+			struct position {
+				long index;
+				unsigned line;
+				unsigned column;
+			};
+
+			std::string m_moduleId;
+			std::string m_filename;
+			const std::string& m_source;
+
+			std::map<std::string, position> m_positions;
+			long m_nextIndex = 0;
+			std::size_t m_searchFrom = 0;
+
+			// Newlines are counted once, up to the last declaration found
+			std::size_t m_counted = 0;
+			unsigned m_line = 1;
+		};
+
+		// Records the remark if its kind and pass are wanted, from any thread
+		void emit(const remark& r);
+
+		// Everything emitted so far, ordered by module, source position and pass
+		std::vector<remark> collected();
+
+		// "Foo.hs:12:1: remark: [inline] f: message", like a compiler diagnostic.
+		// The module name stands in for an unknown file, remarks about the
+		// whole module have no function: "Foo.hs: remark: [size-info] message".
+		void printText(std::ostream& out);
+
+		// One YAML document per remark, in the style of LLVM's optimization records
+		void writeYAML(std::ostream& out);
+
+		// A JSON array of remark objects
+		void writeJSON(std::ostream& out);
+
+		// Picks YAML or JSON by the extension of 'path' (".json" for JSON)
+		bool writeFile(const std::string& path);
+
+	}
+
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace mhc {
+
+	// Hash map of symbols with nested scopes. Every insert made inside a scope
+	// is recorded in an undo log, leaving the scope replays the log back to
+	// the scope's mark, restoring shadowed symbols and dropping new ones.
+	// Entering a scope is O(1), leaving it is proportional to the inserts made
+	// inside it, lookups are a single hash probe regardless of nesting depth.
+	template <typename T>
+	class scoped_table {
+	public:
+		using map_type = std::unordered_map<std::string, T>;
+
+		// Enters a scope for the lifetime of the guard
+		class scope {
+		public:
+			explicit scope(scoped_table& table) : m_table(table) { m_table.enterScope(); }
+			~scope() { m_table.leaveScope(); }
+
+			scope(const scope&) = delete;
+			scope& operator=(const scope&) = delete;
+
+		private:
+			scoped_table& m_table;
+		};
+
+		void enterScope() {
+			m_scopes.push_back(m_undo.size());
+		}
+
+		void leaveScope() {
+			const size_t mark = m_scopes.back();
+			m_scopes.pop_back();
+
+			while (m_undo.size() > mark) {
+				undo_entry& entry = m_undo.back();
+
+				if (entry.shadowed) {
+					m_symbols[entry.name] = std::move(entry.previous);
+				} else {
+					m_symbols.erase(entry.name);
+				}
+
+				m_undo.pop_back();
+			}
+		}
+
+		// Adds or replaces a symbol in the innermost scope
+		void insert(const std::string& name, T value) {
+			auto itr = m_symbols.find(name);
+
+			if (!m_scopes.empty()) {
+				undo_entry entry;
+				entry.name = name;
+				entry.shadowed = (itr != m_symbols.end());
+				if (entry.shadowed) {
+					entry.previous = itr->second;
+				}
+				m_undo.push_back(std::move(entry));
+			}
+
+			if (itr != m_symbols.end()) {
+				itr->second = std::move(value);
+			} else {
+				m_symbols.emplace(name, std::move(value));
+			}
+		}
+
+		// Null when the symbol isn't visible
+		T* find(const std::string& name) {
+			auto itr = m_symbols.find(name);
+			return (itr != m_symbols.end()) ? &itr->second : nullptr;
+		}
+
+		const T* find(const std::string& name) const {
+			auto itr = m_symbols.find(name);
+			return (itr != m_symbols.end()) ? &itr->second : nullptr;
+		}
+
+		// Number of visible symbols
+		size_t size() const { return m_symbols.size(); }
+
+		size_t depth() const { return m_scopes.size(); }
+
+		// Approximate heap use: map nodes and buckets, names and the undo log
+		size_t bytes() const {
+			size_t total = m_symbols.bucket_count() * sizeof(void*)
+			             + m_undo.capacity() * sizeof(undo_entry)
+			             + m_scopes.capacity() * sizeof(size_t);
+
+			for (const auto& itr : m_symbols) {
+				total += sizeof(typename map_type::value_type) + 2 * sizeof(void*) + itr.first.capacity();
+			}
+			for (const auto& itr : m_undo) {
+				total += itr.name.capacity();
+			}
+
+			return total;
+		}
+
+		typename map_type::const_iterator begin() const { return m_symbols.begin(); }
+		typename map_type::const_iterator end() const { return m_symbols.end(); }
+
+	private:
+		struct undo_entry {
+			std::string name;
+			bool shadowed = false;
+			T previous = T();
+		};
+
+		map_type m_symbols;
+		std::vector<undo_entry> m_undo;
+		std::vector<size_t> m_scopes;
+	};
+
+}
@@ -0,0 +1,741 @@
+#include "syntax.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "lexer.h"
+
+
+using namespace mhc::syntax;
+using namespace mhc::lexer;
+
+using namespace std;
+
+
+namespace {
+
+	const char* const g_reservedIds[] = {
+		"_", "case", "class", "data", "default", "deriving", "do", "else", "foreign", "if", "import", "in",
+		"infix", "infixl", "infixr", "instance", "let", "module", "newtype", "of", "then", "type", "where",
+	};
+
+	const char* const g_reservedOps[] = {
+		"..", ":", "::", "=", "\\", "|", "<-", "->", "@", "~", "=>",
+	};
+
+	bool isReservedId(const string& text) {
+		return find(begin(g_reservedIds), end(g_reservedIds), text) != end(g_reservedIds);
+	}
+
+	bool isReservedOp(const string& text) {
+		return find(begin(g_reservedOps), end(g_reservedOps), text) != end(g_reservedOps);
+	}
+
+	bool isFixityKeyword(const string& text) {
+		return text == "infixl" || text == "infixr" || text == "infix";
+	}
+
+	// Decimal, hexadecimal (0x) and octal (0o) literals
+	bool integerValue(const string& text, int64_t& value) {
+		int base = 10;
+		size_t start = 0;
+		if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+			base = 16;
+			start = 2;
+		} else if (text.size() > 2 && text[0] == '0' && (text[1] == 'o' || text[1] == 'O')) {
+			base = 8;
+			start = 2;
+		}
+
+		char* end = nullptr;
+		value = static_cast<int64_t>(strtoull(text.c_str() + start, &end, base));
+		return end && *end == '\0' && end != text.c_str() + start;
+	}
+
+	class reader {
+	public:
+		reader(const vector<token>& tokens, const fixity_table* fixities)
+		: m_tokens(tokens), m_fixities(fixities) {}
+
+		bool failed() const { return m_failed; }
+		const string& error() const { return m_error; }
+
+		bool atEnd() const { return m_pos >= m_tokens.size(); }
+
+		const token* peek(size_t ahead = 0) const {
+			return (m_pos + ahead < m_tokens.size()) ? &m_tokens[m_pos + ahead] : nullptr;
+		}
+
+		// Strings and characters keep their quotes, they never match punctuation
+		bool isText(const char* text, size_t ahead = 0) const {
+			const token* t = peek(ahead);
+			return t && t->kind != token_kind::string && t->kind != token_kind::character && t->text == text;
+		}
+
+		bool accept(const char* text) {
+			if (!isText(text)) {
+				return false;
+			}
+
+			++m_pos;
+			return true;
+		}
+
+		void expect(const char* text) {
+			if (!accept(text)) {
+				fail(string("expected '") + text + "'");
+			}
+		}
+
+		void fail(const string& message) {
+			if (m_failed) {
+				return;
+			}
+
+			m_failed = true;
+			m_error = message;
+			if (!atEnd()) {
+				m_error += " at '" + peek()->text + "'";
+			}
+		}
+
+		// An operator in infix position: a symbol or a backquoted name
+		bool peekOperator(string& name, size_t& length, size_t ahead = 0) const {
+			const token* t = peek(ahead);
+			if (t && t->kind == token_kind::varsym && !isReservedOp(t->text)) {
+				name = t->text;
+				length = 1;
+				return true;
+			}
+
+			const token* quoted = peek(ahead + 1);
+			if (isText("`", ahead) && quoted && (quoted->kind == token_kind::varid || quoted->kind == token_kind::conid)
+			 && isText("`", ahead + 2)) {
+				name = quoted->text;
+				length = 3;
+				return true;
+			}
+
+			return false;
+		}
+
+		fixity fixityOf(const string& op) const {
+			const auto itr = m_fixities->find(op);
+			return (itr != m_fixities->end()) ? itr->second : fixity();
+		}
+
+		type_expr parseType() {
+			type_expr result = parseBType();
+			if (accept("->")) {
+				type_expr function;
+				function.name = "->";
+				function.args.push_back(std::move(result));
+				function.args.push_back(parseType());
+				return function;
+			}
+			if (isText("=>")) {
+				fail("class contexts aren't supported yet");
+			}
+
+			return result;
+		}
+
+		expr parseExp() {
+			return parseInfix(0);
+		}
+
+		pattern parsePattern() {
+			const token* t = peek();
+			if (t && t->kind == token_kind::conid) {
+				pattern result;
+				result.kind = pattern_kind::constructor;
+				result.name = t->text;
+				++m_pos;
+
+				while (!m_failed && startsApat()) {
+					result.args.push_back(parseApat());
+				}
+				return result;
+			}
+
+			return parseApat();
+		}
+
+		pattern parseApat() {
+			pattern result;
+			const token* t = peek();
+			if (!t) {
+				fail("expected a pattern");
+				return result;
+			}
+
+			if (t->kind == token_kind::varid && t->text == "_") {
+				++m_pos;
+			} else if (t->kind == token_kind::varid && !isReservedId(t->text)) {
+				result.kind = pattern_kind::variable;
+				result.name = t->text;
+				++m_pos;
+				if (isText("@")) {
+					fail("as-patterns aren't supported yet");
+				}
+			} else if (t->kind == token_kind::conid) {
+				result.kind = pattern_kind::constructor;
+				result.name = t->text;
+				++m_pos;
+			} else if (t->kind == token_kind::integer) {
+				result.kind = pattern_kind::integer;
+				if (!integerValue(t->text, result.integer)) {
+					fail("invalid integer literal");
+				}
+				++m_pos;
+			} else if (isText("(")) {
+				++m_pos;
+
+				// Negative literal
+				if (isText("-") && peek(1) && peek(1)->kind == token_kind::integer) {
+					++m_pos;
+					result = parseApat();
+					result.integer = -result.integer;
+				} else {
+					result = parsePattern();
+				}
+
+				if (isText(",")) {
+					fail("tuples aren't supported yet");
+				}
+				expect(")");
+			} else {
+				fail("unsupported pattern");
+			}
+
+			return result;
+		}
+
+		bool startsApat() const {
+			const token* t = peek();
+			if (!t) {
+				return false;
+			}
+
+			return (t->kind == token_kind::varid && (t->text == "_" || !isReservedId(t->text)))
+			    || t->kind == token_kind::conid || t->kind == token_kind::integer
+			    || isText("(") || isText("[");
+		}
+
+		clause parseClause() {
+			clause result;
+
+			string op;
+			size_t length = 0;
+			const token* first = peek();
+
+			if (isText("(") && peekOperator(op, length, 1) && length == 1 && isText(")", 2)) {
+				// Operator defined in prefix form: (<+>) a b = ...
+				result.name = op;
+				m_pos += 3;
+				while (!m_failed && startsApat()) {
+					result.params.push_back(parseApat());
+				}
+			} else if (first && first->kind == token_kind::varid && !isReservedId(first->text) && !peekOperator(op, length, 1)) {
+				result.name = first->text;
+				++m_pos;
+				while (!m_failed && startsApat()) {
+					result.params.push_back(parseApat());
+				}
+			} else {
+				// Infix definition: a <+> b = ..., a `op` b = ...
+				result.params.push_back(parsePattern());
+				if (!peekOperator(op, length)) {
+					fail("expected a function or operator definition");
+					return result;
+				}
+				m_pos += length;
+				result.name = op;
+				result.params.push_back(parsePattern());
+			}
+
+			if (accept("=")) {
+				guarded_rhs rhs;
+				rhs.body = parseExp();
+				result.rhs.push_back(std::move(rhs));
+			} else if (isText("|")) {
+				while (!m_failed && accept("|")) {
+					guarded_rhs rhs;
+					rhs.guarded = true;
+					rhs.guard = parseExp();
+					expect("=");
+					rhs.body = parseExp();
+					result.rhs.push_back(std::move(rhs));
+				}
+			} else {
+				fail("expected '=' or a guard");
+			}
+
+			if (isText("where")) {
+				fail("where bindings aren't supported yet");
+			}
+			while (accept(";")) {
+			}
+			if (!atEnd()) {
+				fail("unexpected token");
+			}
+
+			return result;
+		}
+
+	private:
+		type_expr parseBType() {
+			type_expr result = parseAType();
+			while (!m_failed && startsAType()) {
+				result.args.push_back(parseAType());
+			}
+
+			return result;
+		}
+
+		bool startsAType() const {
+			const token* t = peek();
+			return t && (t->kind == token_kind::conid || (t->kind == token_kind::varid && !isReservedId(t->text))
+			          || isText("(") || isText("["));
+		}
+
+		type_expr parseAType() {
+			type_expr result;
+			const token* t = peek();
+
+			if (t && (t->kind == token_kind::conid || (t->kind == token_kind::varid && !isReservedId(t->text)))) {
+				result.name = t->text;
+				++m_pos;
+			} else if (accept("[")) {
+				result.name = "[]";
+				result.args.push_back(parseType());
+				expect("]");
+			} else if (accept("(")) {
+				if (accept(")")) {
+					result.name = "()";
+					return result;
+				}
+
+				result = parseType();
+				if (isText(",")) {
+					type_expr tuple;
+					tuple.name = "(,)";
+					tuple.args.push_back(std::move(result));
+					while (!m_failed && accept(",")) {
+						tuple.args.push_back(parseType());
+					}
+					result = std::move(tuple);
+				}
+				expect(")");
+			} else {
+				fail("expected a type");
+			}
+
+			return result;
+		}
+
+		expr parseInfix(int minPrecedence) {
+			expr lhs;
+			if (accept("-")) {
+				// Negation binds like binary minus
+				lhs.kind = expr_kind::negate;
+				lhs.children.push_back(parseInfix(7));
+			} else {
+				lhs = parseLexp();
+			}
+
+			string op;
+			size_t length = 0;
+			while (!m_failed && peekOperator(op, length)) {
+				const fixity f = fixityOf(op);
+				if (f.precedence < minPrecedence) {
+					break;
+				}
+
+				m_pos += length;
+				expr rhs = parseInfix(f.assoc == 'r' ? f.precedence : f.precedence + 1);
+
+				// "f $ x" is plain application
+				if (op == "$") {
+					if (lhs.kind != expr_kind::apply) {
+						expr apply;
+						apply.kind = expr_kind::apply;
+						apply.children.push_back(std::move(lhs));
+						lhs = std::move(apply);
+					}
+					lhs.children.push_back(std::move(rhs));
+					continue;
+				}
+
+				expr binary;
+				binary.kind = expr_kind::binary;
+				binary.name = op;
+				mhc::ops::resolveOperator(op, binary.op);
+				binary.children.push_back(std::move(lhs));
+				binary.children.push_back(std::move(rhs));
+				lhs = std::move(binary);
+			}
+
+			return lhs;
+		}
+
+		expr parseLexp() {
+			expr result;
+
+			if (accept("if")) {
+				result.kind = expr_kind::if_then_else;
+				result.children.push_back(parseExp());
+				accept(";");
+				expect("then");
+				result.children.push_back(parseExp());
+				accept(";");
+				expect("else");
+				result.children.push_back(parseExp());
+				return result;
+			}
+
+			if (accept("let")) {
+				const bool braces = accept("{");
+
+				vector<pair<string, expr>> bindings;
+				do {
+					const token* t = peek();
+					if (!t || t->kind != token_kind::varid || isReservedId(t->text)) {
+						fail("expected a let binding");
+						return result;
+					}
+					if (!isText("=", 1)) {
+						fail("local functions aren't supported yet");
+						return result;
+					}
+
+					m_pos += 2;
+					bindings.push_back(make_pair(t->text, parseExp()));
+				} while (!m_failed && accept(";") && !isText("in") && !isText("}"));
+
+				if (braces) {
+					expect("}");
+				}
+				expect("in");
+
+				// Bindings scope over the ones after them
+				result = parseExp();
+				for (auto itr = bindings.rbegin(); itr != bindings.rend(); ++itr) {
+					expr let;
+					let.kind = expr_kind::let_in;
+					let.name = itr->first;
+					let.children.push_back(std::move(itr->second));
+					let.children.push_back(std::move(result));
+					result = std::move(let);
+				}
+				return result;
+			}
+
+			if (isText("case")) {
+				fail("case expressions aren't supported yet");
+				return result;
+			}
+			if (isText("\\")) {
+				fail("lambda expressions aren't supported yet");
+				return result;
+			}
+			if (isText("do")) {
+				fail("do blocks aren't supported yet");
+				return result;
+			}
+
+			result = parseAexp();
+			if (startsAexp()) {
+				expr apply;
+				apply.kind = expr_kind::apply;
+				apply.children.push_back(std::move(result));
+				while (!m_failed && startsAexp()) {
+					apply.children.push_back(parseAexp());
+				}
+				result = std::move(apply);
+			}
+
+			return result;
+		}
+
+		bool startsAexp() const {
+			const token* t = peek();
+			if (!t) {
+				return false;
+			}
+
+			return (t->kind == token_kind::varid && !isReservedId(t->text))
+			    || t->kind == token_kind::conid || t->kind == token_kind::integer || t->kind == token_kind::floating
+			    || t->kind == token_kind::string || t->kind == token_kind::character
+			    || isText("(") || isText("[");
+		}
+
+		expr parseAexp() {
+			expr result;
+			const token* t = peek();
+			if (!t) {
+				fail("expected an expression");
+				return result;
+			}
+
+			string op;
+			size_t length = 0;
+
+			if (t->kind == token_kind::varid && !isReservedId(t->text)) {
+				result.kind = expr_kind::variable;
+				result.name = t->text;
+				++m_pos;
+			} else if (t->kind == token_kind::conid) {
+				result.kind = expr_kind::constructor;
+				result.name = t->text;
+				++m_pos;
+			} else if (t->kind == token_kind::integer) {
+				result.kind = expr_kind::integer;
+				if (!integerValue(t->text, result.integer)) {
+					fail("invalid integer literal");
+				}
+				++m_pos;
+			} else if (t->kind == token_kind::floating) {
+				result.kind = expr_kind::floating;
+				result.floating = strtod(t->text.c_str(), nullptr);
+				++m_pos;
+			} else if (isText("(")) {
+				if (peekOperator(op, length, 1) && isText(")", 1 + length)) {
+					// An operator used as a function: (+)
+					result.kind = expr_kind::variable;
+					result.name = op;
+					m_pos += 2 + length;
+					return result;
+				}
+				if (isText(")", 1)) {
+					fail("the unit value isn't supported yet");
+					return result;
+				}
+				if (!isText("-", 1) && peekOperator(op, length, 1)) {
+					fail("operator sections aren't supported yet");
+					return result;
+				}
+
+				++m_pos;
+				result = parseExp();
+				if (isText(",")) {
+					fail("tuples aren't supported yet");
+				} else if (peekOperator(op, length) && isText(")", length)) {
+					fail("operator sections aren't supported yet");
+				}
+				expect(")");
+			} else if (isText("[")) {
+				fail("lists aren't supported yet");
+			} else if (t->kind == token_kind::string || t->kind == token_kind::character) {
+				fail("string and character literals aren't supported yet");
+			} else {
+				fail("expected an expression");
+			}
+
+			return result;
+		}
+
+		const vector<token>& m_tokens;
+		const fixity_table* m_fixities;
+		size_t m_pos = 0;
+
+		bool m_failed = false;
+		string m_error;
+	};
+
+	// The "::" of a signature among tokens [begin, end), it comes before the
+	// first "=" or "|". Returns 'end' for any other declaration.
+	size_t findSignature(const vector<token>& tokens, size_t begin, size_t end) {
+		int depth = 0;
+		for (size_t i = begin; i < end; ++i) {
+			const string& t = tokens[i].text;
+			if (tokens[i].kind == token_kind::string || tokens[i].kind == token_kind::character) {
+				continue;
+			}
+
+			if (t == "(" || t == "[") {
+				++depth;
+			} else if (t == ")" || t == "]") {
+				--depth;
+			} else if (depth == 0 && (t == "=" || t == "|")) {
+				break;
+			} else if (depth == 0 && t == "::") {
+				return i;
+			}
+		}
+
+		return end;
+	}
+
+	void signatureNames(const vector<token>& tokens, size_t begin, size_t end, vector<string>& names) {
+		for (size_t i = begin; i < end; ++i) {
+			if (tokens[i].kind == token_kind::varid || tokens[i].kind == token_kind::varsym) {
+				names.push_back(tokens[i].text);
+			}
+		}
+	}
+
+}
+
+namespace mhc {
+
+	namespace syntax {
+
+		fixity_table defaultFixities() {
+			fixity_table table;
+			auto add = [&](int precedence, char assoc, initializer_list<const char*> ops) {
+				for (const char* op : ops) {
+					fixity f;
+					f.precedence = precedence;
+					f.assoc = assoc;
+					table[op] = f;
+				}
+			};
+
+			add(8, 'r', { "^" });
+			add(8, 'l', { "shiftL", "shiftR" });
+			add(7, 'l', { "*", "/", "quot", "rem", "div", "mod", ".&." });
+			add(6, 'l', { "+", "-", "xor" });
+			add(5, 'l', { ".|." });
+			add(4, 'n', { "==", "/=", "<", "<=", ">", ">=" });
+			add(3, 'r', { "&&" });
+			add(2, 'r', { "||" });
+			add(0, 'r', { "$" });
+
+			return table;
+		}
+
+		bool addFixities(const string& decl, fixity_table& table) {
+			const vector<token> tokens = tokenize(decl);
+			if (tokens.empty() || !isFixityKeyword(tokens[0].text)) {
+				return false;
+			}
+
+			fixity f;
+			f.assoc = (tokens[0].text == "infixl" ? 'l' : (tokens[0].text == "infixr" ? 'r' : 'n'));
+
+			size_t i = 1;
+			if (i < tokens.size() && tokens[i].kind == token_kind::integer) {
+				f.precedence = atoi(tokens[i].text.c_str());
+				++i;
+			}
+
+			for (; i < tokens.size(); ++i) {
+				if (tokens[i].kind == token_kind::varsym || tokens[i].kind == token_kind::varid || tokens[i].kind == token_kind::conid) {
+					table[tokens[i].text] = f;
+				}
+			}
+
+			return true;
+		}
+
+		bool parseDecl(const string& text, const fixity_table& fixities, decl& result, string& error) {
+			const vector<token> tokens = tokenize(text);
+			result = decl();
+
+			if (tokens.empty()) {
+				return true;
+			}
+
+			const string& keyword = tokens[0].text;
+			if (isFixityKeyword(keyword) || keyword == "import" || keyword == "foreign" || keyword == "instance"
+			 || keyword == "class" || keyword == "default" || keyword == "data" || keyword == "newtype" || keyword == "type") {
+				return true;
+			}
+
+			reader in(tokens, &fixities);
+
+			const size_t colons = findSignature(tokens, 0, tokens.size());
+			if (colons != tokens.size()) {
+				result.kind = decl_kind::signature;
+				signatureNames(tokens, 0, colons, result.names);
+
+				const vector<token> typeTokens(tokens.begin() + colons + 1, tokens.end());
+				reader typeIn(typeTokens, &fixities);
+				result.type = typeIn.parseType();
+				if (!typeIn.failed() && !typeIn.atEnd()) {
+					typeIn.fail("unexpected token");
+				}
+				error = typeIn.error();
+				return !typeIn.failed();
+			}
+
+			result.kind = decl_kind::clause;
+			result.equation = in.parseClause();
+			error = in.error();
+			return !in.failed();
+		}
+
+		map<string, type_expr> topLevelSignatures(const string& source) {
+			const vector<token> tokens = tokenize(source);
+			map<string, type_expr> signatures;
+
+			// The body follows the header's "where", its declarations are
+			// separated by the ';' outside of any brackets
+			size_t i = 0;
+			if (!tokens.empty() && tokens[0].text == "module") {
+				while (i < tokens.size() && tokens[i].text != "where") {
+					++i;
+				}
+				++i;
+			}
+
+			fixity_table none;
+			while (i < tokens.size()) {
+				size_t next = i;
+				for (int depth = 0; next < tokens.size() && (depth > 0 || tokens[next].text != ";"); ++next) {
+					if (tokens[next].kind == token_kind::special) {
+						const string& t = tokens[next].text;
+						depth += (t == "(" || t == "[" || t == "{") ? 1 : (t == ")" || t == "]" || t == "}") ? -1 : 0;
+					}
+				}
+
+				const bool named = (tokens[i].kind == token_kind::varid && !isReservedId(tokens[i].text)) || tokens[i].text == "(";
+				const size_t colons = named ? findSignature(tokens, i, next) : next;
+				if (colons != next) {
+					const vector<token> typeTokens(tokens.begin() + colons + 1, tokens.begin() + next);
+					reader in(typeTokens, &none);
+					const type_expr type = in.parseType();
+
+					vector<string> names;
+					signatureNames(tokens, i, colons, names);
+					if (!in.failed() && in.atEnd()) {
+						for (const auto& name : names) {
+							signatures[name] = type;
+						}
+					}
+				}
+
+				i = next + 1;
+			}
+
+			return signatures;
+		}
+
+		bool parseType(const string& text, type_expr& result) {
+			const vector<token> tokens = tokenize(text);
+			fixity_table none;
+			reader in(tokens, &none);
+
+			result = in.parseType();
+			return !in.failed() && in.atEnd();
+		}
+
+		string typeString(const type_expr& type) {
+			if (type.name == "->" && type.args.size() == 2) {
+				const string param = typeString(type.args[0]);
+				return (type.args[0].name == "->" ? "(" + param + ")" : param) + " -> " + typeString(type.args[1]);
+			}
+
+			string result = type.name;
+			for (const auto& itr : type.args) {
+				const string arg = typeString(itr);
+				result += (itr.args.empty() ? " " + arg : " (" + arg + ")");
+			}
+
+			return result;
+		}
+
+	}
+
+}
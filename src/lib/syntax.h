@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "operators.h"
+
+
+namespace mhc {
+
+	// The parser keeps bindings as source text, this reads them into trees for
+	// the desugarer. It covers the expression language the back end lowers:
+	// application, operators with their fixities, if, let and literals, and
+	// equations with patterns and guards.
+	namespace syntax {
+
+		struct type_expr {
+			std::string name;                 // "->" for functions, else a type constructor or variable
+			std::vector<type_expr> args;
+		};
+
+		enum class expr_kind : std::uint8_t {
+			variable,
+			constructor,
+			integer,
+			floating,
+			apply,          // children: function, then the arguments
+			binary,         // name: the operator, op: its primitive, children: lhs, rhs
+			negate,
+			if_then_else,   // children: condition, then, else
+			let_in,         // name: the bound variable, children: rhs, body
+		};
+
+		struct expr {
+			expr_kind kind = expr_kind::integer;
+			std::string name;
+			ops::opcode op = ops::opcode::count;  // Binary, count when no primitive has the name
+			std::int64_t integer = 0;
+			double floating = 0;
+			std::vector<expr> children;
+			std::uint32_t type = UINT32_MAX;  // Set by type inference, a node of its infer::checker
+		};
+
+		enum class pattern_kind : std::uint8_t {
+			variable,
+			wildcard,
+			integer,
+			constructor,    // args: the field patterns
+		};
+
+		struct pattern {
+			pattern_kind kind = pattern_kind::wildcard;
+			std::string name;
+			std::int64_t integer = 0;
+			std::vector<pattern> args;
+		};
+
+		// One right hand side, a missing guard always holds
+		struct guarded_rhs {
+			bool guarded = false;
+			expr guard;
+			expr body;
+		};
+
+		// One equation of a function, "name params | guard = body ..."
+		struct clause {
+			std::string name;
+			std::vector<pattern> params;
+			std::vector<guarded_rhs> rhs;
+		};
+
+		struct fixity {
+			int precedence = 9;
+			char assoc = 'l';                 // 'l', 'r' or 'n'
+		};
+
+		using fixity_table = std::map<std::string, fixity>;
+
+		// The Prelude's fixities for the operators the back end knows
+		fixity_table defaultFixities();
+
+		// Records the operators of a fixity declaration ("infixl 6 <+>"), returns
+		// false for any other declaration
+		bool addFixities(const std::string& decl, fixity_table& table);
+
+		enum class decl_kind : std::uint8_t {
+			clause,
+			signature,      // names and type
+			other,          // Fixities, imports, instances and the like
+		};
+
+		struct decl {
+			decl_kind kind = decl_kind::other;
+			clause equation;
+			std::vector<std::string> names;
+			type_expr type;
+		};
+
+		// Reads one top-level declaration, 'error' describes what couldn't be
+		// parsed or isn't supported yet
+		bool parseDecl(const std::string& text, const fixity_table& fixities, decl& result, std::string& error);
+
+		bool parseType(const std::string& text, type_expr& result);
+
+		// The signatures among a whole module's top-level declarations, found
+		// without parsing anything else. One that can't be read is left out.
+		std::map<std::string, type_expr> topLevelSignatures(const std::string& source);
+
+		std::string typeString(const type_expr& type);
+
+	}
+
+}
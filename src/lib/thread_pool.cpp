@@ -0,0 +1,125 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+
+using namespace std;
+
+
+namespace {
+
+	// Identifies the pool and queue owned by the current worker thread
+	thread_local const mhc::thread_pool* t_pool = nullptr;
+	thread_local unsigned t_queue = 0;
+
+}
+
+namespace mhc {
+
+	thread_pool::thread_pool(unsigned threads)
+	: m_queued(0), m_nextQueue(0) {
+		threads = max(threads, 1u);
+
+		for (unsigned i = 0; i < threads; ++i) {
+			m_queues.emplace_back(new worker_queue);
+		}
+		for (unsigned i = 0; i < threads; ++i) {
+			m_threads.emplace_back(&thread_pool::run, this, i);
+		}
+	}
+
+	thread_pool::~thread_pool() {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+
+		for (auto& itr : m_threads) {
+			itr.join();
+		}
+	}
+
+	void thread_pool::submit(function<void()> task) {
+		const unsigned index = (t_pool == this)
+			? t_queue
+			: (m_nextQueue++ % static_cast<unsigned>(m_queues.size()));
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			++m_pending;
+		}
+
+		{
+			lock_guard<mutex> lock(m_queues[index]->mutex);
+			m_queues[index]->tasks.push_back(move(task));
+		}
+
+		// Publish under the pool lock so a worker about to sleep can't miss it
+		{
+			lock_guard<mutex> lock(m_mutex);
+			++m_queued;
+		}
+		m_wake.notify_one();
+	}
+
+	void thread_pool::wait() {
+		unique_lock<mutex> lock(m_mutex);
+		m_idle.wait(lock, [this] { return m_pending == 0; });
+	}
+
+	bool thread_pool::take(unsigned index, function<void()>& task) {
+		// Own queue first, newest task
+		{
+			worker_queue& own = *m_queues[index];
+			lock_guard<mutex> lock(own.mutex);
+			if (!own.tasks.empty()) {
+				task = move(own.tasks.back());
+				own.tasks.pop_back();
+				--m_queued;
+				return true;
+			}
+		}
+
+		// Steal the oldest task from the other workers
+		for (size_t i = 1; i < m_queues.size(); ++i) {
+			worker_queue& victim = *m_queues[(index + i) % m_queues.size()];
+			lock_guard<mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				task = move(victim.tasks.front());
+				victim.tasks.pop_front();
+				--m_queued;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void thread_pool::run(unsigned index) {
+		t_pool = this;
+		t_queue = index;
+
+		for (;;) {
+			function<void()> task;
+
+			if (take(index, task)) {
+				task();
+
+				lock_guard<mutex> lock(m_mutex);
+				if (--m_pending == 0) {
+					m_idle.notify_all();
+				}
+				continue;
+			}
+
+			unique_lock<mutex> lock(m_mutex);
+			m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+
+			if (m_stop && m_queued == 0) {
+				return;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace mhc {
+
+	// Fixed size pool where every worker owns a task deque. Workers run their
+	// own most recently pushed task first and steal the oldest task from
+	// another worker when they run dry. Tasks submitted from inside a task go
+	// to the submitting worker's deque, which keeps dependent work local.
+	class thread_pool {
+	public:
+		explicit thread_pool(unsigned threads);
+		~thread_pool();
+
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		// Tasks must not throw
+		void submit(std::function<void()> task);
+
+		// Blocks until every submitted task, including ones submitted by other
+		// tasks, has finished
+		void wait();
+
+		unsigned size() const { return static_cast<unsigned>(m_threads.size()); }
+
+	private:
+		struct worker_queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		void run(unsigned index);
+		bool take(unsigned index, std::function<void()>& task);
+
+		std::vector<std::unique_ptr<worker_queue>> m_queues;
+		std::vector<std::thread> m_threads;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_idle;
+
+		std::atomic<size_t> m_queued;
+		size_t m_pending = 0;
+		std::atomic<unsigned> m_nextQueue;
+		bool m_stop = false;
+	};
+
+}
@@ -0,0 +1,171 @@
+#include "timing.h"
+
+#include <time.h>
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "json.h"
+
+
+using namespace mhc::timing;
+
+using namespace std;
+
+
+namespace {
+
+	atomic<bool> g_enabled(false);
+
+	// Counted for every thread once a binary enables the hook in
+	// timing_hook.cpp, enabling timing later must not change what operator
+	// new does
+	thread_local uint64_t g_threadAllocated = 0;
+
+	struct phase_total {
+		double wall = 0;
+		double cpu = 0;
+		uint64_t bytes = 0;
+		unsigned count = 0;
+	};
+
+	struct trace_event {
+		string name;
+		string detail;
+		uint64_t startMicros;
+		uint64_t durationMicros;
+		unsigned thread;
+	};
+
+	// Recorded from any thread, a phase ends at most once per scope so the lock is cheap
+	mutex g_mutex;
+	vector<string> g_order;
+	map<string, phase_total> g_totals;
+	vector<trace_event> g_events;
+	map<thread::id, unsigned> g_threads;
+
+	const chrono::steady_clock::time_point g_processStart = chrono::steady_clock::now();
+
+	double threadCpuSeconds() {
+		timespec ts;
+		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+			return 0;
+		}
+
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	uint64_t micros(chrono::steady_clock::duration d) {
+		return chrono::duration_cast<chrono::microseconds>(d).count();
+	}
+
+}
+
+namespace mhc {
+
+	namespace timing {
+
+		void enable() {
+			g_enabled = true;
+		}
+
+		bool enabled() {
+			return g_enabled.load(memory_order_relaxed);
+		}
+
+		uint64_t allocatedBytes() {
+			return g_threadAllocated;
+		}
+
+		void countAllocation(size_t bytes) {
+			g_threadAllocated += bytes;
+		}
+
+		scoped_phase::scoped_phase(const char* phase, const string& detail)
+		: m_active(enabled()), m_phase(phase) {
+			if (!m_active) {
+				return;
+			}
+
+			m_detail = detail;
+			m_start = chrono::steady_clock::now();
+			m_cpuStart = threadCpuSeconds();
+			m_bytesStart = g_threadAllocated;
+		}
+
+		scoped_phase::~scoped_phase() {
+			if (!m_active) {
+				return;
+			}
+
+			const auto end = chrono::steady_clock::now();
+			const double cpu = threadCpuSeconds() - m_cpuStart;
+			const uint64_t bytes = g_threadAllocated - m_bytesStart;
+
+			lock_guard<mutex> lock(g_mutex);
+
+			auto itr = g_totals.find(m_phase);
+			if (itr == g_totals.end()) {
+				g_order.push_back(m_phase);
+				itr = g_totals.insert(make_pair(string(m_phase), phase_total())).first;
+			}
+
+			itr->second.wall += chrono::duration<double>(end - m_start).count();
+			itr->second.cpu += cpu;
+			itr->second.bytes += bytes;
+			itr->second.count += 1;
+
+			const auto thread = g_threads.insert(make_pair(this_thread::get_id(), static_cast<unsigned>(g_threads.size()))).first;
+			g_events.push_back({ m_phase, m_detail, micros(m_start - g_processStart), micros(end - m_start), thread->second });
+		}
+
+		void printReport(ostream& out) {
+			lock_guard<mutex> lock(g_mutex);
+
+			out << "===-- Time report --===" << endl;
+			out << setw(12) << "Wall (s)" << setw(12) << "CPU (s)" << setw(16) << "Allocated" << setw(8) << "Count" << "  Phase" << endl;
+
+			for (const auto& name : g_order) {
+				const phase_total& total = g_totals[name];
+				out << fixed << setprecision(4)
+				    << setw(12) << total.wall
+				    << setw(12) << total.cpu
+				    << setw(16) << total.bytes
+				    << setw(8) << total.count
+				    << "  " << name << endl;
+			}
+		}
+
+		bool writeTrace(const string& path) {
+			ofstream out(path.c_str());
+			if (!out) {
+				return false;
+			}
+
+			lock_guard<mutex> lock(g_mutex);
+
+			out << "{\"traceEvents\":[";
+			for (size_t i = 0; i < g_events.size(); ++i) {
+				const trace_event& e = g_events[i];
+				out << (i > 0 ? "," : "") << "\n{\"name\":" << json::quoted(e.name) << ",\"cat\":\"mhc\",\"ph\":\"X\""
+				    << ",\"ts\":" << e.startMicros << ",\"dur\":" << e.durationMicros
+				    << ",\"pid\":1,\"tid\":" << e.thread;
+
+				if (!e.detail.empty()) {
+					out << ",\"args\":{\"detail\":" << json::quoted(e.detail) << "}";
+				}
+				out << "}";
+			}
+			out << "\n]}" << endl;
+
+			return static_cast<bool>(out);
+		}
+
+	}
+
+}
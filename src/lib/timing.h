@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+
+namespace mhc {
+
+	namespace timing {
+
+		// Phases are only measured once enabled, until then a scoped_phase
+		// costs one relaxed load
+		void enable();
+		bool enabled();
+
+		// Bytes allocated with operator new by the calling thread so far,
+		// always 0 unless the binary links timing_hook.cpp and enabled it
+		std::uint64_t allocatedBytes();
+		void countAllocation(std::size_t bytes);
+
+		// Measures wall time, CPU time of the calling thread and bytes it
+		// allocated from construction to destruction. Phases with the same name
+		// add up in the report, every instance is a span in the trace, labelled
+		// with 'detail' (a declaration, partition, file...) when set.
+		class scoped_phase {
+		public:
+			explicit scoped_phase(const char* phase, const std::string& detail = "");
+			~scoped_phase();
+
+			scoped_phase(const scoped_phase&) = delete;
+			scoped_phase& operator=(const scoped_phase&) = delete;
+
+		private:
+			bool m_active;
+			const char* m_phase;
+			std::string m_detail;
+
+			std::chrono::steady_clock::time_point m_start;
+			double m_cpuStart = 0;
+			std::uint64_t m_bytesStart = 0;
+		};
+
+		// Wall, CPU and allocated bytes per phase in order of first use. Time
+		// spent in 'opt', 'llc' and the linker counts as wall time only.
+		void printReport(std::ostream& out);
+
+		// Chrome trace-event JSON, loads in chrome://tracing or Perfetto
+		bool writeTrace(const std::string& path);
+
+	}
+
+}
@@ -0,0 +1,272 @@
+#include "types.h"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+
+
+using namespace mhc::types;
+using namespace mhc;
+
+using namespace std;
+
+
+namespace {
+
+	struct node_hash {
+		size_t operator()(const type_node& n) const {
+			return n.hash;
+		}
+	};
+
+	// Children are interned, so comparing them by pointer is structural
+	struct node_equal {
+		bool operator()(const type_node& a, const type_node& b) const {
+			return a.kind == b.kind && a.name == b.name && a.param == b.param && a.result == b.result && a.allowed == b.allowed;
+		}
+	};
+
+	using node_table = unordered_set<type_node, node_hash, node_equal>;
+
+	// Binding groups and partitions are typed on several threads, so the
+	// table is split by hash and each part has its own lock
+	struct table_shard {
+		mutex lock;
+		node_table nodes;
+	};
+
+	const size_t g_shardCount = 16;
+
+	table_shard* shards() {
+		static table_shard table[g_shardCount];
+		return table;
+	}
+
+	type intern(type_kind kind, const string& name, type param, type result, uint16_t allowed = UINT16_MAX) {
+		type_node n;
+		n.kind = kind;
+		n.name = name;
+		n.param = param;
+		n.result = result;
+		n.allowed = allowed;
+		n.closed = (kind == type_kind::constant) || (kind == type_kind::function && param->closed && result->closed);
+
+		// Combined like boost::hash_combine
+		size_t h = hash<string>()(name) ^ static_cast<size_t>(kind) ^ (static_cast<size_t>(allowed) << 16);
+		h ^= hash<type>()(param) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		h ^= hash<type>()(result) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		n.hash = h;
+
+		// Elements of an unordered_set never move. The low bits of the hash
+		// pick the bucket inside a shard, so the shard comes from the high ones.
+		table_shard& shard = shards()[(h >> (sizeof(size_t) * 8 - 4)) % g_shardCount];
+		lock_guard<mutex> lock(shard.lock);
+		return &*shard.nodes.insert(n).first;
+	}
+
+	void show(type t, string& result) {
+		switch (t->kind) {
+			case type_kind::constant:
+			case type_kind::variable:
+				result += t->name;
+				break;
+			case type_kind::function: {
+				const bool nested = (t->param->kind == type_kind::function);
+				result += nested ? "(" : "";
+				show(t->param, result);
+				result += nested ? ") -> " : " -> ";
+				show(t->result, result);
+				break;
+			}
+		}
+	}
+
+}
+
+namespace mhc {
+
+	namespace types {
+
+		type constant(const string& name) {
+			return intern(type_kind::constant, name, nullptr, nullptr);
+		}
+
+		type variable(const string& name, uint16_t allowed) {
+			return intern(type_kind::variable, name, nullptr, nullptr, allowed);
+		}
+
+		type function(type param, type result) {
+			return intern(type_kind::function, string(), param, result);
+		}
+
+		type fromSyntax(const syntax::type_expr& t, string& error) {
+			if (t.name == "->" && t.args.size() == 2) {
+				const type param = fromSyntax(t.args[0], error);
+				const type result = param ? fromSyntax(t.args[1], error) : nullptr;
+				return result ? function(param, result) : nullptr;
+			}
+
+			if (!t.args.empty() || t.name.empty() || !isalpha(static_cast<unsigned char>(t.name[0]))) {
+				error = "the type " + syntax::typeString(t) + " isn't supported yet";
+				return nullptr;
+			}
+
+			return isupper(static_cast<unsigned char>(t.name[0])) ? constant(t.name) : variable(t.name);
+		}
+
+		string show(type t) {
+			string result;
+			::show(t, result);
+			return result;
+		}
+
+		size_t internedCount() {
+			size_t result = 0;
+			for (size_t i = 0; i < g_shardCount; ++i) {
+				lock_guard<mutex> lock(shards()[i].lock);
+				result += shards()[i].nodes.size();
+			}
+			return result;
+		}
+
+		void synonym_table::add(const string& name, type definition) {
+			lock_guard<mutex> lock(m_mutex);
+			m_definitions[name] = definition;
+			m_resolved.clear();
+			m_expanded.clear();
+		}
+
+		void synonym_table::add(const string& name, const vector<string>& params, const syntax::type_expr& definition) {
+			lock_guard<mutex> lock(m_mutex);
+			m_parameterized[name] = parameterized{ params, definition };
+			m_resolved.clear();
+			m_expanded.clear();
+		}
+
+		void synonym_table::clear() {
+			lock_guard<mutex> lock(m_mutex);
+			m_definitions.clear();
+			m_parameterized.clear();
+			m_resolved.clear();
+			m_expanded.clear();
+		}
+
+		type synonym_table::expand(type t, string& error) {
+			lock_guard<mutex> lock(m_mutex);
+			return expandType(t, error);
+		}
+
+		type synonym_table::fromSyntax(const syntax::type_expr& t, string& error) {
+			lock_guard<mutex> lock(m_mutex);
+			const type converted = convert(t, map<string, type>(), error);
+			return converted ? expandType(converted, error) : nullptr;
+		}
+
+		type synonym_table::convert(const syntax::type_expr& t, const map<string, type>& args, string& error) {
+			const auto found = m_parameterized.find(t.name);
+			if (found == m_parameterized.end()) {
+				if (t.name == "->" && t.args.size() == 2) {
+					const type param = convert(t.args[0], args, error);
+					const type result = param ? convert(t.args[1], args, error) : nullptr;
+					return result ? function(param, result) : nullptr;
+				}
+
+				const auto arg = args.find(t.name);
+				if (arg != args.end() && t.args.empty()) {
+					return arg->second;
+				}
+				return types::fromSyntax(t, error);
+			}
+
+			const vector<string>& params = found->second.params;
+			if (t.args.size() != params.size()) {
+				error = "the type synonym " + t.name + " takes " + to_string(params.size()) + " type argument" +
+					(params.size() == 1 ? "" : "s") + ", " + syntax::typeString(t) + " has " + to_string(t.args.size());
+				return nullptr;
+			}
+
+			const auto cycle = find(m_expanding.begin(), m_expanding.end(), t.name);
+			if (cycle != m_expanding.end()) {
+				error = "the type synonyms";
+				for (auto itr = cycle; itr != m_expanding.end(); ++itr) {
+					error += (itr == cycle ? " " : ", ") + *itr;
+				}
+				error += " form a cycle";
+				return nullptr;
+			}
+
+			// Arguments are converted where they're written, the definition
+			// sees only its own parameters
+			map<string, type> bound;
+			for (size_t i = 0; i < params.size(); ++i) {
+				const type arg = convert(t.args[i], args, error);
+				if (!arg) {
+					return nullptr;
+				}
+				bound[params[i]] = arg;
+			}
+
+			m_expanding.push_back(t.name);
+			const type result = convert(found->second.definition, bound, error);
+			m_expanding.pop_back();
+			return result;
+		}
+
+		type synonym_table::expandName(const string& name, string& error) {
+			const auto resolved = m_resolved.find(name);
+			if (resolved != m_resolved.end()) {
+				return resolved->second;
+			}
+
+			const auto cycle = find(m_expanding.begin(), m_expanding.end(), name);
+			if (cycle != m_expanding.end()) {
+				error = "the type synonyms";
+				for (auto itr = cycle; itr != m_expanding.end(); ++itr) {
+					error += (itr == cycle ? " " : ", ") + *itr;
+				}
+				error += " form a cycle";
+				return nullptr;
+			}
+
+			m_expanding.push_back(name);
+			const type result = expandType(m_definitions[name], error);
+			m_expanding.pop_back();
+
+			if (result) {
+				m_resolved[name] = result;
+			}
+			return result;
+		}
+
+		type synonym_table::expandType(type t, string& error) {
+			if (m_definitions.empty() || t->kind == type_kind::variable) {
+				return t;
+			}
+
+			const auto found = m_expanded.find(t);
+			if (found != m_expanded.end()) {
+				return found->second;
+			}
+
+			type result = t;
+			if (t->kind == type_kind::constant) {
+				if (m_definitions.count(t->name) > 0) {
+					result = expandName(t->name, error);
+				}
+			} else {
+				const type param = expandType(t->param, error);
+				const type body = param ? expandType(t->result, error) : nullptr;
+				result = body ? function(param, body) : nullptr;
+			}
+
+			if (result) {
+				m_expanded[t] = result;
+			}
+			return result;
+		}
+
+	}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "syntax.h"
+
+
+namespace mhc {
+
+	// Types as written in signatures and data declarations. Every type is
+	// interned in one table for the whole process, so structurally equal types
+	// are the same node and compare by pointer, and a type can key a map
+	// without hashing its structure again. Nodes are immutable and never freed.
+	namespace types {
+
+		enum class type_kind : std::uint8_t {
+			constant,       // A type constructor without arguments, "Int" or a data type
+			variable,
+			function,
+		};
+
+		struct type_node {
+			type_kind kind;
+			std::string name;                       // Constants and variables
+			const type_node* param;                 // Functions
+			const type_node* result;
+			std::uint16_t allowed;                  // Variables: the infer::type_set they're restricted to
+			bool closed;                            // Mentions no variables
+			std::size_t hash;
+		};
+
+		using type = const type_node*;
+
+		type constant(const std::string& name);
+		type variable(const std::string& name, std::uint16_t allowed = UINT16_MAX);
+		type function(type param, type result);
+
+		// Null when the type has a form that isn't supported yet (applied
+		// type constructors, lists and tuples), 'error' says which
+		type fromSyntax(const syntax::type_expr& t, std::string& error);
+
+		std::string show(type t);
+
+		// Types interned so far
+		std::size_t internedCount();
+
+		// Type synonyms of a module. One without parameters is expanded once
+		// on first use and remembered, along with every type expanded through
+		// the table. One with parameters is kept as written and substituted at
+		// each use. The checkers of a module's binding groups share the table
+		// across threads.
+		class synonym_table {
+		public:
+			// The definition is expanded when it's first needed, so synonyms
+			// may refer to ones added later
+			void add(const std::string& name, type definition);
+			void add(const std::string& name, const std::vector<std::string>& params, const syntax::type_expr& definition);
+			void clear();
+
+			// The type with every synonym replaced, null and 'error' set when
+			// the synonyms it uses form a cycle
+			type expand(type t, std::string& error);
+
+			// Like types::fromSyntax, but synonyms with parameters may be
+			// applied, and the result is expanded. A synonym applied to the
+			// wrong number of types is an error.
+			type fromSyntax(const syntax::type_expr& t, std::string& error);
+
+		private:
+			struct parameterized {
+				std::vector<std::string> params;
+				syntax::type_expr definition;
+			};
+
+			type expandType(type t, std::string& error);
+			type expandName(const std::string& name, std::string& error);
+			type convert(const syntax::type_expr& t, const std::map<std::string, type>& args, std::string& error);
+
+			std::mutex m_mutex;
+
+			std::map<std::string, type> m_definitions;
+			std::map<std::string, parameterized> m_parameterized;
+			std::map<std::string, type> m_resolved;
+			std::map<type, type> m_expanded;
+			std::vector<std::string> m_expanding;     // Synonyms being expanded, innermost last
+		};
+
+	}
+
+}
@@ -1,13 +1,20 @@
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/program_options/variables_map.hpp>
 
+#include "build.h"
 #include "driver.h"
+#include "mem_report.h"
+#include "remarks.h"
+#include "timing.h"
+#include "timing_hook.h"
 
 using namespace std;
 namespace po = boost::program_options;
@@ -16,19 +23,61 @@ using namespace mhc::driver;
 
 
 int main(int argc, char** argv) {
+	// Before anything is allocated, so enabling timing later doesn't change
+	// what's counted
+	mhc::timing::enableAllocationHook();
+
 	// Build the supported options
 	po::options_description desc("Allowed options");
 	desc.add_options()
 		("help", "produce help message")
 		("output-file,o", po::value<string>(), "output file")
-		("input-file,i", po::value<string>(), "input file")
+		("input-file,i", po::value<vector<string>>(), "input file")
+		("make", "build the input files and every module they import")
+		("jobs,j", po::value<unsigned>(), "number of modules to compile in parallel with --make")
+		("cache-dir", po::value<string>(), "directory of the compilation cache")
+		("cache-size", po::value<unsigned>(), "maximum size of the compilation cache in MB, --incremental keeps declarations in a second cache of this size")
+		("cache-stats", "print compilation cache hit and miss statistics")
+		("dce-stats", "print how many unreachable declarations were eliminated before code generation")
+		("incremental", "reuse code generated for unchanged declarations, requires --cache-dir")
+		("codegen-partitions", po::value<unsigned>(), "split each module into N partitions generated and optimized in parallel")
+		("typecheck-threads", po::value<unsigned>(), "infer the types of independent binding groups on N threads")
+		("streaming", "compile one batch of declarations at a time to bound memory use")
+		("march", po::value<string>(), "target CPU, 'native' selects the host CPU and its features")
+		("mcpu", po::value<string>(), "target CPU passed to the code generator, 'native' selects the host CPU")
+		("mattr", po::value<string>(), "target features to enable or disable, e.g. +avx2,-avx512f")
+		("optimize,O", po::value<unsigned>(), "optimization level 0-3, -O0 compiles fastest (default 3)")
+		("fprofile-generate", po::value<string>(), "instrument the program to write profiles on exit, -fprofile-generate=dir or the current directory")
+		("fprofile-use", po::value<string>(), "optimize with the profiles from -fprofile-use=dir or the current directory")
+		("ftime-report", "print wall time, CPU time and allocated bytes of every compiler phase and LLVM pass")
+		("ftime-trace", po::value<string>(), "write a Chrome trace of the compiler phases to the given JSON file")
+		("mem-report", "print the peak RSS and what the source, AST and LLVM module hold after each phase")
+		("Rpass", po::value<string>(), "report optimizations by passes whose name matches the regular expression")
+		("Rpass-missed", po::value<string>(), "report missed optimizations by passes whose name matches the regular expression")
+		("Rpass-analysis", po::value<string>(), "report the analysis behind decisions of passes whose name matches the regular expression")
+		("fsave-remarks", po::value<string>(), "write the remarks to the given YAML file (JSON if it ends in .json) instead of printing them")
+		("dump-core", "print the Core of every binding before it's lowered to LLVM IR")
 		;
 
 	po::positional_options_description p;
 	p.add("input-file", -1);
 
+	// The profile directory is only ever given as -fprofile-use=dir, a bare
+	// option means the current directory and leaves the next argument an
+	// input file
+	vector<string> args(argv + 1, argv + argc);
+	for (auto& itr : args) {
+		if (itr == "-fprofile-generate" || itr == "--fprofile-generate" || itr == "-fprofile-use" || itr == "--fprofile-use") {
+			itr += "=.";
+		}
+	}
+
 	po::variables_map vm;
-	po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+	// Target options are spelled like gcc's: -march=native. Without guessing so
+	// short options such as -o and -i don't match long prefixes.
+	const int style = (po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+	                | po::command_line_style::allow_long_disguise;
+	po::store(po::command_line_parser(args).options(desc).positional(p).style(style).run(), vm);
 	po::notify(vm); 
 
 	if (vm.count("help") > 0) {
@@ -36,26 +85,132 @@ int main(int argc, char** argv) {
 		return 1;
 	}
 
-	if (vm.count("input-file") > 0) {
-		const string inputFilename = vm["input-file"].as<string>();
-		const string tmpBitCodeFile = "output.bc";
-		string outputFilename = "a.out";
+	if (vm.count("input-file") == 0) {
+		cerr << "No input file" << endl;
+		return 1;
+	}
+
+	const vector<string> inputFilenames = vm["input-file"].as<vector<string>>();
+	string outputFilename = "a.out";
 
-		if (vm.count("output-file") > 0) {
-			outputFilename = vm["output-file"].as<string>();
+	if (vm.count("output-file") > 0) {
+		outputFilename = vm["output-file"].as<string>();
+	}
+
+	options opts;
+	if (vm.count("cache-dir") > 0) {
+		opts.cacheDir = vm["cache-dir"].as<string>();
+	}
+	if (vm.count("cache-size") > 0) {
+		opts.cacheMaxBytes = static_cast<uintmax_t>(vm["cache-size"].as<unsigned>()) * 1024 * 1024;
+	}
+	opts.cacheStats = (vm.count("cache-stats") > 0);
+	opts.deadDeclStats = (vm.count("dce-stats") > 0);
+	opts.incremental = (vm.count("incremental") > 0);
+	opts.streaming = (vm.count("streaming") > 0);
+	opts.dumpCore = (vm.count("dump-core") > 0);
+	if (vm.count("codegen-partitions") > 0) {
+		opts.codegenPartitions = vm["codegen-partitions"].as<unsigned>();
+	}
+	if (vm.count("typecheck-threads") > 0) {
+		opts.typeCheckThreads = vm["typecheck-threads"].as<unsigned>();
+	}
+	if (vm.count("optimize") > 0) {
+		opts.optLevel = vm["optimize"].as<unsigned>();
+		if (opts.optLevel > 3) {
+			cerr << "Optimization level must be 0-3" << endl;
+			return 1;
 		}
+	}
+	if (vm.count("fprofile-generate") > 0) {
+		opts.profileGenerate = vm["fprofile-generate"].as<string>();
+	}
+	if (vm.count("fprofile-use") > 0) {
+		opts.profileUse = vm["fprofile-use"].as<string>();
+	}
+	if (vm.count("march") > 0) {
+		const string arch = vm["march"].as<string>();
+		opts.cpu = (arch == "native" ? hostCPU() : arch);
+		opts.features = (arch == "native" ? hostFeatures() : "");
+	}
+	if (vm.count("mcpu") > 0) {
+		const string cpu = vm["mcpu"].as<string>();
+		opts.cpu = (cpu == "native" ? hostCPU() : cpu);
+	}
+	if (vm.count("mattr") > 0) {
+		// Explicit features come last so they override the host's
+		const string attrs = vm["mattr"].as<string>();
+		opts.features = (opts.features.empty() ? attrs : opts.features + "," + attrs);
+	}
 
-		// Pull in the source file and generate the code
-		ifstream in(inputFilename.c_str());
-		const string fileContents(static_cast<stringstream const&>(stringstream() << in.rdbuf()).str());
+	const bool timeReport = (vm.count("ftime-report") > 0);
+	const string timeTrace = (vm.count("ftime-trace") > 0 ? vm["ftime-trace"].as<string>() : "");
+	if (timeReport || !timeTrace.empty()) {
+		mhc::timing::enable();
+	}
+	opts.timePasses = timeReport;
 
-		if (!generateOutput(fileContents, tmpBitCodeFile)) {
-			return 2;
+	const bool memReport = (vm.count("mem-report") > 0);
+	if (memReport) {
+		mhc::mem_report::enable();
+	}
+
+	auto pattern = [&](const char* name) {
+		return (vm.count(name) > 0 ? vm[name].as<string>() : string());
+	};
+	if (!mhc::remarks::configure(pattern("Rpass"), pattern("Rpass-missed"), pattern("Rpass-analysis"))) {
+		cerr << "Invalid regular expression for -Rpass" << endl;
+		return 1;
+	}
+	const string remarksFile = pattern("fsave-remarks");
+
+	// Reported whether or not the build succeeded
+	auto report = [&] {
+		if (mhc::remarks::enabled()) {
+			if (remarksFile.empty()) {
+				mhc::remarks::printText(cerr);
+			} else if (!mhc::remarks::writeFile(remarksFile)) {
+				cerr << "Failed to write remarks file: " << remarksFile << endl;
+			}
+		}
+		if (timeReport) {
+			mhc::timing::printReport(cerr);
+		}
+		if (memReport) {
+			mhc::mem_report::print(cerr);
+		}
+		if (!timeTrace.empty() && !mhc::timing::writeTrace(timeTrace)) {
+			cerr << "Failed to write trace file: " << timeTrace << endl;
 		}
+	};
 
-		if (!optimizeAndLink(tmpBitCodeFile, outputFilename)) {
-			return 3;
+	if (vm.count("make") > 0) {
+		const unsigned jobs = (vm.count("jobs") > 0 ? vm["jobs"].as<unsigned>() : 1);
+
+		const bool built = mhc::build::make(inputFilenames, outputFilename, jobs, opts);
+		report();
+		if (!built) {
+			return 2;
 		}
+
+		cout << "Executable complete!" << endl;
+		return 0;
+	}
+
+	if (inputFilenames.size() != 1) {
+		cerr << "Multiple input files require --make" << endl;
+		return 1;
+	}
+
+	// Pull in the source file and generate the code
+	ifstream in(inputFilenames[0].c_str());
+	const string fileContents(static_cast<stringstream const&>(stringstream() << in.rdbuf()).str());
+
+	opts.sourceName = inputFilenames[0];
+	const bool compiled = compile(fileContents, outputFilename, opts);
+	report();
+	if (!compiled) {
+		return 2;
 	}
 
 	cout << "Executable complete!" << endl;
@@ -0,0 +1,61 @@
+#include "timing_hook.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "timing.h"
+
+
+using namespace std;
+
+
+namespace {
+
+	atomic<bool> g_hookEnabled(false);
+
+}
+
+namespace mhc {
+
+	namespace timing {
+
+		void enableAllocationHook() {
+			g_hookEnabled.store(true, memory_order_relaxed);
+		}
+
+	}
+
+}
+
+void* operator new(size_t size) {
+	void* const p = malloc(size ? size : 1);
+	if (!p) {
+		throw bad_alloc();
+	}
+
+	if (g_hookEnabled.load(memory_order_relaxed)) {
+		mhc::timing::countAllocation(size);
+	}
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
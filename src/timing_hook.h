@@ -0,0 +1,15 @@
+#pragma once
+
+
+namespace mhc {
+
+	namespace timing {
+
+		// Starts feeding allocatedBytes from the replacement global allocation
+		// functions in timing_hook.cpp. Only binaries that want allocations in
+		// their timing report link it, the library leaves operator new alone.
+		void enableAllocationHook();
+
+	}
+
+}
@@ -44,6 +44,9 @@ public:
 			boost::apply_visitor(astHelper, itr);
 		}
 	}
+	void operator()(const parser::import_decl& decl) {
+		cout << mIndentString << "AST Import Decl: " << decl.module_id << endl;
+	}
 	void operator()(const parser::type_synonym_decl& decl) {
 		cout << mIndentString << "AST Type Synonym Decl" << endl;
 	}
@@ -97,6 +100,24 @@ TEST(ASTTest, DataType_Basic) {
 	*/
 }
 
+TEST(ASTTest, DataType_Constructors) {
+	const auto input =
+		"data Shape = Circle Double | Rect Double Double | Empty";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(input, root));
+
+	const auto expr = boost::get<base_expr>(&root);
+	const auto module = boost::get<module_decl>(&expr->children[0]);
+	const auto adt = boost::get<algebraic_datatype_decl>(&module->body[0]);
+	ASSERT_TRUE(adt != nullptr);
+
+	EXPECT_EQ((vector<string>{ "Circle", "Rect", "Empty" }), adt->constructors);
+
+	// Components still hold constructors and field types together
+	EXPECT_EQ((vector<string>{ "Circle", "Double", "Rect", "Double", "Double", "Empty" }), adt->components);
+}
+
 TEST(ASTTest, DataType_NewValue) {
 	// Taken from Real World Haskell, Ch. 3
 	const auto input =
@@ -127,3 +148,129 @@ TEST(ASTTest, DataType_NewValue) {
 	EXPECT_EQ("Test",     adt->deriving_typeclasses[1]);
 }
 
+
+TEST(ASTTest, Decl_SourceText) {
+	const auto input =
+		"validIdentifier :: Maybe Int";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(input, root));
+
+	const auto expr = boost::get<base_expr>(&root);
+	ASSERT_TRUE(expr != nullptr);
+
+	const auto module = boost::get<module_decl>(&expr->children[0]);
+	ASSERT_TRUE(module != nullptr);
+	ASSERT_EQ(1, module->body.size());
+
+	const auto decl = boost::get<string>(&module->body[0]);
+	ASSERT_TRUE(decl != nullptr);
+
+	// Token boundaries are kept so later passes can find identifiers
+	EXPECT_EQ("validIdentifier :: Maybe Int", *decl);
+}
+
+TEST(ASTTest, TypeSynonym_SourceText) {
+	const auto input =
+		"type Pair a = Either a a";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(input, root));
+
+	const auto expr = boost::get<base_expr>(&root);
+	ASSERT_TRUE(expr != nullptr);
+
+	const auto module = boost::get<module_decl>(&expr->children[0]);
+	ASSERT_TRUE(module != nullptr);
+	ASSERT_EQ(1, module->body.size());
+
+	const auto syn = boost::get<type_synonym_decl>(&module->body[0]);
+	ASSERT_TRUE(syn != nullptr);
+
+	EXPECT_EQ("Pair a", syn->type_new);
+	EXPECT_EQ("Either a a", syn->type_old);
+}
+
+TEST(ASTTest, ImportDecl) {
+	const auto input =
+		"module Main where import qualified Data.List as L; main = 3";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(input, root));
+
+	const auto expr = boost::get<base_expr>(&root);
+	ASSERT_TRUE(expr != nullptr);
+
+	const auto module = boost::get<module_decl>(&expr->children[0]);
+	ASSERT_TRUE(module != nullptr);
+	EXPECT_EQ("Main", module->module_id);
+	ASSERT_EQ(2, module->body.size());
+
+	const auto import = boost::get<import_decl>(&module->body[0]);
+	ASSERT_TRUE(import != nullptr);
+	EXPECT_EQ("Data.List", import->module_id);
+}
+
+TEST(ASTTest, ModuleExports) {
+	const auto input =
+		"module Foo (f, T(..), module Bar) where f = 3";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(input, root));
+
+	const auto expr = boost::get<base_expr>(&root);
+	ASSERT_TRUE(expr != nullptr);
+
+	const auto module = boost::get<module_decl>(&expr->children[0]);
+	ASSERT_TRUE(module != nullptr);
+	EXPECT_TRUE(module->has_export_list);
+
+	ASSERT_EQ(3, module->exports.size());
+	EXPECT_EQ("f",          module->exports[0]);
+	EXPECT_EQ("T(..)",      module->exports[1]);
+	EXPECT_EQ("module Bar", module->exports[2]);
+}
+
+TEST(ASTTest, ParseStream) {
+	const auto input =
+		"module Foo (f) where import Bar; data T = A; f = 3; g :: Int";
+
+	module_decl header;
+	vector<base_expr_node> decls;
+
+	EXPECT_TRUE(parseStream(input, header, [&decls](const base_expr_node& decl) {
+		decls.push_back(decl);
+		return true;
+	}));
+
+	EXPECT_EQ("Foo", header.module_id);
+	EXPECT_TRUE(header.has_export_list);
+	EXPECT_TRUE(header.body.empty());
+
+	ASSERT_EQ(4, decls.size());
+	EXPECT_TRUE(boost::get<import_decl>(&decls[0]) != nullptr);
+	EXPECT_TRUE(boost::get<algebraic_datatype_decl>(&decls[1]) != nullptr);
+
+	const auto decl = boost::get<string>(&decls[2]);
+	ASSERT_TRUE(decl != nullptr);
+	EXPECT_EQ("f = 3", *decl);
+}
+
+TEST(ASTTest, ParseStreamHeaderless) {
+	module_decl header;
+	size_t count = 0;
+
+	EXPECT_TRUE(parseStream("f = 3; g = 4", header, [&count](const base_expr_node&) {
+		++count;
+		return true;
+	}));
+	EXPECT_TRUE(header.module_id.empty());
+	EXPECT_EQ(2, count);
+
+	// Stops at the first declaration the callback rejects
+	count = 0;
+	EXPECT_FALSE(parseStream("f = 3; g = 4", header, [&count](const base_expr_node&) {
+		return ++count < 1;
+	}));
+	EXPECT_EQ(1, count);
+}
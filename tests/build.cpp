@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/scope_exit.hpp>
+
+#include <build.h>
+
+using namespace mhc;
+using namespace std;
+
+
+namespace {
+
+	const string g_buildDir = "test_build";
+
+	void writeModule(const string& path, const string& source) {
+		boost::filesystem::create_directories(boost::filesystem::path(path).parent_path());
+
+		ofstream out(path.c_str(), ios::trunc);
+		out << source;
+	}
+
+}
+
+TEST(BuildTest, ScanImports) {
+	const auto imports = build::scanImports(
+		"module Main where "
+		"import Data.List; "
+		"import qualified Foo as F; "
+		"main = 3");
+
+	ASSERT_EQ(2, imports.size());
+	EXPECT_EQ("Data.List", imports[0]);
+	EXPECT_EQ("Foo", imports[1]);
+}
+
+TEST(BuildTest, ScanImportsLayout) {
+	const auto imports = build::scanImports(
+		"module Main where\n"
+		"import A\n"
+		"import B\n"
+		"import qualified C as X\n"
+		"\n"
+		"main = 3");
+
+	ASSERT_EQ(3, imports.size());
+	EXPECT_EQ("A", imports[0]);
+	EXPECT_EQ("B", imports[1]);
+	EXPECT_EQ("C", imports[2]);
+}
+
+TEST(BuildTest, ScanImportsIgnoresComments) {
+	const auto imports = build::scanImports(
+		"{- import Hidden; -}\n"
+		"-- import AlsoHidden\n"
+		"import Shown");
+
+	ASSERT_EQ(1, imports.size());
+	EXPECT_EQ("Shown", imports[0]);
+}
+
+TEST(BuildTest, ModulePath) {
+	EXPECT_EQ("src/Data/Map.hs", build::modulePath("src", "Data.Map"));
+}
+
+TEST(BuildTest, DiscoverModulesDependencyOrder) {
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove_all(g_buildDir);
+	} BOOST_SCOPE_EXIT_END
+
+	writeModule(g_buildDir + "/Main.hs", "import A; import B; import Prelude; main = 3");
+	writeModule(g_buildDir + "/A.hs", "module A where import Util.C; a = 1");
+	writeModule(g_buildDir + "/B.hs", "module B where import Util.C; b = 1");
+	writeModule(g_buildDir + "/Util/C.hs", "module Util.C where c = 1");
+
+	vector<build::module_info> modules;
+	ASSERT_TRUE(build::discoverModules({ g_buildDir + "/Main.hs" }, modules));
+
+	// Prelude has no source file and is treated as external
+	ASSERT_EQ(4, modules.size());
+	EXPECT_EQ("Util.C", modules[0].moduleId);
+	EXPECT_EQ("Main", modules[3].moduleId);
+	EXPECT_EQ(g_buildDir + "/Util/C.o", modules[0].objPath);
+
+	for (size_t i = 0; i < modules.size(); ++i) {
+		for (const size_t dep : modules[i].imports) {
+			EXPECT_LT(dep, i);
+		}
+	}
+}
+
+TEST(BuildTest, DiscoverModulesCycle) {
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove_all(g_buildDir);
+	} BOOST_SCOPE_EXIT_END
+
+	writeModule(g_buildDir + "/Main.hs", "import A; main = 3");
+	writeModule(g_buildDir + "/A.hs", "module A where import B; a = 1");
+	writeModule(g_buildDir + "/B.hs", "module B where import A; b = 1");
+
+	vector<build::module_info> modules;
+	EXPECT_FALSE(build::discoverModules({ g_buildDir + "/Main.hs" }, modules));
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/scope_exit.hpp>
+
+#include <cache.h>
+
+
+using namespace mhc;
+using namespace std;
+
+
+namespace {
+
+	const string g_cacheDir = "test_cache";
+
+	void writeFile(const string& filename, const string& contents) {
+		ofstream out(filename.c_str(), ios::trunc);
+		out << contents;
+	}
+
+	string readFile(const string& filename) {
+		ifstream in(filename.c_str());
+		return static_cast<stringstream const&>(stringstream() << in.rdbuf()).str();
+	}
+
+}
+
+TEST(CacheTest, HashKeyStable) {
+	EXPECT_EQ(cache::hashKey({ "mhc", "-O3", "main = 1" }), cache::hashKey({ "mhc", "-O3", "main = 1" }));
+	EXPECT_EQ(40, cache::hashKey({ "" }).size());
+	// SHA-1 of the single separator byte
+	EXPECT_EQ("5ba93c9db0cff93f52b521d7420e43f6eda2784f", cache::hashKey({ "" }));
+}
+
+TEST(CacheTest, HashKeyDistinguishesParts) {
+	EXPECT_NE(cache::hashKey({ "ab", "c" }), cache::hashKey({ "a", "bc" }));
+	EXPECT_NE(cache::hashKey({ "mhc", "-O3", "main = 1" }), cache::hashKey({ "mhc", "-O0", "main = 1" }));
+}
+
+TEST(CacheTest, MissThenHit) {
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove_all(g_cacheDir);
+		boost::filesystem::remove("test_cache_src.o");
+		boost::filesystem::remove("test_cache_dst.o");
+	} BOOST_SCOPE_EXIT_END
+
+	cache::object_cache objectCache(g_cacheDir, 1024 * 1024);
+	const string key = cache::hashKey({ "main = 1" });
+
+	EXPECT_FALSE(objectCache.fetch(key, "test_cache_dst.o"));
+
+	writeFile("test_cache_src.o", "object contents");
+	EXPECT_TRUE(objectCache.store(key, "test_cache_src.o"));
+
+	EXPECT_TRUE(objectCache.fetch(key, "test_cache_dst.o"));
+	EXPECT_EQ("object contents", readFile("test_cache_dst.o"));
+
+	EXPECT_EQ(1, objectCache.hits());
+	EXPECT_EQ(1, objectCache.misses());
+
+	ostringstream stats;
+	objectCache.printStats(stats);
+	EXPECT_NE(string::npos, stats.str().find("total hits: 1, misses: 1"));
+}
+
+TEST(CacheTest, EvictsLeastRecentlyUsed) {
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove_all(g_cacheDir);
+		boost::filesystem::remove("test_cache_src.o");
+		boost::filesystem::remove("test_cache_dst.o");
+	} BOOST_SCOPE_EXIT_END
+
+	// Room for two 10 byte entries
+	cache::object_cache objectCache(g_cacheDir, 25);
+	writeFile("test_cache_src.o", "0123456789");
+
+	EXPECT_TRUE(objectCache.store("a", "test_cache_src.o"));
+	EXPECT_TRUE(objectCache.store("b", "test_cache_src.o"));
+
+	// Age the entries explicitly, then use 'a' so 'b' becomes the oldest
+	boost::filesystem::last_write_time(g_cacheDir + "/a.o", 1000);
+	boost::filesystem::last_write_time(g_cacheDir + "/b.o", 2000);
+	EXPECT_TRUE(objectCache.fetch("a", "test_cache_dst.o"));
+
+	EXPECT_TRUE(objectCache.store("c", "test_cache_src.o"));
+
+	EXPECT_TRUE(boost::filesystem::exists(g_cacheDir + "/a.o"));
+	EXPECT_FALSE(boost::filesystem::exists(g_cacheDir + "/b.o"));
+	EXPECT_TRUE(boost::filesystem::exists(g_cacheDir + "/c.o"));
+}
+
+TEST(CacheTest, EntriesUseTheCacheExtension) {
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove_all(g_cacheDir);
+		boost::filesystem::remove("test_cache_src.o");
+	} BOOST_SCOPE_EXIT_END
+
+	writeFile("test_cache_src.o", "0123456789");
+
+	// Each cache only charges its own entries against its bound
+	cache::object_cache objectCache(g_cacheDir, 15);
+	cache::object_cache bitcodeCache(g_cacheDir, 15, ".bc");
+	EXPECT_TRUE(objectCache.store("a", "test_cache_src.o"));
+	EXPECT_TRUE(bitcodeCache.store("b", "test_cache_src.o"));
+
+	EXPECT_TRUE(boost::filesystem::exists(g_cacheDir + "/a.o"));
+	EXPECT_TRUE(boost::filesystem::exists(g_cacheDir + "/b.bc"));
+}
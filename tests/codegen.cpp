@@ -2,17 +2,21 @@
 
 #include <parser.h>
 #include <codegen.h>
+#include <llvm_compat.h>
 
 #include <memory>
+#include <set>
 #include <string>
 
 #include <boost/variant/get.hpp>
 
-#include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
 #include "llvm/IR/LLVMContext.h"
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
 
 using namespace mhc;
 using namespace parser;
@@ -23,10 +27,25 @@ using namespace std;
 
 namespace {
 
-	unique_ptr<Module> codegenTest(const base_expr_node& root) {
-		LLVMContext &context = getGlobalContext();
+	// Branches to a block laid out no later than their own
+	size_t backEdges(const Function& function) {
+		set<const BasicBlock*> seen;
+		size_t count = 0;
+		for (const auto& bb : function) {
+			seen.insert(&bb);
+			const BranchInst* const br = dyn_cast_or_null<BranchInst>(bb.getTerminator());
+			for (unsigned i = 0; br && i < br->getNumSuccessors(); ++i) {
+				count += seen.count(br->getSuccessor(i));
+			}
+		}
+
+		return count;
+	}
+
+	// Every test owns its context, the module must not outlive it
+	unique_ptr<Module> codegenTest(const base_expr_node& root, LLVMContext& context) {
 		unique_ptr<Module> module(new Module("", context));
-		IRBuilder<> builder(getGlobalContext());
+		IRBuilder<> builder(context);
 
 		ast_codegen codeGenerator(module.get(), builder);
 
@@ -53,7 +72,8 @@ TEST(CodegenTest, BasicFunction) {
 	raw_string_ostream errorOut(errorInfo);
 
 	// Expect this to fail since we require a 'return'
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_TRUE(verifyModule(*module, &errorOut)) << errorInfo;
 }
  
@@ -70,7 +90,8 @@ TEST(CodegenTest, FunctionSingleDecl) {
 	raw_string_ostream errorOut(errorInfo);
 
 	// Expect this to fail since we require a 'return'
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_TRUE(verifyModule(*module, &errorOut)) << errorInfo;
 }
  
@@ -87,7 +108,8 @@ TEST(CodegenTest, FunctionSingleDeclReturn) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -106,7 +128,8 @@ TEST(CodegenTest, FunctionMultiDeclAssign) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -124,7 +147,8 @@ TEST(CodegenTest, FunctionMultiDeclSum) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -149,7 +173,8 @@ TEST(CodegenTest, MultipleFunction) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -165,7 +190,8 @@ TEST(CodegenTest, FunctionArgs) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -185,7 +211,8 @@ TEST(CodegenTest, FunctionMultipleArgs) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -201,7 +228,8 @@ TEST(CodegenTest, FunctionUseArgs) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -220,7 +248,8 @@ TEST(CodegenTest, FunctionCall) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -238,7 +267,8 @@ TEST(CodegenTest, IfElseStmt) {
 	base_expr_node root;
 	EXPECT_TRUE(parse(testProgram, root));
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
@@ -266,7 +296,8 @@ TEST(CodegenTest, OperatorGreaterThan) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -285,7 +316,8 @@ TEST(CodegenTest, OperatorEqual) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -305,7 +337,8 @@ TEST(CodegenTest, OperatorModulo) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -323,7 +356,8 @@ TEST(CodegenTest, Assignment) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -344,7 +378,8 @@ TEST(CodegenTest, WhileStmt) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -365,7 +400,8 @@ TEST(CodegenTest, LogicalOR) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -385,7 +421,8 @@ TEST(CodegenTest, SameVariableNameDiffFunctions) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -407,7 +444,8 @@ TEST(CodegenTest, FuncCallInIfStmt) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -426,7 +464,8 @@ TEST(CodegenTest, WhileWithReturnStmt) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -446,7 +485,8 @@ TEST(CodegenTest, FuncWithEarlyReturnStmt) {
 	string errorInfo;
 	raw_string_ostream errorOut(errorInfo);
 
-	auto module = codegenTest(root);
+	LLVMContext context;
+	auto module = codegenTest(root, context);
 	EXPECT_FALSE(verifyModule(*module, &errorOut)) << errorInfo;
 }
 
@@ -455,3 +495,275 @@ TEST(CodegenTest, FuncWithEarlyReturnStmt) {
 
 
 
+
+TEST(CodegenTest, LinkageFollowsExports) {
+	const auto testProgram =
+		"module Foo (f) where f = 3; g = 4; foreign export ccall h :: Int -> Int";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(testProgram, root));
+
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("", context));
+	IRBuilder<> builder(context);
+
+	ast_codegen codeGenerator(module.get(), builder);
+	const base_expr* expr = boost::get<base_expr>(&root);
+	boost::apply_visitor(codeGenerator, expr->children[0]);
+
+	EXPECT_EQ(GlobalValue::ExternalLinkage, codeGenerator.linkageOf("f"));
+	EXPECT_EQ(GlobalValue::InternalLinkage, codeGenerator.linkageOf("g"));
+	EXPECT_EQ(GlobalValue::ExternalLinkage, codeGenerator.linkageOf("main"));
+	EXPECT_EQ(GlobalValue::ExternalLinkage, codeGenerator.linkageOf("h"));
+
+	EXPECT_EQ(CallingConv::Fast, codeGenerator.callingConvOf("f"));
+	EXPECT_EQ(CallingConv::C,    codeGenerator.callingConvOf("main"));
+	EXPECT_EQ(CallingConv::C,    codeGenerator.callingConvOf("h"));
+
+	// Split modules can't hide anything behind internal linkage
+	codeGenerator.setSplitModule(true);
+	EXPECT_EQ(GlobalValue::ExternalLinkage, codeGenerator.linkageOf("g"));
+}
+
+TEST(CodegenTest, TailCalls) {
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("", context));
+	IRBuilder<> builder(context);
+
+	Type* const i64 = Type::getInt64Ty(context);
+	FunctionType* const unary = FunctionType::get(i64, vector<Type*>(1, i64), false);
+	FunctionType* const binary = FunctionType::get(i64, vector<Type*>(2, i64), false);
+
+	Function* const f = Function::Create(unary, GlobalValue::ExternalLinkage, "f", module.get());
+	Function* const g = Function::Create(unary, GlobalValue::ExternalLinkage, "g", module.get());
+	Function* const h = Function::Create(binary, GlobalValue::ExternalLinkage, "h", module.get());
+
+	// f x = g x; g x = g x; h x y = f x
+	vector<CallInst*> calls;
+	for (auto* caller : { f, g, h }) {
+		builder.SetInsertPoint(BasicBlock::Create(context, "entry", caller));
+		Function* const callee = (caller == f ? g : (caller == g ? g : f));
+		calls.push_back(builder.CreateCall(callee, &*caller->arg_begin()));
+		builder.CreateRet(calls.back());
+	}
+
+	ast_codegen codeGenerator(module.get(), builder);
+	codeGenerator.finalizeLinkage();
+
+	EXPECT_TRUE(calls[0]->isMustTailCall());
+	EXPECT_TRUE(calls[1]->isTailCall());
+	EXPECT_FALSE(calls[1]->isMustTailCall());
+	EXPECT_TRUE(calls[2]->isTailCall());
+	EXPECT_FALSE(calls[2]->isMustTailCall());
+	EXPECT_FALSE(verifyModule(*module));
+}
+
+TEST(CodegenTest, SelfTailCallLoops) {
+	const auto testProgram =
+		"module Main where sumTo acc n = if n == 0 then acc else sumTo (acc + n) (n - 1)";
+
+	base_expr_node root;
+	ASSERT_TRUE(parse(testProgram, root));
+
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("Main", context));
+	IRBuilder<> builder(context);
+	ast_codegen codeGenerator(module.get(), builder);
+	for (auto& itr : boost::get<base_expr>(root).children) {
+		boost::apply_visitor(codeGenerator, itr);
+	}
+	ASSERT_TRUE(codeGenerator.finalizeLinkage());
+	EXPECT_FALSE(verifyModule(*module));
+
+	// Lowered through the Core, the accumulator loop branches back to a
+	// header instead of calling itself, even without optimization
+	Function* const sumTo = module->getFunction("sumTo");
+	ASSERT_TRUE(sumTo != nullptr);
+
+	bool calls = false;
+	bool phis = false;
+	for (auto& bb : *sumTo) {
+		for (auto& inst : bb) {
+			calls = calls || isa<CallInst>(inst);
+			phis = phis || isa<PHINode>(inst);
+		}
+	}
+	EXPECT_FALSE(calls);
+	EXPECT_TRUE(phis);
+}
+
+// The accumulator loop of a self tail call keeps nsw on its arithmetic, which
+// lets the optimizer see the trip count and fold the whole loop away
+TEST(CodegenTest, AccumulatorLoopFolds) {
+	const auto testProgram =
+		"module Main where sumSquares :: Int -> Int -> Int -> Int; "
+		"sumSquares acc i n = if i > n then acc else sumSquares (acc + i * i) (i + 1) n";
+
+	base_expr_node root;
+	ASSERT_TRUE(parse(testProgram, root));
+
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("Main", context));
+	IRBuilder<> builder(context);
+	ast_codegen codeGenerator(module.get(), builder);
+	for (auto& itr : boost::get<base_expr>(root).children) {
+		boost::apply_visitor(codeGenerator, itr);
+	}
+	ASSERT_TRUE(codeGenerator.finalizeLinkage());
+	ASSERT_FALSE(verifyModule(*module));
+
+	Function* const sumSquares = module->getFunction("sumSquares");
+	ASSERT_TRUE(sumSquares != nullptr);
+	EXPECT_EQ(1u, backEdges(*sumSquares));
+
+	bool nsw = true;
+	for (auto& bb : *sumSquares) {
+		for (auto& inst : bb) {
+			const auto* const op = dyn_cast<OverflowingBinaryOperator>(&inst);
+			nsw = nsw && (!op || op->hasNoSignedWrap());
+		}
+	}
+	EXPECT_TRUE(nsw);
+
+	PassManagerBuilder passBuilder;
+	passBuilder.OptLevel = 3;
+	passBuilder.LoopVectorize = true;
+	passBuilder.SLPVectorize = true;
+
+	compat::module_pass_manager passes;
+	passBuilder.populateModulePassManager(passes);
+	passes.run(*module);
+	ASSERT_FALSE(verifyModule(*module));
+
+	// Only the closed form of the sum is left, no loop and no call to itself
+	EXPECT_EQ(0u, backEdges(*sumSquares));
+	for (auto& bb : *sumSquares) {
+		for (auto& inst : bb) {
+			const CallInst* const call = dyn_cast<CallInst>(&inst);
+			EXPECT_TRUE(!call || call->getCalledFunction()->isIntrinsic());
+		}
+	}
+}
+
+// div and mod round toward negative infinity, quot and rem toward zero
+// compare gives Haskell's Ordering: constructors order by declaration,
+// fields from the left break ties, False is less than True. Each binding
+// folds to the tag of its result, LT is 0, EQ 1 and GT 2.
+TEST(CodegenTest, DerivedCompareOrdering) {
+	const auto testProgram =
+		"module Main where data Color = Red | Green | Blue deriving (Eq, Ord); "
+		"data Shape = Circle Int | Square Int Int deriving (Eq, Ord); "
+		"order :: Ordering -> Int; order o = fromEnum o; "
+		"colors = order (compare Red Blue); "
+		"constructors = order (compare (Square 1 2) (Circle 9)); "
+		"fields = order (compare (Square 1 2) (Square 1 3)); "
+		"ints = order (compare 3 3); "
+		"bools = order (compare True False); "
+		"orderings = order (compare GT LT); "
+		"less = if Blue < Green || Red >= Green then 1 else 0; "
+		"lessShapes = if Square 2 0 <= Square 1 5 then 1 else 0";
+
+	base_expr_node root;
+	ASSERT_TRUE(parse(testProgram, root));
+
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("Main", context));
+	IRBuilder<> builder(context);
+	ast_codegen codeGenerator(module.get(), builder);
+	for (auto& itr : boost::get<base_expr>(root).children) {
+		boost::apply_visitor(codeGenerator, itr);
+	}
+	ASSERT_TRUE(codeGenerator.finalizeLinkage());
+	ASSERT_FALSE(verifyModule(*module));
+
+	PassManagerBuilder passBuilder;
+	passBuilder.OptLevel = 2;
+	// Every instance is inlined, so each binding folds
+	passBuilder.Inliner = createFunctionInliningPass(1000);
+	compat::module_pass_manager passes;
+	passBuilder.populateModulePassManager(passes);
+	passes.run(*module);
+
+	const auto folded = [&](const char* name) -> int64_t {
+		const Function* const f = module->getFunction(name);
+		const ReturnInst* const ret = f ? dyn_cast<ReturnInst>(f->getEntryBlock().getTerminator()) : nullptr;
+		const ConstantInt* const value = ret ? dyn_cast_or_null<ConstantInt>(ret->getReturnValue()) : nullptr;
+		EXPECT_TRUE(value != nullptr) << name;
+		return value ? value->getSExtValue() : -1;
+	};
+
+	EXPECT_EQ(0, folded("colors"));
+	EXPECT_EQ(2, folded("constructors"));
+	EXPECT_EQ(0, folded("fields"));
+	EXPECT_EQ(1, folded("ints"));
+	EXPECT_EQ(2, folded("bools"));
+	EXPECT_EQ(2, folded("orderings"));
+	EXPECT_EQ(0, folded("less"));
+	EXPECT_EQ(0, folded("lessShapes"));
+}
+
+TEST(CodegenTest, IntegralDivision) {
+	LLVMContext context;
+	IRBuilder<> builder(context);
+
+	const auto fold = [&](ops::opcode code, ops::operand_type type, int64_t l, int64_t r) {
+		Value* const result = emitBinaryOp(builder, code, type, builder.getInt64(l), builder.getInt64(r));
+		return cast<ConstantInt>(result)->getSExtValue();
+	};
+
+	const ops::operand_type i = ops::operand_type::integer;
+	EXPECT_EQ(-3, fold(ops::opcode::quot, i, -7, 2));
+	EXPECT_EQ(-1, fold(ops::opcode::rem,  i, -7, 2));
+	EXPECT_EQ(-4, fold(ops::opcode::div,  i, -7, 2));
+	EXPECT_EQ(1,  fold(ops::opcode::mod,  i, -7, 2));
+	EXPECT_EQ(-4, fold(ops::opcode::div,  i, 7, -2));
+	EXPECT_EQ(-1, fold(ops::opcode::mod,  i, 7, -2));
+	EXPECT_EQ(3,  fold(ops::opcode::div,  i, -7, -2));
+	EXPECT_EQ(-1, fold(ops::opcode::mod,  i, -7, -2));
+	EXPECT_EQ(-3, fold(ops::opcode::div,  i, -6, 2));
+	EXPECT_EQ(0,  fold(ops::opcode::mod,  i, -6, 2));
+	EXPECT_EQ(3,  fold(ops::opcode::div,  ops::operand_type::word, 7, 2));
+
+	// Fractional only
+	EXPECT_TRUE(emitBinaryOp(builder, ops::opcode::fdiv, i, builder.getInt64(7), builder.getInt64(2)) == nullptr);
+}
+
+TEST(CodegenTest, ConstructorMetadata) {
+	const auto testProgram =
+		"data Shape = Circle Double | Rect Double Double | Empty";
+
+	base_expr_node root;
+	EXPECT_TRUE(parse(testProgram, root));
+
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("", context));
+	IRBuilder<> builder(context);
+	ast_codegen codeGenerator(module.get(), builder);
+
+	const base_expr* expr = boost::get<base_expr>(&root);
+	const module_decl* decl = boost::get<module_decl>(&expr->children[0]);
+	boost::apply_visitor(codeGenerator, decl->body[0]);
+
+	FunctionType* const type = FunctionType::get(Type::getInt64Ty(context), false);
+	Function* const f = Function::Create(type, GlobalValue::ExternalLinkage, "f", module.get());
+	builder.SetInsertPoint(BasicBlock::Create(context, "entry", f));
+
+	Value* const rect = codeGenerator.emitConstructor("Rect", { builder.getInt64(1), builder.getInt64(2) });
+	ASSERT_TRUE(rect != nullptr);
+	EXPECT_TRUE(codeGenerator.emitConstructor("Square", {}) == nullptr);
+
+	LoadInst* const tag = cast<LoadInst>(codeGenerator.emitTagLoad(rect, "Shape"));
+	LoadInst* const field = cast<LoadInst>(codeGenerator.emitFieldLoad(rect, 1));
+	builder.CreateRet(builder.CreateAdd(tag, field));
+	ASSERT_FALSE(verifyModule(*module));
+
+	// Tags are [0, 3) and don't alias fields
+	MDNode* const range = tag->getMetadata(LLVMContext::MD_range);
+	ASSERT_TRUE(range != nullptr);
+	EXPECT_EQ(0, compat::constantOperand(range, 0)->getZExtValue());
+	EXPECT_EQ(3, compat::constantOperand(range, 1)->getZExtValue());
+
+	ASSERT_TRUE(tag->getMetadata(LLVMContext::MD_tbaa) != nullptr);
+	ASSERT_TRUE(field->getMetadata(LLVMContext::MD_tbaa) != nullptr);
+	EXPECT_NE(tag->getMetadata(LLVMContext::MD_tbaa), field->getMetadata(LLVMContext::MD_tbaa));
+}
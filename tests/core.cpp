@@ -0,0 +1,291 @@
+#include <gtest/gtest.h>
+
+#include <core.h>
+#include <desugar.h>
+#include <syntax.h>
+
+#include <sstream>
+#include <string>
+
+using namespace mhc;
+using namespace std;
+
+
+namespace {
+
+	// Desugars 'decls' as the bindings of a module declaring 'Shape' and
+	// 'dataTypes'
+	bool desugar(const vector<string>& decls, core::module& result, unsigned threads = 1, const vector<parser::algebraic_datatype_decl>& dataTypes = {}) {
+		parser::algebraic_datatype_decl shape;
+		shape.type_ctor = "Shape";
+		shape.components = { "Circle", "Double", "Square", "Double", "Int", "Empty" };
+		shape.constructors = { "Circle", "Square", "Empty" };
+		shape.deriving_typeclasses = { "Eq", "Ord" };
+
+		parser::module_decl decl;
+		decl.module_id = "Main";
+		decl.body.push_back(shape);
+		for (const auto& itr : dataTypes) {
+			decl.body.push_back(itr);
+		}
+		for (const auto& itr : decls) {
+			decl.body.push_back(itr);
+		}
+
+		core::desugarer desugarer;
+		desugarer.setThreads(threads);
+		desugarer.addEnvironment(decl);
+		for (const auto& itr : decls) {
+			desugarer.addDecl(itr);
+		}
+
+		return desugarer.finish(result);
+	}
+
+}
+
+TEST(CoreTest, ParseFixities) {
+	syntax::fixity_table fixities = syntax::defaultFixities();
+	ASSERT_TRUE(syntax::addFixities("infixr 5 <+>", fixities));
+	EXPECT_EQ(5, fixities["<+>"].precedence);
+	EXPECT_EQ('r', fixities["<+>"].assoc);
+
+	// Multiplication binds tighter, subtraction associates to the left
+	syntax::decl d;
+	string error;
+	ASSERT_TRUE(syntax::parseDecl("f x = x - 1 - 2 * x", fixities, d, error)) << error;
+	ASSERT_EQ(syntax::decl_kind::clause, d.kind);
+	ASSERT_EQ(1u, d.equation.rhs.size());
+
+	const syntax::expr& body = d.equation.rhs[0].body;
+	ASSERT_EQ(syntax::expr_kind::binary, body.kind);
+	EXPECT_EQ("-", body.name);
+	EXPECT_EQ("-", body.children[0].name);
+	EXPECT_EQ("*", body.children[1].name);
+	EXPECT_EQ(ops::opcode::sub, body.op);
+	EXPECT_EQ(ops::opcode::mul, body.children[1].op);
+
+	ASSERT_TRUE(syntax::parseDecl("f x = x <+> x", fixities, d, error)) << error;
+	EXPECT_EQ(ops::opcode::count, d.equation.rhs[0].body.op);
+
+	ASSERT_TRUE(syntax::parseDecl("area :: Shape -> Double", fixities, d, error));
+	EXPECT_EQ(syntax::decl_kind::signature, d.kind);
+	EXPECT_EQ("Shape -> Double", syntax::typeString(d.type));
+
+	EXPECT_FALSE(syntax::parseDecl("f x = y where y = x", fixities, d, error));
+	EXPECT_FALSE(error.empty());
+}
+
+TEST(CoreTest, DesugarEquations) {
+	core::module program("Main");
+	ASSERT_TRUE(desugar({
+		"area :: Shape -> Double",
+		"area (Circle r) = 3.14 * r * r",
+		"area (Square s n) = s * s",
+		"area Empty = 0",
+		"fact 0 = 1",
+		"fact n = n * fact (n - 1)",
+		"clamp x | x < 0 = 0 | x > 10 = 10 | otherwise = x",
+	}, program));
+
+	ostringstream errors;
+	EXPECT_TRUE(core::verify(program, errors)) << errors.str();
+	EXPECT_EQ(3u, program.functions.size());
+
+	// Shape's, then LT, EQ and GT of the implicit Ordering
+	ASSERT_EQ(6u, program.constructors.size());
+	EXPECT_EQ("GT", program.constructors[5].name);
+
+	const core::var_id area = program.findGlobal("area");
+	ASSERT_NE(core::g_none, area);
+	EXPECT_EQ("Shape -> Double", core::typeName(program, program.vars[area].type));
+
+	const core::var_id fact = program.findGlobal("fact");
+	ASSERT_NE(core::g_none, fact);
+	EXPECT_EQ("Int -> Int", core::typeName(program, program.vars[fact].type));
+}
+
+TEST(CoreTest, Specializations) {
+	core::module program("Main");
+	ASSERT_TRUE(desugar({
+		"square x = x * x",
+		"ident x = x",
+		"half = square 1.5",
+		"main = square (ident 3)",
+	}, program));
+
+	ostringstream errors;
+	EXPECT_TRUE(core::verify(program, errors)) << errors.str();
+
+	// Defined at the defaults under its own name, elsewhere specialized
+	const core::var_id square = program.findGlobal("square");
+	ASSERT_NE(core::g_none, square);
+	EXPECT_EQ("Int -> Int", core::typeName(program, program.vars[square].type));
+
+	const core::var_id special = program.findGlobal("square{Double}");
+	ASSERT_NE(core::g_none, special);
+	EXPECT_EQ("Double -> Double", core::typeName(program, program.vars[special].type));
+	EXPECT_TRUE(core::isSpecialization("square{Double}"));
+	EXPECT_EQ(5u, program.functions.size());
+}
+
+TEST(CoreTest, NegateKeepsSignedZero) {
+	core::module program("Main");
+	ASSERT_TRUE(desugar({
+		"neg :: Double -> Double",
+		"neg x = -x",
+		"dec :: Int -> Int",
+		"dec n = -n",
+	}, program));
+
+	ostringstream printed;
+	core::print(printed, program);
+	EXPECT_NE(string::npos, printed.str().find("sub -0.0 x"));
+	EXPECT_NE(string::npos, printed.str().find("sub 0 n"));
+}
+
+// The right operand of && and || is only evaluated when it decides the
+// result, here it would divide by zero
+TEST(CoreTest, ShortCircuitLogic) {
+	core::module program("Main");
+	ASSERT_TRUE(desugar({
+		"f :: Int -> Int",
+		"f x = if x /= 0 && 10 `quot` x > 1 then 1 else 2",
+		"g :: Int -> Bool",
+		"g x = x == 0 || 10 `quot` x > 1",
+	}, program));
+
+	ostringstream errors;
+	ASSERT_TRUE(core::verify(program, errors)) << errors.str();
+	ASSERT_EQ(2u, program.functions.size());
+
+	// The division is in an alternative of the match on the left operand,
+	// not in the lets before it
+	for (const auto& itr : program.functions) {
+		core::expr_id e = itr.body;
+		while (program.exprs[e].kind != core::expr_kind::match) {
+			const core::expr& x = program.exprs[e];
+			ASSERT_NE(core::expr_kind::ret, x.kind);
+			EXPECT_FALSE(x.kind == core::expr_kind::let_prim && x.op == ops::opcode::quot);
+			e = x.body;
+		}
+	}
+
+	size_t divisions = 0;
+	for (const auto& x : program.exprs) {
+		divisions += (x.kind == core::expr_kind::let_prim && x.op == ops::opcode::quot) ? 1 : 0;
+	}
+	EXPECT_EQ(2u, divisions);
+
+	// Only Bool has them
+	core::module other("Main");
+	EXPECT_FALSE(desugar({ "main :: Int", "main = 3 && 5" }, other));
+}
+
+TEST(CoreTest, ParallelInference) {
+	const vector<string> decls = {
+		"square x = x * x",
+		"ident x = x",
+		"isEven :: Int -> Bool",
+		"isEven n = if n == 0 then True else isOdd (n - 1)",
+		"isOdd n = if n == 0 then False else isEven (n - 1)",
+		"area (Circle r) = square r",
+		"area s = 0",
+		"two = 1 + 1",
+		"scaled = two * 1.5",
+		"main = if isOdd 3 then square (ident 3) else 0",
+	};
+
+	// Groups are inferred on their own checkers in any order, the Core
+	// doesn't change
+	core::module sequential("Main");
+	ASSERT_TRUE(desugar(decls, sequential));
+	ostringstream expected;
+	core::print(expected, sequential);
+
+	for (int i = 0; i < 4; ++i) {
+		core::module parallel("Main");
+		ASSERT_TRUE(desugar(decls, parallel, 4));
+		ostringstream found;
+		core::print(found, parallel);
+		EXPECT_EQ(expected.str(), found.str());
+	}
+
+	// A value's uses in other groups still decide its type
+	const core::var_id two = sequential.findGlobal("two");
+	ASSERT_NE(core::g_none, two);
+	EXPECT_EQ("Double", core::typeName(sequential, sequential.vars[two].type));
+	EXPECT_NE(core::g_none, sequential.findGlobal("square{Double}"));
+}
+
+TEST(CoreTest, DerivedInstances) {
+	parser::algebraic_datatype_decl color;
+	color.type_ctor = "Color";
+	color.components = { "Red", "Green", "Blue" };
+	color.constructors = color.components;
+	color.deriving_typeclasses = { "Eq", "Ord", "Enum", "Bounded" };
+
+	core::module program("Main");
+	ASSERT_TRUE(desugar({
+		"next c = if c == maxBound then minBound else succ c",
+		"isFirst c = c == minBound",
+		"smaller a b = Square a 1 < Square b 2",
+		"main = if next Blue /= Red then 0 else fromEnum (next Red)",
+	}, program, 1, { color }));
+
+	ostringstream errors;
+	EXPECT_TRUE(core::verify(program, errors)) << errors.str();
+
+	// Each method gets a function at each type it's used at, fromEnum and
+	// the bounds are inlined
+	for (const auto& itr : { "=={Color}", "succ{Color}", "compare{Shape}", "next{Color}" }) {
+		const core::var_id f = program.findGlobal(itr);
+		ASSERT_NE(core::g_none, f) << itr;
+		EXPECT_TRUE(core::isSpecialization(itr));
+	}
+	EXPECT_EQ("Color -> Color -> Bool", core::typeName(program, program.vars[program.findGlobal("=={Color}")].type));
+	EXPECT_EQ(core::g_none, program.findGlobal("fromEnum{Color}"));
+
+	// Only data types fit these, there's no default to define them at
+	EXPECT_EQ(core::g_none, program.findGlobal("next"));
+	EXPECT_EQ(core::g_none, program.findGlobal("isFirst"));
+
+	// Shape has fields, it's no enumeration, and a class needs deriving
+	core::module other("Main");
+	EXPECT_FALSE(desugar({ "f s = succ s == Empty" }, other, 1, { color }));
+	color.deriving_typeclasses = { "Eq" };
+	EXPECT_FALSE(desugar({ "f c = c < Red" }, other, 1, { color }));
+
+	// Show has nothing generated for it, it's an error rather than ignored
+	color.deriving_typeclasses = { "Eq", "Show" };
+	EXPECT_FALSE(desugar({ "f c = c == Red" }, other, 1, { color }));
+}
+
+TEST(CoreTest, DesugarErrors) {
+	core::module program("Main");
+	EXPECT_FALSE(desugar({ "f x = g x" }, program));
+	EXPECT_FALSE(desugar({ "f :: Double -> Double", "f x = x .&. 1" }, program));
+	EXPECT_FALSE(desugar({ "f x = y where y = x" }, program));
+	EXPECT_FALSE(desugar({ "f x = let x = x + 1 in x" }, program));
+}
+
+TEST(CoreTest, VerifyRejects) {
+	core::module program("Main");
+	ASSERT_TRUE(desugar({ "inc :: Int -> Int", "inc x = x + 1" }, program));
+
+	ostringstream errors;
+	ASSERT_TRUE(core::verify(program, errors)) << errors.str();
+
+	// The body returns a Double from a function returning Int
+	core::module broken = program;
+	for (auto& itr : broken.atoms) {
+		itr = core::floatingAtom(1.5);
+	}
+	EXPECT_FALSE(core::verify(broken, errors));
+	EXPECT_FALSE(errors.str().empty());
+
+	// An expression reachable from two places
+	broken = program;
+	broken.functions.push_back(broken.functions[0]);
+	EXPECT_FALSE(core::verify(broken, errors));
+}
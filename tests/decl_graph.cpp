@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+
+#include <decl_graph.h>
+#include <lexer.h>
+#include <parser.h>
+
+#include <boost/variant/get.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace mhc;
+using namespace parser;
+using namespace std;
+
+
+namespace {
+
+	module_decl makeModule(const vector<string>& decls) {
+		module_decl module;
+		for (const auto& itr : decls) {
+			module.body.push_back(itr);
+		}
+
+		return module;
+	}
+
+}
+
+TEST(LexerTest, Tokenize) {
+	const auto tokens = lexer::tokenize("f x = g (x + 1) -- comment");
+
+	ASSERT_EQ(9, tokens.size());
+	EXPECT_EQ("f", tokens[0].text);
+	EXPECT_EQ("=", tokens[2].text);
+	EXPECT_EQ(lexer::token_kind::varsym, tokens[2].kind);
+	EXPECT_EQ(lexer::token_kind::special, tokens[4].kind);
+	EXPECT_EQ("1", tokens[7].text);
+	EXPECT_EQ(lexer::token_kind::integer, tokens[7].kind);
+}
+
+TEST(DeclGraphTest, DeclNames) {
+	EXPECT_EQ(vector<string>{ "f" }, declNames(string("f x = x")));
+	EXPECT_EQ(vector<string>{ "f" }, declNames(string("f :: Int -> Int")));
+	EXPECT_EQ(vector<string>{ "<+>" }, declNames(string("a <+> b = a")));
+	EXPECT_EQ(vector<string>{ "<+>" }, declNames(string("infixl 6 <+>")));
+	EXPECT_EQ(vector<string>{ "c_sin" }, declNames(string("foreign import ccall \"sin\" c_sin :: Double -> Double")));
+	EXPECT_TRUE(declNames(string("foreign export ccall f :: Int -> Int")).empty());
+}
+
+TEST(DeclGraphTest, References) {
+	const auto module = makeModule({
+		"main = f 1",
+		"f x = g x",
+		"g x = x",
+		"unused = 2",
+	});
+
+	const auto graph = buildDeclGraph(module);
+	ASSERT_EQ(4, graph.nodes.size());
+
+	EXPECT_EQ(vector<size_t>{ 1 }, graph.nodes[0].refs);
+	EXPECT_EQ(vector<size_t>{ 2 }, graph.nodes[1].refs);
+	EXPECT_TRUE(graph.nodes[2].refs.empty());
+	EXPECT_TRUE(graph.nodes[3].refs.empty());
+}
+
+TEST(DeclGraphTest, ComponentsDependenciesFirst) {
+	const auto module = makeModule({
+		"main = even 10",
+		"even n = odd n",
+		"odd n = even n",
+	});
+
+	const auto components = stronglyConnectedComponents(buildDeclGraph(module));
+	ASSERT_EQ(2, components.size());
+
+	EXPECT_EQ((vector<size_t>{ 1, 2 }), components[0]);
+	EXPECT_EQ(vector<size_t>{ 0 }, components[1]);
+}
+
+TEST(DeclGraphTest, FingerprintsFollowReferences) {
+	const auto before = declFingerprints(buildDeclGraph(makeModule({
+		"main = f 1",
+		"f x = g x",
+		"g x = x",
+		"h = 2",
+	})));
+
+	// Editing 'g' invalidates everything that reaches it, but not 'h'
+	const auto after = declFingerprints(buildDeclGraph(makeModule({
+		"main = f 1",
+		"f x = g x",
+		"g x = x + 1",
+		"h = 2",
+	})));
+
+	EXPECT_NE(before[0], after[0]);
+	EXPECT_NE(before[1], after[1]);
+	EXPECT_NE(before[2], after[2]);
+	EXPECT_EQ(before[3], after[3]);
+}
+
+TEST(DeclGraphTest, FingerprintsIgnoreOrder) {
+	const auto before = declFingerprints(buildDeclGraph(makeModule({
+		"f x = g x",
+		"g x = x",
+	})));
+
+	const auto after = declFingerprints(buildDeclGraph(makeModule({
+		"g x = x",
+		"f x = g x",
+	})));
+
+	EXPECT_EQ(before[0], after[1]);
+	EXPECT_EQ(before[1], after[0]);
+}
+
+TEST(DeclGraphTest, FingerprintsFollowMonomorphicUsers) {
+	const auto before = declFingerprints(buildDeclGraph(makeModule({
+		"main = f k",
+		"k = 3",
+		"f :: Double -> Int",
+		"f x = 7",
+		"g :: Int -> Int",
+		"g x = x",
+	})));
+
+	// 'k' has no signature, so its type comes from 'f'. Everything using 'k'
+	// changes with it, 'g' doesn't.
+	const auto after = declFingerprints(buildDeclGraph(makeModule({
+		"main = f k",
+		"k = 3",
+		"f :: Int -> Int",
+		"f x = 7",
+		"g :: Int -> Int",
+		"g x = x",
+	})));
+
+	EXPECT_NE(before[0], after[0]);
+	EXPECT_NE(before[1], after[1]);
+	EXPECT_EQ(before[4], after[4]);
+	EXPECT_EQ(before[5], after[5]);
+}
+
+TEST(DeclGraphTest, PartitionKeepsComponentsTogether) {
+	const auto module = makeModule({
+		"main = even 10",
+		"even n = odd n",
+		"odd n = even n",
+		"a = 1",
+		"b = 2",
+	});
+
+	const auto groups = partitionComponents(buildDeclGraph(module), 3);
+	ASSERT_EQ(3, groups.size());
+
+	// Every node lands in exactly one group, and the even/odd cycle stays whole
+	vector<int> seen(5, 0);
+	for (const auto& group : groups) {
+		for (const size_t n : group) {
+			++seen[n];
+		}
+
+		const bool hasEven = find(group.begin(), group.end(), 1) != group.end();
+		const bool hasOdd = find(group.begin(), group.end(), 2) != group.end();
+		EXPECT_EQ(hasEven, hasOdd);
+	}
+	EXPECT_EQ(vector<int>(5, 1), seen);
+}
+
+TEST(DeclGraphTest, PartitionDropsEmptyGroups) {
+	const auto module = makeModule({ "main = 1" });
+
+	const auto groups = partitionComponents(buildDeclGraph(module), 4);
+	ASSERT_EQ(1, groups.size());
+	EXPECT_EQ(vector<size_t>{ 0 }, groups[0]);
+}
+
+TEST(DeclGraphTest, ReachableFromMainAndExports) {
+	auto module = makeModule({
+		"main = f 1",
+		"f :: Int -> Int",
+		"f x = x",
+		"unused = g 2",
+		"g x = x",
+		"exported = 3",
+		"foreign export ccall callback :: Int -> Int",
+		"callback x = x",
+	});
+	module.module_id = "Foo";
+	module.has_export_list = true;
+	module.exports = { "exported" };
+
+	const auto graph = buildDeclGraph(module);
+	const vector<bool> expected = { true, true, true, false, false, true, true, true };
+	EXPECT_EQ(expected, reachableDecls(module, graph));
+
+	EXPECT_EQ((vector<string>{ "unused", "g" }), eliminateDeadDecls(module));
+	ASSERT_EQ(6, module.body.size());
+	EXPECT_EQ("exported = 3", boost::get<string>(module.body[3]));
+}
+
+TEST(DeclGraphTest, EliminatedOncePerBinding) {
+	auto module = makeModule({ "main = 1", "f :: Int -> Int", "f 0 = 1", "f n = n" });
+
+	EXPECT_EQ(vector<string>{ "f" }, eliminateDeadDecls(module));
+	EXPECT_EQ(1, module.body.size());
+}
+
+TEST(DeclGraphTest, EverythingReachableWithoutExportList) {
+	auto module = makeModule({ "a = 1", "b = 2" });
+	module.module_id = "Foo";
+
+	EXPECT_TRUE(eliminateDeadDecls(module).empty());
+	EXPECT_EQ(2, module.body.size());
+
+	// Without a header only 'main' is exported
+	module.module_id = "";
+	EXPECT_EQ((vector<string>{ "a", "b" }), eliminateDeadDecls(module));
+}
@@ -589,3 +589,58 @@ TEST(DriverTest, MultipleChainedFunctionCall) {
 	EXPECT_EQ(27, runExecutable(g_outputExe));
 }
 #endif
+
+TEST(DriverTest, TargetInConfigurationKey) {
+	driver::options generic;
+	driver::options haswell;
+	haswell.cpu = "haswell";
+	driver::options noAvx = haswell;
+	noAvx.features = "-avx2";
+
+	EXPECT_NE(driver::configurationKey(generic), driver::configurationKey(haswell));
+	EXPECT_NE(driver::configurationKey(haswell), driver::configurationKey(noAvx));
+	EXPECT_EQ(driver::configurationKey(haswell), driver::configurationKey(haswell));
+
+	// Host detection always names some CPU, features may be unavailable
+	EXPECT_FALSE(driver::hostCPU().empty());
+}
+
+TEST(DriverTest, OptLevelInConfigurationKey) {
+	driver::options o0;
+	o0.optLevel = 0;
+	driver::options o3;
+
+	EXPECT_EQ(3, o3.optLevel);
+	EXPECT_NE(driver::configurationKey(o0), driver::configurationKey(o3));
+
+	// Levels above 3 behave like -O3
+	driver::options o9;
+	o9.optLevel = 9;
+	EXPECT_EQ(driver::configurationKey(o3), driver::configurationKey(o9));
+}
+
+TEST(DriverTest, IncrementalFollowsMonomorphicUses) {
+	driver::options opts;
+	opts.cacheDir = "test_incremental_cache";
+	opts.incremental = true;
+
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove_all("test_incremental_cache");
+		for (const auto& itr : { "test_incremental", "test_incremental.bc", "test_incremental.o", "test_incremental_opt.bc" }) {
+			boost::filesystem::remove(itr);
+		}
+	} BOOST_SCOPE_EXIT_END
+
+	const auto run = [&opts](const string& program) {
+		if (!driver::generateOutput(program, "test_incremental.bc", opts) || !driver::optimizeAndLink("test_incremental.bc", "test_incremental")) {
+			return -1;
+		}
+
+		const int r = system("./test_incremental");
+		return (r == -1) ? -1 : WEXITSTATUS(r);
+	};
+
+	// 'k' is untouched, but its user now makes it an Int rather than a Double
+	EXPECT_EQ(7, run("module Main (main) where k = 3; f :: Double -> Int; f x = 7; main = f k"));
+	EXPECT_EQ(6, run("module Main (main) where k = 3; f :: Int -> Int; f x = x * 2; main = f k"));
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include <infer.h>
+#include <syntax.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace mhc;
+using namespace mhc::infer;
+using namespace std;
+
+
+namespace {
+
+	// Reads equations and signatures into 'equations', returns the names bound
+	vector<string> readDecls(checker& types, const vector<string>& decls, map<string, vector<syntax::clause>>& equations) {
+		const syntax::fixity_table fixities = syntax::defaultFixities();
+		vector<string> names;
+
+		for (const auto& itr : decls) {
+			syntax::decl d;
+			string error;
+			EXPECT_TRUE(syntax::parseDecl(itr, fixities, d, error)) << error;
+
+			if (d.kind == syntax::decl_kind::signature) {
+				types.addSignature(d.names[0], d.type);
+			} else if (equations.count(d.equation.name) == 0) {
+				names.push_back(d.equation.name);
+				equations[d.equation.name].push_back(d.equation);
+			} else {
+				equations[d.equation.name].push_back(d.equation);
+			}
+		}
+
+		return names;
+	}
+
+}
+
+TEST(InferTest, UnifyAndPathCompression) {
+	checker types;
+	const node_id a = types.fresh();
+	const node_id b = types.fresh();
+	const node_id c = types.fresh();
+
+	ASSERT_TRUE(types.unify(a, b));
+	ASSERT_TRUE(types.unify(b, c));
+	ASSERT_TRUE(types.unify(c, types.constant("Int")));
+
+	EXPECT_EQ(types.constant("Int"), types.find(a));
+	EXPECT_EQ(types.constant("Int"), types.at(a).link);
+
+	EXPECT_FALSE(types.unify(types.constant("Int"), types.constant("Double")));
+
+	// Numeric literals can't be Bool
+	const node_id literal = types.fresh(g_numSet);
+	EXPECT_FALSE(types.unify(types.constant("Bool"), literal));
+	EXPECT_EQ(types.constant("Int"), types.defaultType(types.at(literal).allowed));
+}
+
+TEST(InferTest, OccursCheck) {
+	checker types;
+	const node_id a = types.fresh();
+	EXPECT_FALSE(types.unify(a, types.function(a, types.constant("Int"))));
+	EXPECT_EQ(node_kind::variable, types.at(types.find(a)).kind);
+}
+
+TEST(InferTest, Generalize) {
+	checker types;
+	map<string, vector<syntax::clause>> equations;
+
+	for (const auto& name : readDecls(types, { "ident x = x", "square x = x * x", "two = 1 + 1" }, equations)) {
+		types.inferGroup(equations, { name });
+	}
+	EXPECT_TRUE(types.errors().empty());
+
+	// Each use instantiates the variables afresh
+	const node_id ident = types.scheme("ident");
+	EXPECT_EQ("a -> a", types.show(ident));
+	EXPECT_EQ(1u, types.generics(ident).size());
+	EXPECT_NE(types.instantiate(ident), types.instantiate(ident));
+
+	const node_id square = types.scheme("square");
+	ASSERT_EQ(1u, types.generics(square).size());
+	EXPECT_EQ(g_numSet & operandSet(ops::opcode::mul), types.at(types.generics(square)[0]).allowed);
+
+	// A value keeps its constrained variables monomorphic
+	EXPECT_TRUE(types.generics(types.scheme("two")).empty());
+}
+
+TEST(InferTest, MutualRecursionAndSignatures) {
+	checker types;
+	map<string, vector<syntax::clause>> equations;
+	const vector<string> names = readDecls(types, {
+		"isEven :: Int -> Bool",
+		"isEven n = if n == 0 then True else isOdd (n - 1)",
+		"isOdd n = if n == 0 then False else isEven (n - 1)",
+	}, equations);
+
+	types.inferGroup(equations, names);
+	EXPECT_TRUE(types.errors().empty());
+	EXPECT_EQ("Int -> Bool", types.show(types.scheme("isOdd")));
+
+	// A signature can't claim more than the definition gives
+	checker strict;
+	map<string, vector<syntax::clause>> more;
+	strict.inferGroup(more, readDecls(strict, { "f :: a -> a", "f x = x + 1" }, more));
+	ASSERT_EQ(1u, strict.errors().count("f"));
+}
+
+TEST(InferTest, Errors) {
+	checker types;
+	map<string, vector<syntax::clause>> equations;
+
+	for (const auto& name : readDecls(types, { "f x = x + True", "g x = x x", "h = y" }, equations)) {
+		types.inferGroup(equations, { name });
+	}
+
+	ASSERT_EQ(3u, types.errors().size());
+	EXPECT_EQ("operator + isn't defined on Bool", types.errors().at("f"));
+	EXPECT_EQ("variable not in scope: y", types.errors().at("h"));
+}
+
+TEST(InferTest, HaskellOperators) {
+	checker types;
+	map<string, vector<syntax::clause>> equations;
+
+	const vector<string> names = readDecls(types, {
+		"both :: Int", "both = 3 && 5",
+		"half :: Int", "half = 7 / 2",
+		"percent x = x % 2",
+		"floored x = x `div` 2 + x `mod` 3",
+		"ratio x = x / 2",
+	}, equations);
+	for (const auto& name : names) {
+		types.inferGroup(equations, { name });
+	}
+
+	// && is Bool's, / needs a Fractional type and the C spellings are gone
+	ASSERT_EQ(3u, types.errors().size());
+	EXPECT_EQ(1u, types.errors().count("both"));
+	EXPECT_EQ(1u, types.errors().count("half"));
+	EXPECT_EQ("variable not in scope: %", types.errors().at("percent"));
+
+	const node_id floored = types.generics(types.scheme("floored"))[0];
+	EXPECT_EQ(g_intSet | g_wordSet, types.at(floored).allowed & g_kindSet);
+	const node_id ratio = types.generics(types.scheme("ratio"))[0];
+	EXPECT_EQ(g_doubleSet, types.at(ratio).allowed & g_kindSet);
+}
+
+TEST(InferTest, OpenWorldSignatures) {
+	// Local signatures aren't the module's
+	const map<string, syntax::type_expr> signatures = syntax::topLevelSignatures(
+		"module M (half) where half :: Double -> Double; "
+		"half x = x / two where { two :: Double; two = 2.0 }; count = 3");
+	ASSERT_EQ(1u, signatures.size());
+	EXPECT_EQ("Double -> Double", syntax::typeString(signatures.at("half")));
+
+	// A name another batch defines has its declared type, not one guessed
+	// from its uses here
+	checker types;
+	types.setOpenWorld(&signatures);
+	map<string, vector<syntax::clause>> equations;
+	for (const auto& name : readDecls(types, { "f y = half y", "g = count + 1" }, equations)) {
+		types.inferGroup(equations, { name });
+	}
+
+	EXPECT_EQ("Double -> Double", types.show(types.scheme("f")));
+	ASSERT_EQ(1u, types.errors().size());
+	EXPECT_EQ("variable not in scope, or defined elsewhere in the module without a type signature: count", types.errors().at("g"));
+}
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/scope_exit.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/variant/get.hpp>
+
+#include <cache.h>
+#include <driver.h>
+#include <interface.h>
+#include <parser.h>
+
+using namespace mhc;
+using namespace mhc::iface;
+using namespace parser;
+using namespace std;
+
+
+namespace {
+
+	module_decl parseModule(const string& input) {
+		base_expr_node root;
+		EXPECT_TRUE(parse(input, root));
+
+		const auto expr = boost::get<base_expr>(&root);
+		EXPECT_TRUE(expr != nullptr && !expr->children.empty());
+
+		const auto module = boost::get<module_decl>(&expr->children[0]);
+		EXPECT_TRUE(module != nullptr);
+
+		return module ? *module : module_decl();
+	}
+
+}
+
+TEST(InterfaceTest, LookupEntries) {
+	const auto module = parseModule(
+		"module Foo where "
+		"data Shape = Circle Double deriving (Show); "
+		"type Name = String; "
+		"area :: Shape -> Double; "
+		"area = 3; "
+		"infixl 6 <+>");
+
+	const string image = buildInterface(module);
+
+	interface_file file;
+	ASSERT_TRUE(file.openBuffer(image.data(), image.size()));
+
+	boost::string_ref payload;
+	ASSERT_TRUE(file.lookup("area", entry_kind::value, payload));
+	EXPECT_EQ("Shape -> Double", payload.to_string());
+
+	ASSERT_TRUE(file.lookup("Shape", entry_kind::data, payload));
+	EXPECT_EQ("Show\nCircle\nDouble", payload.to_string());
+
+	ASSERT_TRUE(file.lookup("Circle", entry_kind::constructor, payload));
+	EXPECT_EQ("Shape", payload.to_string());
+
+	ASSERT_TRUE(file.lookup("Name", entry_kind::synonym, payload));
+	EXPECT_EQ("Name = String", payload.to_string());
+
+	ASSERT_TRUE(file.lookup("<+>", entry_kind::fixity, payload));
+	EXPECT_EQ("infixl 6", payload.to_string());
+
+	EXPECT_FALSE(file.lookup("area", entry_kind::data, payload));
+	EXPECT_FALSE(file.lookup("missing", entry_kind::value, payload));
+}
+
+TEST(InterfaceTest, ExportListFilters) {
+	const auto module = parseModule(
+		"module Foo (Shape(..), area) where "
+		"data Shape = Circle Double; "
+		"area = 3; "
+		"helper = 4");
+
+	const string image = buildInterface(module);
+
+	interface_file file;
+	ASSERT_TRUE(file.openBuffer(image.data(), image.size()));
+
+	boost::string_ref payload;
+	EXPECT_TRUE(file.lookup("Shape", entry_kind::data, payload));
+	EXPECT_TRUE(file.lookup("Circle", entry_kind::constructor, payload));
+	EXPECT_TRUE(file.lookup("area", entry_kind::value, payload));
+	EXPECT_FALSE(file.lookup("helper", entry_kind::value, payload));
+}
+
+TEST(InterfaceTest, ContentHashTracksChanges) {
+	const string a = buildInterface(parseModule("module Foo where f :: Int"));
+	const string b = buildInterface(parseModule("module Foo where f :: Double"));
+
+	interface_file fileA;
+	interface_file fileB;
+	ASSERT_TRUE(fileA.openBuffer(a.data(), a.size()));
+	ASSERT_TRUE(fileB.openBuffer(b.data(), b.size()));
+
+	// The whole SHA-1 digest, importers are rebuilt by this alone
+	EXPECT_EQ(40, fileA.contentHash().size());
+	const file_header* header = reinterpret_cast<const file_header*>(a.data());
+	EXPECT_EQ(cache::hashKey({ a.substr(sizeof(file_header), header->stringsOffset - sizeof(file_header)), a.substr(header->stringsOffset) }),
+	          fileA.contentHash());
+	EXPECT_NE(fileA.contentHash(), fileB.contentHash());
+}
+
+TEST(InterfaceTest, RejectsCorruptImage) {
+	string image = buildInterface(parseModule("module Foo where f = 3"));
+
+	interface_file file;
+	EXPECT_FALSE(file.openBuffer(image.data(), 8));
+
+	image[0] = 'X';
+	EXPECT_FALSE(file.openBuffer(image.data(), image.size()));
+}
+
+TEST(InterfaceTest, InterfacePath) {
+	EXPECT_EQ("src/Data/Map.mhi", interfacePath("src", "Data.Map"));
+	EXPECT_EQ("Main.mhi",         interfacePath("", "Main"));
+}
+
+TEST(InterfaceTest, Unfoldings) {
+	const auto module = parseModule("module Foo (f) where f = 3; g = 4");
+
+	const string bitCode("BC\xC0\xDE\0\x01", 6);
+	const string image = buildInterface(module, { { "f", bitCode }, { "g", "hidden" } });
+
+	interface_file file;
+	ASSERT_TRUE(file.openBuffer(image.data(), image.size()));
+
+	boost::string_ref payload;
+	ASSERT_TRUE(file.lookup("f", entry_kind::unfolding, payload));
+	EXPECT_EQ(bitCode, payload.to_string());
+
+	EXPECT_FALSE(file.lookup("g", entry_kind::unfolding, payload));
+}
+
+// Through the whole pipeline only what importers can call gets an unfolding,
+// not the entry point or a helper left out of the export list
+TEST(InterfaceTest, UnfoldingsOnlyForExports) {
+	BOOST_SCOPE_EXIT(void) {
+		boost::filesystem::remove("test_unfoldings.bc");
+		boost::filesystem::remove("test_unfoldings.mhi");
+	} BOOST_SCOPE_EXIT_END
+
+	ASSERT_TRUE(driver::generateOutput(
+		"module Main (main, double) where double :: Int -> Int; double x = x * 2; "
+		"helper :: Int -> Int; helper x = x + 1; main = double (helper 3)",
+		"test_unfoldings.bc", driver::options(), "test_unfoldings.mhi"));
+
+	interface_file file;
+	ASSERT_TRUE(file.open("test_unfoldings.mhi"));
+
+	boost::string_ref payload;
+	EXPECT_TRUE(file.lookup("double", entry_kind::unfolding, payload));
+	EXPECT_FALSE(file.lookup("main", entry_kind::unfolding, payload));
+	EXPECT_FALSE(file.lookup("helper", entry_kind::unfolding, payload));
+}
+
+TEST(InterfaceTest, InlinePragmas) {
+	const auto names = inlinePragmas("{-# INLINE f, (<+>) #-}\nf = 3\n{-# LANGUAGE Foo #-}\n{- INLINE g -}");
+
+	ASSERT_EQ(2, names.size());
+	EXPECT_EQ("f",   names[0]);
+	EXPECT_EQ("<+>", names[1]);
+}
+
+TEST(InterfaceTest, SummaryBuildsSameInterface) {
+	const auto module = parseModule(
+		"module Foo where "
+		"data Shape = Circle Double; "
+		"area :: Shape -> Double; "
+		"area s = 3; "
+		"a <+> b = a; "
+		"infixl 6 <+>");
+
+	module_decl summary = module;
+	summary.body.clear();
+	for (const auto& itr : module.body) {
+		summary.body.push_back(interfaceSummary(itr));
+	}
+
+	EXPECT_EQ("area s ", boost::get<string>(summary.body[2]));
+	EXPECT_EQ(buildInterface(module), buildInterface(summary));
+}
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+
+#include <mem_report.h>
+#include <parser.h>
+
+#include <sstream>
+#include <string>
+
+using namespace mhc;
+using namespace parser;
+using namespace std;
+
+
+TEST(MemReportTest, AstNodesByKind) {
+	base_expr_node root;
+	ASSERT_TRUE(parse("module Foo where import Bar; data Shape = Circle Double | Empty; area = 3; name = 4", root));
+
+	const auto usage = mem_report::astUsage(root);
+	EXPECT_EQ(1, usage.kinds.at("module_decl").first);
+	EXPECT_EQ(1, usage.kinds.at("import_decl").first);
+	EXPECT_EQ(1, usage.kinds.at("algebraic_datatype_decl").first);
+	EXPECT_EQ(2, usage.kinds.at("declaration").first);
+
+	uint64_t total = 0;
+	for (const auto& itr : usage.kinds) {
+		total += itr.second.second;
+	}
+	EXPECT_EQ(usage.bytes, total);
+}
+
+TEST(MemReportTest, SamplesReportPeakRSS) {
+	EXPECT_GT(mem_report::peakRSS(), 0);
+
+	mem_report::enable();
+	mem_report::sample("test phase", { { "source buffer", 1234 } });
+
+	ostringstream out;
+	mem_report::print(out);
+	EXPECT_NE(string::npos, out.str().find("test phase: peak RSS"));
+	EXPECT_NE(string::npos, out.str().find("source buffer"));
+	EXPECT_NE(string::npos, out.str().find("1234 bytes"));
+}
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+
+#include <operators.h>
+
+#include <string>
+
+using namespace mhc::ops;
+using namespace std;
+
+
+TEST(OperatorsTest, ResolveSymbols) {
+	opcode code;
+
+	ASSERT_TRUE(resolveOperator("+", code));
+	EXPECT_EQ(opcode::add, code);
+
+	ASSERT_TRUE(resolveOperator("/=", code));
+	EXPECT_EQ(opcode::ne, code);
+
+	ASSERT_TRUE(resolveOperator("quot", code));
+	EXPECT_EQ(opcode::quot, code);
+
+	ASSERT_TRUE(resolveOperator("div", code));
+	EXPECT_EQ(opcode::div, code);
+
+	ASSERT_TRUE(resolveOperator("/", code));
+	EXPECT_EQ(opcode::fdiv, code);
+
+	ASSERT_TRUE(resolveOperator(".&.", code));
+	EXPECT_EQ(opcode::bit_and, code);
+
+	ASSERT_TRUE(resolveOperator("&&", code));
+	EXPECT_EQ(opcode::logical_and, code);
+
+	EXPECT_FALSE(resolveOperator("<$>", code));
+	EXPECT_FALSE(resolveOperator("", code));
+
+	// Only the Haskell spellings
+	for (const auto& itr : { "%", "!=", "<<", ">>", "&" }) {
+		EXPECT_FALSE(resolveOperator(itr, code)) << itr;
+	}
+}
+
+TEST(OperatorsTest, Support) {
+	EXPECT_TRUE(isComparison(opcode::lt));
+	EXPECT_FALSE(isComparison(opcode::add));
+
+	EXPECT_TRUE(isSupported(opcode::shr, operand_type::word));
+	EXPECT_TRUE(isSupported(opcode::fdiv, operand_type::floating));
+	EXPECT_FALSE(isSupported(opcode::fdiv, operand_type::integer));
+	EXPECT_FALSE(isSupported(opcode::div, operand_type::floating));
+	EXPECT_FALSE(isSupported(opcode::rem, operand_type::floating));
+	EXPECT_FALSE(isSupported(opcode::shl, operand_type::floating));
+	EXPECT_FALSE(isSupported(opcode::logical_or, operand_type::integer));
+	EXPECT_FALSE(isSupported(opcode::count, operand_type::integer));
+}
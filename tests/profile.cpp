@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+
+#include <codegen.h>
+#include <llvm_compat.h>
+#include <parser.h>
+#include <profile.h>
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/variant/get.hpp>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include "llvm/IR/LLVMContext.h"
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+
+using namespace mhc;
+using namespace profile;
+
+using namespace llvm;
+using namespace std;
+
+
+namespace {
+
+	// f x = if x > 0 then 1 else 2, g x = x
+	unique_ptr<Module> branchyModule(LLVMContext& context) {
+		unique_ptr<Module> module(new Module("Branchy", context));
+		IRBuilder<> builder(context);
+
+		Type* const i64 = Type::getInt64Ty(context);
+		FunctionType* const type = FunctionType::get(i64, vector<Type*>(1, i64), false);
+
+		Function* const f = Function::Create(type, GlobalValue::ExternalLinkage, "f", module.get());
+		BasicBlock* const entryBB = BasicBlock::Create(context, "entry", f);
+		BasicBlock* const thenBB = BasicBlock::Create(context, "then", f);
+		BasicBlock* const elseBB = BasicBlock::Create(context, "else", f);
+
+		builder.SetInsertPoint(entryBB);
+		builder.CreateCondBr(builder.CreateICmpSGT(&*f->arg_begin(), builder.getInt64(0)), thenBB, elseBB);
+		builder.SetInsertPoint(thenBB);
+		builder.CreateRet(builder.getInt64(1));
+		builder.SetInsertPoint(elseBB);
+		builder.CreateRet(builder.getInt64(2));
+
+		Function* const g = Function::Create(type, GlobalValue::ExternalLinkage, "g", module.get());
+		builder.SetInsertPoint(BasicBlock::Create(context, "entry", g));
+		builder.CreateRet(&*g->arg_begin());
+
+		return module;
+	}
+
+	// Lowered through the Core like the driver does
+	unique_ptr<Module> coreModule(LLVMContext& context, const string& source) {
+		unique_ptr<Module> module(new Module("Main", context));
+		IRBuilder<> builder(context);
+		ast_codegen codeGenerator(module.get(), builder);
+
+		parser::base_expr_node root;
+		EXPECT_TRUE(parse(source, root));
+		for (auto& itr : boost::get<parser::base_expr>(root).children) {
+			boost::apply_visitor(codeGenerator, itr);
+		}
+
+		EXPECT_TRUE(codeGenerator.finalizeLinkage());
+		return module;
+	}
+
+	void writeRecord(ofstream& out, uint64_t checksum, const vector<uint64_t>& counts) {
+		const uint64_t header[] = { checksum, counts.size() };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint64_t));
+	}
+
+}
+
+TEST(ProfileTest, InstrumentKeepsLayout) {
+	LLVMContext context;
+	auto module = branchyModule(context);
+
+	const module_layout before = layoutOf(*module);
+	EXPECT_EQ(4, before.counterCount);
+
+	ASSERT_TRUE(instrumentModule(*module, "test.mhprof"));
+	EXPECT_FALSE(verifyModule(*module));
+
+	EXPECT_TRUE(module->getNamedGlobal("__mhc_prof_counters") != nullptr);
+	EXPECT_TRUE(module->getNamedGlobal("llvm.global_ctors") != nullptr);
+
+	// Counters are bumped atomically, never loaded and stored back
+	size_t updates = 0;
+	for (auto& bb : *module->getFunction("f")) {
+		for (auto& inst : bb) {
+			const AtomicRMWInst* const update = dyn_cast<AtomicRMWInst>(&inst);
+			EXPECT_FALSE(isa<StoreInst>(inst));
+			updates += (update && update->getOperation() == AtomicRMWInst::Add) ? 1 : 0;
+		}
+	}
+	EXPECT_EQ(3u, updates);
+
+	// The runtime support isn't part of the layout, so use sees the same one
+	const module_layout after = layoutOf(*module);
+	EXPECT_EQ(before.checksum, after.checksum);
+	EXPECT_EQ(before.counterCount, after.counterCount);
+}
+
+TEST(ProfileTest, BranchTargetsInChecksum) {
+	LLVMContext context;
+	auto module = branchyModule(context);
+	const module_layout before = layoutOf(*module);
+
+	// Same names and counter counts, but the branch now goes the other way
+	BranchInst* const branch = cast<BranchInst>(module->getFunction("f")->getEntryBlock().getTerminator());
+	branch->swapSuccessors();
+
+	const module_layout after = layoutOf(*module);
+	EXPECT_EQ(before.counterCount, after.counterCount);
+	EXPECT_NE(before.checksum, after.checksum);
+}
+
+TEST(ProfileTest, ApplySumsMatchingRuns) {
+	const string path = "test_apply.mhprof";
+	boost::filesystem::remove(path);
+
+	LLVMContext context;
+	auto module = branchyModule(context);
+	const module_layout layout = layoutOf(*module);
+
+	{
+		// Two runs of this module and one of something else
+		ofstream out(path.c_str(), ios::binary);
+		writeRecord(out, layout.checksum, { 10, 9, 10, 0 });
+		writeRecord(out, layout.checksum ^ 1, { 5, 5, 5 });
+		writeRecord(out, layout.checksum, { 10, 9, 10, 0 });
+	}
+
+	ASSERT_TRUE(applyProfile(*module, path));
+	boost::filesystem::remove(path);
+
+	BranchInst* const branch = cast<BranchInst>(module->getFunction("f")->getEntryBlock().getTerminator());
+	MDNode* const weights = branch->getMetadata(LLVMContext::MD_prof);
+	ASSERT_TRUE(weights != nullptr);
+	EXPECT_EQ(19, compat::constantOperand(weights, 1)->getZExtValue());
+	EXPECT_EQ(3,  compat::constantOperand(weights, 2)->getZExtValue());
+
+	EXPECT_TRUE(module->getFunction("f")->hasFnAttribute(Attribute::InlineHint));
+	EXPECT_TRUE(module->getFunction("g")->hasFnAttribute(Attribute::Cold));
+}
+
+TEST(ProfileTest, StaleProfileIgnored) {
+	const string path = "test_stale.mhprof";
+
+	LLVMContext context;
+	auto module = branchyModule(context);
+
+	{
+		ofstream out(path.c_str(), ios::binary);
+		writeRecord(out, layoutOf(*module).checksum + 1, { 1, 1, 1, 1 });
+	}
+
+	EXPECT_FALSE(applyProfile(*module, path));
+	boost::filesystem::remove(path);
+
+	EXPECT_FALSE(module->getFunction("g")->hasFnAttribute(Attribute::Cold));
+}
+
+TEST(ProfileTest, CorruptLengthEndsRead) {
+	const string path = "test_corrupt.mhprof";
+
+	LLVMContext context;
+	auto module = branchyModule(context);
+	const module_layout layout = layoutOf(*module);
+
+	{
+		// A good record, then a header claiming more counters than the file holds
+		ofstream out(path.c_str(), ios::binary);
+		writeRecord(out, layout.checksum, { 10, 9, 10, 0 });
+		const uint64_t header[] = { layout.checksum, uint64_t(1) << 60 };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	}
+
+	EXPECT_TRUE(applyProfile(*module, path));
+	boost::filesystem::remove(path);
+}
+
+TEST(ProfileTest, CoreBranchesAndSwitches) {
+	LLVMContext context;
+	auto module = coreModule(context,
+		"module Main where "
+		"data Shape = Circle Double | Square Double; "
+		"area (Circle r) = r; "
+		"area (Square s) = s * s; "
+		"clamp x | x > 10 = 10 | otherwise = x");
+
+	// A guard is a conditional branch, each equation's constructor pattern
+	// a switch with one case
+	BranchInst* guard = nullptr;
+	for (auto& bb : *module->getFunction("clamp")) {
+		BranchInst* const branch = dyn_cast<BranchInst>(bb.getTerminator());
+		guard = (branch && branch->isConditional()) ? branch : guard;
+	}
+	ASSERT_TRUE(guard != nullptr);
+
+	vector<SwitchInst*> switches;
+	for (auto& bb : *module->getFunction("area")) {
+		if (SwitchInst* const dispatch = dyn_cast<SwitchInst>(bb.getTerminator())) {
+			switches.push_back(dispatch);
+		}
+	}
+	ASSERT_EQ(2u, switches.size());
+
+	// Entries, the guard's taken and total, each switch's case and total
+	const module_layout layout = layoutOf(*module);
+	EXPECT_EQ(2 + 2 + 2 * 2, layout.counterCount);
+
+	const string path = "test_core.mhprof";
+	boost::filesystem::remove(path);
+	{
+		ofstream out(path.c_str(), ios::binary);
+		vector<uint64_t> counts(layout.counterCount, 1);
+		writeRecord(out, layout.checksum, counts);
+	}
+
+	ASSERT_TRUE(applyProfile(*module, path));
+	boost::filesystem::remove(path);
+
+	EXPECT_TRUE(guard->getMetadata(LLVMContext::MD_prof) != nullptr);
+	for (SwitchInst* const dispatch : switches) {
+		MDNode* const weights = dispatch->getMetadata(LLVMContext::MD_prof);
+		ASSERT_TRUE(weights != nullptr);
+		EXPECT_EQ(3u, weights->getNumOperands());
+	}
+
+	auto instrumented = coreModule(context,
+		"module Main where "
+		"data Shape = Circle Double | Square Double; "
+		"area (Circle r) = r; "
+		"area (Square s) = s * s");
+	ASSERT_TRUE(instrumentModule(*instrumented, path));
+	EXPECT_FALSE(verifyModule(*instrumented));
+}
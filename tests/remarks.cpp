@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include <parser.h>
+#include <remarks.h>
+
+#include <boost/variant/get.hpp>
+
+#include <sstream>
+#include <string>
+
+using namespace mhc;
+using namespace parser;
+using namespace std;
+
+
+namespace {
+
+	remarks::remark makeRemark(remarks::remark_kind kind, const string& pass, const string& function, const string& message) {
+		remarks::remark r;
+		r.kind = kind;
+		r.pass = pass;
+		r.function = function;
+		r.message = message;
+		return r;
+	}
+
+}
+
+TEST(RemarksTest, SourceMapLocatesDeclarations) {
+	const string source = "module Foo where -- header\n"
+	                      "data Shape = Circle Double | Empty; -- shapes\n"
+	                      "area = 3; {- spans\n"
+	                      "   lines -} name = 4";
+
+	base_expr_node root;
+	ASSERT_TRUE(parse(source, root));
+	const module_decl* module = boost::get<module_decl>(&boost::get<base_expr>(root).children[0]);
+	ASSERT_NE(nullptr, module);
+
+	remarks::source_map sources("Foo", source, "src/Foo.hs");
+	sources.addModule(*module);
+
+	auto r = makeRemark(remarks::remark_kind::missed, "inline", "area", "");
+	ASSERT_TRUE(sources.locate(r));
+	EXPECT_EQ("Foo", r.module);
+	EXPECT_EQ("src/Foo.hs", r.file);
+	EXPECT_EQ(1, r.declIndex);
+	EXPECT_EQ(3, r.line);
+	EXPECT_EQ(1, r.column);
+
+	r.function = "name";
+	ASSERT_TRUE(sources.locate(r));
+	EXPECT_EQ(2, r.declIndex);
+	EXPECT_EQ(4, r.line);
+	EXPECT_EQ(13, r.column);
+
+	r.function = "missing";
+	EXPECT_FALSE(sources.locate(r));
+}
+
+TEST(RemarksTest, FiltersAndWrites) {
+	EXPECT_FALSE(remarks::configure("(", "", ""));
+	ASSERT_TRUE(remarks::configure("inline", "mhc-.*", ""));
+	EXPECT_TRUE(remarks::enabled());
+
+	EXPECT_TRUE(remarks::wanted(remarks::remark_kind::passed, "inline"));
+	EXPECT_FALSE(remarks::wanted(remarks::remark_kind::passed, "loop-vectorize"));
+	EXPECT_FALSE(remarks::wanted(remarks::remark_kind::analysis, "inline"));
+
+	auto r = makeRemark(remarks::remark_kind::missed, "mhc-unfolding", "area", "too \"large\"");
+	r.module = "Foo";
+	r.line = 3;
+	r.column = 1;
+	remarks::emit(r);
+	remarks::emit(makeRemark(remarks::remark_kind::passed, "loop-vectorize", "area", "vectorized loop"));
+
+	ASSERT_EQ(1, remarks::collected().size());
+
+	ostringstream yaml;
+	remarks::writeYAML(yaml);
+	EXPECT_NE(string::npos, yaml.str().find("--- !Missed"));
+	EXPECT_NE(string::npos, yaml.str().find("Line: 3"));
+
+	ostringstream json;
+	remarks::writeJSON(json);
+	EXPECT_NE(string::npos, json.str().find("\"message\":\"too \\\"large\\\"\""));
+
+	ostringstream text;
+	remarks::printText(text);
+	EXPECT_EQ("Foo:3:1: remark: [mhc-unfolding] area: too \"large\"\n", text.str());
+
+	ASSERT_TRUE(remarks::configure("", "", ""));
+	EXPECT_FALSE(remarks::enabled());
+}
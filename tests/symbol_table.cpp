@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <codegen.h>
+#include <llvm_compat.h>
+#include <parser.h>
+#include <symbol_table.h>
+
+#include <memory>
+#include <string>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+using namespace mhc;
+using namespace parser;
+
+using namespace llvm;
+using namespace std;
+
+
+TEST(SymbolTableTest, ShadowAndRestore) {
+	scoped_table<int> table;
+	table.insert("x", 1);
+
+	{
+		scoped_table<int>::scope scope(table);
+		table.insert("x", 2);
+		table.insert("y", 3);
+
+		ASSERT_TRUE(table.find("x") != nullptr);
+		EXPECT_EQ(2, *table.find("x"));
+		EXPECT_EQ(3, *table.find("y"));
+	}
+
+	ASSERT_TRUE(table.find("x") != nullptr);
+	EXPECT_EQ(1, *table.find("x"));
+	EXPECT_TRUE(table.find("y") == nullptr);
+	EXPECT_EQ(0, table.depth());
+}
+
+TEST(SymbolTableTest, RepeatedInsertInOneScope) {
+	scoped_table<int> table;
+	table.insert("x", 1);
+
+	table.enterScope();
+	table.insert("x", 2);
+	table.insert("x", 3);
+	EXPECT_EQ(3, *table.find("x"));
+	table.leaveScope();
+
+	EXPECT_EQ(1, *table.find("x"));
+	EXPECT_EQ(1, table.size());
+}
+
+// Thousands of locals under deep nesting, copying the table per scope made
+// this quadratic, with the undo log every level costs only its own inserts
+TEST(SymbolTableTest, DeepNestingScales) {
+	const int globals = 5000;
+	const int depth = 5000;
+
+	scoped_table<int> table;
+	for (int i = 0; i < globals; ++i) {
+		table.insert("global" + to_string(i), i);
+	}
+
+	for (int level = 0; level < depth; ++level) {
+		table.enterScope();
+		table.insert("local" + to_string(level), level);
+		table.insert("global" + to_string(level % globals), -level);
+	}
+
+	EXPECT_EQ(depth, table.depth());
+	EXPECT_EQ(globals + depth, table.size());
+	EXPECT_EQ(-(depth - 1), *table.find("global" + to_string((depth - 1) % globals)));
+
+	for (int level = depth - 1; level >= 0; --level) {
+		ASSERT_EQ(level, *table.find("local" + to_string(level)));
+		table.leaveScope();
+		ASSERT_TRUE(table.find("local" + to_string(level)) == nullptr);
+	}
+
+	EXPECT_EQ(globals, table.size());
+	for (int i = 0; i < globals; ++i) {
+		ASSERT_EQ(i, *table.find("global" + to_string(i)));
+	}
+}
+
+TEST(SymbolTableTest, BytesFollowContents) {
+	scoped_table<int> table;
+	const size_t empty = table.bytes();
+
+	table.enterScope();
+	for (int i = 0; i < 100; ++i) {
+		table.insert("a_rather_long_symbol_name_" + to_string(i), i);
+	}
+	EXPECT_GT(table.bytes(), empty + 100 * 26);
+}
+
+// The same nesting in a program: each let is a scope the next one opens inside,
+// its local shadows the global of the same name, and after the innermost one
+// every name is still bound to its own level. The checker and the desugarer
+// look locals up in scoped tables, so this is linear in the depth. The body
+// is what the parser would hand over, one string per declaration, which
+// keeps its debug trace out of the way.
+TEST(SymbolTableTest, NestedBindingsLower) {
+	const int depth = 5000;
+
+	string nested = "deep x = ";
+	for (int level = 0; level < depth; ++level) {
+		nested += "let v" + to_string(level) + " = " + (level == 0 ? string("x") : "v" + to_string(level - 1)) + " + 1 in ";
+	}
+	nested += "v" + to_string(depth - 1) + " - v0";
+
+	module_decl decl;
+	decl.module_id = "Main";
+	decl.body = { string("v7 :: Int"), string("v7 = 1000"), nested, string("global y = v7 + y") };
+
+	LLVMContext context;
+	unique_ptr<Module> module(new Module("Main", context));
+	IRBuilder<> builder(context);
+	ast_codegen codeGenerator(module.get(), builder);
+	codeGenerator(decl);
+	ASSERT_TRUE(codeGenerator.finalizeLinkage());
+	ASSERT_FALSE(verifyModule(*module));
+
+	PassManagerBuilder passBuilder;
+	passBuilder.OptLevel = 2;
+	compat::module_pass_manager passes;
+	passBuilder.populateModulePassManager(passes);
+	passes.run(*module);
+
+	// Folded, the difference between the innermost and outermost local
+	const auto returned = [&](const char* name) -> const Value* {
+		const Function* const f = module->getFunction(name);
+		EXPECT_TRUE(f != nullptr) << name;
+		const ReturnInst* const ret = f ? dyn_cast<ReturnInst>(f->getEntryBlock().getTerminator()) : nullptr;
+		return ret ? ret->getReturnValue() : nullptr;
+	};
+
+	const ConstantInt* const difference = dyn_cast_or_null<ConstantInt>(returned("deep"));
+	ASSERT_TRUE(difference != nullptr);
+	EXPECT_EQ(depth - 1, difference->getSExtValue());
+
+	// Outside 'deep' the global is visible again
+	const BinaryOperator* const sum = dyn_cast_or_null<BinaryOperator>(returned("global"));
+	ASSERT_TRUE(sum != nullptr);
+	const ConstantInt* const seven = dyn_cast<ConstantInt>(sum->getOperand(1));
+	ASSERT_TRUE(seven != nullptr);
+	EXPECT_EQ(1000, seven->getSExtValue());
+}
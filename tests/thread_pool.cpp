@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include <thread_pool.h>
+
+#include <atomic>
+#include <functional>
+
+using namespace mhc;
+using namespace std;
+
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+	thread_pool pool(4);
+	atomic<int> count(0);
+
+	for (int i = 0; i < 1000; ++i) {
+		pool.submit([&count] { ++count; });
+	}
+
+	pool.wait();
+	EXPECT_EQ(1000, count);
+}
+
+TEST(ThreadPoolTest, NestedSubmit) {
+	thread_pool pool(3);
+	atomic<int> count(0);
+
+	// Each task spawns two children until the depth runs out, wait() has to
+	// cover tasks submitted by other tasks
+	function<void(int)> spawn = [&](int depth) {
+		++count;
+		if (depth > 0) {
+			pool.submit([&spawn, depth] { spawn(depth - 1); });
+			pool.submit([&spawn, depth] { spawn(depth - 1); });
+		}
+	};
+
+	pool.submit([&spawn] { spawn(9); });
+	pool.wait();
+
+	EXPECT_EQ(1023, count);
+}
+
+TEST(ThreadPoolTest, WaitWithoutTasks) {
+	thread_pool pool(2);
+	pool.wait();
+
+	EXPECT_EQ(2u, pool.size());
+}
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+
+#include <timing.h>
+#include <timing_hook.h>
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+using namespace mhc;
+using namespace std;
+
+
+TEST(TimingTest, CountsAllocations) {
+	timing::enableAllocationHook();
+
+	const auto before = timing::allocatedBytes();
+	char* const buffer = new char[4096];
+	// Keeps the optimizer from dropping the new[]/delete[] pair
+	static_cast<volatile char*>(buffer)[0] = 1;
+	delete[] buffer;
+	EXPECT_GE(timing::allocatedBytes() - before, 4096);
+}
+
+TEST(TimingTest, ReportAndTrace) {
+	timing::enable();
+
+	{
+		timing::scoped_phase phase("test phase", "first \"quoted\"");
+		unique_ptr<char[]> buffer(new char[1024]);
+	}
+
+	// Spans from other threads land in the same report
+	thread worker([] { timing::scoped_phase phase("test phase", "second"); });
+	worker.join();
+
+	ostringstream report;
+	timing::printReport(report);
+	EXPECT_NE(string::npos, report.str().find("test phase"));
+
+	const string path = "test_trace.json";
+	ASSERT_TRUE(timing::writeTrace(path));
+
+	ifstream in(path.c_str());
+	const string trace((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	boost::filesystem::remove(path);
+
+	EXPECT_EQ(0, trace.find("{\"traceEvents\":["));
+	EXPECT_NE(string::npos, trace.find("\"detail\":\"first \\\"quoted\\\"\""));
+	EXPECT_NE(string::npos, trace.find("\"detail\":\"second\""));
+	EXPECT_NE(string::npos, trace.find("\"ph\":\"X\""));
+}
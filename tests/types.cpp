@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <infer.h>
+#include <syntax.h>
+#include <types.h>
+
+#include <string>
+
+using namespace mhc;
+using namespace std;
+
+
+namespace {
+
+	types::type readType(const string& text) {
+		syntax::type_expr t;
+		string error;
+		EXPECT_TRUE(syntax::parseType(text, t));
+		const types::type result = types::fromSyntax(t, error);
+		EXPECT_TRUE(result != nullptr) << error;
+		return result;
+	}
+
+}
+
+TEST(TypesTest, Interning) {
+	// Structurally equal types are one node
+	const types::type a = readType("Int -> (Int -> Bool) -> Bool");
+	const types::type b = types::function(types::constant("Int"), types::function(types::function(types::constant("Int"), types::constant("Bool")), types::constant("Bool")));
+	EXPECT_EQ(a, b);
+	EXPECT_NE(a, readType("Int -> Int -> Bool -> Bool"));
+	EXPECT_EQ("Int -> (Int -> Bool) -> Bool", types::show(a));
+
+	EXPECT_TRUE(a->closed);
+	EXPECT_FALSE(readType("a -> Int")->closed);
+	EXPECT_NE(types::constant("a"), types::variable("a"));
+
+	const size_t count = types::internedCount();
+	readType("Int -> (Int -> Bool) -> Bool");
+	EXPECT_EQ(count, types::internedCount());
+}
+
+TEST(TypesTest, Synonyms) {
+	types::synonym_table synonyms;
+	synonyms.add("Predicate", readType("Number -> Bool"));
+	synonyms.add("Number", readType("Double"));
+
+	string error;
+	const types::type t = synonyms.expand(readType("Predicate -> Number"), error);
+	EXPECT_EQ(readType("(Double -> Bool) -> Double"), t);
+
+	// Remembered, expanding again gives the same node
+	EXPECT_EQ(t, synonyms.expand(readType("Predicate -> Number"), error));
+	EXPECT_EQ(readType("a -> Int"), synonyms.expand(readType("a -> Int"), error));
+
+	// The checker converts the expanded type
+	infer::checker checker;
+	checker.setSynonyms(&synonyms);
+	syntax::type_expr written;
+	ASSERT_TRUE(syntax::parseType("Predicate", written));
+	const infer::node_id n = checker.fromSyntax(written, error);
+	ASSERT_NE(infer::g_none, n);
+	EXPECT_EQ("Double -> Bool", checker.show(n));
+	EXPECT_EQ(n, checker.fromSyntax(written, error));
+}
+
+TEST(TypesTest, SynonymCycle) {
+	types::synonym_table synonyms;
+	synonyms.add("A", readType("B -> Int"));
+	synonyms.add("B", readType("A"));
+	synonyms.add("C", readType("Int"));
+
+	string error;
+	EXPECT_TRUE(synonyms.expand(readType("C -> A"), error) == nullptr);
+	EXPECT_EQ("the type synonyms A, B form a cycle", error);
+
+	// Synonyms outside the cycle still expand
+	error.clear();
+	EXPECT_EQ(readType("Int"), synonyms.expand(readType("C"), error));
+	EXPECT_TRUE(error.empty());
+}
+
+TEST(TypesTest, ParameterizedSynonyms) {
+	syntax::type_expr written;
+	types::synonym_table synonyms;
+	ASSERT_TRUE(syntax::parseType("a -> a", written));
+	synonyms.add("Endo", { "a" }, written);
+	ASSERT_TRUE(syntax::parseType("Endo b -> Endo (Endo Size)", written));
+	synonyms.add("Twice", { "b" }, written);
+	synonyms.add("Size", readType("Int"));
+
+	// Arguments are substituted, then synonyms without parameters expanded
+	string error;
+	ASSERT_TRUE(syntax::parseType("Twice Bool -> Endo c", written));
+	EXPECT_EQ(readType("((Bool -> Bool) -> (Int -> Int) -> Int -> Int) -> c -> c"), synonyms.fromSyntax(written, error)) << error;
+
+	ASSERT_TRUE(syntax::parseType("Endo", written));
+	EXPECT_TRUE(synonyms.fromSyntax(written, error) == nullptr);
+	EXPECT_EQ("the type synonym Endo takes 1 type argument, Endo has 0", error);
+
+	ASSERT_TRUE(syntax::parseType("Loop Int", written));
+	synonyms.add("Loop", { "a" }, written);
+	EXPECT_TRUE(synonyms.fromSyntax(written, error) == nullptr);
+	EXPECT_EQ("the type synonyms Loop form a cycle", error);
+
+	// The checker applies them too
+	infer::checker checker;
+	checker.setSynonyms(&synonyms);
+	ASSERT_TRUE(syntax::parseType("Endo Size", written));
+	const infer::node_id n = checker.fromSyntax(written, error);
+	ASSERT_NE(infer::g_none, n) << error;
+	EXPECT_EQ("Int -> Int", checker.show(n));
+}